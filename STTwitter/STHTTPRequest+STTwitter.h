@@ -7,12 +7,42 @@
 //
 
 #import "STHTTPRequest.h"
+#import "STTwitterRequestScheduler.h"
+
+// request options, passed to the backends in the parameters dictionary and never sent to Twitter
+
+extern NSString * const kSTStreamParserKey; // STTwitterStreamParser instance used to frame a streaming response
+extern NSString * const kSTStreamConnectionBlockKey; // void(^)(void), called on the main queue when a streaming connection gets a successful response
+extern NSString * const kSTStreamBatchSizeKey; // NSNumber, the progress block then receives NSArray batches of messages
+extern NSString * const kSTStreamBatchLatencyKey; // NSNumber, seconds
+extern NSString * const kSTStreamRecorderKey; // STTwitterStreamRecorder, receives the raw bytes of successful responses
+extern NSString * const kSTRequestPriorityKey; // NSNumber holding a STTwitterRequestPriority, default STTwitterRequestPriorityInteractive
+extern NSString * const kSTRequestTagKey; // NSString, groups requests in the backend STTwitterRequestRegistry, eg. to cancel them together
+
+// NSError userInfo key, NSNumber holding the HTTP status of a failed request
+extern NSString * const kSTHTTPStatusCodeKey;
+
+// NSError userInfo key, NSDate read from the x-rate-limit-reset header of a failed request, eg. a 429
+extern NSString * const kSTRateLimitResetDateKey;
 
 @interface STHTTPRequest (STTwitter)
 
++ (NSDictionary *)twitterRequestOptionsFromParameters:(NSDictionary *)params;
++ (NSDictionary *)twitterParametersByRemovingRequestOptions:(NSDictionary *)params;
+
 + (STHTTPRequest *)twitterRequestWithURLString:(NSString *)urlString
+                                requestOptions:(NSDictionary *)requestOptions
                         stTwitterProgressBlock:(void(^)(id json))progressBlock
                          stTwitterSuccessBlock:(void(^)(NSDictionary *requestHeaders, NSDictionary *responseHeaders, id json))successBlock
                            stTwitterErrorBlock:(void(^)(NSDictionary *requestHeaders, NSDictionary *responseHeaders, NSError *error))errorBlock;
 
++ (STHTTPRequest *)twitterRequestWithURLString:(NSString *)urlString
+                        stTwitterProgressBlock:(void(^)(id json))progressBlock
+                         stTwitterSuccessBlock:(void(^)(NSDictionary *requestHeaders, NSDictionary *responseHeaders, id json))successBlock
+                           stTwitterErrorBlock:(void(^)(NSDictionary *requestHeaders, NSDictionary *responseHeaders, NSError *error))errorBlock;
+
+// starts the request through the shared STTwitterRequestScheduler, streaming requests start right away
+// didStartBlock is called when the request leaves the scheduler queue, it may be nil
+- (void)twitterStartAsynchronousWithRequestOptions:(NSDictionary *)requestOptions didStartBlock:(dispatch_block_t)didStartBlock;
+
 @end
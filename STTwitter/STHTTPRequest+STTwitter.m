@@ -8,6 +8,9 @@
 
 #import "STHTTPRequest+STTwitter.h"
 #import "NSString+STTwitter.h"
+#import "STTwitterStreamParser.h"
+#import "STTwitterStreamPipeline.h"
+#import "STTwitterStreamRecorder.h"
 
 #if DEBUG
 #   define STLog(...) NSLog(__VA_ARGS__)
@@ -15,10 +18,71 @@
 #   define STLog(...)
 #endif
 
+NSString * const kSTStreamParserKey = @"kSTStreamParserKey";
+NSString * const kSTStreamConnectionBlockKey = @"kSTStreamConnectionBlockKey";
+NSString * const kSTStreamBatchSizeKey = @"kSTStreamBatchSizeKey";
+NSString * const kSTStreamBatchLatencyKey = @"kSTStreamBatchLatencyKey";
+NSString * const kSTStreamRecorderKey = @"kSTStreamRecorderKey";
+NSString * const kSTRequestPriorityKey = @"kSTRequestPriorityKey";
+NSString * const kSTRequestTagKey = @"kSTRequestTagKey";
+
+NSString * const kSTHTTPStatusCodeKey = @"kSTHTTPStatusCodeKey";
+NSString * const kSTRateLimitResetDateKey = @"kSTRateLimitResetDateKey";
+
+static NSTimeInterval const kSTTwitterStreamStallTimeout = 90.0; // three missed keep-alive signals, https://dev.twitter.com/docs/streaming-apis/connecting#Stalls
+
 @implementation STHTTPRequest (STTwitter)
 
++ (NSArray *)twitterRequestOptionKeys {
+    return @[kSTStreamParserKey, kSTStreamConnectionBlockKey, kSTStreamBatchSizeKey, kSTStreamBatchLatencyKey, kSTStreamRecorderKey, kSTRequestPriorityKey, kSTRequestTagKey];
+}
+
++ (NSDictionary *)twitterRequestOptionsFromParameters:(NSDictionary *)params {
+    
+    NSMutableDictionary *md = [NSMutableDictionary dictionary];
+    
+    for(NSString *key in [self twitterRequestOptionKeys]) {
+        id value = [params objectForKey:key];
+        if(value) md[key] = value;
+    }
+    
+    return md;
+}
+
++ (NSDictionary *)twitterParametersByRemovingRequestOptions:(NSDictionary *)params {
+    
+    NSMutableDictionary *md = nil;
+    
+    for(NSString *key in [self twitterRequestOptionKeys]) {
+        if([params objectForKey:key] == nil) continue;
+        if(md == nil) md = [params mutableCopy];
+        [md removeObjectForKey:key];
+    }
+    
+    return md ? md : params;
+}
+
++ (NSError *)error:(NSError *)error withHTTPStatus:(NSInteger)status responseHeaders:(NSDictionary *)responseHeaders {
+    
+    if(error == nil || status < 400) return error;
+    
+    NSMutableDictionary *userInfo = [[error userInfo] mutableCopy];
+    if(userInfo == nil) userInfo = [NSMutableDictionary dictionary];
+    userInfo[kSTHTTPStatusCodeKey] = @(status);
+    
+    for(NSString *key in responseHeaders) {
+        if([key caseInsensitiveCompare:@"x-rate-limit-reset"] != NSOrderedSame) continue;
+        NSTimeInterval reset = [[responseHeaders[key] description] doubleValue];
+        if(reset > 0) userInfo[kSTRateLimitResetDateKey] = [NSDate dateWithTimeIntervalSince1970:reset];
+    }
+    
+    return [NSError errorWithDomain:[error domain] code:[error code] userInfo:userInfo];
+}
+
 + (NSError *)errorFromResponseData:(NSData *)responseData {
     
+    if([responseData length] == 0) return nil;
+    
     NSError *jsonError = nil;
     NSDictionary *json = [NSJSONSerialization JSONObjectWithData:responseData options:NSJSONReadingMutableLeaves error:&jsonError];
 
@@ -49,7 +113,20 @@
     return nil;
 }
 
+// streaming connections are served by a background queue, away from the main run loop
++ (NSOperationQueue *)twitterStreamNetworkQueue {
+    static NSOperationQueue *queue = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        queue = [[NSOperationQueue alloc] init];
+        [queue setName:@"STTwitter stream network queue"];
+        [queue setMaxConcurrentOperationCount:1];
+    });
+    return queue;
+}
+
 + (STHTTPRequest *)twitterRequestWithURLString:(NSString *)urlString
+                                requestOptions:(NSDictionary *)requestOptions
                         stTwitterProgressBlock:(void(^)(id json))progressBlock
                          stTwitterSuccessBlock:(void(^)(NSDictionary *requestHeaders, NSDictionary *responseHeaders, id json))successBlock
                            stTwitterErrorBlock:(void(^)(NSDictionary *requestHeaders, NSDictionary *responseHeaders, NSError *error))errorBlock {
@@ -58,44 +135,54 @@
     __weak STHTTPRequest *wr = r;
     
     r.ignoreCookieStorage = YES;
+    r.reusesResponseBuffer = YES; // responseData is only read from the blocks below
     
-    r.downloadProgressBlock = ^(NSData *data, NSInteger totalBytesReceived, NSInteger totalBytesExpectedToReceive) {
-        
-        if(progressBlock == nil) return;
+    STTwitterStreamPipeline *streamPipeline = nil;
+    
+    if(progressBlock) {
         
-        NSError *jsonError = nil;
-        id json = [NSJSONSerialization JSONObjectWithData:data options:NSJSONReadingAllowFragments error:&jsonError];
+        // streaming response, messages may span several data chunks
         
-        if(json) {
-            progressBlock(json);
-            return;
+        STTwitterStreamParser *streamParser = requestOptions[kSTStreamParserKey];
+        if(streamParser == nil) {
+            streamParser = [[STTwitterStreamParser alloc] init];
         }
         
-        // we can receive several dictionaries in the same data chunk
-        // such as '{..}\r\n{..}\r\n{..}' which is not valid JSON
-        // so we split them up into a 'jsonChunks' array such as [{..},{..},{..}]
+        streamPipeline = [STTwitterStreamPipeline streamPipelineWithParser:streamParser jsonBlock:progressBlock];
+        streamPipeline.batchSize = [requestOptions[kSTStreamBatchSizeKey] unsignedIntegerValue];
+        streamPipeline.batchLatency = [requestOptions[kSTStreamBatchLatencyKey] doubleValue];
         
-        NSString *jsonString = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
+        r.streamingMode = YES; // long-lived connection, don't accumulate the whole response
+        r.delegateQueue = [self twitterStreamNetworkQueue];
+        r.usesSessionTransport = NO; // a long-lived connection of its own, not a pooled one
+        r.stallTimeoutSeconds = kSTTwitterStreamStallTimeout;
         
-        NSArray *jsonChunks = [jsonString componentsSeparatedByString:@"\r\n"];
+        __block void(^connectionBlock)(void) = requestOptions[kSTStreamConnectionBlockKey];
+        STTwitterStreamRecorder *recorder = requestOptions[kSTStreamRecorderKey];
+        __block BOOL hasRecordedConnectionStart = NO;
         
-        for(NSString *jsonChunk in jsonChunks) {
-            if([jsonChunk length] == 0) continue;
-            NSData *data = [jsonChunk dataUsingEncoding:NSUTF8StringEncoding];
-            NSError *jsonError = nil;
-            id json = [NSJSONSerialization JSONObjectWithData:data options:NSJSONReadingAllowFragments error:&jsonError];
-            if(json == nil) {
-//                errorBlock(wr.responseHeaders, jsonError);
-                return; // not enough information to say it's an error
+        r.downloadProgressBlock = ^(NSData *data, NSInteger totalBytesReceived, NSInteger totalBytesExpectedToReceive) {
+            
+            if(connectionBlock) {
+                if(wr.responseStatus < 400) [streamPipeline deliverBlockAfterPendingMessages:connectionBlock];
+                connectionBlock = nil;
             }
-            progressBlock(json);
-        }
-    };
+            
+            if(recorder && wr.responseStatus < 400) {
+                if(hasRecordedConnectionStart == NO) [recorder appendConnectionStart]; // each request is a new connection
+                hasRecordedConnectionStart = YES;
+                [recorder appendData:data];
+            }
+            
+            [streamPipeline appendData:data];
+        };
+    }
     
     r.completionBlock = ^(NSDictionary *responseHeaders, NSString *body) {
         
+        // parsed from the raw bytes, body is only decoded into a string if it is not json
         NSError *jsonError = nil;
-        id json = [NSJSONSerialization JSONObjectWithData:wr.responseData options:NSJSONReadingMutableLeaves error:&jsonError];
+        id json = [wr.responseData length] ? [NSJSONSerialization JSONObjectWithData:wr.responseData options:NSJSONReadingMutableLeaves error:&jsonError] : nil;
         
         if(json == nil) {
             successBlock(wr.requestHeaders, wr.responseHeaders, body); // response is not necessarily json
@@ -110,7 +197,7 @@
         NSError *e = [self errorFromResponseData:wr.responseData];
         
         if(e) {
-            errorBlock(wr.requestHeaders, wr.responseHeaders, e);
+            errorBlock(wr.requestHeaders, wr.responseHeaders, [self error:e withHTTPStatus:wr.responseStatus responseHeaders:wr.responseHeaders]);
             return;
         }
         
@@ -129,10 +216,91 @@
         }
         
         STLog(@"-- body: %@", wr.responseString);
-        errorBlock(wr.requestHeaders, wr.responseHeaders, error);
+        errorBlock(wr.requestHeaders, wr.responseHeaders, [self error:error withHTTPStatus:wr.responseStatus responseHeaders:wr.responseHeaders]);
     };
     
+    if(streamPipeline) {
+        
+        // the request calls back on the network queue, end the stream on the main queue after the pending messages
+        
+        completionBlock_t completionBlock = r.completionBlock;
+        errorBlock_t requestErrorBlock = r.errorBlock;
+        
+        r.completionBlock = ^(NSDictionary *responseHeaders, NSString *body) {
+            STHTTPRequest *sr = wr; // keeps the request alive until delivery
+            [streamPipeline deliverBlockAfterPendingMessages:^{
+                [sr self];
+                completionBlock(responseHeaders, body);
+            }];
+        };
+        
+        r.errorBlock = ^(NSError *error) {
+            STHTTPRequest *sr = wr;
+            [streamPipeline deliverBlockAfterPendingMessages:^{
+                [sr self];
+                requestErrorBlock(error);
+            }];
+        };
+    }
+    
     return r;
 }
 
++ (STHTTPRequest *)twitterRequestWithURLString:(NSString *)urlString
+                        stTwitterProgressBlock:(void(^)(id json))progressBlock
+                         stTwitterSuccessBlock:(void(^)(NSDictionary *requestHeaders, NSDictionary *responseHeaders, id json))successBlock
+                           stTwitterErrorBlock:(void(^)(NSDictionary *requestHeaders, NSDictionary *responseHeaders, NSError *error))errorBlock {
+    
+    return [self twitterRequestWithURLString:urlString
+                              requestOptions:nil
+                      stTwitterProgressBlock:progressBlock
+                       stTwitterSuccessBlock:successBlock
+                         stTwitterErrorBlock:errorBlock];
+}
+
+- (void)twitterStartAsynchronousWithRequestOptions:(NSDictionary *)requestOptions didStartBlock:(dispatch_block_t)didStartBlock {
+    
+    if(self.streamingMode) {
+        if(didStartBlock) didStartBlock();
+        [self startAsynchronous];
+        return;
+    }
+    
+    STTwitterRequestPriority priority = [requestOptions[kSTRequestPriorityKey] unsignedIntegerValue];
+    
+    // called when the request ends, or is cancelled while pending, which frees its slot or removes it from the queue
+    // set by the start block when the request starts right away, the unit tests complete requests synchronously
+    
+    __block dispatch_block_t finishBlock = nil;
+    
+    completionBlock_t completionBlock = self.completionBlock;
+    errorBlock_t errorBlock = self.errorBlock;
+    
+    self.completionBlock = ^(NSDictionary *responseHeaders, NSString *body) {
+        if(finishBlock) finishBlock();
+        if(completionBlock) completionBlock(responseHeaders, body);
+    };
+    
+    self.errorBlock = ^(NSError *error) {
+        if(finishBlock) finishBlock();
+        if(errorBlock) errorBlock(error);
+    };
+    
+    // the start block retains the request while it is pending, the scheduler releases it once started or finished
+    
+    dispatch_block_t pendingFinishBlock = [[STTwitterRequestScheduler sharedScheduler] scheduleRequestForHost:[self.url host]
+                                                                                                     priority:priority
+                                                                                                   startBlock:^(dispatch_block_t startedFinishBlock) {
+                                                                                                       finishBlock = startedFinishBlock;
+                                                                                                       if(self.error) { // cancelled while pending
+                                                                                                           finishBlock();
+                                                                                                           return;
+                                                                                                       }
+                                                                                                       if(didStartBlock) didStartBlock();
+                                                                                                       [self startAsynchronous];
+                                                                                                   }];
+    
+    if(finishBlock == nil) finishBlock = pendingFinishBlock;
+}
+
 @end
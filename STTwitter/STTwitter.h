@@ -1,2 +1,17 @@
 #import "STTwitterAPI.h"
 #import "STTwitterHTML.h"
+#import "STTwitterStreamSession.h"
+#import "STTwitterStreamRecorder.h"
+#import "STTwitterStreamReplay.h"
+#import "STTwitterStreamFilter.h"
+#import "STTwitterRequestScheduler.h"
+#import "STTwitterRequestRegistry.h"
+#import "STTwitterMediaUpload.h"
+#import "STTwitterResponseCache.h"
+#import "STTwitterRequestCoalescer.h"
+#import "STTwitterRateLimiter.h"
+#import "STTwitterCredentialPool.h"
+#import "STTwitterCursorIterator.h"
+#import "STTwitterTimelineBackfill.h"
+#import "STTwitterTimelineBackfillQueue.h"
+#import "STTwitterUsersLookup.h"
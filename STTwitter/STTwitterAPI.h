@@ -28,6 +28,16 @@
  */
 
 @class ACAccount;
+@class STTwitterStreamSession;
+@class STTwitterStreamReplay;
+@class STTwitterRequestRegistry;
+@class STTwitterMediaUpload;
+@class STTwitterRequestCoalescer;
+@class STTwitterRateLimiter;
+@class STTwitterCredentialPool;
+@class STTwitterCursorIterator;
+@class STTwitterUsersLookup;
+@protocol STHTTPRequestCache;
 
 @interface STTwitterAPI : NSObject
 
@@ -75,6 +85,9 @@
 + (instancetype)twitterAPIAppOnlyWithConsumerKey:(NSString *)consumerKey
                                   consumerSecret:(NSString *)consumerSecret;
 
+// spreads the requests over the credentials of the pool, each one with its own rate limiter, for read-heavy workloads
++ (instancetype)twitterAPIWithCredentialPool:(STTwitterCredentialPool *)credentialPool;
+
 - (void)postTokenRequest:(void(^)(NSURL *url, NSString *oauthToken))successBlock
            oauthCallback:(NSString *)oauthCallback
               errorBlock:(void(^)(NSError *error))errorBlock;
@@ -107,6 +120,19 @@
 @property (nonatomic, readonly) NSString *oauthAccessTokenSecret;
 @property (nonatomic, readonly) NSString *bearerToken;
 
+// live requests, tag them with kSTRequestTagKey in the parameters to cancel them together
+@property (nonatomic, readonly) STTwitterRequestRegistry *requestRegistry;
+
+// cache for GET responses, eg. STTwitterResponseCache, nil by default, not used by the OS X / iOS accounts backend
+@property (nonatomic, retain) id <STHTTPRequestCache> responseCache;
+
+// merges identical GETs in flight, one per instance by default, can be shared between instances or set to nil
+@property (nonatomic, retain) STTwitterRequestCoalescer *requestCoalescer;
+
+// paces requests within the x-rate-limit-* budgets of the account, one per instance by default, set to nil to disable
+// not used by the OS X / iOS accounts backend, getRateLimitsForResources: seeds it
+@property (nonatomic, retain) STTwitterRateLimiter *rateLimiter;
+
 #pragma mark Generic methods to GET and POST
 
 - (NSString *)fetchResource:(NSString *)resource
@@ -131,6 +157,59 @@
         successBlock:(void(^)(NSDictionary *rateLimits, id response))successBlock
           errorBlock:(void(^)(NSError *error))errorBlock;
 
+// streaming endpoints, delimited=length in parameters selects length framing
+- (STTwitterStreamSession *)streamResource:(NSString *)resource
+                                HTTPMethod:(NSString *)HTTPMethod
+                             baseURLString:(NSString *)baseURLString
+                                parameters:(NSDictionary *)parameters
+                             progressBlock:(void(^)(id response))progressBlock
+                         stallWarningBlock:(void(^)(NSString *code, NSString *message, NSUInteger percentFull))stallWarningBlock
+                                errorBlock:(void(^)(NSError *error))errorBlock;
+
+// replays a capture without the network, with the message types, filter, batching and control blocks of the session, as a live stream
+// the session stops at the end of the capture, completionBlock is then called with a nil error, it is not called when the session is stopped
+- (STTwitterStreamSession *)streamSessionWithReplay:(STTwitterStreamReplay *)replay
+                                      progressBlock:(void(^)(id response))progressBlock
+                                  stallWarningBlock:(void(^)(NSString *code, NSString *message, NSUInteger percentFull))stallWarningBlock
+                                    completionBlock:(void(^)(NSError *error))completionBlock;
+
+#pragma mark Cursored resources
+
+/*
+ Iterators over all the pages of a cursored resource, the next page is fetched while a page is consumed
+ 
+ STTwitterCursorIterator *iterator = [twitter followersIDsIteratorForUserID:nil orScreenName:@"nst021" count:@"5000"];
+ iterator.priority = STTwitterRequestPriorityBulk;
+ [iterator startWithPageBlock:^(NSArray *items, BOOL *stop) { ... } completionBlock:^(NSError *error) { ... }];
+ */
+
+// items is the value of itemsKey in each response, eg. @"ids" or @"users"
+- (STTwitterCursorIterator *)cursorIteratorForResource:(NSString *)resource
+                                            parameters:(NSDictionary *)parameters
+                                              itemsKey:(NSString *)itemsKey;
+
+// ids as strings
+- (STTwitterCursorIterator *)friendsIDsIteratorForUserID:(NSString *)userID
+                                            orScreenName:(NSString *)screenName
+                                                   count:(NSString *)count;
+
+- (STTwitterCursorIterator *)followersIDsIteratorForUserID:(NSString *)userID
+                                              orScreenName:(NSString *)screenName
+                                                     count:(NSString *)count;
+
+- (STTwitterCursorIterator *)blocksIDsIterator;
+
+- (STTwitterCursorIterator *)friendshipIncomingIterator;
+
+// users
+- (STTwitterCursorIterator *)listsMembersIteratorForListID:(NSString *)listID
+                                           includeEntities:(NSNumber *)includeEntities
+                                                skipStatus:(NSNumber *)skipStatus;
+
+- (STTwitterCursorIterator *)listsSubscribersIteratorForListID:(NSString *)listID
+                                               includeEntities:(NSNumber *)includeEntities
+                                                    skipStatus:(NSNumber *)skipStatus;
+
 #pragma mark Timelines
 
 /*
@@ -327,6 +406,18 @@
             successBlock:(void(^)(NSDictionary *status))successBlock
               errorBlock:(void(^)(NSError *error))errorBlock;
 
+// media_ids are returned by POST media/upload, see -postMediaUploadWithFileURL:...
+- (void)postStatusUpdate:(NSString *)status
+       inReplyToStatusID:(NSString *)existingStatusID
+                mediaIDs:(NSArray *)mediaIDs
+                latitude:(NSString *)latitude
+               longitude:(NSString *)longitude
+                 placeID:(NSString *)placeID
+      displayCoordinates:(NSNumber *)displayCoordinates
+                trimUser:(NSNumber *)trimUser
+            successBlock:(void(^)(NSDictionary *status))successBlock
+              errorBlock:(void(^)(NSError *error))errorBlock;
+
 /*
  POST	statuses/retweet/:id
  
@@ -370,7 +461,8 @@
             successBlock:(void(^)(NSDictionary *status))successBlock
               errorBlock:(void(^)(NSError *error))errorBlock;
 
-// convenience
+// convenience, uploads a file URL with POST media/upload, in segments, then posts the status with its media ID
+// other URLs are read whole with -[NSData dataWithContentsOfURL:] and posted with POST statuses/update_with_media, as before
 - (void)postStatusUpdate:(NSString *)status
        inReplyToStatusID:(NSString *)existingStatusID
                 mediaURL:(NSURL *)mediaURL
@@ -380,6 +472,21 @@
             successBlock:(void(^)(NSDictionary *status))successBlock
               errorBlock:(void(^)(NSError *error))errorBlock;
 
+/*
+ POST   media/upload (INIT, APPEND, FINALIZE)
+ 
+ Uploads a photo or a video in segments, several of them in flight at once, see STTwitterMediaUpload.
+ The media ID can then be attached to tweets with the media_ids parameter of POST statuses/update.
+ 
+ Keep the returned upload to cancel it. Uploads that must survive a relaunch are created with a checkpointPath, see STTwitterMediaUpload.
+ */
+
+- (STTwitterMediaUpload *)postMediaUploadWithFileURL:(NSURL *)fileURL
+                                           mediaType:(NSString *)mediaType // nil to guess it from the file extension
+                                       progressBlock:(void(^)(unsigned long long uploadedBytes, unsigned long long totalBytes))progressBlock
+                                        successBlock:(void(^)(NSString *mediaID, NSDictionary *response))successBlock
+                                          errorBlock:(void(^)(NSError *error))errorBlock;
+
 /*
  GET    statuses/oembed
  
@@ -437,6 +544,11 @@
 
 #pragma mark Streaming
 
+/*
+ Streaming methods return a session that reconnects automatically, see STTwitterStreamSession.h
+ errorBlock is called only when the session gives up, or not at all if the session is stopped.
+ */
+
 /*
  POST	statuses/filter
  
@@ -449,31 +561,33 @@
  At least one predicate parameter (follow, locations, or track) must be specified.
  */
 
-- (void)postStatusesFilterUserIDs:(NSArray *)userIDs
-                  keywordsToTrack:(NSArray *)keywordsToTrack
-            locationBoundingBoxes:(NSArray *)locationBoundingBoxes
-                        delimited:(NSNumber *)delimited
-                    stallWarnings:(NSNumber *)stallWarnings
-                    progressBlock:(void(^)(id response))progressBlock
-                stallWarningBlock:(void(^)(NSString *code, NSString *message, NSUInteger percentFull))stallWarningBlock
-                       errorBlock:(void(^)(NSError *error))errorBlock;
+- (STTwitterStreamSession *)postStatusesFilterUserIDs:(NSArray *)userIDs
+                                      keywordsToTrack:(NSArray *)keywordsToTrack
+                                locationBoundingBoxes:(NSArray *)locationBoundingBoxes
+                                            delimited:(NSNumber *)delimited
+                                        stallWarnings:(NSNumber *)stallWarnings
+                                        progressBlock:(void(^)(id response))progressBlock
+                                    stallWarningBlock:(void(^)(NSString *code, NSString *message, NSUInteger percentFull))stallWarningBlock
+                                           errorBlock:(void(^)(NSError *error))errorBlock;
 
 // convenience
-- (void)postStatusesFilterKeyword:(NSString *)keyword
-                    progressBlock:(void(^)(id response))progressBlock
-                       errorBlock:(void(^)(NSError *error))errorBlock;
+- (STTwitterStreamSession *)postStatusesFilterKeyword:(NSString *)keyword
+                                        progressBlock:(void(^)(id response))progressBlock
+                                           errorBlock:(void(^)(NSError *error))errorBlock;
 
 /*
  GET    statuses/sample
  
  Returns a small random sample of all public statuses. The Tweets returned by the default access level are the same, so if two different clients connect to this endpoint, they will see the same Tweets.
+ 
+ Set a filter on the returned session to drop the Tweets you don't need before they are decoded, see STTwitterStreamFilter.
  */
 
-- (void)getStatusesSampleDelimited:(NSNumber *)delimited
-                     stallWarnings:(NSNumber *)stallWarnings
-                     progressBlock:(void(^)(id response))progressBlock
-                 stallWarningBlock:(void(^)(NSString *code, NSString *message, NSUInteger percentFull))stallWarningBlock
-                        errorBlock:(void(^)(NSError *error))errorBlock;
+- (STTwitterStreamSession *)getStatusesSampleDelimited:(NSNumber *)delimited
+                                         stallWarnings:(NSNumber *)stallWarnings
+                                         progressBlock:(void(^)(id response))progressBlock
+                                     stallWarningBlock:(void(^)(NSString *code, NSString *message, NSUInteger percentFull))stallWarningBlock
+                                            errorBlock:(void(^)(NSError *error))errorBlock;
 
 /*
  GET    statuses/firehose
@@ -481,14 +595,16 @@
  This endpoint requires special permission to access.
  
  Returns all public statuses. Few applications require this level of access. Creative use of a combination of other resources and various access levels can satisfy nearly every application use case.
+ 
+ Set a filter on the returned session to drop the Tweets you don't need before they are decoded, see STTwitterStreamFilter.
  */
 
-- (void)getStatusesFirehoseWithCount:(NSString *)count
-                           delimited:(NSNumber *)delimited
-                       stallWarnings:(NSNumber *)stallWarnings
-                       progressBlock:(void(^)(id response))progressBlock
-                   stallWarningBlock:(void(^)(NSString *code, NSString *message, NSUInteger percentFull))stallWarningBlock
-                          errorBlock:(void(^)(NSError *error))errorBlock;
+- (STTwitterStreamSession *)getStatusesFirehoseWithCount:(NSString *)count
+                                               delimited:(NSNumber *)delimited
+                                           stallWarnings:(NSNumber *)stallWarnings
+                                           progressBlock:(void(^)(id response))progressBlock
+                                       stallWarningBlock:(void(^)(NSString *code, NSString *message, NSUInteger percentFull))stallWarningBlock
+                                              errorBlock:(void(^)(NSError *error))errorBlock;
 
 /*
  GET    user
@@ -496,15 +612,15 @@
  Streams messages for a single user, as described in User streams https://dev.twitter.com/docs/streaming-apis/streams/user
  */
 
-- (void)getUserStreamDelimited:(NSNumber *)delimited
-                 stallWarnings:(NSNumber *)stallWarnings
-includeMessagesFromFollowedAccounts:(NSNumber *)includeMessagesFromFollowedAccounts
-                includeReplies:(NSNumber *)includeReplies
-               keywordsToTrack:(NSArray *)keywordsToTrack
-         locationBoundingBoxes:(NSArray *)locationBoundingBoxes
-                 progressBlock:(void(^)(id response))progressBlock
-             stallWarningBlock:(void(^)(NSString *code, NSString *message, NSUInteger percentFull))stallWarningBlock
-                    errorBlock:(void(^)(NSError *error))errorBlock;
+- (STTwitterStreamSession *)getUserStreamDelimited:(NSNumber *)delimited
+                                     stallWarnings:(NSNumber *)stallWarnings
+               includeMessagesFromFollowedAccounts:(NSNumber *)includeMessagesFromFollowedAccounts
+                                    includeReplies:(NSNumber *)includeReplies
+                                   keywordsToTrack:(NSArray *)keywordsToTrack
+                             locationBoundingBoxes:(NSArray *)locationBoundingBoxes
+                                     progressBlock:(void(^)(id response))progressBlock
+                                 stallWarningBlock:(void(^)(NSString *code, NSString *message, NSUInteger percentFull))stallWarningBlock
+                                        errorBlock:(void(^)(NSError *error))errorBlock;
 
 /*
  GET    site
@@ -512,14 +628,14 @@ includeMessagesFromFollowedAccounts:(NSNumber *)includeMessagesFromFollowedAccou
  Streams messages for a set of users, as described in Site streams https://dev.twitter.com/docs/streaming-apis/streams/site
  */
 
-- (void)getSiteStreamForUserIDs:(NSArray *)userIDs
-                      delimited:(NSNumber *)delimited
-                  stallWarnings:(NSNumber *)stallWarnings
-         restrictToUserMessages:(NSNumber *)restrictToUserMessages
-                 includeReplies:(NSNumber *)includeReplies
-                  progressBlock:(void(^)(id response))progressBlock
-              stallWarningBlock:(void(^)(NSString *code, NSString *message, NSUInteger percentFull))stallWarningBlock
-                     errorBlock:(void(^)(NSError *error))errorBlock;
+- (STTwitterStreamSession *)getSiteStreamForUserIDs:(NSArray *)userIDs
+                                          delimited:(NSNumber *)delimited
+                                      stallWarnings:(NSNumber *)stallWarnings
+                             restrictToUserMessages:(NSNumber *)restrictToUserMessages
+                                     includeReplies:(NSNumber *)includeReplies
+                                      progressBlock:(void(^)(id response))progressBlock
+                                  stallWarningBlock:(void(^)(NSString *code, NSString *message, NSUInteger percentFull))stallWarningBlock
+                                         errorBlock:(void(^)(NSError *error))errorBlock;
 
 #pragma mark Direct Messages
 
@@ -985,6 +1101,14 @@ includeMessagesFromFollowedAccounts:(NSNumber *)includeMessagesFromFollowedAccou
                        successBlock:(void(^)(NSArray *users))successBlock
                          errorBlock:(void(^)(NSError *error))errorBlock;
 
+// any number of user IDs and screen names, deduplicated and fetched 100 at a time in parallel, see STTwitterUsersLookup
+// usersByID is keyed by id_str, missing values are unknown, suspended or deleted users
+- (STTwitterUsersLookup *)getUsersLookupForUserIDs:(NSArray *)userIDs
+                                     orScreenNames:(NSArray *)screenNames
+                                   includeEntities:(NSNumber *)includeEntities
+                                      successBlock:(void(^)(NSDictionary *usersByID, NSArray *missingUserIDs, NSArray *missingScreenNames))successBlock
+                                        errorBlock:(void(^)(NSError *error))errorBlock;
+
 /*
  GET    users/show
  
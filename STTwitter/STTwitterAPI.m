@@ -13,6 +13,18 @@
 #import "STTwitterAppOnly.h"
 #import <Accounts/Accounts.h>
 #import "STHTTPRequest.h"
+#import "STHTTPRequest+STTwitter.h"
+#import "STTwitterStreamParser.h"
+#import "STTwitterStreamSession.h"
+#import "STTwitterStreamPipeline.h"
+#import "STTwitterStreamReplay.h"
+#import "STTwitterMediaUpload.h"
+#import "STTwitterRequestCoalescer.h"
+#import "STTwitterRateLimiter.h"
+#import "STTwitterCredentialPool.h"
+#import "STTwitterCursorIterator.h"
+#import "STTwitterUsersLookup.h"
+#import "STTwitterRequestRegistry.h"
 
 static NSString *kBaseURLStringAPI = @"https://api.twitter.com/1.1";
 static NSString *kBaseURLStringStream = @"https://stream.twitter.com/1.1";
@@ -30,6 +42,9 @@ static NSDateFormatter *dateFormatter = nil;
 - (id)init {
     self = [super init];
     
+    self.requestCoalescer = [[STTwitterRequestCoalescer alloc] init];
+    self.rateLimiter = [[STTwitterRateLimiter alloc] init];
+    
     [[NSNotificationCenter defaultCenter] addObserverForName:ACAccountStoreDidChangeNotification object:nil queue:nil usingBlock:^(NSNotification *note) {
         // account must be considered invalid
         
@@ -148,6 +163,12 @@ static NSDateFormatter *dateFormatter = nil;
     return [self twitterAPIAppOnlyWithConsumerName:nil consumerKey:consumerKey consumerSecret:consumerSecret];
 }
 
++ (instancetype)twitterAPIWithCredentialPool:(STTwitterCredentialPool *)credentialPool {
+    STTwitterAPI *twitter = [[STTwitterAPI alloc] init];
+    twitter.oauth = credentialPool;
+    return twitter;
+}
+
 - (NSString *)prettyDescription {
     NSMutableString *ms = [[_oauth loginTypeDescription] mutableCopy];
     
@@ -226,6 +247,34 @@ static NSDateFormatter *dateFormatter = nil;
     return nil;
 }
 
+- (void)setOauth:(NSObject<STTwitterProtocol> *)oauth {
+    _oauth = oauth;
+    if([_oauth respondsToSelector:@selector(setResponseCache:)]) {
+        [_oauth setResponseCache:_responseCache];
+    }
+    [[self requestRegistry] setRateLimiter:_rateLimiter];
+}
+
+- (void)setResponseCache:(id<STHTTPRequestCache>)responseCache {
+    _responseCache = responseCache;
+    if([_oauth respondsToSelector:@selector(setResponseCache:)]) {
+        [_oauth setResponseCache:responseCache];
+    }
+}
+
+- (void)setRateLimiter:(STTwitterRateLimiter *)rateLimiter {
+    _rateLimiter = rateLimiter;
+    [[self requestRegistry] setRateLimiter:rateLimiter];
+}
+
+- (STTwitterRequestRegistry *)requestRegistry {
+    if([_oauth respondsToSelector:@selector(requestRegistry)]) {
+        return [_oauth requestRegistry];
+    }
+    
+    return nil;
+}
+
 - (NSString *)userName {
     
 #if TARGET_OS_IPHONE
@@ -260,6 +309,15 @@ static NSDateFormatter *dateFormatter = nil;
                       errorBlock:errorBlock];
 }
 
+// identifies the account for STTwitterRequestCoalescer, requests without a token are coalesced per backend only
+- (NSString *)coalescingCredentials {
+    NSString *token = [self oauthAccessToken];
+    if(token == nil) token = [self bearerToken];
+    if(token == nil) return [NSString stringWithFormat:@"%p", _oauth];
+    
+    return [NSString stringWithFormat:@"%@ %@", NSStringFromClass([_oauth class]), token];
+}
+
 - (void)getResource:(NSString *)resource
       baseURLString:(NSString *)baseURLString
          parameters:(NSDictionary *)parameters
@@ -267,13 +325,38 @@ static NSDateFormatter *dateFormatter = nil;
        successBlock:(void(^)(NSDictionary *rateLimits, id json))successBlock
          errorBlock:(void(^)(NSError *error))errorBlock {
     
+    BOOL canCoalesce = _requestCoalescer && progressBlock == nil && [[STHTTPRequest twitterRequestOptionsFromParameters:parameters] count] == 0;
+    
+    if(canCoalesce) {
+        NSString *key = [STTwitterRequestCoalescer keyForResource:resource
+                                                    baseURLString:baseURLString
+                                                       parameters:parameters
+                                                      credentials:[self coalescingCredentials]];
+        
+        [_requestCoalescer performRequestWithKey:key successBlock:successBlock errorBlock:errorBlock fetchBlock:^(void (^fetchSuccessBlock)(NSDictionary *, id), void (^fetchErrorBlock)(NSError *)) {
+            [_oauth fetchResource:resource
+                       HTTPMethod:@"GET"
+                    baseURLString:baseURLString
+                       parameters:parameters
+                    progressBlock:nil
+                     successBlock:^(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, id response) {
+                         fetchSuccessBlock(responseHeaders, response);
+                     } errorBlock:^(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, NSError *error) {
+                         fetchErrorBlock(error);
+                     }];
+        }];
+        
+        return;
+    }
+    
     [_oauth fetchResource:resource
                HTTPMethod:@"GET"
             baseURLString:baseURLString
                parameters:parameters
-            progressBlock:^(NSString *requestID, id response) {
-                if(progressBlock) progressBlock(response);
-            } successBlock:^(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, id response) {
+            progressBlock:progressBlock ? ^(NSString *requestID, id response) {
+                progressBlock(response);
+            } : nil
+             successBlock:^(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, id response) {
                 if(successBlock) successBlock(responseHeaders, response);
             } errorBlock:^(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, NSError *error) {
                 if(errorBlock) errorBlock(error);
@@ -291,9 +374,10 @@ static NSDateFormatter *dateFormatter = nil;
                HTTPMethod:@"POST"
             baseURLString:baseURLString
                parameters:parameters
-            progressBlock:^(NSString *requestID, id response) {
-                if(progressBlock) progressBlock(response);
-            } successBlock:^(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, id response) {
+            progressBlock:progressBlock ? ^(NSString *requestID, id response) {
+                progressBlock(response);
+            } : nil
+             successBlock:^(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, id response) {
                 if(successBlock) successBlock(responseHeaders, response);
             } errorBlock:^(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, NSError *error) {
                 if(errorBlock) errorBlock(error);
@@ -310,9 +394,10 @@ static NSDateFormatter *dateFormatter = nil;
                HTTPMethod:@"POST"
             baseURLString:baseURLString
                parameters:parameters
-            progressBlock:^(NSString *requestID, id response) {
-                if(progressBlock) progressBlock(response);
-            } successBlock:nil
+            progressBlock:progressBlock ? ^(NSString *requestID, id response) {
+                progressBlock(response);
+            } : nil
+             successBlock:nil
                errorBlock:^(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, NSError *error) {
                    errorBlock(error);
                }];
@@ -328,9 +413,10 @@ static NSDateFormatter *dateFormatter = nil;
                HTTPMethod:@"GET"
             baseURLString:baseURLString
                parameters:parameters
-            progressBlock:^(NSString *requestID, id response) {
-                if(progressBlock) progressBlock(response);
-            } successBlock:nil
+            progressBlock:progressBlock ? ^(NSString *requestID, id response) {
+                progressBlock(response);
+            } : nil
+             successBlock:nil
                errorBlock:^(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, NSError *error) {
                    errorBlock(error);
                }];
@@ -452,6 +538,85 @@ static NSDateFormatter *dateFormatter = nil;
 				   }];
 }
 
+#pragma mark Cursored resources
+
+- (STTwitterCursorIterator *)cursorIteratorForResource:(NSString *)resource
+                                            parameters:(NSDictionary *)parameters
+                                              itemsKey:(NSString *)itemsKey {
+    
+    return [STTwitterCursorIterator cursorIteratorWithTwitter:self
+                                                     resource:resource
+                                                   parameters:parameters
+                                                     itemsKey:itemsKey
+                                                       cursor:nil];
+}
+
+- (STTwitterCursorIterator *)friendsIDsIteratorForUserID:(NSString *)userID
+                                            orScreenName:(NSString *)screenName
+                                                   count:(NSString *)count {
+    
+    NSAssert((userID || screenName), @"userID or screenName is missing");
+    
+    NSMutableDictionary *md = [NSMutableDictionary dictionary];
+    if(userID) md[@"user_id"] = userID;
+    if(screenName) md[@"screen_name"] = screenName;
+    if(count) md[@"count"] = count;
+    md[@"stringify_ids"] = @"1";
+    
+    return [self cursorIteratorForResource:@"friends/ids.json" parameters:md itemsKey:@"ids"];
+}
+
+- (STTwitterCursorIterator *)followersIDsIteratorForUserID:(NSString *)userID
+                                              orScreenName:(NSString *)screenName
+                                                     count:(NSString *)count {
+    
+    NSAssert((userID || screenName), @"userID or screenName is missing");
+    
+    NSMutableDictionary *md = [NSMutableDictionary dictionary];
+    if(userID) md[@"user_id"] = userID;
+    if(screenName) md[@"screen_name"] = screenName;
+    if(count) md[@"count"] = count;
+    md[@"stringify_ids"] = @"1";
+    
+    return [self cursorIteratorForResource:@"followers/ids.json" parameters:md itemsKey:@"ids"];
+}
+
+- (STTwitterCursorIterator *)blocksIDsIterator {
+    return [self cursorIteratorForResource:@"blocks/ids.json" parameters:@{@"stringify_ids" : @"1"} itemsKey:@"ids"];
+}
+
+- (STTwitterCursorIterator *)friendshipIncomingIterator {
+    return [self cursorIteratorForResource:@"friendships/incoming.json" parameters:@{@"stringify_ids" : @"1"} itemsKey:@"ids"];
+}
+
+- (STTwitterCursorIterator *)listsMembersIteratorForListID:(NSString *)listID
+                                           includeEntities:(NSNumber *)includeEntities
+                                                skipStatus:(NSNumber *)skipStatus {
+    
+    NSParameterAssert(listID);
+    
+    NSMutableDictionary *md = [NSMutableDictionary dictionary];
+    md[@"list_id"] = listID;
+    if(includeEntities) md[@"include_entities"] = [includeEntities boolValue] ? @"1" : @"0";
+    if(skipStatus) md[@"skip_status"] = [skipStatus boolValue] ? @"1" : @"0";
+    
+    return [self cursorIteratorForResource:@"lists/members.json" parameters:md itemsKey:@"users"];
+}
+
+- (STTwitterCursorIterator *)listsSubscribersIteratorForListID:(NSString *)listID
+                                               includeEntities:(NSNumber *)includeEntities
+                                                    skipStatus:(NSNumber *)skipStatus {
+    
+    NSParameterAssert(listID);
+    
+    NSMutableDictionary *md = [NSMutableDictionary dictionary];
+    md[@"list_id"] = listID;
+    if(includeEntities) md[@"include_entities"] = [includeEntities boolValue] ? @"1" : @"0";
+    if(skipStatus) md[@"skip_status"] = [skipStatus boolValue] ? @"1" : @"0";
+    
+    return [self cursorIteratorForResource:@"lists/subscribers.json" parameters:md itemsKey:@"users"];
+}
+
 #pragma mark Timelines
 
 - (void)getStatusesMentionTimelineWithCount:(NSString *)count
@@ -799,6 +964,29 @@ static NSDateFormatter *dateFormatter = nil;
             successBlock:(void(^)(NSDictionary *status))successBlock
               errorBlock:(void(^)(NSError *error))errorBlock {
     
+    [self postStatusUpdate:status
+         inReplyToStatusID:existingStatusID
+                  mediaIDs:nil
+                  latitude:latitude
+                 longitude:longitude
+                   placeID:placeID
+        displayCoordinates:displayCoordinates
+                  trimUser:trimUser
+              successBlock:successBlock
+                errorBlock:errorBlock];
+}
+
+- (void)postStatusUpdate:(NSString *)status
+       inReplyToStatusID:(NSString *)existingStatusID
+                mediaIDs:(NSArray *)mediaIDs
+                latitude:(NSString *)latitude
+               longitude:(NSString *)longitude
+                 placeID:(NSString *)placeID // wins over lat/lon
+      displayCoordinates:(NSNumber *)displayCoordinates
+                trimUser:(NSNumber *)trimUser
+            successBlock:(void(^)(NSDictionary *status))successBlock
+              errorBlock:(void(^)(NSError *error))errorBlock {
+    
     if(status == nil) {
         NSError *error = [NSError errorWithDomain:NSStringFromClass([self class]) code:0 userInfo:@{NSLocalizedDescriptionKey : @"cannot post empty status"}];
         errorBlock(error);
@@ -820,6 +1008,10 @@ static NSDateFormatter *dateFormatter = nil;
         md[@"display_coordinates"] = @"true";
     }
     
+    if([mediaIDs count] > 0) {
+        md[@"media_ids"] = [mediaIDs componentsJoinedByString:@","];
+    }
+    
     [self postAPIResource:@"statuses/update.json" parameters:md successBlock:^(NSDictionary *rateLimits, id response) {
         successBlock(response);
     } errorBlock:^(NSError *error) {
@@ -868,27 +1060,75 @@ static NSDateFormatter *dateFormatter = nil;
             successBlock:(void(^)(NSDictionary *status))successBlock
               errorBlock:(void(^)(NSError *error))errorBlock {
     
-    NSData *data = [NSData dataWithContentsOfURL:mediaURL];
+    NSParameterAssert(mediaURL);
     
-    if(data == nil) {
-        NSError *error = [NSError errorWithDomain:NSStringFromClass([self class]) code:0 userInfo:@{NSLocalizedDescriptionKey : @"data is nil"}];
-        errorBlock(error);
+    // other URLs are read whole and posted with the status, as before
+    if([mediaURL isFileURL] == NO) {
+        
+        NSData *data = [NSData dataWithContentsOfURL:mediaURL];
+        
+        if(data == nil) {
+            NSError *error = [NSError errorWithDomain:NSStringFromClass([self class]) code:0 userInfo:@{NSLocalizedDescriptionKey : @"data is nil"}];
+            errorBlock(error);
+            return;
+        }
+        
+        [self postStatusUpdate:status
+                mediaDataArray:@[data]
+             possiblySensitive:nil
+             inReplyToStatusID:existingStatusID
+                      latitude:latitude
+                     longitude:longitude
+                       placeID:placeID
+            displayCoordinates:@(YES)
+                  successBlock:^(NSDictionary *status) {
+                      successBlock(status);
+                  } errorBlock:^(NSError *error) {
+                      errorBlock(error);
+                  }];
         return;
     }
     
-    [self postStatusUpdate:status
-            mediaDataArray:@[data]
-         possiblySensitive:nil
-         inReplyToStatusID:existingStatusID
-                  latitude:latitude
-                 longitude:longitude
-                   placeID:placeID
-        displayCoordinates:@(YES)
-              successBlock:^(NSDictionary *status) {
-                  successBlock(status);
-              } errorBlock:^(NSError *error) {
-                  errorBlock(error);
-              }];
+    // chunked upload, a failed segment is retried alone instead of the whole file
+    STTwitterMediaUpload *upload = [STTwitterMediaUpload mediaUploadWithTwitter:self fileURL:mediaURL mediaType:nil];
+    
+    // videos and animated GIFs are rejected by the tweet without their category
+    upload.mediaCategory = [STTwitterMediaUpload mediaCategoryForMediaType:upload.mediaType];
+    
+    [upload startWithProgressBlock:nil successBlock:^(NSString *mediaID, NSDictionary *response) {
+        [self postStatusUpdate:status
+             inReplyToStatusID:existingStatusID
+                      mediaIDs:@[mediaID]
+                      latitude:latitude
+                     longitude:longitude
+                       placeID:placeID
+            displayCoordinates:@(YES)
+                      trimUser:nil
+                  successBlock:^(NSDictionary *status) {
+                      successBlock(status);
+                  } errorBlock:^(NSError *error) {
+                      errorBlock(error);
+                  }];
+    } errorBlock:^(NSError *error) {
+        errorBlock(error);
+    }];
+}
+
+// POST media/upload
+
+- (STTwitterMediaUpload *)postMediaUploadWithFileURL:(NSURL *)fileURL
+                                           mediaType:(NSString *)mediaType
+                                       progressBlock:(void(^)(unsigned long long uploadedBytes, unsigned long long totalBytes))progressBlock
+                                        successBlock:(void(^)(NSString *mediaID, NSDictionary *response))successBlock
+                                          errorBlock:(void(^)(NSError *error))errorBlock {
+    
+    NSParameterAssert(fileURL);
+    
+    STTwitterMediaUpload *upload = [STTwitterMediaUpload mediaUploadWithTwitter:self fileURL:fileURL mediaType:mediaType];
+    
+    [upload startWithProgressBlock:progressBlock successBlock:successBlock errorBlock:errorBlock];
+    
+    return upload;
 }
 
 // GET statuses/oembed
@@ -1131,21 +1371,222 @@ static NSDateFormatter *dateFormatter = nil;
 
 #pragma mark Streaming
 
-+ (NSDictionary *)stallWarningDictionaryFromJSON:(NSString *)json {
-    if([json isKindOfClass:[NSDictionary class]]) return nil;
-    return [json valueForKey:@"warning"];
+// control messages go to their dedicated blocks when set, other messages to progressBlock if subscribed
++ (void)routeStreamMessage:(id)json
+                 ofSession:(STTwitterStreamSession *)session
+             progressBlock:(void(^)(id response))progressBlock
+         stallWarningBlock:(void(^)(NSString *code, NSString *message, NSUInteger percentFull))stallWarningBlock {
+    
+    STTwitterStreamMessageType type = [STTwitterStreamParser messageTypeOfJSONObject:json];
+    
+    if(type == STTwitterStreamMessageTypeWarning && stallWarningBlock) {
+        NSDictionary *warning = [json valueForKey:@"warning"];
+        stallWarningBlock([warning valueForKey:@"code"],
+                          [warning valueForKey:@"message"],
+                          [[warning valueForKey:@"percent_full"] integerValue]);
+        return;
+    }
+    
+    if(type == STTwitterStreamMessageTypeLimit && session.limitBlock) {
+        NSDictionary *limit = [json valueForKey:@"limit"];
+        session.limitBlock([[limit valueForKey:@"track"] unsignedIntegerValue]);
+        return;
+    }
+    
+    if(type == STTwitterStreamMessageTypeDisconnect && session.disconnectBlock) {
+        NSDictionary *disconnect = [json valueForKey:@"disconnect"];
+        session.disconnectBlock([[disconnect valueForKey:@"code"] integerValue],
+                                [disconnect valueForKey:@"stream_name"],
+                                [disconnect valueForKey:@"reason"]);
+        return;
+    }
+    
+    if((type & session.messageTypes) == 0) return; // control message not subscribed to
+    
+    progressBlock(json);
+}
+
+// batches are split between the dedicated blocks and the session batchBlock, keeping the order within each
++ (void)routeStreamMessages:(NSArray *)messages
+                  ofSession:(STTwitterStreamSession *)session
+          stallWarningBlock:(void(^)(NSString *code, NSString *message, NSUInteger percentFull))stallWarningBlock {
+    
+    NSMutableArray *batch = [NSMutableArray arrayWithCapacity:[messages count]];
+    
+    for(id json in messages) {
+        [self routeStreamMessage:json
+                       ofSession:session
+                   progressBlock:^(id response) {
+                       [batch addObject:response];
+                   } stallWarningBlock:stallWarningBlock];
+    }
+    
+    if([batch count] > 0 && session.batchBlock) session.batchBlock(batch);
+}
+
+// https://dev.twitter.com/docs/streaming-apis/parameters#delimited
+// "length" is the only value accepted by Twitter, the stream is then framed by message lengths instead of delimiters
++ (void)addDelimitedParameter:(NSNumber *)delimited toParameters:(NSMutableDictionary *)md {
+    if([delimited boolValue]) md[@"delimited"] = @"length";
+}
+
+// each connection gets its own parser, control messages are always decoded
++ (STTwitterStreamParser *)streamParserForSession:(STTwitterStreamSession *)session framing:(STTwitterStreamFraming)framing {
+    STTwitterStreamParser *streamParser = [STTwitterStreamParser streamParserWithFraming:framing];
+    streamParser.decodedMessageTypes = session.messageTypes | STTwitterStreamMessageTypeWarning | STTwitterStreamMessageTypeLimit | STTwitterStreamMessageTypeDisconnect;
+    streamParser.filter = session.filter;
+    return streamParser;
+}
+
++ (BOOL)isBatchedSession:(STTwitterStreamSession *)session {
+    return (session.batchBlock != nil && session.batchSize > 0);
+}
+
+// block receiving the messages of a connection, or their batches
++ (void(^)(id json))streamMessageBlockForSession:(STTwitterStreamSession *)session
+                                   progressBlock:(void(^)(id response))progressBlock
+                               stallWarningBlock:(void(^)(NSString *code, NSString *message, NSUInteger percentFull))stallWarningBlock {
+    
+    __weak STTwitterStreamSession *weakSession = session;
+    BOOL batched = [self isBatchedSession:session];
+    
+    return ^(id json) {
+        if(batched) {
+            [self routeStreamMessages:json
+                            ofSession:weakSession
+                    stallWarningBlock:stallWarningBlock];
+            return;
+        }
+        [self routeStreamMessage:json
+                       ofSession:weakSession
+                   progressBlock:progressBlock
+               stallWarningBlock:stallWarningBlock];
+    };
+}
+
+- (STTwitterStreamSession *)streamResource:(NSString *)resource
+                                HTTPMethod:(NSString *)HTTPMethod
+                             baseURLString:(NSString *)baseURLString
+                                parameters:(NSDictionary *)parameters
+                             progressBlock:(void(^)(id response))progressBlock
+                         stallWarningBlock:(void(^)(NSString *code, NSString *message, NSUInteger percentFull))stallWarningBlock
+                                errorBlock:(void(^)(NSError *error))errorBlock {
+    
+    BOOL delimitedByLength = [parameters[@"delimited"] isEqualToString:@"length"];
+    STTwitterStreamFraming framing = delimitedByLength ? STTwitterStreamFramingLength : STTwitterStreamFramingDelimiter;
+    
+    __weak __block STTwitterStreamSession *weakSession = nil;
+    
+    STTwitterStreamSession *session = [STTwitterStreamSession streamSessionWithConnectBlock:^NSString *(void(^connectedBlock)(void), void(^connectionErrorBlock)(NSError *error)) {
+        
+        NSMutableDictionary *md = [parameters mutableCopy];
+        md[kSTStreamParserKey] = [[self class] streamParserForSession:weakSession framing:framing];
+        md[kSTStreamConnectionBlockKey] = [connectedBlock copy];
+        
+        if([[self class] isBatchedSession:weakSession]) {
+            md[kSTStreamBatchSizeKey] = @(weakSession.batchSize);
+            md[kSTStreamBatchLatencyKey] = @(weakSession.batchLatency);
+        }
+        
+        if(weakSession.recorder) md[kSTStreamRecorderKey] = weakSession.recorder;
+        
+        void(^messageBlock)(id json) = [[self class] streamMessageBlockForSession:weakSession
+                                                                    progressBlock:progressBlock
+                                                                stallWarningBlock:stallWarningBlock];
+        
+        return [_oauth fetchResource:resource
+                          HTTPMethod:HTTPMethod
+                       baseURLString:baseURLString
+                          parameters:md
+                       progressBlock:^(NSString *requestID, id json) {
+                           messageBlock(json);
+                       } successBlock:^(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, id response) {
+                           // reaching successBlock for a stream request is an error
+                           NSError *error = [NSError errorWithDomain:NSStringFromClass([self class]) code:0 userInfo:@{NSLocalizedDescriptionKey : @"Stream closed by the server."}];
+                           connectionErrorBlock(error);
+                       } errorBlock:^(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, NSError *error) {
+                           connectionErrorBlock(error);
+                       }];
+        
+    } cancelBlock:^(NSString *requestID) {
+        if([_oauth respondsToSelector:@selector(cancelRequestWithID:)]) {
+            [_oauth cancelRequestWithID:requestID];
+        }
+    } errorBlock:errorBlock];
+    
+    weakSession = session;
+    
+    // lets the caller configure the session first
+    dispatch_async(dispatch_get_main_queue(), ^{
+        [session start];
+    });
+    
+    return session;
+}
+
+- (STTwitterStreamSession *)streamSessionWithReplay:(STTwitterStreamReplay *)replay
+                                      progressBlock:(void(^)(id response))progressBlock
+                                  stallWarningBlock:(void(^)(NSString *code, NSString *message, NSUInteger percentFull))stallWarningBlock
+                                    completionBlock:(void(^)(NSError *error))completionBlock {
+    
+    NSParameterAssert(replay);
+    NSParameterAssert(completionBlock);
+    
+    __weak __block STTwitterStreamSession *weakSession = nil;
+    
+    STTwitterStreamSession *session = [STTwitterStreamSession streamSessionWithConnectBlock:^NSString *(void(^connectedBlock)(void), void(^connectionErrorBlock)(NSError *error)) {
+        
+        STTwitterStreamSession *strongSession = weakSession; // retained until the end of the replay, like a connection
+        
+        // length framing falls back on delimiter framing, so both kinds of captures are replayed
+        STTwitterStreamParser *streamParser = [[self class] streamParserForSession:strongSession framing:STTwitterStreamFramingLength];
+        
+        void(^messageBlock)(id json) = [[self class] streamMessageBlockForSession:strongSession
+                                                                    progressBlock:progressBlock
+                                                                stallWarningBlock:stallWarningBlock];
+        
+        STTwitterStreamPipeline *pipeline = [STTwitterStreamPipeline streamPipelineWithParser:streamParser jsonBlock:messageBlock];
+        
+        if([[self class] isBatchedSession:strongSession]) {
+            pipeline.batchSize = strongSession.batchSize;
+            pipeline.batchLatency = strongSession.batchLatency;
+        }
+        
+        connectedBlock();
+        
+        // the end of the capture ends the session instead of reconnecting
+        [replay replayIntoPipeline:pipeline completionBlock:^(NSError *error) {
+            if(strongSession.isStopped) return; // stopped by the caller
+            [strongSession stop];
+            completionBlock(error);
+        }];
+        
+        return replay.path;
+        
+    } cancelBlock:^(NSString *requestID) {
+        [replay cancel];
+    } errorBlock:nil];
+    
+    weakSession = session;
+    
+    // lets the caller configure the session first
+    dispatch_async(dispatch_get_main_queue(), ^{
+        [session start];
+    });
+    
+    return session;
 }
 
 // POST statuses/filter
 
-- (void)postStatusesFilterUserIDs:(NSArray *)userIDs
-                  keywordsToTrack:(NSArray *)keywordsToTrack
-            locationBoundingBoxes:(NSArray *)locationBoundingBoxes
-                        delimited:(NSNumber *)delimited
-                    stallWarnings:(NSNumber *)stallWarnings
-                    progressBlock:(void(^)(id response))progressBlock
-                stallWarningBlock:(void(^)(NSString *code, NSString *message, NSUInteger percentFull))stallWarningBlock
-                       errorBlock:(void(^)(NSError *error))errorBlock {
+- (STTwitterStreamSession *)postStatusesFilterUserIDs:(NSArray *)userIDs
+                                      keywordsToTrack:(NSArray *)keywordsToTrack
+                                locationBoundingBoxes:(NSArray *)locationBoundingBoxes
+                                            delimited:(NSNumber *)delimited
+                                        stallWarnings:(NSNumber *)stallWarnings
+                                        progressBlock:(void(^)(id response))progressBlock
+                                    stallWarningBlock:(void(^)(NSString *code, NSString *message, NSUInteger percentFull))stallWarningBlock
+                                           errorBlock:(void(^)(NSError *error))errorBlock {
     
     NSString *follow = [userIDs componentsJoinedByString:@","];
     NSString *keywords = [keywordsToTrack componentsJoinedByString:@","];
@@ -1154,134 +1595,95 @@ static NSDateFormatter *dateFormatter = nil;
     NSAssert(([follow length] || [keywords length] || [locations length]), @"At least one predicate parameter (follow, locations, or track) must be specified.");
     
     NSMutableDictionary *md = [NSMutableDictionary dictionary];
-    if(delimited) md[@"delimited"] = [delimited boolValue] ? @"1" : @"0";
+    [[self class] addDelimitedParameter:delimited toParameters:md];
     if(stallWarnings) md[@"stall_warnings"] = [stallWarnings boolValue] ? @"1" : @"0";
     
     if([follow length]) md[@"follow"] = follow;
     if([keywords length]) md[@"track"] = keywords;
     if([locations length]) md[@"locations"] = locations;
     
-    [self postResource:@"statuses/filter.json"
-         baseURLString:kBaseURLStringStream
-            parameters:md
-         progressBlock:^(id json) {
-             
-             NSDictionary *stallWarning = [[self class] stallWarningDictionaryFromJSON:json];
-             if(stallWarning && stallWarningBlock) {
-                 stallWarningBlock([stallWarning valueForKey:@"code"],
-                                   [stallWarning valueForKey:@"message"],
-                                   [[stallWarning valueForKey:@"percent_full"] integerValue]);
-             } else {
-                 progressBlock(json);
-             }
-             
-         } successBlock:^(NSDictionary *rateLimits, id response) {
-             // reaching successBlock for a stream request is an error
-             errorBlock(response);
-         } errorBlock:^(NSError *error) {
-             errorBlock(error);
-         }];
+    return [self streamResource:@"statuses/filter.json"
+                     HTTPMethod:@"POST"
+                  baseURLString:kBaseURLStringStream
+                     parameters:md
+                  progressBlock:progressBlock
+              stallWarningBlock:stallWarningBlock
+                     errorBlock:errorBlock];
 }
 
 // convenience
-- (void)postStatusesFilterKeyword:(NSString *)keyword
-                    progressBlock:(void(^)(id response))progressBlock
-                       errorBlock:(void(^)(NSError *error))errorBlock {
+- (STTwitterStreamSession *)postStatusesFilterKeyword:(NSString *)keyword
+                                        progressBlock:(void(^)(id response))progressBlock
+                                           errorBlock:(void(^)(NSError *error))errorBlock {
     
     NSParameterAssert(keyword);
     
-    [self postStatusesFilterUserIDs:nil
-                    keywordsToTrack:@[keyword]
-              locationBoundingBoxes:nil
-                          delimited:nil
-                      stallWarnings:nil
-                      progressBlock:progressBlock
-                  stallWarningBlock:nil
-                         errorBlock:errorBlock];
+    return [self postStatusesFilterUserIDs:nil
+                           keywordsToTrack:@[keyword]
+                     locationBoundingBoxes:nil
+                                 delimited:nil
+                             stallWarnings:nil
+                             progressBlock:progressBlock
+                         stallWarningBlock:nil
+                                errorBlock:errorBlock];
 }
 
 // GET statuses/sample
-- (void)getStatusesSampleDelimited:(NSNumber *)delimited
-                     stallWarnings:(NSNumber *)stallWarnings
-                     progressBlock:(void(^)(id response))progressBlock
-                 stallWarningBlock:(void(^)(NSString *code, NSString *message, NSUInteger percentFull))stallWarningBlock
-                        errorBlock:(void(^)(NSError *error))errorBlock {
+- (STTwitterStreamSession *)getStatusesSampleDelimited:(NSNumber *)delimited
+                                         stallWarnings:(NSNumber *)stallWarnings
+                                         progressBlock:(void(^)(id response))progressBlock
+                                     stallWarningBlock:(void(^)(NSString *code, NSString *message, NSUInteger percentFull))stallWarningBlock
+                                            errorBlock:(void(^)(NSError *error))errorBlock {
     
     NSMutableDictionary *md = [NSMutableDictionary dictionary];
-    if(delimited) md[@"delimited"] = [delimited boolValue] ? @"1" : @"0";
+    [[self class] addDelimitedParameter:delimited toParameters:md];
     if(stallWarnings) md[@"stall_warnings"] = [stallWarnings boolValue] ? @"1" : @"0";
     
-    [self getResource:@"statuses/sample.json"
-        baseURLString:kBaseURLStringStream
-           parameters:md
-        progressBlock:^(id json) {
-            
-            NSDictionary *stallWarning = [[self class] stallWarningDictionaryFromJSON:json];
-            if(stallWarning && stallWarningBlock) {
-                stallWarningBlock([stallWarning valueForKey:@"code"],
-                                  [stallWarning valueForKey:@"message"],
-                                  [[stallWarning valueForKey:@"percent_full"] integerValue]);
-            } else {
-                progressBlock(json);
-            }
-            
-        } successBlock:^(NSDictionary *rateLimits, id json) {
-            // reaching successBlock for a stream request is an error
-            errorBlock(json);
-        } errorBlock:^(NSError *error) {
-            errorBlock(error);
-        }];
+    return [self streamResource:@"statuses/sample.json"
+                     HTTPMethod:@"GET"
+                  baseURLString:kBaseURLStringStream
+                     parameters:md
+                  progressBlock:progressBlock
+              stallWarningBlock:stallWarningBlock
+                     errorBlock:errorBlock];
 }
 
 // GET statuses/firehose
-- (void)getStatusesFirehoseWithCount:(NSString *)count
-                           delimited:(NSNumber *)delimited
-                       stallWarnings:(NSNumber *)stallWarnings
-                       progressBlock:(void(^)(id response))progressBlock
-                   stallWarningBlock:(void(^)(NSString *code, NSString *message, NSUInteger percentFull))stallWarningBlock
-                          errorBlock:(void(^)(NSError *error))errorBlock {
+- (STTwitterStreamSession *)getStatusesFirehoseWithCount:(NSString *)count
+                                               delimited:(NSNumber *)delimited
+                                           stallWarnings:(NSNumber *)stallWarnings
+                                           progressBlock:(void(^)(id response))progressBlock
+                                       stallWarningBlock:(void(^)(NSString *code, NSString *message, NSUInteger percentFull))stallWarningBlock
+                                              errorBlock:(void(^)(NSError *error))errorBlock {
     
     NSMutableDictionary *md = [NSMutableDictionary dictionary];
     if(count) md[@"count"] = count;
-    if(delimited) md[@"delimited"] = [delimited boolValue] ? @"1" : @"0";
+    [[self class] addDelimitedParameter:delimited toParameters:md];
     if(stallWarnings) md[@"stall_warnings"] = [stallWarnings boolValue] ? @"1" : @"0";
     
-    [self getResource:@"statuses/firehose.json"
-        baseURLString:kBaseURLStringStream
-           parameters:md
-        progressBlock:^(id json) {
-            
-            NSDictionary *stallWarning = [[self class] stallWarningDictionaryFromJSON:json];
-            if(stallWarning && stallWarningBlock) {
-                stallWarningBlock([stallWarning valueForKey:@"code"],
-                                  [stallWarning valueForKey:@"message"],
-                                  [[stallWarning valueForKey:@"percent_full"] integerValue]);
-            } else {
-                progressBlock(json);
-            }
-            
-        } successBlock:^(NSDictionary *rateLimits, id json) {
-            // reaching successBlock for a stream request is an error
-            errorBlock(json);
-        } errorBlock:^(NSError *error) {
-            errorBlock(error);
-        }];
+    return [self streamResource:@"statuses/firehose.json"
+                     HTTPMethod:@"GET"
+                  baseURLString:kBaseURLStringStream
+                     parameters:md
+                  progressBlock:progressBlock
+              stallWarningBlock:stallWarningBlock
+                     errorBlock:errorBlock];
 }
 
 // GET user
-- (void)getUserStreamDelimited:(NSNumber *)delimited
-                 stallWarnings:(NSNumber *)stallWarnings
-includeMessagesFromFollowedAccounts:(NSNumber *)includeMessagesFromFollowedAccounts
-                includeReplies:(NSNumber *)includeReplies
-               keywordsToTrack:(NSArray *)keywordsToTrack
-         locationBoundingBoxes:(NSArray *)locationBoundingBoxes
-                 progressBlock:(void(^)(id response))progressBlock
-             stallWarningBlock:(void(^)(NSString *code, NSString *message, NSUInteger percentFull))stallWarningBlock
-                    errorBlock:(void(^)(NSError *error))errorBlock {
+- (STTwitterStreamSession *)getUserStreamDelimited:(NSNumber *)delimited
+                                     stallWarnings:(NSNumber *)stallWarnings
+               includeMessagesFromFollowedAccounts:(NSNumber *)includeMessagesFromFollowedAccounts
+                                    includeReplies:(NSNumber *)includeReplies
+                                   keywordsToTrack:(NSArray *)keywordsToTrack
+                             locationBoundingBoxes:(NSArray *)locationBoundingBoxes
+                                     progressBlock:(void(^)(id response))progressBlock
+                                 stallWarningBlock:(void(^)(NSString *code, NSString *message, NSUInteger percentFull))stallWarningBlock
+                                        errorBlock:(void(^)(NSError *error))errorBlock {
     
     NSMutableDictionary *md = [NSMutableDictionary dictionary];
     md[@"stringify_friend_ids"] = @"1";
-    if(delimited) md[@"delimited"] = [delimited boolValue] ? @"1" : @"0";
+    [[self class] addDelimitedParameter:delimited toParameters:md];
     if(stallWarnings) md[@"stall_warnings"] = [stallWarnings boolValue] ? @"1" : @"0";
     if(includeMessagesFromFollowedAccounts) md[@"with"] = @"user"; // default is 'followings'
     if(includeReplies && [includeReplies boolValue]) md[@"replies"] = @"all";
@@ -1292,41 +1694,28 @@ includeMessagesFromFollowedAccounts:(NSNumber *)includeMessagesFromFollowedAccou
     if([keywords length]) md[@"keywords"] = keywords;
     if([locations length]) md[@"locations"] = locations;
     
-    [self getResource:@"user.json"
-        baseURLString:kBaseURLStringUserStream
-           parameters:md
-        progressBlock:^(id json) {
-            
-            NSDictionary *stallWarning = [[self class] stallWarningDictionaryFromJSON:json];
-            if(stallWarning && stallWarningBlock) {
-                stallWarningBlock([stallWarning valueForKey:@"code"],
-                                  [stallWarning valueForKey:@"message"],
-                                  [[stallWarning valueForKey:@"percent_full"] integerValue]);
-            } else {
-                progressBlock(json);
-            }
-            
-        } successBlock:^(NSDictionary *rateLimits, id json) {
-            // reaching successBlock for a stream request is an error
-            errorBlock(json);
-        } errorBlock:^(NSError *error) {
-            errorBlock(error);
-        }];
+    return [self streamResource:@"user.json"
+                     HTTPMethod:@"GET"
+                  baseURLString:kBaseURLStringUserStream
+                     parameters:md
+                  progressBlock:progressBlock
+              stallWarningBlock:stallWarningBlock
+                     errorBlock:errorBlock];
 }
 
 // GET site
-- (void)getSiteStreamForUserIDs:(NSArray *)userIDs
-                      delimited:(NSNumber *)delimited
-                  stallWarnings:(NSNumber *)stallWarnings
-         restrictToUserMessages:(NSNumber *)restrictToUserMessages
-                 includeReplies:(NSNumber *)includeReplies
-                  progressBlock:(void(^)(id response))progressBlock
-              stallWarningBlock:(void(^)(NSString *code, NSString *message, NSUInteger percentFull))stallWarningBlock
-                     errorBlock:(void(^)(NSError *error))errorBlock {
+- (STTwitterStreamSession *)getSiteStreamForUserIDs:(NSArray *)userIDs
+                                          delimited:(NSNumber *)delimited
+                                      stallWarnings:(NSNumber *)stallWarnings
+                             restrictToUserMessages:(NSNumber *)restrictToUserMessages
+                                     includeReplies:(NSNumber *)includeReplies
+                                      progressBlock:(void(^)(id response))progressBlock
+                                  stallWarningBlock:(void(^)(NSString *code, NSString *message, NSUInteger percentFull))stallWarningBlock
+                                         errorBlock:(void(^)(NSError *error))errorBlock {
     
     NSMutableDictionary *md = [NSMutableDictionary dictionary];
     md[@"stringify_friend_ids"] = @"1";
-    if(delimited) md[@"delimited"] = [delimited boolValue] ? @"1" : @"0";
+    [[self class] addDelimitedParameter:delimited toParameters:md];
     if(stallWarnings) md[@"stall_warnings"] = [stallWarnings boolValue] ? @"1" : @"0";
     if(restrictToUserMessages) md[@"with"] = @"user"; // default is 'followings'
     if(includeReplies && [includeReplies boolValue]) md[@"replies"] = @"all";
@@ -1334,26 +1723,13 @@ includeMessagesFromFollowedAccounts:(NSNumber *)includeMessagesFromFollowedAccou
     NSString *follow = [userIDs componentsJoinedByString:@","];
     if([follow length]) md[@"follow"] = follow;
     
-    [self getResource:@"site.json"
-        baseURLString:kBaseURLStringSiteStream
-           parameters:md
-        progressBlock:^(id json) {
-            
-            NSDictionary *stallWarning = [[self class] stallWarningDictionaryFromJSON:json];
-            if(stallWarning && stallWarningBlock) {
-                stallWarningBlock([stallWarning valueForKey:@"code"],
-                                  [stallWarning valueForKey:@"message"],
-                                  [[stallWarning valueForKey:@"percent_full"] integerValue]);
-            } else {
-                progressBlock(json);
-            }
-            
-        } successBlock:^(NSDictionary *rateLimits, id json) {
-            // reaching successBlock for a stream request is an error
-            errorBlock(json);
-        } errorBlock:^(NSError *error) {
-            errorBlock(error);
-        }];
+    return [self streamResource:@"site.json"
+                     HTTPMethod:@"GET"
+                  baseURLString:kBaseURLStringSiteStream
+                     parameters:md
+                  progressBlock:progressBlock
+              stallWarningBlock:stallWarningBlock
+                     errorBlock:errorBlock];
 }
 
 #pragma mark Direct Messages
@@ -2199,6 +2575,20 @@ includeMessagesFromFollowedAccounts:(NSNumber *)includeMessagesFromFollowedAccou
     }];
 }
 
+- (STTwitterUsersLookup *)getUsersLookupForUserIDs:(NSArray *)userIDs
+                                     orScreenNames:(NSArray *)screenNames
+                                   includeEntities:(NSNumber *)includeEntities
+                                      successBlock:(void(^)(NSDictionary *usersByID, NSArray *missingUserIDs, NSArray *missingScreenNames))successBlock
+                                        errorBlock:(void(^)(NSError *error))errorBlock {
+    
+    STTwitterUsersLookup *lookup = [STTwitterUsersLookup usersLookupWithTwitter:self];
+    lookup.includeEntities = includeEntities;
+    
+    [lookup lookupUserIDs:userIDs screenNames:screenNames successBlock:successBlock errorBlock:errorBlock];
+    
+    return lookup;
+}
+
 // GET users/show
 - (void)getUsersShowForUserID:(NSString *)userID
                  orScreenName:(NSString *)screenName
@@ -3783,6 +4173,7 @@ includeMessagesFromFollowedAccounts:(NSNumber *)includeMessagesFromFollowedAccou
 	if (resources)
         d = @{ @"resources" : [resources componentsJoinedByString:@","] };
 	[self getAPIResource:@"application/rate_limit_status.json" parameters:d successBlock:^(NSDictionary *rateLimits, id response) {
+        [_rateLimiter updateWithRateLimitStatus:response];
         successBlock(response);
     } errorBlock:^(NSError *error) {
         errorBlock(error);
@@ -10,16 +10,24 @@
 #import "STHTTPRequest.h"
 #import "NSString+STTwitter.h"
 #import "STHTTPRequest+STTwitter.h"
+#import "STTwitterRequestRegistry.h"
 
 @interface NSData (Base64)
 - (NSString *)base64Encoding; // private API
 @end
 
+@interface STTwitterAppOnly ()
+@property (nonatomic, retain) STTwitterRequestRegistry *requestRegistry; // live requests, by requestID
+@property (nonatomic, retain) id <STHTTPRequestCache> responseCache;
+@end
+
 @implementation STTwitterAppOnly
 
 - (id)init {
     self = [super init];
     
+    self.requestRegistry = [[STTwitterRequestRegistry alloc] init];
+    
     // TODO: remove cookies from Twitter if needed
     
     return self;
@@ -150,6 +158,9 @@
      Accept-Encoding: gzip
      */
     
+    NSDictionary *requestOptions = [STHTTPRequest twitterRequestOptionsFromParameters:params];
+    params = [STHTTPRequest twitterParametersByRemovingRequestOptions:params];
+    
     NSMutableString *urlString = [NSMutableString stringWithFormat:@"%@/%@", baseURLString, resource];
     
     NSMutableArray *parameters = [NSMutableArray array];
@@ -168,9 +179,11 @@
     NSString *requestID = [[NSUUID UUID] UUIDString];
     
     __block STHTTPRequest *r = [STHTTPRequest twitterRequestWithURLString:urlString
-                                                   stTwitterProgressBlock:^(id json) {
-                                                       if(progressBlock) progressBlock(requestID, json);
-                                                   } stTwitterSuccessBlock:^(NSDictionary *requestHeaders, NSDictionary *responseHeaders, id json) {
+                                                           requestOptions:requestOptions
+                                                   stTwitterProgressBlock:progressBlock ? ^(id json) {
+                                                       progressBlock(requestID, json);
+                                                   } : nil
+                                                    stTwitterSuccessBlock:^(NSDictionary *requestHeaders, NSDictionary *responseHeaders, id json) {
                                                        successBlock(requestID, requestHeaders, responseHeaders, json);
                                                    } stTwitterErrorBlock:^(NSDictionary *requestHeaders, NSDictionary *responseHeaders, NSError *error) {
                                                        errorBlock(requestID, requestHeaders, responseHeaders, error);
@@ -179,7 +192,9 @@
         [r setHeaderWithName:@"Authorization" value:[NSString stringWithFormat:@"Bearer %@", _bearerToken]];
     }
     
-    [r startAsynchronous];
+    r.responseCache = _responseCache;
+    
+    [_requestRegistry startRequest:r withID:requestID requestOptions:requestOptions];
     
     return requestID;
 }
@@ -220,6 +235,10 @@
     }
 }
 
+- (void)cancelRequestWithID:(NSString *)requestID {
+    [_requestRegistry cancelRequestWithID:requestID];
+}
+
 - (NSString *)postResource:(NSString *)resource
              baseURLString:(NSString *)baseURLString // no trailing slash
                 parameters:(NSDictionary *)params
@@ -228,14 +247,19 @@
               successBlock:(void(^)(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, id json))successBlock
                 errorBlock:(void(^)(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, NSError *error))errorBlock {
     
+    NSDictionary *requestOptions = [STHTTPRequest twitterRequestOptionsFromParameters:params];
+    params = [STHTTPRequest twitterParametersByRemovingRequestOptions:params];
+    
     NSString *urlString = [NSString stringWithFormat:@"%@/%@", baseURLString, resource];
     
     NSString *requestID = [[NSUUID UUID] UUIDString];
     
     __block STHTTPRequest *r = [STHTTPRequest twitterRequestWithURLString:urlString
-                                                   stTwitterProgressBlock:^(id json) {
-                                                       if(progressBlock) progressBlock(requestID, json);
-                                                   } stTwitterSuccessBlock:^(NSDictionary *requestHeaders, NSDictionary *responseHeaders, id json) {
+                                                           requestOptions:requestOptions
+                                                   stTwitterProgressBlock:progressBlock ? ^(id json) {
+                                                       progressBlock(requestID, json);
+                                                   } : nil
+                                                    stTwitterSuccessBlock:^(NSDictionary *requestHeaders, NSDictionary *responseHeaders, id json) {
                                                        successBlock(requestID, requestHeaders, responseHeaders, json);
                                                    } stTwitterErrorBlock:^(NSDictionary *requestHeaders, NSDictionary *responseHeaders, NSError *error) {
                                                        errorBlock(requestID, requestHeaders, responseHeaders, error);
@@ -258,7 +282,7 @@
         r.encodePOSTDictionary = YES;
     }
     
-    [r startAsynchronous];
+    [_requestRegistry startRequest:r withID:requestID requestOptions:requestOptions];
     
     return requestID;
 }
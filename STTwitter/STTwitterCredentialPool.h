@@ -0,0 +1,55 @@
+//
+//  STTwitterCredentialPool.h
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "STTwitterProtocol.h"
+
+@class STTwitterRateLimiter;
+
+/*
+ Backend that spreads requests over several credentials, eg. the bearer tokens of several apps, see +[STTwitterAPI twitterAPIWithCredentialPool:]
+
+ Each request goes to the credential with the largest remaining budget for its resource, credentials with an unknown budget first,
+ in turn when several credentials have the same budget. Each credential gets its own STTwitterRateLimiter.
+
+ A credential that gets an authentication error (HTTP 401, Twitter codes 32, 89, 99, 215) is sidelined for sidelineInterval.
+ A GET that fails with an authentication error or a 429 is sent again once with another credential, streaming requests are not.
+
+ Meant for reads of public data, responses may differ from one user credential to another,
+ so user credentials don't share cached responses, see -responseCacheForCredential:.
+ Pooled requests are registered in the requestRegistry of the pool, cancel them by ID or by tag, whatever credential serves them.
+ The rateLimiter of that registry is not used, each credential has its own.
+ */
+
+@interface STTwitterCredentialPool : NSObject <STTwitterProtocol>
+
+@property (nonatomic) NSTimeInterval sidelineInterval; // default 15 minutes
+
+@property (nonatomic, readonly) NSArray *credentials;
+@property (nonatomic, readonly) NSArray *availableCredentials; // not sidelined
+
+// STTwitterAppOnly and STTwitterOAuth instances, app-only credentials need a bearer token or can fetch one
++ (instancetype)credentialPoolWithCredentials:(NSArray *)credentials;
+
+- (void)addCredential:(NSObject <STTwitterProtocol> *)credential;
+- (void)removeCredential:(NSObject <STTwitterProtocol> *)credential;
+
+- (void)sidelineCredential:(NSObject <STTwitterProtocol> *)credential;
+- (void)reinstateCredential:(NSObject <STTwitterProtocol> *)credential;
+
+- (STTwitterRateLimiter *)rateLimiterForCredential:(NSObject <STTwitterProtocol> *)credential;
+
+// the responseCache as given to the credential, shared by app-only credentials, scoped to the user for the others
+- (id <STHTTPRequestCache>)responseCacheForCredential:(NSObject <STTwitterProtocol> *)credential;
+
+// the credential that the next request for this resource would use, nil if all of them are sidelined
+- (NSObject <STTwitterProtocol> *)credentialForResource:(NSString *)resource;
+
++ (BOOL)isAuthenticationError:(NSError *)error;
+
+@end
@@ -0,0 +1,451 @@
+//
+//  STTwitterCredentialPool.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STTwitterCredentialPool.h"
+#import "STTwitterRateLimiter.h"
+#import "STTwitterRequestRegistry.h"
+#import "STHTTPRequest+STTwitter.h"
+#import "STTwitterAppOnly.h"
+
+#if DEBUG
+#   define STLog(...) NSLog(__VA_ARGS__)
+#else
+#   define STLog(...)
+#endif
+
+@interface STTwitterPooledRequest : NSObject
+@property (nonatomic, retain) NSObject <STTwitterProtocol> *credential;
+@property (nonatomic, retain) NSString *credentialRequestID;
+@property (nonatomic) BOOL isCancelled;
+@end
+
+@implementation STTwitterPooledRequest
+@end
+
+// the shared cache, with keys scoped to one user credential
+@interface STTwitterCredentialScopedCache : NSObject <STHTTPRequestCache>
+@property (nonatomic, retain) id <STHTTPRequestCache> cache;
+@property (nonatomic, retain) NSString *scope;
+@end
+
+@implementation STTwitterCredentialScopedCache
+
+- (NSURLRequest *)scopedRequest:(NSURLRequest *)request {
+    NSURL *url = [request URL];
+    NSString *separator = [url query] ? @"&" : @"?";
+    NSString *urlString = [NSString stringWithFormat:@"%@%@st_credential=%@", [url absoluteString], separator, _scope];
+
+    NSMutableURLRequest *scopedRequest = [request mutableCopy];
+    [scopedRequest setURL:[NSURL URLWithString:urlString]];
+    return scopedRequest;
+}
+
+- (void)lookUpCachedResponseForRequest:(NSURLRequest *)request completionBlock:(void(^)(NSCachedURLResponse *cachedResponse, BOOL isFresh))completionBlock {
+    [_cache lookUpCachedResponseForRequest:[self scopedRequest:request] completionBlock:completionBlock];
+}
+
+- (void)storeCachedResponse:(NSCachedURLResponse *)cachedResponse forRequest:(NSURLRequest *)request {
+    [_cache storeCachedResponse:cachedResponse forRequest:[self scopedRequest:request]];
+}
+
+@end
+
+@interface STTwitterCredentialPool ()
+@property (nonatomic, retain) NSMutableArray *mutableCredentials;
+@property (nonatomic, retain) NSMapTable *rateLimitersByCredential;
+@property (nonatomic, retain) NSMapTable *sidelineDatesByCredential;
+@property (nonatomic, retain) NSCountedSet *inFlightCredentials;
+@property (nonatomic, retain) NSMutableDictionary *requestsByID;
+@property (nonatomic) NSUInteger cursor; // rotates the credentials with the same budget
+@property (nonatomic, retain) id <STHTTPRequestCache> responseCache;
+@property (nonatomic, retain) STTwitterRequestRegistry *requestRegistry; // pooled requests, by the pool requestID
+@end
+
+@implementation STTwitterCredentialPool
+
+- (id)init {
+    self = [super init];
+
+    self.sidelineInterval = 15 * 60.0;
+    self.mutableCredentials = [NSMutableArray array];
+    self.rateLimitersByCredential = [NSMapTable strongToStrongObjectsMapTable];
+    self.sidelineDatesByCredential = [NSMapTable strongToStrongObjectsMapTable];
+    self.inFlightCredentials = [NSCountedSet set];
+    self.requestsByID = [NSMutableDictionary dictionary];
+    self.requestRegistry = [[STTwitterRequestRegistry alloc] init];
+
+    return self;
+}
+
++ (instancetype)credentialPoolWithCredentials:(NSArray *)credentials {
+    STTwitterCredentialPool *pool = [[self alloc] init];
+    for(NSObject <STTwitterProtocol> *credential in credentials) {
+        [pool addCredential:credential];
+    }
+    return pool;
+}
+
+#pragma mark Credentials
+
+- (NSArray *)credentials {
+    @synchronized(self) {
+        return [_mutableCredentials copy];
+    }
+}
+
+- (NSArray *)availableCredentials {
+
+    NSDate *now = [NSDate date];
+    NSMutableArray *credentials = [NSMutableArray array];
+
+    @synchronized(self) {
+        for(NSObject <STTwitterProtocol> *credential in _mutableCredentials) {
+            NSDate *sidelineDate = [_sidelineDatesByCredential objectForKey:credential];
+            if(sidelineDate && [now timeIntervalSinceDate:sidelineDate] < _sidelineInterval) continue;
+            [credentials addObject:credential];
+        }
+    }
+
+    return credentials;
+}
+
+- (void)addCredential:(NSObject <STTwitterProtocol> *)credential {
+
+    NSParameterAssert(credential);
+
+    STTwitterRequestRegistry *registry = [credential respondsToSelector:@selector(requestRegistry)] ? [credential requestRegistry] : nil;
+
+    STTwitterRateLimiter *rateLimiter = registry.rateLimiter;
+    if(rateLimiter == nil) {
+        rateLimiter = [[STTwitterRateLimiter alloc] init];
+        registry.rateLimiter = rateLimiter;
+    }
+
+    if(_responseCache && [credential respondsToSelector:@selector(setResponseCache:)]) {
+        [credential setResponseCache:[self responseCacheForCredential:credential]];
+    }
+
+    @synchronized(self) {
+        if([_mutableCredentials containsObject:credential]) return;
+        [_mutableCredentials addObject:credential];
+        [_rateLimitersByCredential setObject:rateLimiter forKey:credential];
+    }
+}
+
+- (void)removeCredential:(NSObject <STTwitterProtocol> *)credential {
+    @synchronized(self) {
+        [_mutableCredentials removeObject:credential];
+        [_rateLimitersByCredential removeObjectForKey:credential];
+        [_sidelineDatesByCredential removeObjectForKey:credential];
+    }
+}
+
+- (void)sidelineCredential:(NSObject <STTwitterProtocol> *)credential {
+    STLog(@"-- sidelining credential %@", [credential consumerName]);
+    @synchronized(self) {
+        [_sidelineDatesByCredential setObject:[NSDate date] forKey:credential];
+    }
+}
+
+- (void)reinstateCredential:(NSObject <STTwitterProtocol> *)credential {
+    @synchronized(self) {
+        [_sidelineDatesByCredential removeObjectForKey:credential];
+    }
+}
+
+- (STTwitterRateLimiter *)rateLimiterForCredential:(NSObject <STTwitterProtocol> *)credential {
+    @synchronized(self) {
+        return [_rateLimitersByCredential objectForKey:credential];
+    }
+}
+
++ (BOOL)isAuthenticationError:(NSError *)error {
+
+    NSInteger status = [[[error userInfo] objectForKey:kSTHTTPStatusCodeKey] integerValue];
+    if(status == 401) return YES;
+
+    // https://dev.twitter.com/docs/error-codes-responses
+    // 32 could not authenticate you, 89 invalid or expired token, 99 unable to verify your credentials, 215 bad authentication data
+    NSInteger code = [error code];
+    return (status >= 400 && (code == 32 || code == 89 || code == 99 || code == 215));
+}
+
+#pragma mark Selection
+
+// requests left in the window, unknown budgets first since they are likely full
+- (NSInteger)estimatedBudgetOfCredential:(NSObject <STTwitterProtocol> *)credential forResource:(NSString *)resource {
+
+    NSDictionary *rateLimit = [[_rateLimitersByCredential objectForKey:credential] rateLimitForResource:resource];
+
+    NSInteger budget = NSIntegerMax / 2;
+
+    if(rateLimit) {
+        BOOL isNewWindow = [rateLimit[@"reset"] timeIntervalSinceNow] <= 0;
+        budget = [rateLimit[isNewWindow ? @"limit" : @"remaining"] integerValue];
+    }
+
+    return budget - (NSInteger)[_inFlightCredentials countForObject:credential];
+}
+
+- (NSObject <STTwitterProtocol> *)credentialForResource:(NSString *)resource excludedCredentials:(NSSet *)excludedCredentials rotate:(BOOL)rotate {
+
+    NSArray *availableCredentials = [self availableCredentials];
+
+    @synchronized(self) {
+
+        NSUInteger count = [availableCredentials count];
+
+        NSObject <STTwitterProtocol> *bestCredential = nil;
+        NSInteger bestBudget = NSIntegerMin;
+
+        for(NSUInteger i = 0; i < count; i++) {
+            NSObject <STTwitterProtocol> *credential = availableCredentials[(_cursor + i) % count];
+            if([excludedCredentials containsObject:credential]) continue;
+
+            NSInteger budget = [self estimatedBudgetOfCredential:credential forResource:resource];
+            if(budget > bestBudget) {
+                bestBudget = budget;
+                bestCredential = credential;
+            }
+        }
+
+        if(rotate) _cursor++;
+
+        return bestCredential;
+    }
+}
+
+- (NSObject <STTwitterProtocol> *)credentialForResource:(NSString *)resource {
+    return [self credentialForResource:resource excludedCredentials:nil rotate:NO];
+}
+
+#pragma mark STTwitterProtocol
+
+- (NSString *)consumerName {
+    return nil;
+}
+
+- (NSString *)loginTypeDescription {
+    return [NSString stringWithFormat:@"Credential Pool (%lu)", (unsigned long)[[self credentials] count]];
+}
+
+- (BOOL)canVerifyCredentials {
+    for(NSObject <STTwitterProtocol> *credential in [self credentials]) {
+        if([credential canVerifyCredentials]) return YES;
+    }
+    return NO;
+}
+
+// succeeds if at least one credential is valid, sidelines the others, username is the one of the first valid user credential
+- (void)verifyCredentialsWithSuccessBlock:(void(^)(NSString *username))successBlock
+                               errorBlock:(void(^)(NSError *error))errorBlock {
+
+    NSArray *credentials = [[self credentials] filteredArrayUsingPredicate:[NSPredicate predicateWithBlock:^BOOL(NSObject <STTwitterProtocol> *credential, NSDictionary *bindings) {
+        return [credential canVerifyCredentials];
+    }]];
+
+    if([credentials count] == 0) {
+        NSError *error = [NSError errorWithDomain:NSStringFromClass([self class]) code:0 userInfo:@{NSLocalizedDescriptionKey : @"No credential can be verified."}];
+        errorBlock(error);
+        return;
+    }
+
+    __block NSUInteger pendingCount = [credentials count];
+    __block NSUInteger validCount = 0;
+    __block NSString *firstUsername = nil;
+    __block NSError *lastError = nil;
+
+    void(^credentialDidFinish)(void) = ^{
+        if(--pendingCount > 0) return;
+        if(validCount > 0) {
+            successBlock(firstUsername);
+        } else {
+            errorBlock(lastError);
+        }
+    };
+
+    for(NSObject <STTwitterProtocol> *credential in credentials) {
+        [credential verifyCredentialsWithSuccessBlock:^(NSString *username) {
+            [self reinstateCredential:credential];
+            validCount++;
+            if(firstUsername == nil) firstUsername = username;
+            credentialDidFinish();
+        } errorBlock:^(NSError *error) {
+            [self sidelineCredential:credential];
+            lastError = error;
+            credentialDidFinish();
+        }];
+    }
+}
+
+- (NSString *)fetchResource:(NSString *)resource
+                 HTTPMethod:(NSString *)HTTPMethod
+              baseURLString:(NSString *)baseURLString
+                 parameters:(NSDictionary *)params
+              progressBlock:(void(^)(NSString *requestID, id response))progressBlock
+               successBlock:(void(^)(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, id response))successBlock
+                 errorBlock:(void(^)(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, NSError *error))errorBlock {
+
+    NSString *requestID = [[NSUUID UUID] UUIDString];
+
+    // registered once for all the attempts, so that the tag of the request cancels the attempt in flight
+
+    STTwitterRequestRegistry *requestRegistry = _requestRegistry;
+
+    [requestRegistry registerRequestWithID:requestID tag:params[kSTRequestTagKey] cancelBlock:^{
+        [self cancelPooledRequestWithID:requestID];
+    }];
+
+    [self fetchResource:resource
+             HTTPMethod:HTTPMethod
+          baseURLString:baseURLString
+             parameters:params
+              requestID:requestID
+    excludedCredentials:[NSSet set]
+          progressBlock:progressBlock
+           successBlock:^(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, id response) {
+               [requestRegistry requestDidFinishWithID:requestID];
+               if(successBlock) successBlock(requestID, requestHeaders, responseHeaders, response);
+           } errorBlock:^(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, NSError *error) {
+               [requestRegistry requestDidFinishWithID:requestID];
+               if(errorBlock) errorBlock(requestID, requestHeaders, responseHeaders, error);
+           }];
+
+    return requestID;
+}
+
+- (void)fetchResource:(NSString *)resource
+           HTTPMethod:(NSString *)HTTPMethod
+        baseURLString:(NSString *)baseURLString
+           parameters:(NSDictionary *)params
+            requestID:(NSString *)requestID
+  excludedCredentials:(NSSet *)excludedCredentials
+        progressBlock:(void(^)(NSString *requestID, id response))progressBlock
+         successBlock:(void(^)(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, id response))successBlock
+           errorBlock:(void(^)(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, NSError *error))errorBlock {
+
+    NSObject <STTwitterProtocol> *credential = [self credentialForResource:resource excludedCredentials:excludedCredentials rotate:YES];
+
+    if(credential == nil) {
+        NSError *error = [NSError errorWithDomain:NSStringFromClass([self class]) code:0 userInfo:@{NSLocalizedDescriptionKey : @"No credential available."}];
+        if(errorBlock) errorBlock(requestID, nil, nil, error);
+        return;
+    }
+
+    STTwitterPooledRequest *pr = [[STTwitterPooledRequest alloc] init];
+    pr.credential = credential;
+
+    @synchronized(self) {
+        _requestsByID[requestID] = pr;
+        [_inFlightCredentials addObject:credential];
+    }
+
+    // credentials without a registry, eg. STTwitterOS, don't feed their rate limiter themselves
+
+    BOOL feedsRateLimiter = [credential respondsToSelector:@selector(requestRegistry)] == NO || [credential requestRegistry] == nil;
+    NSURL *url = [NSURL URLWithString:[NSString stringWithFormat:@"%@/%@", baseURLString, resource]];
+
+    void(^requestDidFinish)(NSInteger, NSDictionary *) = ^(NSInteger statusCode, NSDictionary *responseHeaders) {
+        @synchronized(self) {
+            if(_requestsByID[requestID] == pr) [_requestsByID removeObjectForKey:requestID];
+            [_inFlightCredentials removeObject:credential];
+        }
+        if(feedsRateLimiter) [[self rateLimiterForCredential:credential] requestDidFinishForURL:url statusCode:statusCode responseHeaders:responseHeaders];
+    };
+
+    NSString *credentialRequestID = [credential fetchResource:resource
+                                                   HTTPMethod:HTTPMethod
+                                                baseURLString:baseURLString
+                                                   parameters:params
+                                                progressBlock:progressBlock ? ^(NSString *credentialRequestID, id response) {
+                                                    progressBlock(requestID, response);
+                                                } : nil
+                                                 successBlock:^(NSString *credentialRequestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, id response) {
+                                                     requestDidFinish(200, responseHeaders);
+                                                     if(successBlock) successBlock(requestID, requestHeaders, responseHeaders, response);
+                                                 } errorBlock:^(NSString *credentialRequestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, NSError *error) {
+
+                                                     NSInteger status = [[[error userInfo] objectForKey:kSTHTTPStatusCodeKey] integerValue];
+                                                     requestDidFinish(status, responseHeaders);
+
+                                                     BOOL isAuthenticationError = [[self class] isAuthenticationError:error];
+                                                     if(isAuthenticationError) [self sidelineCredential:credential];
+
+                                                     BOOL canRetry = (isAuthenticationError || status == 429)
+                                                     && pr.isCancelled == NO
+                                                     && progressBlock == nil
+                                                     && [HTTPMethod isEqualToString:@"GET"]
+                                                     && [excludedCredentials count] == 0; // once
+
+                                                     if(canRetry && [self credentialForResource:resource excludedCredentials:[NSSet setWithObject:credential] rotate:NO]) {
+                                                         [self fetchResource:resource
+                                                                  HTTPMethod:HTTPMethod
+                                                               baseURLString:baseURLString
+                                                                  parameters:params
+                                                                   requestID:requestID
+                                                         excludedCredentials:[NSSet setWithObject:credential]
+                                                               progressBlock:progressBlock
+                                                                successBlock:successBlock
+                                                                  errorBlock:errorBlock];
+                                                         return;
+                                                     }
+
+                                                     if(errorBlock) errorBlock(requestID, requestHeaders, responseHeaders, error);
+                                                 }];
+
+    @synchronized(self) {
+        pr.credentialRequestID = credentialRequestID;
+    }
+
+    [_requestRegistry requestDidStartWithID:requestID];
+}
+
+- (void)cancelRequestWithID:(NSString *)requestID {
+    [_requestRegistry cancelRequestWithID:requestID];
+}
+
+- (void)cancelPooledRequestWithID:(NSString *)requestID {
+
+    STTwitterPooledRequest *pr = nil;
+
+    @synchronized(self) {
+        pr = _requestsByID[requestID];
+        pr.isCancelled = YES;
+    }
+
+    if(pr.credentialRequestID && [pr.credential respondsToSelector:@selector(cancelRequestWithID:)]) {
+        [pr.credential cancelRequestWithID:pr.credentialRequestID];
+    }
+}
+
+- (void)setResponseCache:(id <STHTTPRequestCache>)responseCache {
+    _responseCache = responseCache;
+    for(NSObject <STTwitterProtocol> *credential in [self credentials]) {
+        if([credential respondsToSelector:@selector(setResponseCache:)]) {
+            [credential setResponseCache:[self responseCacheForCredential:credential]];
+        }
+    }
+}
+
+- (id <STHTTPRequestCache>)responseCacheForCredential:(NSObject <STTwitterProtocol> *)credential {
+
+    if(_responseCache == nil) return nil;
+
+    // app-only responses don't depend on the app, user context responses depend on the user, eg. users/show "following"
+
+    if([credential isKindOfClass:[STTwitterAppOnly class]]) return _responseCache;
+
+    NSString *accessToken = [credential respondsToSelector:@selector(oauthAccessToken)] ? [credential oauthAccessToken] : nil;
+
+    STTwitterCredentialScopedCache *scopedCache = [[STTwitterCredentialScopedCache alloc] init];
+    scopedCache.cache = _responseCache;
+    scopedCache.scope = accessToken ? [accessToken st_stringByAddingRFC3986PercentEscapesUsingEncoding:NSUTF8StringEncoding] : [NSString stringWithFormat:@"%p", credential];
+    return scopedCache;
+}
+
+@end
@@ -0,0 +1,61 @@
+//
+//  STTwitterCursorIterator.h
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "STTwitterRequestScheduler.h"
+
+@class STTwitterAPI;
+
+/*
+ Walks the pages of a cursored resource, eg. followers/ids
+ https://dev.twitter.com/docs/misc/cursoring
+
+ The next page is requested as soon as a page is handed to the page block, so that the network
+ and the consumer work at the same time. At most maxPrefetchedPages pages are fetched ahead,
+ the whole result is never kept in memory.
+
+ The iteration ends with a next cursor of 0, when the page block sets stop, with -cancel, or with the first error.
+ The completion block is then called once. Use from the main thread.
+ */
+
+// fetches the page at cursor, calls one of the blocks once
+typedef void(^STTwitterCursorPageFetchBlock)(NSString *cursor, void(^successBlock)(NSArray *items, NSString *nextCursor), void(^errorBlock)(NSError *error));
+
+@interface STTwitterCursorIterator : NSObject
+
+@property (nonatomic) NSUInteger maxPrefetchedPages; // default 1, pages fetched but not yet handed to the page block
+@property (nonatomic) STTwitterRequestPriority priority; // default STTwitterRequestPriorityInteractive, requests made through STTwitterAPI
+
+// state
+@property (nonatomic, readonly) NSString *cursor; // cursor of the first page not yet handed to the page block, to resume later
+@property (nonatomic, readonly) NSUInteger pageCount; // pages handed to the page block
+@property (nonatomic, readonly) NSUInteger itemCount;
+@property (nonatomic, readonly) BOOL isFinished;
+
++ (instancetype)cursorIteratorWithCursor:(NSString *)cursor fetchBlock:(STTwitterCursorPageFetchBlock)fetchBlock;
+
+// GET resource with a cursor parameter, items are read with itemsKey in the responses, eg. @"ids" or @"users"
+// cursor is nil or @"-1" for the first page
++ (instancetype)cursorIteratorWithTwitter:(STTwitterAPI *)twitter
+                                 resource:(NSString *)resource
+                               parameters:(NSDictionary *)parameters
+                                 itemsKey:(NSString *)itemsKey
+                                   cursor:(NSString *)cursor;
+
+// the page block returns before the next page is handed to it
+- (void)startWithPageBlock:(void(^)(NSArray *items, BOOL *stop))pageBlock
+           completionBlock:(void(^)(NSError *error))completionBlock;
+
+// for consumers that process pages asynchronously, call doneBlock once the page is processed
+- (void)startWithAsynchronousPageBlock:(void(^)(NSArray *items, void(^doneBlock)(BOOL stop)))pageBlock
+                       completionBlock:(void(^)(NSError *error))completionBlock;
+
+// the completion block is called with a nil error, pages fetched ahead are dropped
+- (void)cancel;
+
+@end
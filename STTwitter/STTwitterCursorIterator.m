@@ -0,0 +1,270 @@
+//
+//  STTwitterCursorIterator.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STTwitterCursorIterator.h"
+#import "STTwitterAPI.h"
+#import "STTwitterRequestRegistry.h"
+#import "STHTTPRequest+STTwitter.h"
+
+@interface STTwitterCursorPage : NSObject
+@property (nonatomic, retain) NSArray *items;
+@property (nonatomic, retain) NSString *nextCursor;
+@end
+
+@implementation STTwitterCursorPage
+@end
+
+@interface STTwitterCursorIterator ()
+@property (nonatomic, copy) STTwitterCursorPageFetchBlock fetchBlock;
+@property (nonatomic, copy) dispatch_block_t cancelBlock; // cancels the request in flight
+@property (nonatomic, copy) void(^pageBlock)(NSArray *items, void(^doneBlock)(BOOL stop));
+@property (nonatomic, copy) void(^completionBlock)(NSError *error);
+@property (nonatomic, retain) NSMutableArray *pages; // fetched ahead
+@property (nonatomic, retain) NSString *fetchCursor; // cursor of the next page to fetch
+@property (nonatomic, retain) NSError *error;
+@property (nonatomic) BOOL isFetching;
+@property (nonatomic) BOOL hasFetchedLastPage;
+@property (nonatomic) BOOL isConsuming;
+@property (nonatomic) BOOL isPumping;
+@property (nonatomic) BOOL needsPump;
+@property (nonatomic, readwrite) NSString *cursor;
+@property (nonatomic, readwrite) NSUInteger pageCount;
+@property (nonatomic, readwrite) NSUInteger itemCount;
+@property (nonatomic, readwrite) BOOL isFinished;
+@end
+
+@implementation STTwitterCursorIterator
+
+- (id)init {
+    self = [super init];
+    self.maxPrefetchedPages = 1;
+    self.pages = [NSMutableArray array];
+    return self;
+}
+
++ (instancetype)cursorIteratorWithCursor:(NSString *)cursor fetchBlock:(STTwitterCursorPageFetchBlock)fetchBlock {
+
+    NSParameterAssert(fetchBlock);
+
+    STTwitterCursorIterator *iterator = [[self alloc] init];
+    iterator.cursor = cursor ? cursor : @"-1";
+    iterator.fetchCursor = iterator.cursor;
+    iterator.fetchBlock = fetchBlock;
+    return iterator;
+}
+
++ (instancetype)cursorIteratorWithTwitter:(STTwitterAPI *)twitter
+                                 resource:(NSString *)resource
+                               parameters:(NSDictionary *)parameters
+                                 itemsKey:(NSString *)itemsKey
+                                   cursor:(NSString *)cursor {
+
+    NSParameterAssert(twitter);
+    NSParameterAssert(resource);
+    NSParameterAssert(itemsKey);
+
+    // all the requests of the iteration share a tag, to cancel the one in flight
+
+    NSString *tag = [[NSUUID UUID] UUIDString];
+
+    __block __weak STTwitterCursorIterator *weakIterator = nil;
+
+    STTwitterCursorIterator *iterator = [self cursorIteratorWithCursor:cursor fetchBlock:^(NSString *pageCursor, void (^successBlock)(NSArray *, NSString *), void (^errorBlock)(NSError *)) {
+
+        NSMutableDictionary *md = parameters ? [parameters mutableCopy] : [NSMutableDictionary dictionary];
+        md[@"cursor"] = pageCursor;
+        md[kSTRequestTagKey] = tag;
+        md[kSTRequestPriorityKey] = @(weakIterator.priority);
+
+        [twitter getAPIResource:resource parameters:md successBlock:^(NSDictionary *rateLimits, id response) {
+
+            if([response isKindOfClass:[NSDictionary class]] == NO) {
+                NSString *errorDescription = [NSString stringWithFormat:@"Unexpected response for %@", resource];
+                errorBlock([NSError errorWithDomain:NSStringFromClass([self class]) code:0 userInfo:@{NSLocalizedDescriptionKey : errorDescription}]);
+                return;
+            }
+
+            successBlock([response valueForKey:itemsKey], [response valueForKey:@"next_cursor_str"]);
+        } errorBlock:^(NSError *error) {
+            errorBlock(error);
+        }];
+    }];
+
+    weakIterator = iterator;
+
+    iterator.cancelBlock = ^{
+        [[twitter requestRegistry] cancelRequestsWithTag:tag];
+    };
+
+    return iterator;
+}
+
+#pragma mark Iteration
+
+- (void)startWithPageBlock:(void(^)(NSArray *items, BOOL *stop))pageBlock
+           completionBlock:(void(^)(NSError *error))completionBlock {
+
+    NSParameterAssert(pageBlock);
+
+    [self startWithAsynchronousPageBlock:^(NSArray *items, void (^doneBlock)(BOOL)) {
+        BOOL stop = NO;
+        pageBlock(items, &stop);
+        doneBlock(stop);
+    } completionBlock:completionBlock];
+}
+
+- (void)startWithAsynchronousPageBlock:(void(^)(NSArray *items, void(^doneBlock)(BOOL stop)))pageBlock
+                       completionBlock:(void(^)(NSError *error))completionBlock {
+
+    NSParameterAssert(pageBlock);
+    NSAssert(_pageBlock == nil && _isFinished == NO, @"an iterator can only be started once");
+
+    self.pageBlock = pageBlock;
+    self.completionBlock = completionBlock;
+
+    [self pump];
+}
+
+- (void)cancel {
+    [self finishWithError:nil];
+}
+
+// fetches ahead, hands the next page to the consumer, or ends the iteration
+- (void)pump {
+
+    // the blocks may call back synchronously, loop instead of recursing
+
+    if(_isPumping) {
+        _needsPump = YES;
+        return;
+    }
+
+    _isPumping = YES;
+
+    do {
+        _needsPump = NO;
+
+        if(_isFinished) break;
+
+        [self fetchAheadIfNeeded];
+
+        if(_isConsuming == NO && [_pages count] > 0) {
+            [self deliverNextPage];
+        } else if(_isConsuming == NO && _isFetching == NO && (_hasFetchedLastPage || _error)) {
+            [self finishWithError:_error];
+        }
+
+    } while(_needsPump);
+
+    _isPumping = NO;
+}
+
+- (void)fetchAheadIfNeeded {
+
+    NSUInteger pagesAhead = [_pages count] + (_isConsuming ? 1 : 0);
+
+    if(_isFetching == NO && _hasFetchedLastPage == NO && _error == nil && pagesAhead <= _maxPrefetchedPages) {
+        [self fetchNextPage];
+    }
+}
+
+- (void)fetchNextPage {
+
+    self.isFetching = YES;
+
+    __block BOOL isDone = NO;
+
+    STTwitterCursorPageFetchBlock fetchBlock = _fetchBlock; // the iteration may end before the block returns
+
+    fetchBlock(_fetchCursor, ^(NSArray *items, NSString *nextCursor) {
+        if(isDone || _isFinished) return;
+        isDone = YES;
+
+        STTwitterCursorPage *page = [[STTwitterCursorPage alloc] init];
+        page.items = items ? items : @[];
+        page.nextCursor = nextCursor;
+        [_pages addObject:page];
+
+        self.isFetching = NO;
+        self.fetchCursor = nextCursor;
+        self.hasFetchedLastPage = ([nextCursor length] == 0 || [nextCursor isEqualToString:@"0"]);
+
+        [self pump];
+    }, ^(NSError *error) {
+        if(isDone || _isFinished) return;
+        isDone = YES;
+
+        self.isFetching = NO;
+        self.error = error;
+
+        [self pump];
+    });
+}
+
+- (void)deliverNextPage {
+
+    STTwitterCursorPage *page = _pages[0];
+    [_pages removeObjectAtIndex:0];
+
+    self.isConsuming = YES;
+    self.pageCount += 1;
+    self.itemCount += [page.items count];
+    self.cursor = page.nextCursor;
+
+    // the next page is requested before the consumer gets this one
+    [self fetchAheadIfNeeded];
+
+    __block BOOL isDone = NO;
+
+    void(^pageBlock)(NSArray *, void(^)(BOOL)) = _pageBlock;
+
+    pageBlock(page.items, ^(BOOL stop) {
+
+        dispatch_block_t block = ^{
+            if(isDone || _isFinished) return;
+            isDone = YES;
+
+            self.isConsuming = NO;
+
+            if(stop) {
+                [self finishWithError:nil];
+                return;
+            }
+
+            [self pump];
+        };
+
+        if([NSThread isMainThread]) {
+            block();
+        } else {
+            dispatch_async(dispatch_get_main_queue(), block);
+        }
+    });
+}
+
+- (void)finishWithError:(NSError *)error {
+
+    if(_isFinished) return;
+
+    self.isFinished = YES;
+    [_pages removeAllObjects];
+
+    if(_isFetching && _cancelBlock) _cancelBlock();
+
+    void(^completionBlock)(NSError *) = _completionBlock;
+
+    // the blocks may retain the caller, which retains the iterator
+    self.pageBlock = nil;
+    self.completionBlock = nil;
+    self.fetchBlock = nil;
+    self.cancelBlock = nil;
+
+    if(completionBlock) completionBlock(error);
+}
+
+@end
@@ -0,0 +1,68 @@
+//
+//  STTwitterMediaUpload.h
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class STTwitterAPI;
+
+/*
+ Chunked media upload, POST media/upload with the INIT, APPEND and FINALIZE commands
+ https://dev.twitter.com/rest/public/uploading-media
+
+ The file is sent in segments, several of them in flight at once. A failed segment is retried on its own,
+ with an exponential backoff, instead of restarting the whole upload.
+
+ With a checkpointPath, the media ID and the completed segments are saved after each segment,
+ so that an upload interrupted by a crash or a relaunch can be resumed with +mediaUploadWithTwitter:checkpointPath:
+ The checkpoint is removed once the upload succeeds.
+
+ Use from the main thread. The returned media ID can be attached to a tweet with the media_ids parameter.
+ */
+
+@interface STTwitterMediaUpload : NSObject
+
+// configuration, before -start
+
+@property (nonatomic) NSUInteger segmentSize; // default 1 MB, at most 5 MB
+@property (nonatomic) NSUInteger maxConcurrentSegments; // default 3
+@property (nonatomic) NSUInteger maxRetriesPerSegment; // default 3, network errors, 429 and 5xx only
+@property (nonatomic) NSTimeInterval retryDelay; // default 1 second, doubled for each retry of a segment
+@property (nonatomic, copy) NSString *mediaCategory; // optional, eg. tweet_video
+@property (nonatomic, copy) NSString *checkpointPath; // optional
+
+// state
+
+@property (nonatomic, readonly) NSURL *fileURL;
+@property (nonatomic, readonly) NSString *mediaType;
+@property (nonatomic, readonly) NSString *mediaID; // set after INIT
+@property (nonatomic, readonly) unsigned long long totalBytes;
+@property (nonatomic, readonly) unsigned long long uploadedBytes; // completed segments only
+@property (nonatomic, readonly) BOOL isFinished;
+
+// mediaType is guessed from the file extension when nil
++ (instancetype)mediaUploadWithTwitter:(STTwitterAPI *)twitter
+                               fileURL:(NSURL *)fileURL
+                             mediaType:(NSString *)mediaType;
+
+// nil if the checkpoint cannot be read, if the file was modified since, or if the media ID has expired
++ (instancetype)mediaUploadWithTwitter:(STTwitterAPI *)twitter
+                        checkpointPath:(NSString *)checkpointPath;
+
++ (NSString *)mediaTypeForFileURL:(NSURL *)fileURL;
+
+// tweet_video for videos, tweet_gif for animated GIFs, nil for images, which don't need a category
++ (NSString *)mediaCategoryForMediaType:(NSString *)mediaType;
+
+- (void)startWithProgressBlock:(void(^)(unsigned long long uploadedBytes, unsigned long long totalBytes))progressBlock
+                  successBlock:(void(^)(NSString *mediaID, NSDictionary *response))successBlock
+                    errorBlock:(void(^)(NSError *error))errorBlock;
+
+// cancels the requests in flight, errorBlock receives a cancellation error, the checkpoint is kept
+- (void)cancel;
+
+@end
@@ -0,0 +1,439 @@
+//
+//  STTwitterMediaUpload.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STTwitterMediaUpload.h"
+#import "STTwitterAPI.h"
+#import "STTwitterOAuth.h"
+#import "STTwitterRequestRegistry.h"
+#import "STHTTPRequest.h"
+#import "STHTTPRequest+STTwitter.h"
+
+#if DEBUG
+#   define STLog(...) NSLog(__VA_ARGS__)
+#else
+#   define STLog(...)
+#endif
+
+static NSString *kBaseURLStringUpload = @"https://upload.twitter.com/1.1";
+
+static NSUInteger const kSTMediaUploadMaxSegmentSize = 5 * 1024 * 1024;
+static NSTimeInterval const kSTMediaUploadExpirationMargin = 60.0; // don't resume with a media ID about to expire
+static NSTimeInterval const kSTMediaUploadDefaultExpiration = 24 * 60 * 60; // media IDs last 24 hours when INIT doesn't say
+
+@interface STTwitterMediaUpload ()
+@property (nonatomic, retain) STTwitterAPI *twitter;
+@property (nonatomic, retain) NSURL *fileURL;
+@property (nonatomic, retain) NSString *mediaType;
+@property (nonatomic, retain) NSString *mediaID;
+@property (nonatomic, retain) NSDate *expirationDate;
+@property (nonatomic, retain) NSDate *fileModificationDate;
+@property (nonatomic) unsigned long long totalBytes;
+@property (nonatomic) unsigned long long uploadedBytes;
+@property (nonatomic) BOOL isFinished;
+@property (nonatomic) BOOL isStarted;
+@property (nonatomic) BOOL isStopped; // cancelled or failed
+@property (nonatomic) BOOL isFinalizing;
+@property (nonatomic, retain) NSString *requestTag;
+@property (nonatomic, retain) NSData *fileData; // mapped
+@property (nonatomic) NSUInteger segmentCount;
+@property (nonatomic, retain) NSMutableIndexSet *completedSegments;
+@property (nonatomic, retain) NSMutableIndexSet *pendingSegments;
+@property (nonatomic, retain) NSMutableIndexSet *segmentsInFlight;
+@property (nonatomic, retain) NSMutableDictionary *retryCounts; // segment index -> NSNumber
+@property (nonatomic, copy) void(^progressBlock)(unsigned long long uploadedBytes, unsigned long long totalBytes);
+@property (nonatomic, copy) void(^successBlock)(NSString *mediaID, NSDictionary *response);
+@property (nonatomic, copy) void(^errorBlock)(NSError *error);
+@end
+
+@implementation STTwitterMediaUpload
+
+- (instancetype)init {
+    self = [super init];
+
+    _segmentSize = 1024 * 1024;
+    _maxConcurrentSegments = 3;
+    _maxRetriesPerSegment = 3;
+    _retryDelay = 1.0;
+    _requestTag = [[NSUUID UUID] UUIDString];
+    _completedSegments = [NSMutableIndexSet indexSet];
+    _segmentsInFlight = [NSMutableIndexSet indexSet];
+    _retryCounts = [NSMutableDictionary dictionary];
+
+    return self;
+}
+
++ (instancetype)mediaUploadWithTwitter:(STTwitterAPI *)twitter
+                               fileURL:(NSURL *)fileURL
+                             mediaType:(NSString *)mediaType {
+
+    NSParameterAssert(twitter);
+    NSParameterAssert(fileURL);
+
+    STTwitterMediaUpload *upload = [[self alloc] init];
+    upload.twitter = twitter;
+    upload.fileURL = fileURL;
+    upload.mediaType = mediaType ? mediaType : [self mediaTypeForFileURL:fileURL];
+    return upload;
+}
+
++ (instancetype)mediaUploadWithTwitter:(STTwitterAPI *)twitter
+                        checkpointPath:(NSString *)checkpointPath {
+
+    NSParameterAssert(twitter);
+    NSParameterAssert(checkpointPath);
+
+    NSDictionary *checkpoint = [NSDictionary dictionaryWithContentsOfFile:checkpointPath];
+    if(checkpoint == nil) return nil;
+
+    NSString *path = checkpoint[@"filePath"];
+    NSString *mediaID = checkpoint[@"mediaID"];
+    NSDate *expirationDate = checkpoint[@"expirationDate"];
+    if(path == nil || mediaID == nil || expirationDate == nil) return nil;
+
+    if([expirationDate timeIntervalSinceNow] < kSTMediaUploadExpirationMargin) {
+        STLog(@"-- media %@ has expired", mediaID);
+        return nil;
+    }
+
+    NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:path error:nil];
+    if([attributes fileSize] != [checkpoint[@"fileSize"] unsignedLongLongValue] ||
+       [[attributes fileModificationDate] timeIntervalSinceReferenceDate] != [checkpoint[@"fileModificationTime"] doubleValue]) {
+        STLog(@"-- %@ was modified since the checkpoint", path);
+        return nil;
+    }
+
+    STTwitterMediaUpload *upload = [self mediaUploadWithTwitter:twitter
+                                                        fileURL:[NSURL fileURLWithPath:path]
+                                                      mediaType:checkpoint[@"mediaType"]];
+    upload.mediaCategory = checkpoint[@"mediaCategory"];
+    upload.segmentSize = [checkpoint[@"segmentSize"] unsignedIntegerValue];
+    upload.checkpointPath = checkpointPath;
+    upload.mediaID = mediaID;
+    upload.expirationDate = expirationDate;
+
+    for(NSNumber *n in checkpoint[@"completedSegments"]) {
+        [upload.completedSegments addIndex:[n unsignedIntegerValue]];
+    }
+
+    return upload;
+}
+
++ (NSString *)mediaTypeForFileURL:(NSURL *)fileURL {
+
+    NSDictionary *mediaTypes = @{@"jpg"  : @"image/jpeg",
+                                 @"jpeg" : @"image/jpeg",
+                                 @"png"  : @"image/png",
+                                 @"gif"  : @"image/gif",
+                                 @"webp" : @"image/webp",
+                                 @"mp4"  : @"video/mp4",
+                                 @"m4v"  : @"video/mp4",
+                                 @"mov"  : @"video/quicktime"};
+
+    NSString *mediaType = mediaTypes[[[fileURL pathExtension] lowercaseString]];
+
+    return mediaType ? mediaType : @"application/octet-stream";
+}
+
++ (NSString *)mediaCategoryForMediaType:(NSString *)mediaType {
+    
+    if([mediaType isEqualToString:@"image/gif"]) return @"tweet_gif";
+    if([mediaType hasPrefix:@"video/"]) return @"tweet_video";
+    
+    return nil;
+}
+
+#pragma mark Checkpoint
+
+- (void)writeCheckpoint {
+
+    if(_checkpointPath == nil || _mediaID == nil) return;
+
+    NSMutableArray *completedSegments = [NSMutableArray arrayWithCapacity:[_completedSegments count]];
+    [_completedSegments enumerateIndexesUsingBlock:^(NSUInteger idx, BOOL *stop) {
+        [completedSegments addObject:@(idx)];
+    }];
+
+    NSMutableDictionary *checkpoint = [NSMutableDictionary dictionary];
+    checkpoint[@"filePath"] = [_fileURL path];
+    checkpoint[@"fileSize"] = @(_totalBytes);
+    checkpoint[@"fileModificationTime"] = @([_fileModificationDate timeIntervalSinceReferenceDate]); // XML plist dates have no fractional seconds
+    checkpoint[@"mediaType"] = _mediaType;
+    if(_mediaCategory) checkpoint[@"mediaCategory"] = _mediaCategory;
+    checkpoint[@"mediaID"] = _mediaID;
+    checkpoint[@"expirationDate"] = _expirationDate;
+    checkpoint[@"segmentSize"] = @(_segmentSize);
+    checkpoint[@"completedSegments"] = completedSegments;
+
+    BOOL success = [checkpoint writeToFile:_checkpointPath atomically:YES];
+    if(success == NO) {
+        STLog(@"-- cannot write checkpoint to %@", _checkpointPath);
+    }
+}
+
+- (void)removeCheckpoint {
+    if(_checkpointPath == nil) return;
+    [[NSFileManager defaultManager] removeItemAtPath:_checkpointPath error:nil];
+}
+
+#pragma mark Upload
+
+- (void)startWithProgressBlock:(void(^)(unsigned long long uploadedBytes, unsigned long long totalBytes))progressBlock
+                  successBlock:(void(^)(NSString *mediaID, NSDictionary *response))successBlock
+                    errorBlock:(void(^)(NSError *error))errorBlock {
+
+    NSAssert(_isStarted == NO, @"an upload can only be started once");
+
+    self.isStarted = YES;
+    self.progressBlock = progressBlock;
+    self.successBlock = successBlock;
+    self.errorBlock = errorBlock;
+
+    NSError *readError = nil;
+    self.fileData = [NSData dataWithContentsOfURL:_fileURL options:NSDataReadingMappedIfSafe error:&readError];
+
+    if(_fileData == nil) {
+        NSMutableDictionary *userInfo = [NSMutableDictionary dictionaryWithObject:@"data is nil" forKey:NSLocalizedDescriptionKey];
+        if(readError) userInfo[NSUnderlyingErrorKey] = readError;
+        [self failWithError:[NSError errorWithDomain:NSStringFromClass([self class]) code:0 userInfo:userInfo]];
+        return;
+    }
+
+    NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:[_fileURL path] error:nil];
+    self.fileModificationDate = [attributes fileModificationDate];
+
+    if(_segmentSize == 0) _segmentSize = 1024 * 1024;
+    _segmentSize = MIN(_segmentSize, kSTMediaUploadMaxSegmentSize);
+    if(_maxConcurrentSegments == 0) _maxConcurrentSegments = 1;
+
+    self.totalBytes = [_fileData length];
+    self.segmentCount = (NSUInteger)((_totalBytes + _segmentSize - 1) / _segmentSize);
+
+    self.pendingSegments = [NSMutableIndexSet indexSetWithIndexesInRange:NSMakeRange(0, _segmentCount)];
+    [_pendingSegments removeIndexes:_completedSegments];
+
+    [_completedSegments enumerateIndexesUsingBlock:^(NSUInteger idx, BOOL *stop) {
+        _uploadedBytes += [self rangeOfSegment:idx].length;
+    }];
+
+    if(_mediaID) {
+        [self uploadSegments]; // resumed from a checkpoint
+    } else {
+        [self initUpload];
+    }
+}
+
+- (void)cancel {
+
+    if(_isStarted == NO || _isFinished || _isStopped) return;
+
+    NSError *error = [NSError errorWithDomain:@"STHTTPRequest" code:kSTHTTPRequestCancellationError userInfo:@{NSLocalizedDescriptionKey : @"Upload was cancelled."}];
+
+    [self failWithError:error];
+}
+
+- (void)failWithError:(NSError *)error {
+
+    if(_isStopped) return;
+    self.isStopped = YES;
+
+    [[_twitter requestRegistry] cancelRequestsWithTag:_requestTag]; // other segments in flight, their errors are ignored
+
+    self.fileData = nil;
+
+    if(_errorBlock) _errorBlock(error);
+}
+
+- (NSRange)rangeOfSegment:(NSUInteger)segmentIndex {
+    NSUInteger location = segmentIndex * _segmentSize;
+    return NSMakeRange(location, MIN(_segmentSize, (NSUInteger)_totalBytes - location));
+}
+
+- (BOOL)shouldRetryAfterError:(NSError *)error {
+
+    if([error st_isCancellationError]) return NO;
+
+    NSInteger status = [[[error userInfo] objectForKey:kSTHTTPStatusCodeKey] integerValue];
+
+    return (status == 0 || status == 429 || status >= 500); // network errors and server errors
+}
+
+- (void)postCommandWithParameters:(NSDictionary *)parameters
+                     successBlock:(void(^)(id response))successBlock
+                       errorBlock:(void(^)(NSError *error))errorBlock {
+
+    NSMutableDictionary *md = [parameters mutableCopy];
+    md[kSTRequestTagKey] = _requestTag;
+
+    NSString *HTTPMethod = [parameters[@"command"] isEqualToString:@"STATUS"] ? @"GET" : @"POST";
+
+    [_twitter fetchResource:@"media/upload.json"
+                 HTTPMethod:HTTPMethod
+              baseURLString:kBaseURLStringUpload
+                 parameters:md
+              progressBlock:nil
+               successBlock:^(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, id response) {
+                   if(_isStopped) return;
+                   successBlock(response);
+               } errorBlock:^(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, NSError *error) {
+                   if(_isStopped) return;
+                   errorBlock(error);
+               }];
+}
+
+- (void)initUpload {
+
+    NSMutableDictionary *md = [NSMutableDictionary dictionary];
+    md[@"command"] = @"INIT";
+    md[@"total_bytes"] = [NSString stringWithFormat:@"%llu", _totalBytes];
+    md[@"media_type"] = _mediaType;
+    if(_mediaCategory) md[@"media_category"] = _mediaCategory;
+
+    [self postCommandWithParameters:md successBlock:^(id response) {
+
+        NSString *mediaID = [response isKindOfClass:[NSDictionary class]] ? response[@"media_id_string"] : nil;
+
+        if(mediaID == nil) {
+            NSError *error = [NSError errorWithDomain:NSStringFromClass([self class]) code:0 userInfo:@{NSLocalizedDescriptionKey : @"Cannot find media_id_string in server response"}];
+            [self failWithError:error];
+            return;
+        }
+
+        self.mediaID = mediaID;
+
+        NSNumber *expiresAfter = response[@"expires_after_secs"];
+        NSTimeInterval expiration = expiresAfter ? [expiresAfter doubleValue] : kSTMediaUploadDefaultExpiration;
+        self.expirationDate = [NSDate dateWithTimeIntervalSinceNow:expiration];
+
+        [self writeCheckpoint];
+
+        [self uploadSegments];
+
+    } errorBlock:^(NSError *error) {
+        [self failWithError:error];
+    }];
+}
+
+// fills the window of concurrent segments, requests may complete synchronously and call back into this method
+- (void)uploadSegments {
+
+    while(_isStopped == NO && _isFinished == NO && [_segmentsInFlight count] < _maxConcurrentSegments && [_pendingSegments count] > 0) {
+
+        NSUInteger segmentIndex = [_pendingSegments firstIndex];
+        [_pendingSegments removeIndex:segmentIndex];
+        [_segmentsInFlight addIndex:segmentIndex];
+
+        [self appendSegment:segmentIndex];
+    }
+
+    if(_isStopped == NO && [_completedSegments count] == _segmentCount) {
+        [self finalizeUpload];
+    }
+}
+
+- (void)appendSegment:(NSUInteger)segmentIndex {
+
+    NSRange range = [self rangeOfSegment:segmentIndex];
+
+    NSMutableDictionary *md = [NSMutableDictionary dictionary];
+    md[@"command"] = @"APPEND";
+    md[@"media_id"] = _mediaID;
+    md[@"segment_index"] = [NSString stringWithFormat:@"%lu", (unsigned long)segmentIndex];
+    md[@"media"] = [_fileData subdataWithRange:range];
+    md[kSTPOSTDataKey] = @"media";
+
+    [self postCommandWithParameters:md successBlock:^(id response) {
+
+        [_segmentsInFlight removeIndex:segmentIndex];
+        [_completedSegments addIndex:segmentIndex];
+        self.uploadedBytes += range.length;
+
+        [self writeCheckpoint];
+
+        if(_progressBlock) _progressBlock(_uploadedBytes, _totalBytes);
+
+        [self uploadSegments];
+
+    } errorBlock:^(NSError *error) {
+
+        [_segmentsInFlight removeIndex:segmentIndex];
+
+        NSUInteger retryCount = [_retryCounts[@(segmentIndex)] unsignedIntegerValue];
+
+        if(retryCount >= _maxRetriesPerSegment || [self shouldRetryAfterError:error] == NO) {
+            [self failWithError:error];
+            return;
+        }
+
+        _retryCounts[@(segmentIndex)] = @(retryCount + 1);
+
+        NSTimeInterval delay = _retryDelay * pow(2, retryCount);
+
+        STLog(@"-- segment %lu failed, retry in %.1f seconds: %@", (unsigned long)segmentIndex, delay, [error localizedDescription]);
+
+        // the slot is free during the backoff, other segments go on
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+            [_pendingSegments addIndex:segmentIndex];
+            [self uploadSegments];
+        });
+
+        [self uploadSegments];
+    }];
+}
+
+- (void)finalizeUpload {
+
+    if(_isFinalizing) return;
+    self.isFinalizing = YES;
+
+    self.fileData = nil;
+
+    [self postCommandWithParameters:@{@"command":@"FINALIZE", @"media_id":_mediaID} successBlock:^(id response) {
+        [self processResponse:response];
+    } errorBlock:^(NSError *error) {
+        [self failWithError:error];
+    }];
+}
+
+// videos are processed asynchronously after FINALIZE, poll STATUS until processing_info is gone or final
+- (void)processResponse:(NSDictionary *)response {
+
+    NSDictionary *processingInfo = [response isKindOfClass:[NSDictionary class]] ? response[@"processing_info"] : nil;
+    NSString *state = processingInfo[@"state"];
+
+    if([state isEqualToString:@"failed"]) {
+        NSString *message = [processingInfo valueForKeyPath:@"error.message"];
+        NSInteger code = [[processingInfo valueForKeyPath:@"error.code"] integerValue];
+        NSError *error = [NSError errorWithDomain:NSStringFromClass([self class]) code:code userInfo:@{NSLocalizedDescriptionKey : message ? message : @"Media processing failed"}];
+        [self removeCheckpoint]; // the media ID cannot be used anymore
+        [self failWithError:error];
+        return;
+    }
+
+    if([state isEqualToString:@"pending"] || [state isEqualToString:@"in_progress"]) {
+
+        NSTimeInterval delay = MAX([processingInfo[@"check_after_secs"] doubleValue], 1.0);
+
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+            if(_isStopped) return;
+            [self postCommandWithParameters:@{@"command":@"STATUS", @"media_id":_mediaID} successBlock:^(id response) {
+                [self processResponse:response];
+            } errorBlock:^(NSError *error) {
+                [self failWithError:error];
+            }];
+        });
+        return;
+    }
+
+    self.isFinished = YES;
+
+    [self removeCheckpoint];
+
+    if(_successBlock) _successBlock(_mediaID, response);
+}
+
+@end
@@ -10,6 +10,7 @@
 #import "STHTTPRequest.h"
 #import "NSString+STTwitter.h"
 #import "STHTTPRequest+STTwitter.h"
+#import "STTwitterRequestRegistry.h"
 
 #include <CommonCrypto/CommonHMAC.h>
 
@@ -43,10 +44,21 @@ NSString * const kSTPOSTDataKey = @"kSTPOSTDataKey";
 @property (nonatomic, retain) NSString *testOauthNonce;
 @property (nonatomic, retain) NSString *testOauthTimestamp;
 
+@property (nonatomic, retain) STTwitterRequestRegistry *requestRegistry; // live requests, by requestID
+@property (nonatomic, retain) id <STHTTPRequestCache> responseCache;
+
 @end
 
 @implementation STTwitterOAuth
 
+- (id)init {
+    self = [super init];
+    
+    self.requestRegistry = [[STTwitterRequestRegistry alloc] init];
+    
+    return self;
+}
+
 + (instancetype)twitterOAuthWithConsumerName:(NSString *)consumerName
                                  consumerKey:(NSString *)consumerKey
                               consumerSecret:(NSString *)consumerSecret {
@@ -420,6 +432,9 @@ NSString * const kSTPOSTDataKey = @"kSTPOSTDataKey";
              successBlock:(void (^)(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, id json))successBlock
                errorBlock:(void (^)(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, NSError *error))errorBlock {
         
+    NSDictionary *requestOptions = [STHTTPRequest twitterRequestOptionsFromParameters:params];
+    params = [STHTTPRequest twitterParametersByRemovingRequestOptions:params];
+    
     NSMutableString *urlString = [NSMutableString stringWithFormat:@"%@/%@", baseURLString, resource];
     
     NSMutableArray *parameters = [NSMutableArray array];
@@ -438,17 +453,23 @@ NSString * const kSTPOSTDataKey = @"kSTPOSTDataKey";
     __block NSString *requestID = [[NSUUID UUID] UUIDString];
     
     __block STHTTPRequest *r = [STHTTPRequest twitterRequestWithURLString:urlString
-                                                   stTwitterProgressBlock:^(id json) {
-                                                       if(progressBlock) progressBlock(requestID, json);
-                                                   } stTwitterSuccessBlock:^(NSDictionary *requestHeaders, NSDictionary *responseHeaders, id json) {
+                                                           requestOptions:requestOptions
+                                                   stTwitterProgressBlock:progressBlock ? ^(id json) {
+                                                       progressBlock(requestID, json);
+                                                   } : nil
+                                                    stTwitterSuccessBlock:^(NSDictionary *requestHeaders, NSDictionary *responseHeaders, id json) {
                                                        successBlock(requestID, requestHeaders, responseHeaders, json);
                                                    } stTwitterErrorBlock:^(NSDictionary *requestHeaders, NSDictionary *responseHeaders, NSError *error) {
                                                        errorBlock(requestID, requestHeaders, responseHeaders, error);
                                                    }];
     
-    [self signRequest:r];
+    r.responseCache = _responseCache;
+    
+    // signed once the request is done waiting for the budget, so that oauth_timestamp is current
     
-    [r startAsynchronous];
+    [_requestRegistry startRequest:r withID:requestID requestOptions:requestOptions prepareBlock:^{
+        [self signRequest:r];
+    }];
     
     return requestID;
 }
@@ -489,6 +510,10 @@ NSString * const kSTPOSTDataKey = @"kSTPOSTDataKey";
     }
 }
 
+- (void)cancelRequestWithID:(NSString *)requestID {
+    [_requestRegistry cancelRequestWithID:requestID];
+}
+
 - (NSString *)postResource:(NSString *)resource
              baseURLString:(NSString *)baseURLString // no trailing slash
                 parameters:(NSDictionary *)params
@@ -497,14 +522,19 @@ NSString * const kSTPOSTDataKey = @"kSTPOSTDataKey";
               successBlock:(void(^)(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, id response))successBlock
                 errorBlock:(void(^)(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, NSError *error))errorBlock {
     
+    NSDictionary *requestOptions = [STHTTPRequest twitterRequestOptionsFromParameters:params];
+    params = [STHTTPRequest twitterParametersByRemovingRequestOptions:params];
+    
     NSString *urlString = [NSString stringWithFormat:@"%@/%@", baseURLString, resource];
     
     NSString *requestID = [[NSUUID UUID] UUIDString];
     
     __block STHTTPRequest *r = [STHTTPRequest twitterRequestWithURLString:urlString
-                                                   stTwitterProgressBlock:^(id json) {
-                                                       if(progressBlock) progressBlock(requestID, json);
-                                                   } stTwitterSuccessBlock:^(NSDictionary *requestHeaders, NSDictionary *responseHeaders, id json) {
+                                                           requestOptions:requestOptions
+                                                   stTwitterProgressBlock:progressBlock ? ^(id json) {
+                                                       progressBlock(requestID, json);
+                                                   } : nil
+                                                    stTwitterSuccessBlock:^(NSDictionary *requestHeaders, NSDictionary *responseHeaders, id json) {
                                                        successBlock(requestID, requestHeaders, responseHeaders, json);
                                                    } stTwitterErrorBlock:^(NSDictionary *requestHeaders, NSDictionary *responseHeaders, NSError *error) {
                                                        errorBlock(requestID, requestHeaders, responseHeaders, error);
@@ -524,14 +554,16 @@ NSString * const kSTPOSTDataKey = @"kSTPOSTDataKey";
         [r addDataToUpload:postData parameterName:postKey mimeType:@"application/octet-stream" fileName:@"media.jpg"];
     }
     
-    [self signRequest:r isMediaUpload:(postData != nil) oauthCallback:oauthCallback];
-    
     // POST parameters must not be encoded while posting media, or spaces will appear as %20 in the status
     r.encodePOSTDictionary = (postData == nil);
     
     r.POSTDictionary = mutableParams ? mutableParams : @{};
     
-    [r startAsynchronous];
+    // signed once the request is done waiting for the budget, so that oauth_timestamp is current
+    
+    [_requestRegistry startRequest:r withID:requestID requestOptions:requestOptions prepareBlock:^{
+        [self signRequest:r isMediaUpload:(postData != nil) oauthCallback:oauthCallback];
+    }];
     
     return requestID;
 }
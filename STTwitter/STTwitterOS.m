@@ -8,6 +8,9 @@
 
 #import "STTwitterOS.h"
 #import "NSString+STTwitter.h"
+#import "STHTTPRequest+STTwitter.h"
+#import "STTwitterRequestRegistry.h"
+#import "STTwitterOAuth.h" // kSTPOSTDataKey
 #import <Social/Social.h>
 #import <Accounts/Accounts.h>
 #if TARGET_OS_IPHONE
@@ -17,6 +20,7 @@
 @interface STTwitterOS ()
 @property (nonatomic, retain) ACAccountStore *accountStore; // the ACAccountStore must be kept alive for as long as we need an ACAccount instance, see WWDC 2011 Session 124 for more info
 @property (nonatomic, retain) ACAccount *account; // if nil, will be set to first account available
+@property (nonatomic, retain) STTwitterRequestRegistry *requestRegistry; // live requests, by requestID
 @end
 
 @implementation STTwitterOS
@@ -25,6 +29,7 @@
     self = [super init];
     
     self.accountStore = [[ACAccountStore alloc] init];
+    self.requestRegistry = [[STTwitterRequestRegistry alloc] init];
     
     return self;
 }
@@ -32,6 +37,7 @@
 - (instancetype)initWithAccount:(ACAccount *) account {
     self = [super init];
     self.accountStore = [[ACAccountStore alloc] init];
+    self.requestRegistry = [[STTwitterRequestRegistry alloc] init];
     self.account = account;
     return self;
 }
@@ -155,10 +161,16 @@
                completionBlock:(void (^)(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, id response))completionBlock
                     errorBlock:(void (^)(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, NSError *error))errorBlock {
     
-    NSData *mediaData = [params valueForKey:@"media[]"];
+    NSString *mediaKey = [params valueForKey:kSTPOSTDataKey];
+    if(mediaKey == nil) mediaKey = @"media[]"; // statuses/update_with_media
+    NSData *mediaData = [params valueForKey:mediaKey];
+    
+    NSDictionary *requestOptions = [STHTTPRequest twitterRequestOptionsFromParameters:params];
+    params = [STHTTPRequest twitterParametersByRemovingRequestOptions:params]; // streams are not parsed with SLRequest
     
     NSMutableDictionary *paramsWithoutMedia = [params mutableCopy];
-    [paramsWithoutMedia removeObjectForKey:@"media[]"];
+    [paramsWithoutMedia removeObjectForKey:kSTPOSTDataKey];
+    [paramsWithoutMedia removeObjectForKey:mediaKey];
     
     NSString *urlString = [baseURLString stringByAppendingString:resource];
     NSURL *url = [NSURL URLWithString:urlString];
@@ -177,97 +189,140 @@
     [request setAccount:self.account];
     
     if(mediaData) {
-        [request addMultipartData:mediaData withName:@"media[]" type:@"application/octet-stream" filename:@"media.jpg"];
+        [request addMultipartData:mediaData withName:mediaKey type:@"application/octet-stream" filename:@"media.jpg"];
     }
     
-    [request performRequestWithHandler:^(NSData *responseData, NSHTTPURLResponse *urlResponse, NSError *error) {
-
-        NSString *rawResponse = [[NSString alloc] initWithData:responseData encoding:NSUTF8StringEncoding];
+    // SLRequest cannot be cancelled, a cancelled request ends right away and its response is ignored
+    
+    STTwitterRequestRegistry *requestRegistry = _requestRegistry;
+    __block BOOL isDone = NO; // main queue
+    
+    void(^requestCompletionBlock)(NSString *, NSDictionary *, NSDictionary *, id) = ^(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, id response) {
+        if(isDone) return;
+        isDone = YES;
+        [requestRegistry requestDidFinishWithID:requestID];
+        completionBlock(requestID, requestHeaders, responseHeaders, response);
+    };
+    
+    void(^requestErrorBlock)(NSString *, NSDictionary *, NSDictionary *, NSError *) = ^(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, NSError *error) {
+        if(isDone) return;
+        isDone = YES;
+        [requestRegistry requestDidFinishWithID:requestID];
+        errorBlock(requestID, requestHeaders, responseHeaders, error);
+    };
+    
+    STTwitterRequestPriority priority = [requestOptions[kSTRequestPriorityKey] unsignedIntegerValue];
+    
+    __block dispatch_block_t pendingFinishBlock = nil;
+    
+    [requestRegistry registerRequestWithID:requestID tag:requestOptions[kSTRequestTagKey] cancelBlock:^{
+        dispatch_async(dispatch_get_main_queue(), ^{
+            if(pendingFinishBlock) pendingFinishBlock(); // leaves the scheduler queue if still pending
+            NSError *error = [NSError errorWithDomain:@"STHTTPRequest" code:kSTHTTPRequestCancellationError userInfo:@{NSLocalizedDescriptionKey : @"Connection was cancelled."}];
+            requestErrorBlock(requestID, [self requestHeadersForRequest:request], nil, error);
+        });
+    }];
+    
+    pendingFinishBlock = [[STTwitterRequestScheduler sharedScheduler] scheduleRequestForHost:[url host] priority:priority startBlock:^(dispatch_block_t finishBlock) {
         
-        if(responseData == nil) {
-            [[NSOperationQueue mainQueue] addOperationWithBlock:^{
-                errorBlock(requestID, [self requestHeadersForRequest:request], [urlResponse allHeaderFields], error);
-            }];
+        if(isDone) {
+            finishBlock();
             return;
         }
         
-        NSError *jsonError = nil;
-        NSJSONSerialization *json = [NSJSONSerialization JSONObjectWithData:responseData options:NSJSONReadingMutableLeaves error:&jsonError];
+        [requestRegistry requestDidStartWithID:requestID];
         
-        if(json == nil) {
+        [request performRequestWithHandler:^(NSData *responseData, NSHTTPURLResponse *urlResponse, NSError *error) {
             
-            // do our best to extract Twitter error message from responseString
+            finishBlock();
             
-            NSError *regexError = nil;
-            NSString *errorString = [rawResponse firstMatchWithRegex:@"<error.*?>(.*)</error>" error:&regexError];
+            NSString *rawResponse = [[NSString alloc] initWithData:responseData encoding:NSUTF8StringEncoding];
             
-            if(errorString) {
-                error = [NSError errorWithDomain:NSStringFromClass([self class]) code:0 userInfo:@{NSLocalizedDescriptionKey : errorString}];
+            if(responseData == nil) {
                 [[NSOperationQueue mainQueue] addOperationWithBlock:^{
-                    errorBlock(requestID, [self requestHeadersForRequest:request], [urlResponse allHeaderFields], error);
+                    requestErrorBlock(requestID, [self requestHeadersForRequest:request], [urlResponse allHeaderFields], error);
                 }];
                 return;
             }
             
-            [[NSOperationQueue mainQueue] addOperationWithBlock:^{
-                completionBlock(requestID, [self requestHeadersForRequest:request], [urlResponse allHeaderFields], rawResponse);
-            }];
-            return;
-        }
-        
-        /**/
-        
-        if([json isKindOfClass:[NSArray class]] == NO && [json valueForKey:@"error"]) {
+            NSError *jsonError = nil;
+            NSJSONSerialization *json = [NSJSONSerialization JSONObjectWithData:responseData options:NSJSONReadingMutableLeaves error:&jsonError];
             
-            NSString *message = [json valueForKey:@"error"];
-            NSDictionary *userInfo = [NSDictionary dictionaryWithObject:message forKey:NSLocalizedDescriptionKey];
-            NSError *jsonErrorFromResponse = [NSError errorWithDomain:NSStringFromClass([self class]) code:0 userInfo:userInfo];
+            if(json == nil) {
+                
+                // do our best to extract Twitter error message from responseString
+                
+                NSError *regexError = nil;
+                NSString *errorString = [rawResponse firstMatchWithRegex:@"<error.*?>(.*)</error>" error:&regexError];
+                
+                if(errorString) {
+                    error = [NSError errorWithDomain:NSStringFromClass([self class]) code:0 userInfo:@{NSLocalizedDescriptionKey : errorString}];
+                    [[NSOperationQueue mainQueue] addOperationWithBlock:^{
+                        requestErrorBlock(requestID, [self requestHeadersForRequest:request], [urlResponse allHeaderFields], error);
+                    }];
+                    return;
+                }
+                
+                [[NSOperationQueue mainQueue] addOperationWithBlock:^{
+                    requestCompletionBlock(requestID, [self requestHeadersForRequest:request], [urlResponse allHeaderFields], rawResponse);
+                }];
+                return;
+            }
             
-            [[NSOperationQueue mainQueue] addOperationWithBlock:^{
-                    errorBlock(requestID, [self requestHeadersForRequest:request], [urlResponse allHeaderFields], jsonErrorFromResponse);
-            }];
+            /**/
             
-            return;
-        }
-        
-        /**/
-        
-        id jsonErrors = [json valueForKey:@"errors"];
-        
-        if(jsonErrors != nil && [jsonErrors isKindOfClass:[NSArray class]] == NO) {
-            if(jsonErrors == nil) jsonErrors = @"";
-            jsonErrors = [NSArray arrayWithObject:@{@"message":jsonErrors, @"code" : @(0)}];
-        }
-        
-        if([jsonErrors count] > 0 && [jsonErrors lastObject] != [NSNull null]) {
+            if([json isKindOfClass:[NSArray class]] == NO && [json valueForKey:@"error"]) {
+                
+                NSString *message = [json valueForKey:@"error"];
+                NSDictionary *userInfo = [NSDictionary dictionaryWithObject:message forKey:NSLocalizedDescriptionKey];
+                NSError *jsonErrorFromResponse = [NSError errorWithDomain:NSStringFromClass([self class]) code:0 userInfo:userInfo];
+                
+                [[NSOperationQueue mainQueue] addOperationWithBlock:^{
+                        requestErrorBlock(requestID, [self requestHeadersForRequest:request], [urlResponse allHeaderFields], jsonErrorFromResponse);
+                }];
+                
+                return;
+            }
             
-            NSDictionary *jsonErrorDictionary = [jsonErrors lastObject];
-            NSString *message = jsonErrorDictionary[@"message"];
-            NSInteger code = [jsonErrorDictionary[@"code"] intValue];
-            NSDictionary *userInfo = [NSDictionary dictionaryWithObject:message forKey:NSLocalizedDescriptionKey];
-            NSError *jsonErrorFromResponse = [NSError errorWithDomain:NSStringFromClass([self class]) code:code userInfo:userInfo];
+            /**/
             
-            [[NSOperationQueue mainQueue] addOperationWithBlock:^{
-                errorBlock(requestID, [self requestHeadersForRequest:request], [urlResponse allHeaderFields], jsonErrorFromResponse);
-            }];
+            id jsonErrors = [json valueForKey:@"errors"];
             
-            return;
-        }
-        
-        /**/
-        
-        if(json) {
+            if(jsonErrors != nil && [jsonErrors isKindOfClass:[NSArray class]] == NO) {
+                if(jsonErrors == nil) jsonErrors = @"";
+                jsonErrors = [NSArray arrayWithObject:@{@"message":jsonErrors, @"code" : @(0)}];
+            }
             
-            [[NSOperationQueue mainQueue] addOperationWithBlock:^{
-                completionBlock(requestID, [self requestHeadersForRequest:request], [urlResponse allHeaderFields], (NSArray *)json);
-            }];
+            if([jsonErrors count] > 0 && [jsonErrors lastObject] != [NSNull null]) {
+                
+                NSDictionary *jsonErrorDictionary = [jsonErrors lastObject];
+                NSString *message = jsonErrorDictionary[@"message"];
+                NSInteger code = [jsonErrorDictionary[@"code"] intValue];
+                NSDictionary *userInfo = [NSDictionary dictionaryWithObject:message forKey:NSLocalizedDescriptionKey];
+                NSError *jsonErrorFromResponse = [NSError errorWithDomain:NSStringFromClass([self class]) code:code userInfo:userInfo];
+                
+                [[NSOperationQueue mainQueue] addOperationWithBlock:^{
+                    requestErrorBlock(requestID, [self requestHeadersForRequest:request], [urlResponse allHeaderFields], jsonErrorFromResponse);
+                }];
+                
+                return;
+            }
             
-        } else {
+            /**/
             
-            [[NSOperationQueue mainQueue] addOperationWithBlock:^{
-                errorBlock(requestID, [self requestHeadersForRequest:request], [urlResponse allHeaderFields], jsonError);
-            }];
-        }
+            if(json) {
+                
+                [[NSOperationQueue mainQueue] addOperationWithBlock:^{
+                    requestCompletionBlock(requestID, [self requestHeadersForRequest:request], [urlResponse allHeaderFields], (NSArray *)json);
+                }];
+                
+            } else {
+                
+                [[NSOperationQueue mainQueue] addOperationWithBlock:^{
+                    requestErrorBlock(requestID, [self requestHeadersForRequest:request], [urlResponse allHeaderFields], jsonError);
+                }];
+            }
+        }];
     }];
     
     return requestID;
@@ -305,6 +360,10 @@
                        errorBlock:errorBlock];
 }
 
+- (void)cancelRequestWithID:(NSString *)requestID {
+    [_requestRegistry cancelRequestWithID:requestID];
+}
+
 + (NSDictionary *)parametersDictionaryFromCommaSeparatedParametersString:(NSString *)s {
     
     NSArray *parameters = [s componentsSeparatedByString:@", "];
@@ -8,6 +8,9 @@
 
 #import <Foundation/Foundation.h>
 
+@class STTwitterRequestRegistry;
+@protocol STHTTPRequestCache;
+
 @protocol STTwitterProtocol <NSObject>
 
 - (BOOL)canVerifyCredentials;
@@ -27,6 +30,15 @@
 
 @optional
 
+// the errorBlock of the request is called with a cancellation error
+- (void)cancelRequestWithID:(NSString *)requestID;
+
+// live requests, to cancel them by tag, query their state or wait for them
+- (STTwitterRequestRegistry *)requestRegistry;
+
+// cache for GET responses, implemented by the backends built on STHTTPRequest
+- (void)setResponseCache:(id <STHTTPRequestCache>)responseCache;
+
 - (void)postTokenRequest:(void(^)(NSURL *url, NSString *oauthToken))successBlock
            oauthCallback:(NSString *)oauthCallback
               errorBlock:(void(^)(NSError *error))errorBlock;
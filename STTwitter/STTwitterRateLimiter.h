@@ -0,0 +1,54 @@
+//
+//  STTwitterRateLimiter.h
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "STTwitterRequestScheduler.h"
+
+/*
+ Keeps the requests of an account within the rate limits of each resource
+ https://dev.twitter.com/docs/rate-limiting/1.1
+
+ The budget of a resource is read from the x-rate-limit-limit, x-rate-limit-remaining and x-rate-limit-reset headers
+ of its responses, or seeded from GET application/rate_limit_status. Resources without a known budget are not limited.
+
+ The remaining requests are spread evenly until the reset of the window, with bursts of at most burstSize requests,
+ so that a long crawl runs at the allowed rate instead of exhausting the window and waiting for its reset.
+ Waiting requests start by priority, and in FIFO order within a priority.
+
+ Rate limits are per account, use one limiter per account. Streaming requests are not limited.
+ */
+
+@interface STTwitterRateLimiter : NSObject
+
+@property (nonatomic) NSUInteger burstSize; // default 5
+
+// statistics
+@property (nonatomic, readonly) NSUInteger delayedCount; // requests that had to wait for the budget
+@property (nonatomic, readonly) NSUInteger waitingCount;
+
+// eg. statuses/show for https://api.twitter.com/1.1/statuses/show/123.json
++ (NSString *)resourceForURL:(NSURL *)url;
+
+// startBlock is called once the budget of the resource allows it, possibly right away on the calling thread, else on the main thread
+// the request is then counted as in flight until -requestDidFinishForURL:statusCode:responseHeaders:
+- (void)scheduleRequestForURL:(NSURL *)url
+                     priority:(STTwitterRequestPriority)priority
+                   startBlock:(dispatch_block_t)startBlock;
+
+// responseHeaders may be nil, eg. after a network error
+- (void)requestDidFinishForURL:(NSURL *)url
+                    statusCode:(NSInteger)statusCode
+               responseHeaders:(NSDictionary *)responseHeaders;
+
+// response of GET application/rate_limit_status, -[STTwitterAPI getRateLimitsForResources:...] calls it
+- (void)updateWithRateLimitStatus:(NSDictionary *)rateLimitStatus;
+
+// keys limit, remaining and reset (NSDate), nil if the budget of the resource is unknown, resource as passed to the API
+- (NSDictionary *)rateLimitForResource:(NSString *)resource;
+
+@end
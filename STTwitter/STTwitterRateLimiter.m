@@ -0,0 +1,294 @@
+//
+//  STTwitterRateLimiter.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STTwitterRateLimiter.h"
+
+static NSTimeInterval const kSTTwitterRateLimitWindow = 15 * 60.0;
+static NSTimeInterval const kSTTwitterRateLimitResetMargin = 1.0; // clocks are not exactly in sync
+static NSTimeInterval const kSTTwitterRateLimitDefaultRetryDelay = 60.0; // 429 without rate limit headers
+static NSInteger const kSTTwitterRateLimitMinimumLimit = 15; // lowest limit of a resource, assumed for a 429 without headers
+
+@interface STTwitterRateLimitBudget : NSObject
+@property (nonatomic) NSInteger limit; // -1 while unknown
+@property (nonatomic) NSInteger remaining;
+@property (nonatomic) NSTimeInterval resetTime; // since 1970
+@property (nonatomic) NSUInteger inFlightCount;
+@property (nonatomic) double tokens;
+@property (nonatomic) NSTimeInterval lastRefillTime;
+@property (nonatomic) NSUInteger pumpGeneration; // invalidates the pumps scheduled before
+@property (nonatomic, retain) NSMutableArray *waitingRequests;
+@end
+
+@implementation STTwitterRateLimitBudget
+@end
+
+@interface STTwitterRateLimitedRequest : NSObject
+@property (nonatomic) STTwitterRequestPriority priority;
+@property (nonatomic, copy) dispatch_block_t startBlock;
+@end
+
+@implementation STTwitterRateLimitedRequest
+@end
+
+@interface STTwitterRateLimiter ()
+@property (nonatomic, retain) NSMutableDictionary *budgetsByResource;
+@property (nonatomic, readwrite) NSUInteger delayedCount;
+@end
+
+@implementation STTwitterRateLimiter
+
+- (id)init {
+    self = [super init];
+    self.burstSize = 5;
+    self.budgetsByResource = [NSMutableDictionary dictionary];
+    return self;
+}
+
+- (NSUInteger)waitingCount {
+    NSUInteger count = 0;
+    @synchronized(self) {
+        for(STTwitterRateLimitBudget *b in [_budgetsByResource allValues]) {
+            count += [b.waitingRequests count];
+        }
+    }
+    return count;
+}
+
+#pragma mark Resources
+
+// 1.1/statuses/show/123.json and /statuses/show/:id both become statuses/show
++ (NSString *)resourceForPath:(NSString *)path {
+
+    NSMutableArray *components = [NSMutableArray array];
+
+    NSCharacterSet *nonDigits = [[NSCharacterSet decimalDigitCharacterSet] invertedSet];
+
+    for(NSString *c in [path componentsSeparatedByString:@"/"]) {
+        NSString *s = [c hasSuffix:@".json"] ? [c stringByDeletingPathExtension] : c;
+        if([s length] == 0) continue;
+        if([s isEqualToString:@"1.1"] && [components count] == 0) continue;
+        if([s hasPrefix:@":"]) continue;
+        if([s rangeOfCharacterFromSet:nonDigits].location == NSNotFound) continue;
+        [components addObject:s];
+    }
+
+    return [components componentsJoinedByString:@"/"];
+}
+
++ (NSString *)resourceForURL:(NSURL *)url {
+    return [self resourceForPath:[url path]];
+}
+
+- (STTwitterRateLimitBudget *)budgetForResource:(NSString *)resource {
+    STTwitterRateLimitBudget *b = _budgetsByResource[resource];
+    if(b == nil) {
+        b = [[STTwitterRateLimitBudget alloc] init];
+        b.limit = -1;
+        b.waitingRequests = [NSMutableArray array];
+        _budgetsByResource[resource] = b;
+    }
+    return b;
+}
+
+#pragma mark Budget
+
+// 0 if a request can start now, else the time to wait, called with the lock held
+- (NSTimeInterval)delayForBudget:(STTwitterRateLimitBudget *)b now:(NSTimeInterval)now {
+
+    if(b.limit < 0) return 0.0;
+
+    if(now >= b.resetTime) { // new window, until a response tells its actual reset time
+        b.remaining = b.limit;
+        b.resetTime = now + kSTTwitterRateLimitWindow;
+    }
+
+    NSInteger available = b.remaining - (NSInteger)b.inFlightCount;
+    if(available <= 0) return b.resetTime - now + kSTTwitterRateLimitResetMargin;
+
+    // token bucket, refilled so that the available requests last until the reset
+
+    double rate = available / MAX(1.0, b.resetTime - now);
+    b.tokens = MIN((double)MAX(_burstSize, 1), b.tokens + rate * (now - b.lastRefillTime));
+    b.lastRefillTime = now;
+
+    if(b.tokens >= 1.0) return 0.0;
+
+    return (1.0 - b.tokens) / rate;
+}
+
+- (void)startRequestWithBudget:(STTwitterRateLimitBudget *)b {
+    b.inFlightCount++;
+    if(b.limit >= 0) b.tokens -= 1.0;
+}
+
+- (void)setLimit:(NSInteger)limit remaining:(NSInteger)remaining resetTime:(NSTimeInterval)resetTime forBudget:(STTwitterRateLimitBudget *)b now:(NSTimeInterval)now {
+
+    if(b.limit < 0) {
+        b.tokens = MAX(_burstSize, 1);
+        b.lastRefillTime = now;
+    } else if(resetTime < b.resetTime) {
+        return; // response from an older window
+    } else if(resetTime == b.resetTime) {
+        remaining = MIN(remaining, b.remaining); // responses may arrive out of order
+    }
+
+    b.limit = limit;
+    b.remaining = remaining;
+    b.resetTime = resetTime;
+}
+
+#pragma mark Scheduling
+
+- (void)scheduleRequestForURL:(NSURL *)url
+                     priority:(STTwitterRequestPriority)priority
+                   startBlock:(dispatch_block_t)startBlock {
+
+    NSParameterAssert(startBlock);
+
+    NSString *resource = [[self class] resourceForURL:url];
+
+    @synchronized(self) {
+        STTwitterRateLimitBudget *b = [self budgetForResource:resource];
+
+        NSTimeInterval delay = [b.waitingRequests count] ? 1.0 : [self delayForBudget:b now:[[NSDate date] timeIntervalSince1970]];
+
+        if(delay > 0) {
+            STTwitterRateLimitedRequest *rr = [[STTwitterRateLimitedRequest alloc] init];
+            rr.priority = priority;
+            rr.startBlock = startBlock;
+
+            NSUInteger i = [b.waitingRequests indexOfObjectPassingTest:^BOOL(STTwitterRateLimitedRequest *obj, NSUInteger idx, BOOL *stop) {
+                return obj.priority > priority;
+            }];
+            [b.waitingRequests insertObject:rr atIndex:(i == NSNotFound) ? [b.waitingRequests count] : i];
+
+            _delayedCount++;
+
+            if([b.waitingRequests count] == 1) [self schedulePumpForResource:resource budget:b delay:delay];
+            return;
+        }
+
+        [self startRequestWithBudget:b];
+    }
+
+    startBlock();
+}
+
+- (void)schedulePumpForResource:(NSString *)resource budget:(STTwitterRateLimitBudget *)b delay:(NSTimeInterval)delay {
+
+    NSUInteger generation = ++b.pumpGeneration;
+
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+        [self pumpResource:resource generation:generation];
+    });
+}
+
+- (void)pumpResource:(NSString *)resource generation:(NSUInteger)generation {
+
+    NSMutableArray *startBlocks = [NSMutableArray array];
+
+    @synchronized(self) {
+        STTwitterRateLimitBudget *b = _budgetsByResource[resource];
+        if(b.pumpGeneration != generation) return;
+
+        NSTimeInterval delay = 0.0;
+
+        while([b.waitingRequests count]) {
+            delay = [self delayForBudget:b now:[[NSDate date] timeIntervalSince1970]];
+            if(delay > 0) break;
+
+            STTwitterRateLimitedRequest *rr = b.waitingRequests[0];
+            [b.waitingRequests removeObjectAtIndex:0];
+            [self startRequestWithBudget:b];
+            [startBlocks addObject:rr.startBlock];
+        }
+
+        if([b.waitingRequests count]) [self schedulePumpForResource:resource budget:b delay:delay];
+    }
+
+    for(dispatch_block_t startBlock in startBlocks) {
+        startBlock();
+    }
+}
+
+#pragma mark Updates
+
+static NSString *STRateLimitHeaderValue(NSDictionary *headers, NSString *key) {
+    for(NSString *k in headers) {
+        if([k caseInsensitiveCompare:key] == NSOrderedSame) return headers[k];
+    }
+    return nil;
+}
+
+- (void)requestDidFinishForURL:(NSURL *)url
+                    statusCode:(NSInteger)statusCode
+               responseHeaders:(NSDictionary *)responseHeaders {
+
+    NSString *resource = [[self class] resourceForURL:url];
+
+    NSString *limit = STRateLimitHeaderValue(responseHeaders, @"x-rate-limit-limit");
+    NSString *remaining = STRateLimitHeaderValue(responseHeaders, @"x-rate-limit-remaining");
+    NSString *reset = STRateLimitHeaderValue(responseHeaders, @"x-rate-limit-reset");
+
+    NSTimeInterval now = [[NSDate date] timeIntervalSince1970];
+
+    @synchronized(self) {
+        STTwitterRateLimitBudget *b = [self budgetForResource:resource];
+
+        if(b.inFlightCount > 0) b.inFlightCount--;
+
+        if(limit && remaining && reset) {
+            [self setLimit:[limit integerValue] remaining:[remaining integerValue] resetTime:[reset doubleValue] forBudget:b now:now];
+        } else if(statusCode == 429) {
+            NSInteger assumedLimit = (b.limit < 0) ? kSTTwitterRateLimitMinimumLimit : b.limit;
+            [self setLimit:assumedLimit remaining:0 resetTime:MAX(b.resetTime, now + kSTTwitterRateLimitDefaultRetryDelay) forBudget:b now:now];
+        }
+
+        // the budget changed, the waiting requests may start sooner or later than planned
+        if([b.waitingRequests count]) [self schedulePumpForResource:resource budget:b delay:0.0];
+    }
+}
+
+- (void)updateWithRateLimitStatus:(NSDictionary *)rateLimitStatus {
+
+    NSDictionary *resources = [rateLimitStatus valueForKey:@"resources"];
+    if([resources isKindOfClass:[NSDictionary class]] == NO) return;
+
+    NSTimeInterval now = [[NSDate date] timeIntervalSince1970];
+
+    @synchronized(self) {
+        for(NSDictionary *family in [resources allValues]) {
+            if([family isKindOfClass:[NSDictionary class]] == NO) continue;
+
+            [family enumerateKeysAndObjectsUsingBlock:^(NSString *path, NSDictionary *d, BOOL *stop) {
+                if([d isKindOfClass:[NSDictionary class]] == NO) return;
+                if(d[@"limit"] == nil || d[@"remaining"] == nil || d[@"reset"] == nil) return;
+
+                NSString *resource = [[self class] resourceForPath:path];
+                STTwitterRateLimitBudget *b = [self budgetForResource:resource];
+                [self setLimit:[d[@"limit"] integerValue] remaining:[d[@"remaining"] integerValue] resetTime:[d[@"reset"] doubleValue] forBudget:b now:now];
+
+                if([b.waitingRequests count]) [self schedulePumpForResource:resource budget:b delay:0.0];
+            }];
+        }
+    }
+}
+
+- (NSDictionary *)rateLimitForResource:(NSString *)resource {
+
+    @synchronized(self) {
+        STTwitterRateLimitBudget *b = _budgetsByResource[[[self class] resourceForPath:resource]];
+        if(b == nil || b.limit < 0) return nil;
+
+        return @{ @"limit" : @(b.limit),
+                  @"remaining" : @(b.remaining),
+                  @"reset" : [NSDate dateWithTimeIntervalSince1970:b.resetTime] };
+    }
+}
+
+@end
@@ -0,0 +1,46 @@
+//
+//  STTwitterRequestCoalescer.h
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/*
+ Collapses identical GET requests in flight into a single network request
+
+ A GET is identical to one in flight when it has the same URL, the same parameters in any order, and the same credentials.
+ The callers that join a request in flight get its result, the response object is shared between them and must not be mutated.
+ Once the request ends, the next identical GET goes to the network again, see STTwitterResponseCache to reuse responses.
+
+ STTwitterAPI coalesces the GETs made with getResource: and getAPIResource: without a progress block,
+ unless they carry request options such as kSTRequestTagKey, which are specific to each caller.
+ Several STTwitterAPI instances may share a coalescer.
+ */
+
+@interface STTwitterRequestCoalescer : NSObject
+
+// statistics
+@property (nonatomic, readonly) NSUInteger requestCount; // GETs sent to the network
+@property (nonatomic, readonly) NSUInteger mergeCount; // GETs that joined a request in flight instead
+
+@property (nonatomic, readonly) NSUInteger inFlightCount;
+
+// credentials identify the account, eg. an OAuth access token, they are part of the key and never sent
++ (NSString *)keyForResource:(NSString *)resource
+               baseURLString:(NSString *)baseURLString
+                  parameters:(NSDictionary *)parameters
+                 credentials:(NSString *)credentials;
+
+// fetchBlock is called right away, on the calling thread, unless a request with the same key is in flight,
+// it must eventually call one of the blocks it receives, the blocks of all the callers are then called in order
+- (void)performRequestWithKey:(NSString *)key
+                 successBlock:(void(^)(NSDictionary *responseHeaders, id response))successBlock
+                   errorBlock:(void(^)(NSError *error))errorBlock
+                   fetchBlock:(void(^)(void(^successBlock)(NSDictionary *responseHeaders, id response), void(^errorBlock)(NSError *error)))fetchBlock;
+
+- (void)resetCounters;
+
+@end
@@ -0,0 +1,115 @@
+//
+//  STTwitterRequestCoalescer.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STTwitterRequestCoalescer.h"
+
+@interface STTwitterCoalescedRequest : NSObject
+@property (nonatomic, retain) NSMutableArray *successBlocks;
+@property (nonatomic, retain) NSMutableArray *errorBlocks;
+@end
+
+@implementation STTwitterCoalescedRequest
+@end
+
+@interface STTwitterRequestCoalescer ()
+@property (nonatomic, retain) NSMutableDictionary *requestsByKey;
+@property (nonatomic, readwrite) NSUInteger requestCount;
+@property (nonatomic, readwrite) NSUInteger mergeCount;
+@end
+
+@implementation STTwitterRequestCoalescer
+
+- (id)init {
+    self = [super init];
+    self.requestsByKey = [NSMutableDictionary dictionary];
+    return self;
+}
+
+- (NSUInteger)inFlightCount {
+    @synchronized(self) {
+        return [_requestsByKey count];
+    }
+}
+
+- (void)resetCounters {
+    @synchronized(self) {
+        _requestCount = 0;
+        _mergeCount = 0;
+    }
+}
+
++ (NSString *)keyForResource:(NSString *)resource
+               baseURLString:(NSString *)baseURLString
+                  parameters:(NSDictionary *)parameters
+                 credentials:(NSString *)credentials {
+
+    NSMutableArray *pairs = [NSMutableArray arrayWithCapacity:[parameters count]];
+
+    NSArray *sortedKeys = [[parameters allKeys] sortedArrayUsingSelector:@selector(compare:)];
+    for(NSString *k in sortedKeys) {
+        [pairs addObject:[NSString stringWithFormat:@"%@=%@", k, parameters[k]]];
+    }
+
+    return [NSString stringWithFormat:@"%@\n%@/%@?%@", credentials ? credentials : @"", baseURLString, resource, [pairs componentsJoinedByString:@"&"]];
+}
+
+- (void)performRequestWithKey:(NSString *)key
+                 successBlock:(void(^)(NSDictionary *responseHeaders, id response))successBlock
+                   errorBlock:(void(^)(NSError *error))errorBlock
+                   fetchBlock:(void(^)(void(^successBlock)(NSDictionary *responseHeaders, id response), void(^errorBlock)(NSError *error)))fetchBlock {
+
+    NSParameterAssert(key);
+    NSParameterAssert(fetchBlock);
+
+    void(^noSuccessBlock)(NSDictionary *, id) = ^(NSDictionary *responseHeaders, id response) {};
+    void(^noErrorBlock)(NSError *) = ^(NSError *error) {};
+
+    STTwitterCoalescedRequest *cr = nil;
+
+    @synchronized(self) {
+        STTwitterCoalescedRequest *inFlight = _requestsByKey[key];
+
+        if(inFlight) {
+            [inFlight.successBlocks addObject:successBlock ? [successBlock copy] : noSuccessBlock];
+            [inFlight.errorBlocks addObject:errorBlock ? [errorBlock copy] : noErrorBlock];
+            _mergeCount++;
+            return;
+        }
+
+        cr = [[STTwitterCoalescedRequest alloc] init];
+        cr.successBlocks = [NSMutableArray arrayWithObject:successBlock ? [successBlock copy] : noSuccessBlock];
+        cr.errorBlocks = [NSMutableArray arrayWithObject:errorBlock ? [errorBlock copy] : noErrorBlock];
+        _requestsByKey[key] = cr;
+        _requestCount++;
+    }
+
+    // the key is released before the blocks are called, so that they can send the same GET again
+
+    fetchBlock(^(NSDictionary *responseHeaders, id response) {
+        NSArray *successBlocks = [self removeRequest:cr forKey:key] ? cr.successBlocks : nil;
+        for(void(^block)(NSDictionary *, id) in successBlocks) {
+            block(responseHeaders, response);
+        }
+    }, ^(NSError *error) {
+        NSArray *errorBlocks = [self removeRequest:cr forKey:key] ? cr.errorBlocks : nil;
+        for(void(^block)(NSError *) in errorBlocks) {
+            block(error);
+        }
+    });
+}
+
+// NO if the request already ended, the key may then belong to a newer request
+- (BOOL)removeRequest:(STTwitterCoalescedRequest *)cr forKey:(NSString *)key {
+    @synchronized(self) {
+        if(_requestsByKey[key] != cr) return NO;
+        [_requestsByKey removeObjectForKey:key];
+        return YES;
+    }
+}
+
+@end
@@ -0,0 +1,59 @@
+//
+//  STTwitterRequestRegistry.h
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/*
+ Live requests of a backend, keyed by the requestID returned by fetchResource:
+ 
+ Requests can be tagged with the kSTRequestTagKey request option, eg. with the name of a view or a job,
+ so that all of them can be cancelled at once when it goes away.
+ 
+ Cancelled requests call their errorBlock with a cancellation error, see -[NSError st_isCancellationError].
+ */
+
+@class STHTTPRequest;
+@class STTwitterRateLimiter;
+
+typedef NS_ENUM(NSUInteger, STTwitterRequestState) {
+    STTwitterRequestStateUnknown = 0, // never registered, or already finished
+    STTwitterRequestStatePending, // waiting for a slot in STTwitterRequestScheduler
+    STTwitterRequestStateRunning
+};
+
+@interface STTwitterRequestRegistry : NSObject
+
+@property (nonatomic, readonly) NSUInteger count;
+
+// requests started with -startRequest:... wait for the budget of their resource before entering the scheduler, optional
+@property (nonatomic, retain) STTwitterRateLimiter *rateLimiter;
+
+// registers the request, removes it when it ends, starts it through STTwitterRateLimiter and STTwitterRequestScheduler
+- (void)startRequest:(STHTTPRequest *)request withID:(NSString *)requestID requestOptions:(NSDictionary *)requestOptions;
+
+// prepareBlock is called right before the request goes out, eg. to sign it once it is done waiting for the budget
+- (void)startRequest:(STHTTPRequest *)request withID:(NSString *)requestID requestOptions:(NSDictionary *)requestOptions prepareBlock:(dispatch_block_t)prepareBlock;
+
+// other kinds of requests, eg. SLRequest, the owner reports the start and the end of the request
+- (void)registerRequestWithID:(NSString *)requestID tag:(NSString *)tag cancelBlock:(dispatch_block_t)cancelBlock;
+- (void)requestDidStartWithID:(NSString *)requestID;
+- (void)requestDidFinishWithID:(NSString *)requestID;
+
+- (void)cancelRequestWithID:(NSString *)requestID;
+- (void)cancelRequestsWithTag:(NSString *)tag;
+- (void)cancelAllRequests;
+
+- (NSArray *)requestIDsWithTag:(NSString *)tag;
+- (STTwitterRequestState)stateOfRequestWithID:(NSString *)requestID;
+- (double)progressOfRequestWithID:(NSString *)requestID; // fraction of the expected bytes received, -1 when unknown
+
+// called on the main queue after the request blocks, or right away if the request is not registered
+- (void)waitForRequestWithID:(NSString *)requestID completionBlock:(void(^)(void))completionBlock;
+- (void)waitForRequestsWithTag:(NSString *)tag completionBlock:(void(^)(void))completionBlock;
+
+@end
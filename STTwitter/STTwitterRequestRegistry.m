@@ -0,0 +1,273 @@
+//
+//  STTwitterRequestRegistry.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STTwitterRequestRegistry.h"
+#import "STHTTPRequest+STTwitter.h"
+#import "STTwitterRateLimiter.h"
+
+@interface STTwitterRegisteredRequest : NSObject
+@property (nonatomic, retain) NSString *requestID;
+@property (nonatomic, retain) NSString *tag;
+@property (nonatomic) STTwitterRequestState state;
+@property (nonatomic, copy) dispatch_block_t cancelBlock;
+@property (nonatomic, retain) STHTTPRequest *request; // keeps the request alive until it ends
+@property (nonatomic, retain) NSMutableArray *completionBlocks;
+@end
+
+@implementation STTwitterRegisteredRequest
+@end
+
+@interface STTwitterRequestRegistry ()
+@property (nonatomic, retain) NSMutableDictionary *requestsByID;
+@end
+
+@implementation STTwitterRequestRegistry
+
+- (id)init {
+    self = [super init];
+    self.requestsByID = [NSMutableDictionary dictionary];
+    return self;
+}
+
+- (NSUInteger)count {
+    @synchronized(self) {
+        return [_requestsByID count];
+    }
+}
+
+- (STTwitterRegisteredRequest *)addRequestWithID:(NSString *)requestID tag:(NSString *)tag cancelBlock:(dispatch_block_t)cancelBlock {
+    
+    NSParameterAssert(requestID);
+    
+    STTwitterRegisteredRequest *rr = [[STTwitterRegisteredRequest alloc] init];
+    rr.requestID = requestID;
+    rr.tag = tag;
+    rr.state = STTwitterRequestStatePending;
+    rr.cancelBlock = cancelBlock;
+    rr.completionBlocks = [NSMutableArray array];
+    
+    @synchronized(self) {
+        _requestsByID[requestID] = rr;
+    }
+    
+    return rr;
+}
+
+- (void)startRequest:(STHTTPRequest *)request withID:(NSString *)requestID requestOptions:(NSDictionary *)requestOptions {
+    [self startRequest:request withID:requestID requestOptions:requestOptions prepareBlock:nil];
+}
+
+- (void)startRequest:(STHTTPRequest *)request withID:(NSString *)requestID requestOptions:(NSDictionary *)requestOptions prepareBlock:(dispatch_block_t)prepareBlock {
+    
+    __weak STHTTPRequest *wr = request;
+    
+    STTwitterRegisteredRequest *rr = [self addRequestWithID:requestID tag:requestOptions[kSTRequestTagKey] cancelBlock:^{
+        [wr cancel];
+    }];
+    rr.request = request;
+    
+    // streaming connections are long-lived, they don't count against the budget of a resource
+    
+    STTwitterRateLimiter *rateLimiter = request.streamingMode ? nil : _rateLimiter;
+    NSURL *url = request.url;
+    __block BOOL isCountedByRateLimiter = NO;
+    
+    // the registry forgets the request before its blocks are called, so that they can register a new request with the same tag
+    
+    completionBlock_t completionBlock = request.completionBlock;
+    errorBlock_t errorBlock = request.errorBlock;
+    
+    request.completionBlock = ^(NSDictionary *responseHeaders, NSString *body) {
+        if(isCountedByRateLimiter) [rateLimiter requestDidFinishForURL:url statusCode:wr.responseStatus responseHeaders:responseHeaders];
+        NSArray *completionBlocks = [self removeRequestWithID:requestID];
+        if(completionBlock) completionBlock(responseHeaders, body);
+        [self callCompletionBlocks:completionBlocks];
+    };
+    
+    request.errorBlock = ^(NSError *error) {
+        if(isCountedByRateLimiter) [rateLimiter requestDidFinishForURL:url statusCode:wr.responseStatus responseHeaders:wr.responseHeaders];
+        NSArray *completionBlocks = [self removeRequestWithID:requestID];
+        if(errorBlock) errorBlock(error);
+        [self callCompletionBlocks:completionBlocks];
+    };
+    
+    dispatch_block_t startBlock = ^{
+        if(prepareBlock) prepareBlock();
+        [request twitterStartAsynchronousWithRequestOptions:requestOptions didStartBlock:^{
+            [self requestDidStartWithID:requestID];
+        }];
+    };
+    
+    // fresh cached responses never reach Twitter, they don't wait for the budget nor use it
+    
+    if(rateLimiter == nil) {
+        startBlock();
+        return;
+    }
+    
+    // the start block retains the request while it waits for the budget
+    
+    STTwitterRequestPriority priority = [requestOptions[kSTRequestPriorityKey] unsignedIntegerValue];
+    
+    [request lookUpCachedResponseWithCompletionBlock:^(BOOL hasFreshCachedResponse) {
+        
+        if(request.error) return; // cancelled while looking up
+        
+        if(hasFreshCachedResponse) {
+            startBlock();
+            return;
+        }
+        
+        [rateLimiter scheduleRequestForURL:url priority:priority startBlock:^{
+            if(request.error) { // cancelled while waiting
+                [rateLimiter requestDidFinishForURL:url statusCode:0 responseHeaders:nil];
+                return;
+            }
+            isCountedByRateLimiter = YES;
+            startBlock();
+        }];
+    }];
+}
+
+- (void)registerRequestWithID:(NSString *)requestID tag:(NSString *)tag cancelBlock:(dispatch_block_t)cancelBlock {
+    [self addRequestWithID:requestID tag:tag cancelBlock:cancelBlock];
+}
+
+- (void)requestDidStartWithID:(NSString *)requestID {
+    @synchronized(self) {
+        STTwitterRegisteredRequest *rr = _requestsByID[requestID];
+        rr.state = STTwitterRequestStateRunning;
+    }
+}
+
+- (void)requestDidFinishWithID:(NSString *)requestID {
+    NSArray *completionBlocks = [self removeRequestWithID:requestID];
+    [self callCompletionBlocks:completionBlocks];
+}
+
+- (NSArray *)removeRequestWithID:(NSString *)requestID {
+    @synchronized(self) {
+        STTwitterRegisteredRequest *rr = _requestsByID[requestID];
+        if(rr == nil) return nil;
+        [_requestsByID removeObjectForKey:requestID];
+        return rr.completionBlocks;
+    }
+}
+
+- (void)callCompletionBlocks:(NSArray *)completionBlocks {
+    for(void(^completionBlock)(void) in completionBlocks) {
+        dispatch_async(dispatch_get_main_queue(), completionBlock);
+    }
+}
+
+#pragma mark Cancellation
+
+- (void)cancelRequestWithID:(NSString *)requestID {
+    
+    dispatch_block_t cancelBlock = nil;
+    
+    @synchronized(self) {
+        STTwitterRegisteredRequest *rr = _requestsByID[requestID];
+        cancelBlock = rr.cancelBlock;
+        rr.cancelBlock = nil; // cancel only once
+    }
+    
+    if(cancelBlock) cancelBlock();
+}
+
+- (void)cancelRequestsWithTag:(NSString *)tag {
+    for(NSString *requestID in [self requestIDsWithTag:tag]) {
+        [self cancelRequestWithID:requestID];
+    }
+}
+
+- (void)cancelAllRequests {
+    
+    NSArray *requestIDs = nil;
+    
+    @synchronized(self) {
+        requestIDs = [_requestsByID allKeys];
+    }
+    
+    for(NSString *requestID in requestIDs) {
+        [self cancelRequestWithID:requestID];
+    }
+}
+
+#pragma mark State
+
+- (NSArray *)requestIDsWithTag:(NSString *)tag {
+    
+    NSMutableArray *requestIDs = [NSMutableArray array];
+    
+    @synchronized(self) {
+        [_requestsByID enumerateKeysAndObjectsUsingBlock:^(NSString *requestID, STTwitterRegisteredRequest *rr, BOOL *stop) {
+            if([rr.tag isEqualToString:tag]) [requestIDs addObject:requestID];
+        }];
+    }
+    
+    return requestIDs;
+}
+
+- (STTwitterRequestState)stateOfRequestWithID:(NSString *)requestID {
+    @synchronized(self) {
+        STTwitterRegisteredRequest *rr = _requestsByID[requestID];
+        return rr ? rr.state : STTwitterRequestStateUnknown;
+    }
+}
+
+- (double)progressOfRequestWithID:(NSString *)requestID {
+    
+    STHTTPRequest *r = nil;
+    
+    @synchronized(self) {
+        STTwitterRegisteredRequest *rr = _requestsByID[requestID];
+        if(rr.state != STTwitterRequestStateRunning) return (rr.state == STTwitterRequestStatePending) ? 0.0 : -1.0;
+        r = rr.request;
+    }
+    
+    long long expectedLength = [[r.responseHeaders valueForKey:@"Content-Length"] longLongValue];
+    if(expectedLength <= 0 || r.isEncodedByteCountAvailable == NO) return -1.0;
+    
+    return MIN(1.0, (double)r.totalEncodedBytesReceived / expectedLength); // Content-Length counts encoded bytes
+}
+
+#pragma mark Waiting
+
+- (void)waitForRequestWithID:(NSString *)requestID completionBlock:(void(^)(void))completionBlock {
+    
+    NSParameterAssert(completionBlock);
+    
+    @synchronized(self) {
+        STTwitterRegisteredRequest *rr = _requestsByID[requestID];
+        if(rr) {
+            [rr.completionBlocks addObject:[completionBlock copy]];
+            return;
+        }
+    }
+    
+    dispatch_async(dispatch_get_main_queue(), completionBlock);
+}
+
+- (void)waitForRequestsWithTag:(NSString *)tag completionBlock:(void(^)(void))completionBlock {
+    
+    NSParameterAssert(completionBlock);
+    
+    dispatch_group_t group = dispatch_group_create();
+    
+    for(NSString *requestID in [self requestIDsWithTag:tag]) {
+        dispatch_group_enter(group);
+        [self waitForRequestWithID:requestID completionBlock:^{
+            dispatch_group_leave(group);
+        }];
+    }
+    
+    dispatch_group_notify(group, dispatch_get_main_queue(), completionBlock);
+}
+
+@end
@@ -0,0 +1,46 @@
+//
+//  STTwitterRequestScheduler.h
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/*
+ Limits the number of requests in flight, globally and per host
+ 
+ Pending requests are started by priority class, and in FIFO order within a class.
+ Some slots are reserved to interactive requests, so that a bulk crawl never delays them for long.
+ Each host keeps the same share of its slots reserved, rounded up: with the defaults, background and bulk requests
+ get 6 slots in total and 3 on api.twitter.com, more of them wait in the scheduler.
+ 
+ Streaming connections are long-lived and don't go through the scheduler.
+ */
+
+typedef NS_ENUM(NSUInteger, STTwitterRequestPriority) {
+    STTwitterRequestPriorityInteractive = 0, // default, a user is waiting for the result
+    STTwitterRequestPriorityBackground, // eg. refreshing a timeline
+    STTwitterRequestPriorityBulk // eg. a crawl over thousands of users
+};
+
+@interface STTwitterRequestScheduler : NSObject
+
+@property (nonatomic) NSUInteger maxConcurrentRequests; // default 8
+@property (nonatomic) NSUInteger maxConcurrentRequestsPerHost; // default 4
+@property (nonatomic) NSUInteger interactiveReservedSlots; // default 2, global slots that background and bulk requests cannot use, scaled down on each host
+
+@property (nonatomic, readonly) NSUInteger runningCount;
+@property (nonatomic, readonly) NSUInteger pendingCount;
+
++ (instancetype)sharedScheduler;
+
+// startBlock is called once a slot is available, possibly right away on the calling thread
+// finishBlock frees the slot, call it once the request is done, it may be called from within startBlock
+// the returned block is the same finishBlock, to give up on a request that has not started yet
+- (dispatch_block_t)scheduleRequestForHost:(NSString *)host
+                                  priority:(STTwitterRequestPriority)priority
+                                startBlock:(void(^)(dispatch_block_t finishBlock))startBlock;
+
+@end
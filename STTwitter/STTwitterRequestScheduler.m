@@ -0,0 +1,166 @@
+//
+//  STTwitterRequestScheduler.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STTwitterRequestScheduler.h"
+
+static NSUInteger const kSTTwitterRequestPriorityCount = 3;
+
+@interface STTwitterScheduledRequest : NSObject
+@property (nonatomic, retain) NSString *host;
+@property (nonatomic) STTwitterRequestPriority priority;
+@property (nonatomic, copy) void(^startBlock)(dispatch_block_t finishBlock); // released once started, it usually retains the request
+@property (nonatomic) BOOL isRunning;
+@property (nonatomic) BOOL isFinished;
+@end
+
+@implementation STTwitterScheduledRequest
+@end
+
+@interface STTwitterRequestScheduler ()
+@property (nonatomic, retain) NSArray *pendingRequestsByPriority; // NSMutableArray of STTwitterScheduledRequest for each priority
+@property (nonatomic, retain) NSCountedSet *runningHosts;
+@property (nonatomic) NSUInteger runningCount;
+@end
+
+@implementation STTwitterRequestScheduler
+
++ (instancetype)sharedScheduler {
+    static STTwitterRequestScheduler *sharedScheduler = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedScheduler = [[self alloc] init];
+    });
+    return sharedScheduler;
+}
+
+- (id)init {
+    self = [super init];
+    
+    NSMutableArray *ma = [NSMutableArray arrayWithCapacity:kSTTwitterRequestPriorityCount];
+    for(NSUInteger i = 0; i < kSTTwitterRequestPriorityCount; i++) {
+        [ma addObject:[NSMutableArray array]];
+    }
+    self.pendingRequestsByPriority = ma;
+    
+    self.runningHosts = [NSCountedSet set];
+    
+    self.maxConcurrentRequests = 8;
+    self.maxConcurrentRequestsPerHost = 4;
+    self.interactiveReservedSlots = 2;
+    
+    return self;
+}
+
+- (NSUInteger)pendingCount {
+    @synchronized(self) {
+        NSUInteger count = 0;
+        for(NSArray *pendingRequests in _pendingRequestsByPriority) {
+            count += [pendingRequests count];
+        }
+        return count;
+    }
+}
+
+- (dispatch_block_t)scheduleRequestForHost:(NSString *)host
+                                  priority:(STTwitterRequestPriority)priority
+                                startBlock:(void(^)(dispatch_block_t finishBlock))startBlock {
+    
+    NSParameterAssert(startBlock);
+    
+    STTwitterScheduledRequest *request = [[STTwitterScheduledRequest alloc] init];
+    request.host = host ? host : @"";
+    request.priority = MIN(priority, kSTTwitterRequestPriorityCount - 1);
+    request.startBlock = startBlock;
+    
+    @synchronized(self) {
+        [_pendingRequestsByPriority[request.priority] addObject:request];
+    }
+    
+    [self startPendingRequests];
+    
+    return [self finishBlockForRequest:request];
+}
+
+- (dispatch_block_t)finishBlockForRequest:(STTwitterScheduledRequest *)request {
+    return ^{
+        [self finishRequest:request];
+    };
+}
+
+- (void)finishRequest:(STTwitterScheduledRequest *)request {
+    
+    @synchronized(self) {
+        
+        if(request.isFinished) return;
+        request.isFinished = YES;
+        request.startBlock = nil;
+        
+        if(request.isRunning) {
+            self.runningCount -= 1;
+            [_runningHosts removeObject:request.host];
+        } else {
+            [_pendingRequestsByPriority[request.priority] removeObjectIdenticalTo:request];
+        }
+    }
+    
+    [self startPendingRequests];
+}
+
+// first pending request, by priority then FIFO, whose host has a free slot
+- (STTwitterScheduledRequest *)nextRequestToStart {
+    
+    for(NSUInteger priority = 0; priority < kSTTwitterRequestPriorityCount; priority++) {
+        
+        // REST requests mostly share api.twitter.com, each host keeps the same share of its slots reserved, rounded up
+        
+        NSUInteger maxRunningCount = _maxConcurrentRequests;
+        NSUInteger maxRunningCountPerHost = _maxConcurrentRequestsPerHost;
+        if(priority != STTwitterRequestPriorityInteractive) {
+            NSUInteger reservedSlotsPerHost = (_interactiveReservedSlots * _maxConcurrentRequestsPerHost + MAX(_maxConcurrentRequests, 1) - 1) / MAX(_maxConcurrentRequests, 1);
+            maxRunningCount = (_maxConcurrentRequests > _interactiveReservedSlots) ? (_maxConcurrentRequests - _interactiveReservedSlots) : 1;
+            maxRunningCountPerHost = (_maxConcurrentRequestsPerHost > reservedSlotsPerHost) ? (_maxConcurrentRequestsPerHost - reservedSlotsPerHost) : 1;
+        }
+        
+        if(_runningCount >= maxRunningCount) continue;
+        
+        for(STTwitterScheduledRequest *request in _pendingRequestsByPriority[priority]) {
+            if([_runningHosts countForObject:request.host] < maxRunningCountPerHost) return request;
+        }
+    }
+    
+    return nil;
+}
+
+- (void)startPendingRequests {
+    
+    NSMutableArray *startedRequests = [NSMutableArray array];
+    NSMutableArray *startBlocks = [NSMutableArray array];
+    
+    @synchronized(self) {
+        
+        STTwitterScheduledRequest *request = nil;
+        
+        while((request = [self nextRequestToStart])) {
+            [_pendingRequestsByPriority[request.priority] removeObjectIdenticalTo:request];
+            request.isRunning = YES;
+            self.runningCount += 1;
+            [_runningHosts addObject:request.host];
+            [startedRequests addObject:request];
+            [startBlocks addObject:request.startBlock];
+            request.startBlock = nil;
+        }
+    }
+    
+    // outside of the lock, a start block may finish its request right away
+    
+    [startBlocks enumerateObjectsUsingBlock:^(void(^startBlock)(dispatch_block_t finishBlock), NSUInteger idx, BOOL *stop) {
+        startBlock([self finishBlockForRequest:startedRequests[idx]]);
+    }];
+}
+
+@end
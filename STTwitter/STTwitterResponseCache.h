@@ -0,0 +1,45 @@
+//
+//  STTwitterResponseCache.h
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "STHTTPRequest.h"
+
+/*
+ Cache for GET responses, with a memory tier and an optional disk tier
+
+ A response is fresh for the max age set for its resource, or else for the max-age or Expires given by the server.
+ Fresh responses are served without a network round-trip. Stale responses with an ETag or a Last-Modified header
+ are revalidated by STHTTPRequest, a 304 costs no payload. Disk entries are read on a private queue, requests start once
+ the lookup is answered.
+
+ Twitter marks API responses as no-cache, so only the resources with a max age are cached unless the server allows it.
+ Defaults: help/configuration, help/languages, help/privacy and help/tos for 1 day, trends/available for 1 hour,
+ users/show and lists/show for 5 minutes.
+
+ Responses depend on the authenticated user, use one cache, and one directory, per account.
+ */
+
+@interface STTwitterResponseCache : NSObject <STHTTPRequestCache>
+
+@property (nonatomic) NSUInteger memoryCapacity; // bytes, default 4 MB
+@property (nonatomic) NSUInteger diskCapacity; // bytes, default 20 MB
+@property (nonatomic, readonly) NSString *directoryPath;
+
+// statistics
+@property (nonatomic, readonly) NSUInteger freshHitCount; // served without a request
+@property (nonatomic, readonly) NSUInteger revalidationCount; // stale responses sent for revalidation
+@property (nonatomic, readonly) NSUInteger missCount;
+
+- (instancetype)initWithDirectoryPath:(NSString *)directoryPath; // nil for a memory only cache
+
+// resource as passed to the API, eg. @"help/configuration.json", a max age of 0 disables the cache for the resource
+- (void)setMaxAge:(NSTimeInterval)maxAge forResource:(NSString *)resource;
+
+- (void)removeAllCachedResponses;
+
+@end
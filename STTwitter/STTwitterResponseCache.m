@@ -0,0 +1,430 @@
+//
+//  STTwitterResponseCache.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STTwitterResponseCache.h"
+#include <CommonCrypto/CommonDigest.h>
+
+#if DEBUG
+#   define STLog(...) NSLog(__VA_ARGS__)
+#else
+#   define STLog(...)
+#endif
+
+static NSString * const kSTTwitterResponseCacheDateKey = @"date";
+
+static NSString *STHeaderValue(NSDictionary *headers, NSString *key) {
+    for(NSString *k in headers) {
+        if([k caseInsensitiveCompare:key] == NSOrderedSame) return headers[k];
+    }
+    return nil;
+}
+
+@interface STTwitterResponseCache ()
+@property (nonatomic, retain) NSString *directoryPath;
+@property (nonatomic) NSUInteger freshHitCount;
+@property (nonatomic) NSUInteger revalidationCount;
+@property (nonatomic) NSUInteger missCount;
+@end
+
+@implementation STTwitterResponseCache {
+    NSCache *_memoryCache;
+    NSMutableDictionary *_maxAgesByResource;
+    dispatch_queue_t _diskQueue;
+    unsigned long long _diskUsage; // disk queue only
+    NSMutableSet *_diskFileNames; // entries on disk, so that misses and removals don't wait for the disk queue
+    BOOL _isDiskIndexLoaded;
+}
+
+- (id)init {
+    return [self initWithDirectoryPath:nil];
+}
+
+- (instancetype)initWithDirectoryPath:(NSString *)directoryPath {
+    self = [super init];
+
+    _memoryCache = [[NSCache alloc] init];
+    _maxAgesByResource = [NSMutableDictionary dictionary];
+    _diskFileNames = [NSMutableSet set];
+    _diskQueue = dispatch_queue_create("STTwitterResponseCache.disk", DISPATCH_QUEUE_SERIAL);
+
+    self.memoryCapacity = 4 * 1024 * 1024;
+    self.diskCapacity = 20 * 1024 * 1024;
+    self.directoryPath = directoryPath;
+
+    for(NSString *resource in @[@"help/configuration.json", @"help/languages.json", @"help/privacy.json", @"help/tos.json"]) {
+        [self setMaxAge:24 * 3600 forResource:resource];
+    }
+    [self setMaxAge:3600 forResource:@"trends/available.json"];
+    [self setMaxAge:300 forResource:@"users/show.json"];
+    [self setMaxAge:300 forResource:@"lists/show.json"];
+
+    if(_directoryPath) {
+        [[NSFileManager defaultManager] createDirectoryAtPath:_directoryPath withIntermediateDirectories:YES attributes:nil error:nil];
+        dispatch_async(_diskQueue, ^{
+            NSArray *fileNames = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:_directoryPath error:nil];
+            @synchronized(_diskFileNames) {
+                [_diskFileNames addObjectsFromArray:fileNames];
+                _isDiskIndexLoaded = YES;
+            }
+            _diskUsage = [self diskUsage];
+        });
+    }
+
+    return self;
+}
+
+- (void)dealloc {
+#if !OS_OBJECT_USE_OBJC
+    dispatch_release(_diskQueue);
+#endif
+}
+
+- (void)setMemoryCapacity:(NSUInteger)memoryCapacity {
+    _memoryCapacity = memoryCapacity;
+    [_memoryCache setTotalCostLimit:memoryCapacity];
+}
+
+- (void)setMaxAge:(NSTimeInterval)maxAge forResource:(NSString *)resource {
+    @synchronized(_maxAgesByResource) {
+        _maxAgesByResource[resource] = @(maxAge);
+    }
+}
+
+- (NSNumber *)maxAgeForURL:(NSURL *)url {
+    NSString *path = [url path];
+    @synchronized(_maxAgesByResource) {
+        for(NSString *resource in _maxAgesByResource) {
+            if([path hasSuffix:[@"/" stringByAppendingString:resource]]) return _maxAgesByResource[resource];
+        }
+    }
+    return nil;
+}
+
+#pragma mark Freshness
+
++ (NSDate *)dateFromHTTPDateString:(NSString *)s {
+
+    if(s == nil) return nil;
+
+    static NSDateFormatter *dateFormatter = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        dateFormatter = [[NSDateFormatter alloc] init];
+        [dateFormatter setLocale:[[NSLocale alloc] initWithLocaleIdentifier:@"en_US_POSIX"]];
+        [dateFormatter setTimeZone:[NSTimeZone timeZoneWithAbbreviation:@"GMT"]];
+        [dateFormatter setDateFormat:@"EEE, dd MMM yyyy HH:mm:ss zzz"];
+    });
+
+    @synchronized(dateFormatter) {
+        return [dateFormatter dateFromString:s];
+    }
+}
+
+// how long the response is fresh, a max age set for the resource wins over the server directives
+- (NSTimeInterval)freshnessLifetimeOfResponse:(NSHTTPURLResponse *)response isCacheable:(BOOL *)isCacheable {
+
+    NSNumber *maxAge = [self maxAgeForURL:[response URL]];
+
+    if(maxAge) {
+        *isCacheable = [maxAge doubleValue] > 0;
+        return [maxAge doubleValue];
+    }
+
+    NSDictionary *headers = [response allHeaderFields];
+    NSString *cacheControl = [STHeaderValue(headers, @"Cache-Control") lowercaseString];
+    BOOL hasValidator = STHeaderValue(headers, @"ETag") || STHeaderValue(headers, @"Last-Modified");
+
+    if([cacheControl rangeOfString:@"no-store"].location != NSNotFound) {
+        *isCacheable = NO;
+        return 0;
+    }
+
+    NSTimeInterval lifetime = 0;
+
+    NSRange maxAgeRange = [cacheControl rangeOfString:@"max-age="];
+
+    if([cacheControl rangeOfString:@"no-cache"].location != NSNotFound) {
+        lifetime = 0; // revalidated every time
+    } else if(maxAgeRange.location != NSNotFound) {
+        NSScanner *scanner = [NSScanner scannerWithString:[cacheControl substringFromIndex:NSMaxRange(maxAgeRange)]];
+        [scanner scanDouble:&lifetime];
+    } else {
+        NSDate *expires = [[self class] dateFromHTTPDateString:STHeaderValue(headers, @"Expires")];
+        NSDate *date = [[self class] dateFromHTTPDateString:STHeaderValue(headers, @"Date")];
+        if(expires && date) lifetime = [expires timeIntervalSinceDate:date];
+    }
+
+    lifetime = MAX(lifetime, 0);
+
+    *isCacheable = lifetime > 0 || hasValidator;
+
+    return lifetime;
+}
+
+#pragma mark Keys
+
+// GET parameters come from a dictionary, their order is not stable
+- (NSString *)keyForURL:(NSURL *)url {
+
+    NSString *s = [url absoluteString];
+    NSRange range = [s rangeOfString:@"?"];
+    if(range.location == NSNotFound) return s;
+
+    NSArray *parameters = [[s substringFromIndex:NSMaxRange(range)] componentsSeparatedByString:@"&"];
+    parameters = [parameters sortedArrayUsingSelector:@selector(compare:)];
+
+    return [NSString stringWithFormat:@"%@?%@", [s substringToIndex:range.location], [parameters componentsJoinedByString:@"&"]];
+}
+
+- (NSString *)fileNameForKey:(NSString *)key {
+
+    NSData *data = [key dataUsingEncoding:NSUTF8StringEncoding];
+
+    unsigned char digest[CC_SHA1_DIGEST_LENGTH];
+    CC_SHA1([data bytes], (CC_LONG)[data length], digest);
+
+    NSMutableString *fileName = [NSMutableString stringWithCapacity:CC_SHA1_DIGEST_LENGTH * 2];
+    for(NSUInteger i = 0; i < CC_SHA1_DIGEST_LENGTH; i++) {
+        [fileName appendFormat:@"%02x", digest[i]];
+    }
+
+    return fileName;
+}
+
+- (NSString *)pathForKey:(NSString *)key {
+    return [_directoryPath stringByAppendingPathComponent:[self fileNameForKey:key]];
+}
+
+// YES until the directory has been listed
+- (BOOL)mayHaveDiskEntryForKey:(NSString *)key {
+
+    if(_directoryPath == nil) return NO;
+
+    @synchronized(_diskFileNames) {
+        return _isDiskIndexLoaded == NO || [_diskFileNames containsObject:[self fileNameForKey:key]];
+    }
+}
+
+#pragma mark STHTTPRequestCache
+
+- (void)lookUpCachedResponseForRequest:(NSURLRequest *)request completionBlock:(void(^)(NSCachedURLResponse *cachedResponse, BOOL isFresh))completionBlock {
+
+    NSString *key = [self keyForURL:[request URL]];
+
+    NSCachedURLResponse *cachedResponse = [_memoryCache objectForKey:key];
+
+    if(cachedResponse || [self mayHaveDiskEntryForKey:key] == NO) {
+        completionBlock(cachedResponse, [self isCachedResponseFresh:cachedResponse]);
+        return;
+    }
+
+    dispatch_async(_diskQueue, ^{ // after the pending writes
+
+        NSCachedURLResponse *diskCachedResponse = [self diskCachedResponseForKey:key];
+        if(diskCachedResponse) [_memoryCache setObject:diskCachedResponse forKey:key cost:[[diskCachedResponse data] length]];
+
+        dispatch_async(dispatch_get_main_queue(), ^{
+            completionBlock(diskCachedResponse, [self isCachedResponseFresh:diskCachedResponse]);
+        });
+    });
+}
+
+// counts the lookup
+- (BOOL)isCachedResponseFresh:(NSCachedURLResponse *)cachedResponse {
+
+    if(cachedResponse == nil) {
+        @synchronized(self) { _missCount++; }
+        return NO;
+    }
+
+    NSHTTPURLResponse *response = (NSHTTPURLResponse *)[cachedResponse response];
+    NSDate *date = [cachedResponse userInfo][kSTTwitterResponseCacheDateKey];
+
+    BOOL isCacheable = NO;
+    NSTimeInterval lifetime = [self freshnessLifetimeOfResponse:response isCacheable:&isCacheable];
+    BOOL fresh = date && -[date timeIntervalSinceNow] < lifetime;
+
+    @synchronized(self) {
+        if(fresh) {
+            _freshHitCount++;
+        } else if(STHeaderValue([response allHeaderFields], @"ETag") || STHeaderValue([response allHeaderFields], @"Last-Modified")) {
+            _revalidationCount++;
+        } else {
+            _missCount++;
+        }
+    }
+
+    return fresh;
+}
+
+- (void)storeCachedResponse:(NSCachedURLResponse *)cachedResponse forRequest:(NSURLRequest *)request {
+
+    NSHTTPURLResponse *response = (NSHTTPURLResponse *)[cachedResponse response];
+    if([response isKindOfClass:[NSHTTPURLResponse class]] == NO || [response statusCode] != 200) return;
+
+    NSString *key = [self keyForURL:[request URL]];
+
+    BOOL isCacheable = NO;
+    [self freshnessLifetimeOfResponse:response isCacheable:&isCacheable];
+
+    if(isCacheable == NO) {
+        [self removeCachedResponseForKey:key];
+        return;
+    }
+
+    NSCachedURLResponse *entry = [[NSCachedURLResponse alloc] initWithResponse:response
+                                                                          data:[cachedResponse data]
+                                                                      userInfo:@{kSTTwitterResponseCacheDateKey : [NSDate date]}
+                                                                 storagePolicy:NSURLCacheStorageAllowed];
+
+    [_memoryCache setObject:entry forKey:key cost:[[entry data] length]];
+
+    if(_directoryPath && _diskCapacity > 0) {
+        @synchronized(_diskFileNames) {
+            [_diskFileNames addObject:[self fileNameForKey:key]];
+        }
+        dispatch_async(_diskQueue, ^{
+            [self writeCachedResponse:entry forKey:key];
+        });
+    }
+}
+
+- (void)removeCachedResponseForKey:(NSString *)key {
+
+    [_memoryCache removeObjectForKey:key];
+
+    if([self mayHaveDiskEntryForKey:key] == NO) return;
+
+    @synchronized(_diskFileNames) {
+        [_diskFileNames removeObject:[self fileNameForKey:key]];
+    }
+
+    dispatch_async(_diskQueue, ^{
+        NSString *path = [self pathForKey:key];
+        unsigned long long size = [[[NSFileManager defaultManager] attributesOfItemAtPath:path error:nil] fileSize];
+        if([[NSFileManager defaultManager] removeItemAtPath:path error:nil]) _diskUsage -= MIN(size, _diskUsage);
+    });
+}
+
+- (void)removeAllCachedResponses {
+
+    [_memoryCache removeAllObjects];
+
+    if(_directoryPath == nil) return;
+
+    @synchronized(_diskFileNames) {
+        [_diskFileNames removeAllObjects];
+    }
+
+    dispatch_async(_diskQueue, ^{
+        NSFileManager *fm = [NSFileManager defaultManager];
+        for(NSString *fileName in [fm contentsOfDirectoryAtPath:_directoryPath error:nil]) {
+            [fm removeItemAtPath:[_directoryPath stringByAppendingPathComponent:fileName] error:nil];
+        }
+        _diskUsage = 0;
+    });
+}
+
+#pragma mark Disk
+
+// disk queue
+- (NSCachedURLResponse *)diskCachedResponseForKey:(NSString *)key {
+
+    NSString *path = [self pathForKey:key];
+
+    NSData *data = [NSData dataWithContentsOfFile:path];
+
+    if(data == nil) return nil;
+
+    NSCachedURLResponse *cachedResponse = nil;
+
+    @try {
+        cachedResponse = [NSKeyedUnarchiver unarchiveObjectWithData:data];
+    } @catch (NSException *exception) {
+        STLog(@"-- cannot read cached response %@: %@", path, exception);
+    }
+
+    if([cachedResponse isKindOfClass:[NSCachedURLResponse class]] == NO) {
+        [self removeCachedResponseForKey:key];
+        return nil;
+    }
+
+    return cachedResponse;
+}
+
+// disk queue
+- (void)writeCachedResponse:(NSCachedURLResponse *)cachedResponse forKey:(NSString *)key {
+
+    NSString *path = [self pathForKey:key];
+    NSData *data = [NSKeyedArchiver archivedDataWithRootObject:cachedResponse];
+
+    unsigned long long previousSize = [[[NSFileManager defaultManager] attributesOfItemAtPath:path error:nil] fileSize];
+
+    if([data writeToFile:path atomically:YES] == NO) {
+        STLog(@"-- cannot write cached response to %@", path);
+        if([[NSFileManager defaultManager] fileExistsAtPath:path] == NO) {
+            @synchronized(_diskFileNames) {
+                [_diskFileNames removeObject:[path lastPathComponent]];
+            }
+        }
+        return;
+    }
+
+    _diskUsage = _diskUsage - MIN(previousSize, _diskUsage) + [data length];
+
+    if(_diskUsage > _diskCapacity) [self trimDisk];
+}
+
+// disk queue
+- (unsigned long long)diskUsage {
+
+    unsigned long long usage = 0;
+
+    for(NSString *fileName in [[NSFileManager defaultManager] contentsOfDirectoryAtPath:_directoryPath error:nil]) {
+        NSString *path = [_directoryPath stringByAppendingPathComponent:fileName];
+        usage += [[[NSFileManager defaultManager] attributesOfItemAtPath:path error:nil] fileSize];
+    }
+
+    return usage;
+}
+
+// disk queue, removes the oldest responses down to 3/4 of the capacity
+- (void)trimDisk {
+
+    NSArray *keys = @[NSURLContentModificationDateKey, NSURLFileSizeKey];
+    NSArray *urls = [[NSFileManager defaultManager] contentsOfDirectoryAtURL:[NSURL fileURLWithPath:_directoryPath]
+                                                  includingPropertiesForKeys:keys
+                                                                     options:0
+                                                                       error:nil];
+
+    urls = [urls sortedArrayUsingComparator:^NSComparisonResult(NSURL *url1, NSURL *url2) {
+        NSDate *date1 = nil;
+        NSDate *date2 = nil;
+        [url1 getResourceValue:&date1 forKey:NSURLContentModificationDateKey error:nil];
+        [url2 getResourceValue:&date2 forKey:NSURLContentModificationDateKey error:nil];
+        return [date1 compare:date2];
+    }];
+
+    unsigned long long targetUsage = _diskCapacity / 4 * 3;
+
+    for(NSURL *url in urls) {
+        if(_diskUsage <= targetUsage) break;
+
+        NSNumber *size = nil;
+        [url getResourceValue:&size forKey:NSURLFileSizeKey error:nil];
+
+        if([[NSFileManager defaultManager] removeItemAtURL:url error:nil]) {
+            _diskUsage -= MIN([size unsignedLongLongValue], _diskUsage);
+            @synchronized(_diskFileNames) {
+                [_diskFileNames removeObject:[url lastPathComponent]];
+            }
+        }
+    }
+}
+
+@end
@@ -0,0 +1,38 @@
+//
+//  STTwitterStreamFilter.h
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/*
+ Client-side filter on the raw bytes of tweets, before JSON decoding
+ Useful with the sample and firehose streams, which cannot be filtered by the server.
+
+ A tweet is kept when it contains one of the keywords, and one of the user IDs, and one of the languages, empty criteria match everything.
+ Keywords are matched case-insensitively for ASCII letters, other letters in their given, lowercase, uppercase and capitalized forms.
+
+ User IDs are matched against the author, user.id_str, and languages against the lang of the tweet, not the nested ones.
+ Both are first searched anywhere in the bytes, and only then read from their members, so most tweets are dropped by a memchr scan.
+
+ Keywords are conservative: they only drop tweets that cannot match, eg. a keyword may be found in a user description.
+ Tweets with \u escapes are kept if there are non-ASCII keywords. Messages other than tweets are not filtered.
+ */
+
+@interface STTwitterStreamFilter : NSObject
+
+@property (nonatomic, retain, readonly) NSArray *keywords;
+@property (nonatomic, retain, readonly) NSArray *userIDs; // NSString or NSNumber
+@property (nonatomic, retain, readonly) NSArray *languages; // BCP 47 codes as in the lang field, eg. "en"
+
++ (instancetype)streamFilterWithKeywords:(NSArray *)keywords
+                                 userIDs:(NSArray *)userIDs
+                               languages:(NSArray *)languages;
+
+// NO when the message is a tweet that cannot match, thread safe
+- (BOOL)mayMatchMessageData:(NSData *)messageData;
+
+@end
@@ -0,0 +1,299 @@
+//
+//  STTwitterStreamFilter.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STTwitterStreamFilter.h"
+#import "STTwitterStreamParser.h"
+
+// memchr is vectorized by libc, candidates are then compared in full
+static const char *STFindBytes(const char *bytes, NSUInteger length, const char *pattern, NSUInteger patternLength) {
+    
+    if(patternLength == 0 || patternLength > length) return NULL;
+    
+    const char *end = bytes + length - patternLength + 1;
+    const char *p = bytes;
+    
+    while(p < end) {
+        p = memchr(p, pattern[0], end - p);
+        if(p == NULL) return NULL;
+        if(memcmp(p, pattern, patternLength) == 0) return p;
+        p++;
+    }
+    
+    return NULL;
+}
+
+// pattern is lowercase, only ASCII letters are case-folded
+static BOOL STContainsBytesCaseInsensitive(const char *bytes, NSUInteger length, const char *pattern, NSUInteger patternLength) {
+    
+    if(patternLength == 0 || patternLength > length) return NO;
+    
+    char first = pattern[0];
+    char firstUppercase = (first >= 'a' && first <= 'z') ? (char)(first - 'a' + 'A') : first;
+    
+    const char *end = bytes + length - patternLength + 1;
+    
+    for(int i = 0; i < (first == firstUppercase ? 1 : 2); i++) {
+        
+        const char *p = bytes;
+        char c = (i == 0) ? first : firstUppercase;
+        
+        while(p < end) {
+            p = memchr(p, c, end - p);
+            if(p == NULL) break;
+            if(strncasecmp(p + 1, pattern + 1, patternLength - 1) == 0) return YES;
+            p++;
+        }
+    }
+    
+    return NO;
+}
+
+// the ID must not be a part of a longer number
+static BOOL STContainsNumber(const char *bytes, NSUInteger length, const char *digits, NSUInteger digitsLength) {
+    
+    const char *p = bytes;
+    const char *end = bytes + length;
+    
+    while((p = STFindBytes(p, end - p, digits, digitsLength))) {
+        BOOL digitBefore = (p > bytes && p[-1] >= '0' && p[-1] <= '9');
+        BOOL digitAfter = (p + digitsLength < end && p[digitsLength] >= '0' && p[digitsLength] <= '9');
+        if(digitBefore == NO && digitAfter == NO) return YES;
+        p++;
+    }
+    
+    return NO;
+}
+
+// index after the string starting with the quote at i, length if it is not terminated
+static NSUInteger STSkipString(const char *bytes, NSUInteger length, NSUInteger i) {
+    
+    NSUInteger start = i + 1;
+    
+    for(i = start; i < length; i++) {
+        const char *quote = memchr(bytes + i, '"', length - i);
+        if(quote == NULL) return length;
+        
+        i = quote - bytes;
+        
+        // the quote is escaped by an odd number of backslashes
+        NSUInteger backslashCount = 0;
+        while(i - backslashCount > start && bytes[i - backslashCount - 1] == '\\') backslashCount++;
+        if(backslashCount % 2 == 0) return i + 1;
+    }
+    
+    return length;
+}
+
+// index after the JSON value starting at i
+static NSUInteger STSkipValue(const char *bytes, NSUInteger length, NSUInteger i) {
+    
+    if(i >= length) return length;
+    
+    if(bytes[i] == '"') return STSkipString(bytes, length, i);
+    
+    if(bytes[i] == '{' || bytes[i] == '[') {
+        NSUInteger depth = 0;
+        while(i < length) {
+            char c = bytes[i];
+            if(c == '"') {
+                i = STSkipString(bytes, length, i);
+                continue;
+            }
+            if(c == '{' || c == '[') depth++;
+            if(c == '}' || c == ']') {
+                depth--;
+                if(depth == 0) return i + 1;
+            }
+            i++;
+        }
+        return length;
+    }
+    
+    // number, true, false or null
+    while(i < length && bytes[i] != ',' && bytes[i] != '}' && bytes[i] != ']') i++;
+    return i;
+}
+
+// range of the value of a member of the JSON object in bytes, nested objects are skipped, location is NSNotFound when missing
+static NSRange STRangeOfMemberValue(const char *bytes, NSUInteger length, const char *key, NSUInteger keyLength) {
+    
+    const char *objectStart = memchr(bytes, '{', length);
+    if(objectStart == NULL) return NSMakeRange(NSNotFound, 0);
+    
+    NSUInteger i = objectStart - bytes + 1;
+    
+    while(i < length) {
+        
+        while(i < length && bytes[i] != '"' && bytes[i] != '}') i++;
+        if(i >= length || bytes[i] == '}') break;
+        
+        NSUInteger keyStart = i + 1;
+        i = STSkipString(bytes, length, i);
+        if(i >= length) break;
+        NSUInteger memberKeyLength = i - 1 - keyStart;
+        
+        while(i < length && bytes[i] != ':') i++;
+        i++;
+        while(i < length && (bytes[i] == ' ' || bytes[i] == '\t' || bytes[i] == '\r' || bytes[i] == '\n')) i++;
+        
+        NSUInteger valueStart = i;
+        i = STSkipValue(bytes, length, i);
+        
+        if(memberKeyLength == keyLength && memcmp(bytes + keyStart, key, keyLength) == 0) {
+            return NSMakeRange(valueStart, MIN(i, length) - valueStart);
+        }
+        
+        while(i < length && bytes[i] != ',' && bytes[i] != '}') i++;
+        if(i >= length || bytes[i] == '}') break;
+        i++;
+    }
+    
+    return NSMakeRange(NSNotFound, 0);
+}
+
+static BOOL STRangeEqualsBytes(const char *bytes, NSRange range, NSData *pattern) {
+    return (range.location != NSNotFound && range.length == [pattern length] && memcmp(bytes + range.location, [pattern bytes], range.length) == 0);
+}
+
+@interface STTwitterStreamFilter ()
+@property (nonatomic, retain) NSArray *keywords;
+@property (nonatomic, retain) NSArray *userIDs;
+@property (nonatomic, retain) NSArray *languages;
+@property (nonatomic, retain) NSArray *keywordPatterns; // lowercase UTF-8
+@property (nonatomic, retain) NSArray *userIDPatterns; // decimal digits
+@property (nonatomic, retain) NSArray *userIDValues; // "digits", as in user.id_str
+@property (nonatomic, retain) NSArray *languagePatterns; // "lang":"xx"
+@property (nonatomic, retain) NSArray *languageValues; // "xx"
+@property (nonatomic) BOOL hasNonASCIIKeywords;
+@end
+
+@implementation STTwitterStreamFilter
+
++ (instancetype)streamFilterWithKeywords:(NSArray *)keywords
+                                 userIDs:(NSArray *)userIDs
+                               languages:(NSArray *)languages {
+    
+    STTwitterStreamFilter *filter = [[self alloc] init];
+    filter.keywords = keywords;
+    filter.userIDs = userIDs;
+    filter.languages = languages;
+    
+    NSMutableArray *keywordPatterns = [NSMutableArray array];
+    for(NSString *keyword in keywords) {
+        
+        NSData *pattern = [[keyword lowercaseString] dataUsingEncoding:NSUTF8StringEncoding];
+        if([pattern length] == 0) continue;
+        [keywordPatterns addObject:pattern];
+        
+        if([pattern length] == [keyword length]) continue; // ASCII
+        
+        // non-ASCII letters are compared byte by byte, add the common case variants
+        filter.hasNonASCIIKeywords = YES;
+        for(NSString *variant in @[keyword, [keyword uppercaseString], [keyword capitalizedString]]) {
+            NSData *variantPattern = [variant dataUsingEncoding:NSUTF8StringEncoding];
+            if([keywordPatterns containsObject:variantPattern] == NO) [keywordPatterns addObject:variantPattern];
+        }
+    }
+    filter.keywordPatterns = keywordPatterns;
+    
+    NSMutableArray *userIDPatterns = [NSMutableArray array];
+    NSMutableArray *userIDValues = [NSMutableArray array];
+    for(id userID in userIDs) {
+        [userIDPatterns addObject:[[userID description] dataUsingEncoding:NSUTF8StringEncoding]];
+        [userIDValues addObject:[[NSString stringWithFormat:@"\"%@\"", userID] dataUsingEncoding:NSUTF8StringEncoding]];
+    }
+    filter.userIDPatterns = userIDPatterns;
+    filter.userIDValues = userIDValues;
+    
+    NSMutableArray *languagePatterns = [NSMutableArray array];
+    NSMutableArray *languageValues = [NSMutableArray array];
+    for(NSString *language in languages) {
+        NSString *s = [NSString stringWithFormat:@"\"lang\":\"%@\"", language];
+        [languagePatterns addObject:[s dataUsingEncoding:NSUTF8StringEncoding]];
+        [languageValues addObject:[[NSString stringWithFormat:@"\"%@\"", language] dataUsingEncoding:NSUTF8StringEncoding]];
+    }
+    filter.languagePatterns = languagePatterns;
+    filter.languageValues = languageValues;
+    
+    return filter;
+}
+
+- (BOOL)messageBytes:(const char *)bytes length:(NSUInteger)length mayMatchKeywords:(NSArray *)patterns {
+    
+    if([patterns count] == 0) return YES;
+    
+    for(NSData *pattern in patterns) {
+        if(STContainsBytesCaseInsensitive(bytes, length, [pattern bytes], [pattern length])) return YES;
+    }
+    
+    // non-ASCII characters may be escaped
+    return _hasNonASCIIKeywords && STFindBytes(bytes, length, "\\u", 2) != NULL;
+}
+
+// the quick search drops most tweets, the author is then read from user.id_str
+- (BOOL)messageBytes:(const char *)bytes length:(NSUInteger)length mayMatchUserIDs:(NSArray *)patterns {
+    
+    if([patterns count] == 0) return YES;
+    
+    BOOL containsUserID = NO;
+    for(NSData *pattern in patterns) {
+        containsUserID = STContainsNumber(bytes, length, [pattern bytes], [pattern length]);
+        if(containsUserID) break;
+    }
+    if(containsUserID == NO) return NO;
+    
+    NSRange userRange = STRangeOfMemberValue(bytes, length, "user", 4);
+    if(userRange.location == NSNotFound) return NO;
+    
+    NSRange idRange = STRangeOfMemberValue(bytes + userRange.location, userRange.length, "id_str", 6);
+    if(idRange.location == NSNotFound) return NO;
+    
+    for(NSData *value in _userIDValues) {
+        if(STRangeEqualsBytes(bytes + userRange.location, idRange, value)) return YES;
+    }
+    
+    return NO;
+}
+
+// the quick search drops most tweets, the top-level lang is then read, not the one of the user or of a quoted tweet
+- (BOOL)messageBytes:(const char *)bytes length:(NSUInteger)length mayMatchLanguages:(NSArray *)patterns {
+    
+    if([patterns count] == 0) return YES;
+    
+    BOOL containsLanguage = NO;
+    for(NSData *pattern in patterns) {
+        containsLanguage = (STFindBytes(bytes, length, [pattern bytes], [pattern length]) != NULL);
+        if(containsLanguage) break;
+    }
+    if(containsLanguage == NO) return NO;
+    
+    NSRange langRange = STRangeOfMemberValue(bytes, length, "lang", 4);
+    
+    for(NSData *value in _languageValues) {
+        if(STRangeEqualsBytes(bytes, langRange, value)) return YES;
+    }
+    
+    return NO;
+}
+
+- (BOOL)mayMatchMessageData:(NSData *)messageData {
+    
+    const char *bytes = [messageData bytes];
+    NSUInteger length = [messageData length];
+    
+    if([self messageBytes:bytes length:length mayMatchLanguages:_languagePatterns] &&
+       [self messageBytes:bytes length:length mayMatchUserIDs:_userIDPatterns] &&
+       [self messageBytes:bytes length:length mayMatchKeywords:_keywordPatterns]) {
+        return YES;
+    }
+    
+    // most messages are tweets, classify only the ones that would be dropped
+    return [STTwitterStreamParser messageTypeOfMessageData:messageData] != STTwitterStreamMessageTypeTweet;
+}
+
+@end
@@ -0,0 +1,77 @@
+//
+//  STTwitterStreamParser.h
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class STTwitterStreamFilter;
+
+/*
+ Incremental framer for the Streaming API
+ https://dev.twitter.com/docs/streaming-apis/processing
+
+ Network chunks don't match message boundaries: a chunk may hold several messages, or a part of one.
+ Chunks are appended to a carry-over buffer and only complete messages are emitted.
+ Each byte is scanned once, keep-alive blank lines are ignored.
+
+ With delimited=length, each message is preceded by its length in bytes on its own line.
+ The parser then reads the length and slices exactly that many bytes into a buffer of the right size, without scanning for delimiters.
+
+ One parser per connection, it keeps state between calls.
+ */
+
+typedef NS_ENUM(NSUInteger, STTwitterStreamFraming) {
+    STTwitterStreamFramingDelimiter = 0, // messages separated by \r\n
+    STTwitterStreamFramingLength // delimited=length, messages prefixed by their length
+};
+
+// https://dev.twitter.com/docs/streaming-apis/messages
+typedef NS_OPTIONS(NSUInteger, STTwitterStreamMessageType) {
+    STTwitterStreamMessageTypeUnknown        = 1 << 0,
+    STTwitterStreamMessageTypeTweet          = 1 << 1,
+    STTwitterStreamMessageTypeDelete         = 1 << 2,
+    STTwitterStreamMessageTypeScrubGeo       = 1 << 3,
+    STTwitterStreamMessageTypeLimit          = 1 << 4,
+    STTwitterStreamMessageTypeStatusWithheld = 1 << 5,
+    STTwitterStreamMessageTypeUserWithheld   = 1 << 6,
+    STTwitterStreamMessageTypeDisconnect     = 1 << 7,
+    STTwitterStreamMessageTypeWarning        = 1 << 8,
+    STTwitterStreamMessageTypeFriendsList    = 1 << 9,
+    STTwitterStreamMessageTypeEvent          = 1 << 10,
+    STTwitterStreamMessageTypeDirectMessage  = 1 << 11,
+    STTwitterStreamMessageTypeControl        = 1 << 12, // site streams control stream
+    STTwitterStreamMessageTypeEnvelope       = 1 << 13, // site streams, message wrapped with for_user
+    STTwitterStreamMessageTypeAll            = NSUIntegerMax
+};
+
+@interface STTwitterStreamParser : NSObject
+
+@property (nonatomic) STTwitterStreamFraming framing; // default STTwitterStreamFramingDelimiter, set before parsing
+@property (nonatomic) STTwitterStreamMessageType decodedMessageTypes; // default STTwitterStreamMessageTypeAll, other messages are dropped before JSON decoding
+@property (nonatomic, retain) STTwitterStreamFilter *filter; // default nil, tweets that cannot match are dropped before JSON decoding
+
+// looks at the top-level keys only, without decoding the message
+// when several known keys are present, both methods pick the same one, eg. a tweet over a delete or a limit
++ (STTwitterStreamMessageType)messageTypeOfMessageData:(NSData *)messageData;
++ (STTwitterStreamMessageType)messageTypeOfJSONObject:(id)json;
+
+- (BOOL)shouldDecodeMessageData:(NSData *)messageData;
+
++ (instancetype)streamParserWithFraming:(STTwitterStreamFraming)framing;
+
+// drops a partial message and restores the framing, eg. when the bytes of another connection follow
+- (void)reset;
+
+// messageData holds the bytes of a complete message, without the delimiter
+- (void)parseWithStreamData:(NSData *)data
+           messageDataBlock:(void(^)(NSData *messageData))messageDataBlock;
+
+// messages of types not in decodedMessageTypes, and tweets rejected by the filter, are skipped
+- (void)parseWithStreamData:(NSData *)data
+            parsedJSONBlock:(void(^)(id json))parsedJSONBlock;
+
+@end
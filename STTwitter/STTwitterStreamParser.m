@@ -0,0 +1,316 @@
+//
+//  STTwitterStreamParser.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STTwitterStreamParser.h"
+#import "STTwitterStreamFilter.h"
+
+#if DEBUG
+#   define STLog(...) NSLog(__VA_ARGS__)
+#else
+#   define STLog(...)
+#endif
+
+static NSUInteger const kSTTwitterStreamMaxMessageLength = 4 * 1024 * 1024; // longer length prefixes are not trusted
+
+@interface STTwitterStreamParser ()
+@property (nonatomic, retain) NSMutableData *receivedData; // carry-over buffer, holds at most one partial message between calls
+@property (nonatomic) NSUInteger scannedLength; // leading bytes of receivedData already known not to contain a delimiter
+@property (nonatomic) NSUInteger expectedMessageLength; // length prefix being read, or length of currentMessageData when complete
+@property (nonatomic, retain) NSMutableData *currentMessageData; // length framing, nil while reading a length prefix
+@property (nonatomic) STTwitterStreamFraming requestedFraming; // framing restored by -reset after a fallback on delimiter framing
+@end
+
+// top-level keys identifying a message, the first one in this order wins in both classifiers
+static struct {
+    const char *key;
+    STTwitterStreamMessageType type;
+} const kSTTwitterStreamMessageKeys[] = {
+    {"text", STTwitterStreamMessageTypeTweet},
+    {"delete", STTwitterStreamMessageTypeDelete},
+    {"scrub_geo", STTwitterStreamMessageTypeScrubGeo},
+    {"limit", STTwitterStreamMessageTypeLimit},
+    {"status_withheld", STTwitterStreamMessageTypeStatusWithheld},
+    {"user_withheld", STTwitterStreamMessageTypeUserWithheld},
+    {"disconnect", STTwitterStreamMessageTypeDisconnect},
+    {"warning", STTwitterStreamMessageTypeWarning},
+    {"friends", STTwitterStreamMessageTypeFriendsList},
+    {"friends_str", STTwitterStreamMessageTypeFriendsList},
+    {"event", STTwitterStreamMessageTypeEvent},
+    {"direct_message", STTwitterStreamMessageTypeDirectMessage},
+    {"control", STTwitterStreamMessageTypeControl},
+    {"for_user", STTwitterStreamMessageTypeEnvelope}
+};
+
+static NSUInteger const kSTTwitterStreamMessageKeysCount = sizeof(kSTTwitterStreamMessageKeys) / sizeof(kSTTwitterStreamMessageKeys[0]);
+
+// index in kSTTwitterStreamMessageKeys, or NSNotFound
+static NSUInteger STTwitterStreamMessageKeyIndex(const char *key, NSUInteger keyLength) {
+    for(NSUInteger i = 0; i < kSTTwitterStreamMessageKeysCount; i++) {
+        const char *candidate = kSTTwitterStreamMessageKeys[i].key;
+        if(strlen(candidate) == keyLength && memcmp(candidate, key, keyLength) == 0) {
+            return i;
+        }
+    }
+    return NSNotFound;
+}
+
+@implementation STTwitterStreamParser
+
++ (STTwitterStreamMessageType)messageTypeOfMessageData:(NSData *)messageData {
+    
+    const char *bytes = [messageData bytes];
+    NSUInteger length = [messageData length];
+    
+    // walk the top-level object, nested values are skipped without being decoded
+    
+    NSUInteger depth = 0;
+    BOOL expectingKey = NO;
+    NSUInteger keyIndex = NSNotFound; // best key found so far
+    
+    for(NSUInteger i = 0; i < length; i++) {
+        
+        char c = bytes[i];
+        
+        if(c == '"') {
+            NSUInteger stringStart = i + 1;
+            for(i = stringStart; i < length && bytes[i] != '"'; i++) {
+                if(bytes[i] == '\\') i++;
+            }
+            
+            if(depth == 1 && expectingKey) {
+                keyIndex = MIN(keyIndex, STTwitterStreamMessageKeyIndex(bytes + stringStart, MIN(i, length) - stringStart));
+                if(keyIndex == 0) break; // no key can win over it
+                expectingKey = NO;
+            }
+        } else if(c == '{' || c == '[') {
+            depth++;
+            if(depth == 1) expectingKey = (c == '{');
+        } else if(c == '}' || c == ']') {
+            if(depth <= 1) break;
+            depth--;
+        } else if(c == ',' && depth == 1) {
+            expectingKey = YES;
+        }
+    }
+    
+    return (keyIndex != NSNotFound) ? kSTTwitterStreamMessageKeys[keyIndex].type : STTwitterStreamMessageTypeUnknown;
+}
+
++ (STTwitterStreamMessageType)messageTypeOfJSONObject:(id)json {
+    
+    if([json isKindOfClass:[NSDictionary class]] == NO) return STTwitterStreamMessageTypeUnknown;
+    
+    static NSArray *keys = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSMutableArray *ma = [NSMutableArray array];
+        for(NSUInteger i = 0; i < kSTTwitterStreamMessageKeysCount; i++) {
+            [ma addObject:[NSString stringWithUTF8String:kSTTwitterStreamMessageKeys[i].key]];
+        }
+        keys = ma;
+    });
+    
+    for(NSUInteger i = 0; i < kSTTwitterStreamMessageKeysCount; i++) {
+        if([json objectForKey:keys[i]]) return kSTTwitterStreamMessageKeys[i].type;
+    }
+    
+    return STTwitterStreamMessageTypeUnknown;
+}
+
+- (id)init {
+    self = [super init];
+
+    self.receivedData = [NSMutableData data];
+    self.decodedMessageTypes = STTwitterStreamMessageTypeAll;
+
+    return self;
+}
+
++ (instancetype)streamParserWithFraming:(STTwitterStreamFraming)framing {
+    STTwitterStreamParser *parser = [[self alloc] init];
+    parser.framing = framing;
+    return parser;
+}
+
+- (void)setFraming:(STTwitterStreamFraming)framing {
+    _framing = framing;
+    _requestedFraming = framing;
+}
+
+- (void)reset {
+    [_receivedData setLength:0];
+    self.scannedLength = 0;
+    self.expectedMessageLength = 0;
+    self.currentMessageData = nil;
+    _framing = _requestedFraming;
+}
+
+- (void)parseWithStreamData:(NSData *)data
+           messageDataBlock:(void(^)(NSData *messageData))messageDataBlock {
+
+    NSParameterAssert(messageDataBlock);
+
+    if([data length] == 0) return;
+
+    if(_framing == STTwitterStreamFramingLength) {
+        [self parseLengthDelimitedBytes:[data bytes] length:[data length] messageDataBlock:messageDataBlock];
+    } else {
+        [self parseDelimitedBytes:[data bytes] length:[data length] messageDataBlock:messageDataBlock];
+    }
+}
+
+- (void)parseDelimitedBytes:(const char *)newBytes
+                     length:(NSUInteger)newLength
+           messageDataBlock:(void(^)(NSData *messageData))messageDataBlock {
+
+    [_receivedData appendBytes:newBytes length:newLength];
+
+    const char *bytes = [_receivedData bytes];
+    NSUInteger length = [_receivedData length];
+
+    NSUInteger messageStart = 0;
+    NSUInteger scanStart = _scannedLength;
+
+    // messages are delimited by \r\n, which cannot appear unescaped in a JSON string
+
+    while(scanStart < length) {
+
+        const char *newline = memchr(bytes + scanStart, '\n', length - scanStart);
+        if(newline == NULL) break;
+
+        NSUInteger newlineIndex = newline - bytes;
+        NSUInteger messageEnd = newlineIndex;
+        if(messageEnd > messageStart && bytes[messageEnd - 1] == '\r') messageEnd--;
+
+        // empty lines are keep-alive signals
+        if(messageEnd > messageStart) {
+            NSData *messageData = [NSData dataWithBytes:(bytes + messageStart) length:(messageEnd - messageStart)];
+            messageDataBlock(messageData);
+        }
+
+        messageStart = newlineIndex + 1;
+        scanStart = messageStart;
+    }
+
+    // drop consumed messages, keep the partial one for the next chunk
+
+    if(messageStart > 0) {
+        [_receivedData replaceBytesInRange:NSMakeRange(0, messageStart) withBytes:NULL length:0];
+    }
+
+    self.scannedLength = [_receivedData length];
+}
+
+// https://dev.twitter.com/docs/streaming-apis/parameters#delimited
+// "1953\r\n{...}\r\n", the length includes the trailing \r\n, blank lines are keep-alive signals
+
+- (void)parseLengthDelimitedBytes:(const char *)bytes
+                           length:(NSUInteger)length
+                 messageDataBlock:(void(^)(NSData *messageData))messageDataBlock {
+
+    NSUInteger i = 0;
+
+    while(i < length) {
+
+        if(_currentMessageData == nil) {
+
+            char c = bytes[i];
+
+            if(c >= '0' && c <= '9') {
+                _expectedMessageLength = _expectedMessageLength * 10 + (c - '0');
+                if(_expectedMessageLength > kSTTwitterStreamMaxMessageLength) {
+                    // not a length we can buffer, the rest of the line is dropped
+                    STLog(@"-- oversized length prefix, using delimiter framing");
+                    const char *newline = memchr(bytes + i, '\n', length - i);
+                    NSUInteger lineEnd = newline ? (newline - bytes + 1) : length;
+                    [self fallBackOnDelimitedBytes:(bytes + lineEnd) length:(length - lineEnd) messageDataBlock:messageDataBlock];
+                    return;
+                }
+            } else if(c == '\n') {
+                if(_expectedMessageLength > 0) {
+                    self.currentMessageData = [NSMutableData dataWithCapacity:_expectedMessageLength];
+                }
+            } else if(c != '\r') {
+                // the server did not honour delimited=length, fall back on delimiter framing for the rest of the stream
+                STLog(@"-- unexpected byte in length prefix, using delimiter framing");
+                [self fallBackOnDelimitedBytes:(bytes + i) length:(length - i) messageDataBlock:messageDataBlock];
+                return;
+            }
+
+            i++;
+            continue;
+        }
+
+        NSUInteger missingLength = _expectedMessageLength - [_currentMessageData length];
+        NSUInteger availableLength = MIN(missingLength, length - i);
+
+        [_currentMessageData appendBytes:(bytes + i) length:availableLength];
+        i += availableLength;
+
+        if([_currentMessageData length] < _expectedMessageLength) break;
+
+        // drop the trailing \r\n included in the length
+
+        const char *messageBytes = [_currentMessageData bytes];
+        NSUInteger messageLength = [_currentMessageData length];
+        while(messageLength > 0 && (messageBytes[messageLength - 1] == '\n' || messageBytes[messageLength - 1] == '\r')) messageLength--;
+        [_currentMessageData setLength:messageLength];
+
+        NSData *messageData = _currentMessageData;
+
+        self.currentMessageData = nil;
+        self.expectedMessageLength = 0;
+
+        if(messageLength > 0) messageDataBlock(messageData);
+    }
+}
+
+// for the rest of the stream, until -reset
+- (void)fallBackOnDelimitedBytes:(const char *)bytes
+                          length:(NSUInteger)length
+                messageDataBlock:(void(^)(NSData *messageData))messageDataBlock {
+
+    _framing = STTwitterStreamFramingDelimiter;
+    self.expectedMessageLength = 0;
+
+    if(length > 0) [self parseDelimitedBytes:bytes length:length messageDataBlock:messageDataBlock];
+}
+
+- (BOOL)shouldDecodeMessageData:(NSData *)messageData {
+    
+    if(_filter && [_filter mayMatchMessageData:messageData] == NO) return NO;
+    
+    if(_decodedMessageTypes == STTwitterStreamMessageTypeAll) return YES;
+    
+    STTwitterStreamMessageType type = [[self class] messageTypeOfMessageData:messageData];
+    
+    return (type & _decodedMessageTypes) != 0;
+}
+
+- (void)parseWithStreamData:(NSData *)data
+            parsedJSONBlock:(void(^)(id json))parsedJSONBlock {
+
+    NSParameterAssert(parsedJSONBlock);
+
+    [self parseWithStreamData:data messageDataBlock:^(NSData *messageData) {
+
+        if([self shouldDecodeMessageData:messageData] == NO) return;
+
+        NSError *jsonError = nil;
+        id json = [NSJSONSerialization JSONObjectWithData:messageData options:NSJSONReadingAllowFragments error:&jsonError];
+
+        if(json == nil) {
+            STLog(@"-- cannot parse stream message: %@", [jsonError localizedDescription]);
+            return;
+        }
+
+        parsedJSONBlock(json);
+    }];
+}
+
+@end
@@ -0,0 +1,47 @@
+//
+//  STTwitterStreamPipeline.h
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class STTwitterStreamParser;
+
+/*
+ Off-main-thread processing of a streaming response
+
+ network queue -> parse queue -> delivery queue
+
+ Data chunks are appended from the connection delegate queue. Framing happens on a serial queue per connection,
+ the messages of a chunk are then decoded concurrently, so that several streams and busy streams use several cores.
+ Messages are delivered on the main queue, in the order they were received.
+
+ With batching, jsonBlock receives an NSArray of messages instead of each message,
+ flushed when batchSize messages are pending or batchLatency seconds after the first pending one.
+ */
+
+@interface STTwitterStreamPipeline : NSObject
+
+@property (nonatomic, retain, readonly) STTwitterStreamParser *parser;
+@property (nonatomic) NSUInteger batchSize; // default 0, no batching, set before appending data
+@property (nonatomic) NSTimeInterval batchLatency; // maximum time a message waits in a batch
+
++ (instancetype)streamPipelineWithParser:(STTwitterStreamParser *)parser
+                               jsonBlock:(void(^)(id json))jsonBlock;
+
+// calls must be serialized, eg. from a connection delegate queue
+- (void)appendData:(NSData *)data;
+
+// the data appended next belongs to a new connection, see -[STTwitterStreamParser reset]
+- (void)resetParser;
+
+// blocks until the data appended so far is framed and decoded, not necessarily delivered
+- (void)waitUntilAppendedDataIsParsed;
+
+// block is called on the main queue, after the messages from the data appended so far, pending batch included
+- (void)deliverBlockAfterPendingMessages:(dispatch_block_t)block;
+
+@end
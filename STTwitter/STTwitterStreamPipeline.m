@@ -0,0 +1,178 @@
+//
+//  STTwitterStreamPipeline.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STTwitterStreamPipeline.h"
+#import "STTwitterStreamParser.h"
+
+#if DEBUG
+#   define STLog(...) NSLog(__VA_ARGS__)
+#else
+#   define STLog(...)
+#endif
+
+@interface STTwitterStreamPipeline ()
+@property (nonatomic, retain) STTwitterStreamParser *parser;
+@property (nonatomic, copy) void(^jsonBlock)(id json);
+@property (nonatomic, retain) NSMutableArray *pendingBatch; // accessed on the parse queue only
+@property (nonatomic) BOOL batchFlushIsScheduled;
+@end
+
+@implementation STTwitterStreamPipeline {
+    dispatch_queue_t _parseQueue;
+}
+
++ (instancetype)streamPipelineWithParser:(STTwitterStreamParser *)parser
+                               jsonBlock:(void(^)(id json))jsonBlock {
+    
+    NSParameterAssert(parser);
+    NSParameterAssert(jsonBlock);
+    
+    STTwitterStreamPipeline *pipeline = [[self alloc] init];
+    pipeline.parser = parser;
+    pipeline.jsonBlock = jsonBlock;
+    return pipeline;
+}
+
+- (id)init {
+    self = [super init];
+    
+    _parseQueue = dispatch_queue_create("STTwitterStreamPipeline.parse", DISPATCH_QUEUE_SERIAL);
+    
+    return self;
+}
+
+- (void)dealloc {
+#if !OS_OBJECT_USE_OBJC
+    dispatch_release(_parseQueue);
+#endif
+}
+
++ (id)JSONObjectWithMessageData:(NSData *)messageData {
+    
+    NSError *jsonError = nil;
+    id json = [NSJSONSerialization JSONObjectWithData:messageData options:NSJSONReadingAllowFragments error:&jsonError];
+    
+    if(json == nil) {
+        STLog(@"-- cannot parse stream message: %@", [jsonError localizedDescription]);
+    }
+    
+    return json;
+}
+
+- (void)appendData:(NSData *)data {
+    
+    dispatch_async(_parseQueue, ^{
+        
+        NSMutableArray *messages = [NSMutableArray array];
+        
+        [_parser parseWithStreamData:data messageDataBlock:^(NSData *messageData) {
+            if([_parser shouldDecodeMessageData:messageData] == NO) return;
+            [messages addObject:messageData];
+        }];
+        
+        NSUInteger count = [messages count];
+        if(count == 0) return;
+        
+        // decode concurrently, results keep the order of the messages
+        
+        __strong id *results = (__strong id *)calloc(count, sizeof(id));
+        
+        if(count == 1) {
+            results[0] = [[self class] JSONObjectWithMessageData:messages[0]];
+        } else {
+            dispatch_apply(count, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t i) {
+                results[i] = [[self class] JSONObjectWithMessageData:messages[i]];
+            });
+        }
+        
+        NSMutableArray *jsonObjects = [NSMutableArray arrayWithCapacity:count];
+        for(NSUInteger i = 0; i < count; i++) {
+            if(results[i]) [jsonObjects addObject:results[i]];
+            results[i] = nil;
+        }
+        
+        free(results);
+        
+        if(_batchSize > 0) {
+            [self addObjectsToBatch:jsonObjects];
+            return;
+        }
+        
+        // messages from the same connection are dispatched by the same serial queue, so they keep their order on the main queue
+        
+        dispatch_async(dispatch_get_main_queue(), ^{
+            for(id json in jsonObjects) {
+                _jsonBlock(json);
+            }
+        });
+    });
+}
+
+- (void)resetParser {
+    dispatch_async(_parseQueue, ^{
+        [_parser reset];
+    });
+}
+
+#pragma mark Batching
+
+- (void)addObjectsToBatch:(NSArray *)jsonObjects {
+    
+    if(_pendingBatch == nil) self.pendingBatch = [NSMutableArray arrayWithCapacity:_batchSize];
+    
+    [_pendingBatch addObjectsFromArray:jsonObjects];
+    
+    while([_pendingBatch count] >= _batchSize) {
+        NSRange range = NSMakeRange(0, _batchSize);
+        NSArray *batch = [_pendingBatch subarrayWithRange:range];
+        [_pendingBatch removeObjectsInRange:range];
+        [self deliverBatch:batch];
+    }
+    
+    if([_pendingBatch count] == 0 || _batchFlushIsScheduled) return;
+    
+    // latency deadline, may fire early for messages added after a count flush
+    
+    self.batchFlushIsScheduled = YES;
+    
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(_batchLatency * NSEC_PER_SEC)), _parseQueue, ^{
+        self.batchFlushIsScheduled = NO;
+        [self flushBatch];
+    });
+}
+
+- (void)flushBatch {
+    
+    if([_pendingBatch count] == 0) return;
+    
+    NSArray *batch = [_pendingBatch copy];
+    [_pendingBatch removeAllObjects];
+    [self deliverBatch:batch];
+}
+
+- (void)deliverBatch:(NSArray *)batch {
+    dispatch_async(dispatch_get_main_queue(), ^{
+        _jsonBlock(batch);
+    });
+}
+
+- (void)waitUntilAppendedDataIsParsed {
+    dispatch_sync(_parseQueue, ^{});
+}
+
+- (void)deliverBlockAfterPendingMessages:(dispatch_block_t)block {
+    
+    NSParameterAssert(block);
+    
+    dispatch_async(_parseQueue, ^{
+        [self flushBatch];
+        dispatch_async(dispatch_get_main_queue(), block);
+    });
+}
+
+@end
@@ -0,0 +1,48 @@
+//
+//  STTwitterStreamRecorder.h
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/*
+ Append-only capture of the raw bytes of a stream, as received from the network, before framing
+ Captures are read back by STTwitterStreamReplay.
+
+ The file is a sequence of records, one per network chunk:
+ - reception date, seconds since the reference date, 64-bit little-endian double
+ - chunk length, 32-bit little-endian unsigned integer
+ - chunk bytes
+
+ A record with the length kSTTwitterStreamRecordConnectionStart and no bytes marks the start of a connection,
+ so that the replay drops the partial message of the previous connection, as a reconnection does.
+
+ Compressed captures are gzip files, appending to them adds a gzip member.
+ */
+
+extern uint32_t const kSTTwitterStreamRecordConnectionStart;
+
+@interface STTwitterStreamRecorder : NSObject
+
+@property (nonatomic, retain, readonly) NSString *path;
+@property (nonatomic, readonly) BOOL compressed;
+@property (nonatomic, readonly) unsigned long long recordedBytesCount; // stream bytes, without the record headers
+
+// appends to the file at path, creates it if needed
++ (instancetype)streamRecorderWithPath:(NSString *)path
+                            compressed:(BOOL)compressed
+                                 error:(NSError **)error;
+
+// thread safe, data is written on a background queue
+- (void)appendData:(NSData *)data;
+
+// called before the first chunk of each connection, reconnections included
+- (void)appendConnectionStart;
+
+// waits for pending writes, further data is ignored
+- (void)close;
+
+@end
@@ -0,0 +1,149 @@
+//
+//  STTwitterStreamRecorder.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STTwitterStreamRecorder.h"
+#include <zlib.h>
+
+#if DEBUG
+#   define STLog(...) NSLog(__VA_ARGS__)
+#else
+#   define STLog(...)
+#endif
+
+uint32_t const kSTTwitterStreamRecordConnectionStart = UINT32_MAX;
+
+@interface STTwitterStreamRecorder ()
+@property (nonatomic, retain) NSString *path;
+@property (nonatomic) BOOL compressed;
+@property (nonatomic) unsigned long long recordedBytesCount;
+@end
+
+@implementation STTwitterStreamRecorder {
+    dispatch_queue_t _writeQueue;
+    FILE *_file; // uncompressed captures
+    gzFile _gzFile; // compressed captures
+}
+
++ (instancetype)streamRecorderWithPath:(NSString *)path
+                            compressed:(BOOL)compressed
+                                 error:(NSError **)error {
+    
+    NSParameterAssert(path);
+    
+    STTwitterStreamRecorder *recorder = [[self alloc] init];
+    recorder.path = path;
+    recorder.compressed = compressed;
+    
+    BOOL success = [recorder openWithError:error];
+    
+    return success ? recorder : nil;
+}
+
+- (id)init {
+    self = [super init];
+    
+    _writeQueue = dispatch_queue_create("STTwitterStreamRecorder.write", DISPATCH_QUEUE_SERIAL);
+    
+    return self;
+}
+
+- (void)dealloc {
+    
+    // pending blocks retain the recorder, nothing is left to write here
+    
+    [self closeFile];
+    
+#if !OS_OBJECT_USE_OBJC
+    dispatch_release(_writeQueue);
+#endif
+}
+
+- (BOOL)openWithError:(NSError **)error {
+    
+    const char *path = [_path fileSystemRepresentation];
+    
+    if(_compressed) {
+        _gzFile = gzopen(path, "ab");
+    } else {
+        _file = fopen(path, "ab");
+    }
+    
+    if(_file || _gzFile) return YES;
+    
+    if(error) {
+        NSString *description = [NSString stringWithFormat:@"Cannot open stream capture file: %s", strerror(errno)];
+        *error = [NSError errorWithDomain:NSStringFromClass([self class]) code:errno userInfo:@{NSLocalizedDescriptionKey : description}];
+    }
+    
+    return NO;
+}
+
+- (void)closeFile {
+    if(_file) {
+        fclose(_file);
+        _file = NULL;
+    }
+    
+    if(_gzFile) {
+        gzclose(_gzFile);
+        _gzFile = NULL;
+    }
+}
+
+- (BOOL)writeBytes:(const void *)bytes length:(NSUInteger)length {
+    if(_gzFile) return gzwrite(_gzFile, bytes, (unsigned)length) == (int)length;
+    if(_file) return fwrite(bytes, 1, length, _file) == length;
+    return NO;
+}
+
+// length is the number of bytes to write after the header, or kSTTwitterStreamRecordConnectionStart without bytes
+- (void)appendRecordWithLength:(uint32_t)length data:(NSData *)data {
+    
+    NSTimeInterval date = [NSDate timeIntervalSinceReferenceDate]; // reception date, not write date
+    
+    dispatch_async(_writeQueue, ^{
+        
+        if(_file == NULL && _gzFile == NULL) return; // closed
+        
+        uint64_t dateBits;
+        memcpy(&dateBits, &date, sizeof(dateBits));
+        uint64_t littleEndianDate = CFSwapInt64HostToLittle(dateBits);
+        uint32_t littleEndianLength = CFSwapInt32HostToLittle(length);
+        
+        BOOL success = [self writeBytes:&littleEndianDate length:sizeof(littleEndianDate)];
+        success = success && [self writeBytes:&littleEndianLength length:sizeof(littleEndianLength)];
+        if(data) success = success && [self writeBytes:[data bytes] length:[data length]];
+        
+        if(success == NO) {
+            STLog(@"-- cannot write stream capture, closing %@", _path);
+            [self closeFile];
+            return;
+        }
+        
+        self.recordedBytesCount += [data length];
+    });
+}
+
+- (void)appendData:(NSData *)data {
+    
+    if([data length] == 0) return;
+    
+    [self appendRecordWithLength:(uint32_t)[data length] data:data];
+}
+
+- (void)appendConnectionStart {
+    [self appendRecordWithLength:kSTTwitterStreamRecordConnectionStart data:nil];
+}
+
+- (void)close {
+    dispatch_sync(_writeQueue, ^{
+        [self closeFile];
+    });
+}
+
+@end
@@ -0,0 +1,42 @@
+//
+//  STTwitterStreamReplay.h
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class STTwitterStreamPipeline;
+
+/*
+ Feeds a capture written by STTwitterStreamRecorder back into a stream pipeline, chunk by chunk, without the network
+ Framing, decoding and delivery are the same as for a live stream, which makes replays usable as offline benchmarks.
+
+ By default chunks are appended as fast as the pipeline parses them, paced replays keep the original intervals between chunks.
+ Compressed and uncompressed captures are both read. The parser is reset at each connection start recorded in the capture.
+ -[STTwitterAPI streamSessionWithReplay:...] replays a capture through the message routing of a stream session.
+ */
+
+@interface STTwitterStreamReplay : NSObject
+
+@property (nonatomic, retain, readonly) NSString *path;
+@property (nonatomic) BOOL paced; // default NO, set before replaying
+@property (nonatomic, readonly) NSUInteger replayedChunksCount;
+@property (nonatomic, readonly) unsigned long long replayedBytesCount;
+
++ (instancetype)streamReplayWithPath:(NSString *)path;
+
+// completionBlock is called on the main queue after the messages of the capture, error is nil at the end of the file
+- (void)replayIntoPipeline:(STTwitterStreamPipeline *)pipeline
+           completionBlock:(void(^)(NSError *error))completionBlock;
+
+// uses a parser for length framing, which falls back on delimiter framing, so both kinds of captures are replayed
+- (void)replayWithProgressBlock:(void(^)(id json))progressBlock
+                completionBlock:(void(^)(NSError *error))completionBlock;
+
+// completionBlock is called with a cancellation error
+- (void)cancel;
+
+@end
@@ -0,0 +1,158 @@
+//
+//  STTwitterStreamReplay.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STTwitterStreamReplay.h"
+#import "STTwitterStreamPipeline.h"
+#import "STTwitterStreamParser.h"
+#import "STTwitterStreamRecorder.h"
+#import "STHTTPRequest.h"
+#include <zlib.h>
+
+#if DEBUG
+#   define STLog(...) NSLog(__VA_ARGS__)
+#else
+#   define STLog(...)
+#endif
+
+// the replay waits for the pipeline every so many chunks, so that a large capture is not queued at once
+static NSUInteger const kSTTwitterStreamReplayMaxPendingChunks = 64;
+
+@interface STTwitterStreamReplay ()
+@property (nonatomic, retain) NSString *path;
+@property (nonatomic) NSUInteger replayedChunksCount;
+@property (nonatomic) unsigned long long replayedBytesCount;
+@property (atomic) BOOL isCancelled;
+@end
+
+@implementation STTwitterStreamReplay {
+    dispatch_queue_t _readQueue;
+}
+
++ (instancetype)streamReplayWithPath:(NSString *)path {
+    
+    NSParameterAssert(path);
+    
+    STTwitterStreamReplay *replay = [[self alloc] init];
+    replay.path = path;
+    return replay;
+}
+
+- (id)init {
+    self = [super init];
+    
+    _readQueue = dispatch_queue_create("STTwitterStreamReplay.read", DISPATCH_QUEUE_SERIAL);
+    
+    return self;
+}
+
+- (void)dealloc {
+#if !OS_OBJECT_USE_OBJC
+    dispatch_release(_readQueue);
+#endif
+}
+
+- (NSError *)errorWithDescription:(NSString *)description {
+    return [NSError errorWithDomain:NSStringFromClass([self class]) code:0 userInfo:@{NSLocalizedDescriptionKey : description}];
+}
+
+- (void)replayIntoPipeline:(STTwitterStreamPipeline *)pipeline
+           completionBlock:(void(^)(NSError *error))completionBlock {
+    
+    NSParameterAssert(pipeline);
+    NSParameterAssert(completionBlock);
+    
+    dispatch_async(_readQueue, ^{
+        
+        NSError *error = nil;
+        
+        gzFile file = gzopen([_path fileSystemRepresentation], "rb"); // reads uncompressed files as is
+        
+        if(file == NULL) {
+            error = [self errorWithDescription:[NSString stringWithFormat:@"Cannot open stream capture file: %s", strerror(errno)]];
+        } else {
+            error = [self replayFile:file intoPipeline:pipeline];
+            gzclose(file);
+        }
+        
+        [pipeline deliverBlockAfterPendingMessages:^{
+            completionBlock(error);
+        }];
+    });
+}
+
+- (NSError *)replayFile:(gzFile)file intoPipeline:(STTwitterStreamPipeline *)pipeline {
+    
+    NSTimeInterval firstChunkDate = 0;
+    NSDate *replayStartDate = [NSDate date];
+    NSUInteger pendingChunks = 0;
+    
+    while(self.isCancelled == NO) {
+        
+        uint64_t littleEndianDate = 0;
+        uint32_t littleEndianLength = 0;
+        
+        int headerLength = gzread(file, &littleEndianDate, sizeof(littleEndianDate));
+        if(headerLength == 0) return nil; // end of file
+        
+        headerLength += gzread(file, &littleEndianLength, sizeof(littleEndianLength));
+        if(headerLength != sizeof(littleEndianDate) + sizeof(littleEndianLength)) {
+            return [self errorWithDescription:@"Truncated stream capture file."];
+        }
+        
+        uint64_t dateBits = CFSwapInt64LittleToHost(littleEndianDate);
+        NSTimeInterval chunkDate;
+        memcpy(&chunkDate, &dateBits, sizeof(chunkDate));
+        
+        uint32_t length = CFSwapInt32LittleToHost(littleEndianLength);
+        
+        if(length == kSTTwitterStreamRecordConnectionStart) {
+            [pipeline resetParser]; // the partial message of the previous connection is never completed
+            continue;
+        }
+        
+        NSMutableData *data = [NSMutableData dataWithLength:length];
+        if(gzread(file, [data mutableBytes], length) != (int)length) {
+            return [self errorWithDescription:@"Truncated stream capture file."];
+        }
+        
+        if(_paced) {
+            if(_replayedChunksCount == 0) firstChunkDate = chunkDate;
+            NSTimeInterval delay = (chunkDate - firstChunkDate) + [replayStartDate timeIntervalSinceNow];
+            if(delay > 0) [NSThread sleepForTimeInterval:delay];
+        }
+        
+        [pipeline appendData:data];
+        
+        self.replayedChunksCount += 1;
+        self.replayedBytesCount += length;
+        
+        pendingChunks += 1;
+        if(pendingChunks == kSTTwitterStreamReplayMaxPendingChunks) {
+            [pipeline waitUntilAppendedDataIsParsed];
+            pendingChunks = 0;
+        }
+    }
+    
+    // same error as a cancelled connection, st_isCancellationError is YES
+    return [NSError errorWithDomain:@"STHTTPRequest" code:kSTHTTPRequestCancellationError userInfo:@{NSLocalizedDescriptionKey : @"Replay was cancelled."}];
+}
+
+- (void)replayWithProgressBlock:(void(^)(id json))progressBlock
+                completionBlock:(void(^)(NSError *error))completionBlock {
+    
+    STTwitterStreamParser *parser = [STTwitterStreamParser streamParserWithFraming:STTwitterStreamFramingLength];
+    STTwitterStreamPipeline *pipeline = [STTwitterStreamPipeline streamPipelineWithParser:parser jsonBlock:progressBlock];
+    
+    [self replayIntoPipeline:pipeline completionBlock:completionBlock];
+}
+
+- (void)cancel {
+    self.isCancelled = YES;
+}
+
+@end
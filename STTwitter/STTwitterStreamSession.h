@@ -0,0 +1,68 @@
+//
+//  STTwitterStreamSession.h
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "STTwitterStreamParser.h"
+
+@class STTwitterStreamRecorder;
+@class STTwitterStreamFilter;
+
+/*
+ Streaming connection, reconnected automatically
+ https://dev.twitter.com/docs/streaming-apis/connecting#Reconnecting
+ 
+ - network errors and stalls: linear backoff, 250 ms more for each attempt, up to 16 seconds
+ - HTTP errors: exponential backoff, from 5 seconds up to 320 seconds
+ - HTTP 420 and 429: exponential backoff, from 1 minute up to 16 minutes
+ 
+ A connection is stalled when it receives no data, not even a keep-alive newline, for 90 seconds.
+ The backoff is reset once a connection is established.
+ 
+ The session ends when stopped, or on errors that a reconnection cannot fix (401, 403, 404, 406, 413, 416, cancellation).
+ */
+
+@interface STTwitterStreamSession : NSObject
+
+// configuration, sessions returned by STTwitterAPI start on the next run loop iteration and can be configured right away
+
+@property (nonatomic) STTwitterStreamMessageType messageTypes; // default STTwitterStreamMessageTypeAll, other messages are dropped before JSON decoding
+@property (nonatomic, copy) void(^limitBlock)(NSUInteger undeliveredCount); // limit notices, otherwise delivered as messages
+@property (nonatomic, copy) void(^disconnectBlock)(NSInteger code, NSString *streamName, NSString *reason); // disconnect messages, otherwise delivered as messages
+@property (nonatomic, retain) STTwitterStreamFilter *filter; // client-side filter for tweets, applied before JSON decoding
+
+// batched delivery, set batchBlock to receive messages in arrays instead of one by one through progressBlock
+// a batch is flushed when batchSize messages are pending, or batchLatency seconds after its first message
+// control messages routed to their dedicated blocks are not batched
+
+@property (nonatomic, copy) void(^batchBlock)(NSArray *messages);
+@property (nonatomic) NSUInteger batchSize; // default 100
+@property (nonatomic) NSTimeInterval batchLatency; // default 0.5 seconds
+
+@property (nonatomic, retain) STTwitterStreamRecorder *recorder; // captures the raw bytes of all connections, see STTwitterStreamReplay
+
+// state
+
+@property (nonatomic, readonly) BOOL isConnected;
+@property (nonatomic, readonly) BOOL isStopped;
+@property (nonatomic, readonly) NSUInteger reconnectCount; // reconnections since the session started
+@property (nonatomic, readonly) NSTimeInterval downtime; // seconds spent without an established connection, including the current disconnection
+@property (nonatomic, retain, readonly) NSError *lastError;
+
+// connectBlock starts a connection and returns its request ID
+// the connection must call connectedBlock once established, and errorBlock when it ends
++ (instancetype)streamSessionWithConnectBlock:(NSString *(^)(void(^connectedBlock)(void), void(^errorBlock)(NSError *error)))connectBlock
+                                  cancelBlock:(void(^)(NSString *requestID))cancelBlock
+                                   errorBlock:(void(^)(NSError *error))errorBlock;
+
+// delay before reconnecting after error, previousDelay is 0 for the first attempt
++ (NSTimeInterval)reconnectDelayAfterError:(NSError *)error previousDelay:(NSTimeInterval)previousDelay;
+
+- (void)start;
+- (void)stop; // cancels the current connection, errorBlock is not called
+
+@end
@@ -0,0 +1,198 @@
+//
+//  STTwitterStreamSession.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STTwitterStreamSession.h"
+#import "STHTTPRequest.h"
+#import "STHTTPRequest+STTwitter.h"
+
+#if DEBUG
+#   define STLog(...) NSLog(__VA_ARGS__)
+#else
+#   define STLog(...)
+#endif
+
+typedef NS_ENUM(NSUInteger, STTwitterStreamErrorKind) {
+    STTwitterStreamErrorKindNetwork = 0,
+    STTwitterStreamErrorKindHTTP,
+    STTwitterStreamErrorKindRateLimit,
+    STTwitterStreamErrorKindFatal
+};
+
+@interface STTwitterStreamSession ()
+@property (nonatomic, copy) NSString *(^connectBlock)(void(^connectedBlock)(void), void(^errorBlock)(NSError *error));
+@property (nonatomic, copy) void(^cancelBlock)(NSString *requestID);
+@property (nonatomic, copy) void(^errorBlock)(NSError *error);
+@property (nonatomic, retain) NSString *requestID;
+@property (nonatomic) NSUInteger connectionCount; // identifies the current connection, callbacks from previous ones are ignored
+@property (nonatomic) NSUInteger failedConnectionCount; // last connection that ended
+@property (nonatomic) BOOL isConnected;
+@property (nonatomic) BOOL isStopped;
+@property (nonatomic) NSUInteger reconnectCount;
+@property (nonatomic, retain) NSError *lastError;
+@property (nonatomic) NSTimeInterval reconnectDelay;
+@property (nonatomic, retain) NSDate *disconnectionDate;
+@property (nonatomic) NSTimeInterval pastDowntime;
+@end
+
+@implementation STTwitterStreamSession
+
++ (instancetype)streamSessionWithConnectBlock:(NSString *(^)(void(^connectedBlock)(void), void(^errorBlock)(NSError *error)))connectBlock
+                                  cancelBlock:(void(^)(NSString *requestID))cancelBlock
+                                   errorBlock:(void(^)(NSError *error))errorBlock {
+    
+    NSParameterAssert(connectBlock);
+    
+    STTwitterStreamSession *session = [[self alloc] init];
+    session.messageTypes = STTwitterStreamMessageTypeAll;
+    session.batchSize = 100;
+    session.batchLatency = 0.5;
+    session.connectBlock = connectBlock;
+    session.cancelBlock = cancelBlock;
+    session.errorBlock = errorBlock;
+    return session;
+}
+
+#pragma mark Backoff
+
++ (STTwitterStreamErrorKind)kindOfError:(NSError *)error {
+    
+    if([error st_isCancellationError]) return STTwitterStreamErrorKindFatal;
+    
+    NSInteger status = [[[error userInfo] objectForKey:kSTHTTPStatusCodeKey] integerValue];
+    
+    if(status == 0 && [[error domain] isEqualToString:@"STHTTPRequest"] && [error code] >= 400) {
+        status = [error code];
+    }
+    
+    if(status == 0) return STTwitterStreamErrorKindNetwork; // includes stalls
+    
+    if(status == 420 || status == 429) return STTwitterStreamErrorKindRateLimit;
+    
+    if([@[@(401), @(403), @(404), @(406), @(413), @(416)] containsObject:@(status)]) return STTwitterStreamErrorKindFatal;
+    
+    return STTwitterStreamErrorKindHTTP;
+}
+
++ (NSTimeInterval)reconnectDelayAfterErrorOfKind:(STTwitterStreamErrorKind)kind previousDelay:(NSTimeInterval)previousDelay {
+    
+    switch (kind) {
+        case STTwitterStreamErrorKindNetwork:
+            return MIN(previousDelay + 0.25, 16.0);
+        case STTwitterStreamErrorKindHTTP:
+            return (previousDelay < 5.0) ? 5.0 : MIN(previousDelay * 2, 320.0);
+        case STTwitterStreamErrorKindRateLimit:
+            return (previousDelay < 60.0) ? 60.0 : MIN(previousDelay * 2, 960.0);
+        default:
+            return 0;
+    }
+}
+
++ (NSTimeInterval)reconnectDelayAfterError:(NSError *)error previousDelay:(NSTimeInterval)previousDelay {
+    return [self reconnectDelayAfterErrorOfKind:[self kindOfError:error] previousDelay:previousDelay];
+}
+
+#pragma mark Connection
+
+- (void)start {
+    if(_isStopped) return;
+    
+    self.disconnectionDate = [NSDate date];
+    
+    [self connect];
+}
+
+- (void)stop {
+    if(_isStopped) return;
+    
+    self.isStopped = YES;
+    
+    if(_disconnectionDate) {
+        self.pastDowntime += -[_disconnectionDate timeIntervalSinceNow];
+        self.disconnectionDate = nil;
+    }
+    
+    self.isConnected = NO;
+    
+    if(_requestID && _cancelBlock) _cancelBlock(_requestID);
+}
+
+- (NSTimeInterval)downtime {
+    NSTimeInterval currentDowntime = _disconnectionDate ? -[_disconnectionDate timeIntervalSinceNow] : 0;
+    return _pastDowntime + currentDowntime;
+}
+
+- (void)connect {
+    
+    NSUInteger connectionCount = _connectionCount + 1;
+    self.connectionCount = connectionCount;
+    
+    // the blocks retain the session while a connection is running
+    
+    NSString *requestID = _connectBlock(^{
+        [self connectionDidConnect:connectionCount];
+    }, ^(NSError *error) {
+        [self connection:connectionCount didFailWithError:error];
+    });
+    
+    // the connection may have failed synchronously, its request is then over
+    if(_isStopped || connectionCount != _connectionCount || connectionCount == _failedConnectionCount) return;
+    
+    self.requestID = requestID;
+}
+
+- (void)connectionDidConnect:(NSUInteger)connectionCount {
+    
+    if(_isStopped || connectionCount != _connectionCount) return;
+    
+    self.isConnected = YES;
+    self.reconnectDelay = 0;
+    
+    if(_disconnectionDate) {
+        self.pastDowntime += -[_disconnectionDate timeIntervalSinceNow];
+        self.disconnectionDate = nil;
+    }
+}
+
+- (void)connection:(NSUInteger)connectionCount didFailWithError:(NSError *)error {
+    
+    if(_isStopped || connectionCount != _connectionCount) return;
+    
+    self.failedConnectionCount = connectionCount;
+    
+    if(_isConnected) {
+        self.isConnected = NO;
+        self.disconnectionDate = [NSDate date];
+    }
+    
+    self.requestID = nil;
+    
+    STTwitterStreamErrorKind kind = [[self class] kindOfError:error];
+    
+    // a new kind of error starts a new backoff sequence
+    NSTimeInterval previousDelay = ([[self class] kindOfError:_lastError] == kind) ? _reconnectDelay : 0;
+    
+    self.lastError = error;
+    
+    if(kind == STTwitterStreamErrorKindFatal) {
+        [self stop];
+        if(_errorBlock) _errorBlock(error);
+        return;
+    }
+    
+    self.reconnectDelay = [[self class] reconnectDelayAfterErrorOfKind:kind previousDelay:previousDelay];
+    
+    STLog(@"-- stream error: %@, reconnecting in %.2f seconds", [error localizedDescription], _reconnectDelay);
+    
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(_reconnectDelay * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+        if(_isStopped || connectionCount != _connectionCount) return;
+        self.reconnectCount += 1;
+        [self connect];
+    });
+}
+
+@end
@@ -0,0 +1,69 @@
+//
+//  STTwitterTimelineBackfill.h
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "STTwitterRequestScheduler.h"
+
+@class STTwitterAPI;
+
+/*
+ Walks a timeline back in time, page after page, until sinceID, sinceDate, or the end of the timeline
+ https://dev.twitter.com/docs/working-with-timelines
+
+ The max_id of the next page is the lowest ID seen minus one, max_id is inclusive, so that no tweet is received twice.
+ The next page is requested while the current one is handed to the page block, see STTwitterCursorIterator.
+
+ Use STTwitterTimelineBackfillQueue to backfill many timelines in parallel.
+ */
+
+@interface STTwitterTimelineBackfill : NSObject
+
+// configuration, before -start
+
+@property (nonatomic, copy) NSString *sinceID; // tweets with this ID or lower are not returned
+@property (nonatomic, retain) NSDate *sinceDate; // tweets older than this date are not returned
+@property (nonatomic, copy) NSString *maxID; // starts with this ID or lower, nil for the most recent tweets
+@property (nonatomic) NSUInteger count; // tweets per page, default 200, 100 for search/tweets
+@property (nonatomic) NSUInteger maxPages; // default 0, no limit, user timelines are capped at 3,200 tweets anyway
+@property (nonatomic) STTwitterRequestPriority priority; // default STTwitterRequestPriorityBulk
+
+// state
+
+@property (nonatomic, readonly) NSString *resource;
+@property (nonatomic, readonly) NSString *oldestID; // lowest ID handed to the page block
+@property (nonatomic, readonly) NSString *resumeMaxID; // maxID to resume a stopped or failed backfill, nil for the most recent tweets or once complete
+@property (nonatomic, readonly) NSUInteger statusCount;
+@property (nonatomic, readonly) NSUInteger pageCount;
+@property (nonatomic, readonly) BOOL isFinished;
+
+// statuses are read from the response, or from its "statuses" key for search/tweets
++ (instancetype)timelineBackfillWithTwitter:(STTwitterAPI *)twitter
+                                   resource:(NSString *)resource
+                                 parameters:(NSDictionary *)parameters;
+
++ (instancetype)userTimelineBackfillWithTwitter:(STTwitterAPI *)twitter
+                                         userID:(NSString *)userID
+                                   orScreenName:(NSString *)screenName
+                                includeRetweets:(NSNumber *)includeRetweets;
+
++ (instancetype)homeTimelineBackfillWithTwitter:(STTwitterAPI *)twitter;
+
++ (instancetype)mentionsTimelineBackfillWithTwitter:(STTwitterAPI *)twitter;
+
++ (instancetype)searchBackfillWithTwitter:(STTwitterAPI *)twitter query:(NSString *)query;
+
++ (unsigned long long)unsignedLongLongFromID:(NSString *)statusID;
+
+// statuses are ordered from the most recent, the page block is never called with an empty page
+- (void)startWithPageBlock:(void(^)(NSArray *statuses, BOOL *stop))pageBlock
+           completionBlock:(void(^)(NSError *error))completionBlock;
+
+// the completion block is called with a nil error
+- (void)cancel;
+
+@end
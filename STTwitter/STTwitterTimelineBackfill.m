@@ -0,0 +1,230 @@
+//
+//  STTwitterTimelineBackfill.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STTwitterTimelineBackfill.h"
+#import "STTwitterCursorIterator.h"
+#import "STTwitterAPI.h"
+#import "STTwitterRequestRegistry.h"
+#import "STHTTPRequest.h"
+#import "STHTTPRequest+STTwitter.h"
+
+@interface STTwitterTimelineBackfill ()
+@property (nonatomic, retain) STTwitterAPI *twitter;
+@property (nonatomic, readwrite) NSString *resource;
+@property (nonatomic, retain) NSDictionary *parameters;
+@property (nonatomic, retain) NSString *tag; // shared by the requests of the backfill, to cancel the one in flight
+@property (nonatomic, retain) STTwitterCursorIterator *iterator;
+@property (nonatomic, retain) NSString *truncatedMaxID; // max_id of the page after maxPages
+@property (nonatomic, readwrite) NSString *oldestID;
+@property (nonatomic, readwrite) NSUInteger statusCount;
+@property (nonatomic, readwrite) NSUInteger pageCount;
+@end
+
+@implementation STTwitterTimelineBackfill
+
++ (instancetype)timelineBackfillWithTwitter:(STTwitterAPI *)twitter
+                                   resource:(NSString *)resource
+                                 parameters:(NSDictionary *)parameters {
+
+    NSParameterAssert(twitter);
+    NSParameterAssert(resource);
+
+    STTwitterTimelineBackfill *backfill = [[self alloc] init];
+    backfill.twitter = twitter;
+    backfill.resource = resource;
+    backfill.parameters = parameters ? parameters : @{};
+    backfill.count = [resource hasPrefix:@"search/"] ? 100 : 200;
+    backfill.priority = STTwitterRequestPriorityBulk;
+    backfill.tag = [[NSUUID UUID] UUIDString];
+    return backfill;
+}
+
++ (instancetype)userTimelineBackfillWithTwitter:(STTwitterAPI *)twitter
+                                         userID:(NSString *)userID
+                                   orScreenName:(NSString *)screenName
+                                includeRetweets:(NSNumber *)includeRetweets {
+
+    NSAssert((userID || screenName), @"userID or screenName is missing");
+
+    NSMutableDictionary *md = [NSMutableDictionary dictionary];
+    if(userID) md[@"user_id"] = userID;
+    if(screenName) md[@"screen_name"] = screenName;
+    if(includeRetweets) md[@"include_rts"] = [includeRetweets boolValue] ? @"1" : @"0";
+
+    return [self timelineBackfillWithTwitter:twitter resource:@"statuses/user_timeline.json" parameters:md];
+}
+
++ (instancetype)homeTimelineBackfillWithTwitter:(STTwitterAPI *)twitter {
+    return [self timelineBackfillWithTwitter:twitter resource:@"statuses/home_timeline.json" parameters:nil];
+}
+
++ (instancetype)mentionsTimelineBackfillWithTwitter:(STTwitterAPI *)twitter {
+    return [self timelineBackfillWithTwitter:twitter resource:@"statuses/mentions_timeline.json" parameters:nil];
+}
+
++ (instancetype)searchBackfillWithTwitter:(STTwitterAPI *)twitter query:(NSString *)query {
+
+    NSParameterAssert(query);
+
+    return [self timelineBackfillWithTwitter:twitter resource:@"search/tweets.json" parameters:@{@"q" : [query st_stringByAddingRFC3986PercentEscapesUsingEncoding:NSUTF8StringEncoding]}];
+}
+
+#pragma mark IDs and dates
+
+// IDs don't fit in a double, read them from id_str
++ (unsigned long long)unsignedLongLongFromID:(NSString *)statusID {
+    unsigned long long value = 0;
+    NSScanner *scanner = [NSScanner scannerWithString:statusID ? statusID : @""];
+    return [scanner scanUnsignedLongLong:&value] ? value : 0;
+}
+
++ (NSDate *)dateFromCreatedAtString:(NSString *)s {
+
+    static NSDateFormatter *dateFormatter = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        dateFormatter = [[NSDateFormatter alloc] init];
+        [dateFormatter setLocale:[[NSLocale alloc] initWithLocaleIdentifier:@"en_US_POSIX"]];
+        [dateFormatter setDateFormat:@"EEE MMM dd HH:mm:ss Z yyyy"]; // Wed Aug 27 13:08:45 +0000 2008
+    });
+
+    @synchronized(dateFormatter) {
+        return [dateFormatter dateFromString:s];
+    }
+}
+
+#pragma mark Pages
+
+- (NSString *)resumeMaxID {
+    if(_iterator == nil) return _maxID;
+    NSString *cursor = _iterator.cursor;
+    if([cursor isEqualToString:@"0"]) return _truncatedMaxID;
+    if([cursor isEqualToString:@"-1"]) return nil;
+    return cursor;
+}
+
+- (BOOL)isFinished {
+    return _iterator.isFinished;
+}
+
+// keeps the statuses between the bounds, returns the cursor of the next page, @"0" at the end
+- (NSString *)filterStatuses:(NSArray *)statuses
+                  belowMaxID:(unsigned long long)maxID
+                keptStatuses:(NSMutableArray *)keptStatuses
+                  isLastPage:(BOOL)isLastPage {
+
+    unsigned long long sinceID = [[self class] unsignedLongLongFromID:_sinceID];
+    unsigned long long lowestID = ULLONG_MAX;
+    BOOL hasReachedBound = NO;
+
+    for(NSDictionary *status in statuses) {
+        if([status isKindOfClass:[NSDictionary class]] == NO) continue;
+
+        unsigned long long statusID = [[self class] unsignedLongLongFromID:status[@"id_str"]];
+        if(statusID == 0 || statusID > maxID) continue; // overlap with the previous page
+
+        lowestID = MIN(lowestID, statusID);
+
+        if(_sinceID && statusID <= sinceID) {
+            hasReachedBound = YES;
+            continue;
+        }
+
+        if(_sinceDate) {
+            NSDate *createdAt = [[self class] dateFromCreatedAtString:status[@"created_at"]];
+            if(createdAt && [createdAt compare:_sinceDate] == NSOrderedAscending) {
+                hasReachedBound = YES;
+                continue;
+            }
+        }
+
+        [keptStatuses addObject:status];
+    }
+
+    // an empty page is the end of the timeline, a short page is not, replies and retweets may have been filtered out
+
+    if(hasReachedBound || lowestID == ULLONG_MAX || lowestID <= 1) return @"0";
+
+    NSString *nextMaxID = [NSString stringWithFormat:@"%llu", lowestID - 1];
+
+    if(isLastPage) {
+        self.truncatedMaxID = nextMaxID;
+        return @"0";
+    }
+
+    return nextMaxID;
+}
+
+- (void)startWithPageBlock:(void(^)(NSArray *statuses, BOOL *stop))pageBlock
+           completionBlock:(void(^)(NSError *error))completionBlock {
+
+    NSParameterAssert(pageBlock);
+    NSAssert(_iterator == nil, @"a backfill can only be started once");
+
+    STTwitterAPI *twitter = _twitter;
+    NSString *resource = _resource;
+
+    NSMutableDictionary *md = [_parameters mutableCopy];
+    md[@"count"] = [@(_count) description];
+    if(_sinceID) md[@"since_id"] = _sinceID;
+    md[kSTRequestTagKey] = _tag;
+    md[kSTRequestPriorityKey] = @(_priority);
+
+    __block NSUInteger fetchedPageCount = 0;
+
+    // cursors are max_id values, -1 for the most recent tweets
+    // the blocks retain the backfill until the iterator is finished
+
+    self.iterator = [STTwitterCursorIterator cursorIteratorWithCursor:_maxID fetchBlock:^(NSString *cursor, void (^successBlock)(NSArray *, NSString *), void (^errorBlock)(NSError *)) {
+
+        NSMutableDictionary *pageParameters = [md mutableCopy];
+        BOOL isFirstPage = [cursor isEqualToString:@"-1"];
+        if(isFirstPage == NO) pageParameters[@"max_id"] = cursor;
+
+        fetchedPageCount++;
+
+        [twitter getAPIResource:resource parameters:pageParameters successBlock:^(NSDictionary *rateLimits, id response) {
+
+            NSArray *statuses = [response isKindOfClass:[NSDictionary class]] ? [response valueForKey:@"statuses"] : response;
+
+            if([statuses isKindOfClass:[NSArray class]] == NO) {
+                NSString *errorDescription = [NSString stringWithFormat:@"Unexpected response for %@", resource];
+                errorBlock([NSError errorWithDomain:NSStringFromClass([STTwitterTimelineBackfill class]) code:0 userInfo:@{NSLocalizedDescriptionKey : errorDescription}]);
+                return;
+            }
+
+            BOOL isLastPage = (_maxPages > 0 && fetchedPageCount >= _maxPages);
+
+            NSMutableArray *keptStatuses = [NSMutableArray array];
+            unsigned long long maxID = isFirstPage ? ULLONG_MAX : [STTwitterTimelineBackfill unsignedLongLongFromID:cursor];
+            NSString *nextCursor = [self filterStatuses:statuses belowMaxID:maxID keptStatuses:keptStatuses isLastPage:isLastPage];
+
+            successBlock(keptStatuses, nextCursor);
+        } errorBlock:^(NSError *error) {
+            errorBlock(error);
+        }];
+    }];
+
+    [_iterator startWithPageBlock:^(NSArray *statuses, BOOL *stop) {
+
+        if([statuses count] == 0) return;
+
+        self.pageCount += 1;
+        self.statusCount += [statuses count];
+        self.oldestID = [[statuses lastObject] valueForKey:@"id_str"];
+
+        pageBlock(statuses, stop);
+    } completionBlock:completionBlock];
+}
+
+- (void)cancel {
+    [_iterator cancel];
+    [[_twitter requestRegistry] cancelRequestsWithTag:_tag];
+}
+
+@end
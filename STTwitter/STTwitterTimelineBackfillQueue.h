@@ -0,0 +1,40 @@
+//
+//  STTwitterTimelineBackfillQueue.h
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class STTwitterTimelineBackfill;
+
+/*
+ Runs timeline backfills in parallel, eg. the user timelines of many users, maxConcurrentBackfills at a time.
+
+ The backfills don't need a budget of their own: backfills made with the same STTwitterAPI share its rateLimiter,
+ which paces them within the x-rate-limit budget of each resource, and their bulk priority lets interactive
+ requests go first. Make them with +[STTwitterAPI twitterAPIWithCredentialPool:] to spread them over several accounts.
+
+ Use from the main thread.
+ */
+
+@interface STTwitterTimelineBackfillQueue : NSObject
+
+@property (nonatomic) NSUInteger maxConcurrentBackfills; // default 4, bulk requests also wait for the bulk slots of STTwitterRequestScheduler, 3 on api.twitter.com by default
+@property (nonatomic, readonly) NSUInteger runningCount;
+@property (nonatomic, readonly) NSUInteger pendingCount;
+
+// called each time the last backfill of the queue is finished
+@property (nonatomic, copy) void(^completionBlock)(void);
+
+// the blocks are those of -[STTwitterTimelineBackfill startWithPageBlock:completionBlock:]
+- (void)addBackfill:(STTwitterTimelineBackfill *)backfill
+          pageBlock:(void(^)(STTwitterTimelineBackfill *backfill, NSArray *statuses, BOOL *stop))pageBlock
+    completionBlock:(void(^)(STTwitterTimelineBackfill *backfill, NSError *error))completionBlock;
+
+// the completion blocks of the running and pending backfills are called with a nil error
+- (void)cancelAllBackfills;
+
+@end
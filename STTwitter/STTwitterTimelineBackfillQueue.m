@@ -0,0 +1,116 @@
+//
+//  STTwitterTimelineBackfillQueue.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STTwitterTimelineBackfillQueue.h"
+#import "STTwitterTimelineBackfill.h"
+
+@interface STTwitterTimelineBackfillEntry : NSObject
+@property (nonatomic, retain) STTwitterTimelineBackfill *backfill;
+@property (nonatomic, copy) void(^pageBlock)(STTwitterTimelineBackfill *backfill, NSArray *statuses, BOOL *stop);
+@property (nonatomic, copy) void(^completionBlock)(STTwitterTimelineBackfill *backfill, NSError *error);
+@end
+
+@implementation STTwitterTimelineBackfillEntry
+@end
+
+@interface STTwitterTimelineBackfillQueue ()
+@property (nonatomic, retain) NSMutableArray *pendingEntries;
+@property (nonatomic, retain) NSMutableArray *runningEntries;
+@end
+
+@implementation STTwitterTimelineBackfillQueue
+
+- (id)init {
+    self = [super init];
+    self.maxConcurrentBackfills = 4;
+    self.pendingEntries = [NSMutableArray array];
+    self.runningEntries = [NSMutableArray array];
+    return self;
+}
+
+- (NSUInteger)runningCount {
+    return [_runningEntries count];
+}
+
+- (NSUInteger)pendingCount {
+    return [_pendingEntries count];
+}
+
+- (void)addBackfill:(STTwitterTimelineBackfill *)backfill
+          pageBlock:(void(^)(STTwitterTimelineBackfill *backfill, NSArray *statuses, BOOL *stop))pageBlock
+    completionBlock:(void(^)(STTwitterTimelineBackfill *backfill, NSError *error))completionBlock {
+
+    NSParameterAssert(backfill);
+    NSParameterAssert(pageBlock);
+
+    STTwitterTimelineBackfillEntry *entry = [[STTwitterTimelineBackfillEntry alloc] init];
+    entry.backfill = backfill;
+    entry.pageBlock = pageBlock;
+    entry.completionBlock = completionBlock;
+
+    [_pendingEntries addObject:entry];
+
+    [self startPendingBackfills];
+}
+
+- (void)startPendingBackfills {
+
+    while([_pendingEntries count] > 0 && [_runningEntries count] < MAX(_maxConcurrentBackfills, 1)) {
+
+        STTwitterTimelineBackfillEntry *entry = _pendingEntries[0];
+        [_pendingEntries removeObjectAtIndex:0];
+        [_runningEntries addObject:entry];
+
+        STTwitterTimelineBackfill *backfill = entry.backfill;
+
+        [backfill startWithPageBlock:^(NSArray *statuses, BOOL *stop) {
+            entry.pageBlock(backfill, statuses, stop);
+        } completionBlock:^(NSError *error) {
+            [self backfillEntryDidFinish:entry error:error];
+        }];
+    }
+}
+
+- (void)backfillEntryDidFinish:(STTwitterTimelineBackfillEntry *)entry error:(NSError *)error {
+
+    if([_runningEntries containsObject:entry] == NO) return;
+
+    [_runningEntries removeObject:entry];
+
+    if(entry.completionBlock) entry.completionBlock(entry.backfill, error);
+
+    [self startPendingBackfills];
+
+    if([_runningEntries count] == 0 && [_pendingEntries count] == 0 && _completionBlock) {
+        _completionBlock();
+    }
+}
+
+- (void)cancelAllBackfills {
+
+    // pending backfills are dropped before the running ones are cancelled, so that none is started
+
+    NSArray *pendingEntries = [_pendingEntries copy];
+    [_pendingEntries removeAllObjects];
+
+    for(STTwitterTimelineBackfillEntry *entry in pendingEntries) {
+        if(entry.completionBlock) entry.completionBlock(entry.backfill, nil);
+    }
+
+    NSArray *runningEntries = [_runningEntries copy];
+
+    for(STTwitterTimelineBackfillEntry *entry in runningEntries) {
+        [entry.backfill cancel];
+    }
+
+    if([runningEntries count] == 0 && [pendingEntries count] > 0 && _completionBlock) {
+        _completionBlock();
+    }
+}
+
+@end
@@ -0,0 +1,57 @@
+//
+//  STTwitterUsersLookup.h
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "STTwitterRequestScheduler.h"
+
+@class STTwitterAPI;
+
+/*
+ Hydrates any number of user IDs and screen names with GET users/lookup, eg. the IDs returned by followers/ids
+ https://dev.twitter.com/docs/api/1.1/get/users/lookup
+
+ Values are deduplicated, screen names case-insensitively, and split into chunks of chunkSize.
+ Up to maxConcurrentRequests chunks are in flight at a time, the STTwitterAPI rateLimiter paces them
+ within the users/lookup budget. A chunk answered with a 404, none of its users exist, only adds misses.
+ A chunk that fails with a network error, a 429 or a 5xx is sent again after a backoff, the other chunks go on.
+ After a 429, the backoff lasts at least until the x-rate-limit-reset of the response, or of the rateLimiter budget.
+
+ Use from the main thread.
+ */
+
+@interface STTwitterUsersLookup : NSObject
+
+@property (nonatomic) NSUInteger chunkSize; // default 100, the users/lookup limit
+@property (nonatomic) NSUInteger maxConcurrentRequests; // default 4, bulk requests also wait for the bulk slots of STTwitterRequestScheduler, 3 on api.twitter.com by default
+@property (nonatomic) NSUInteger maxRetriesPerChunk; // default 3
+@property (nonatomic) NSTimeInterval retryDelay; // default 1 second, doubled for each retry of a chunk
+@property (nonatomic) STTwitterRequestPriority priority; // default STTwitterRequestPriorityBulk
+@property (nonatomic, retain) NSNumber *includeEntities;
+
+// state
+@property (nonatomic, readonly) NSUInteger requestCount;
+@property (nonatomic, readonly) BOOL isFinished;
+
++ (instancetype)usersLookupWithTwitter:(STTwitterAPI *)twitter;
+
+// values as strings or numbers, keeps the first occurrence of each value
++ (NSArray *)uniqueValues:(NSArray *)values caseInsensitive:(BOOL)caseInsensitive;
+
++ (NSArray *)chunksOfValues:(NSArray *)values chunkSize:(NSUInteger)chunkSize;
+
+// usersByID is keyed by id_str, missing values are unknown, suspended or deleted users
+// the first error that is not retried cancels the chunks in flight
+- (void)lookupUserIDs:(NSArray *)userIDs
+          screenNames:(NSArray *)screenNames
+         successBlock:(void(^)(NSDictionary *usersByID, NSArray *missingUserIDs, NSArray *missingScreenNames))successBlock
+           errorBlock:(void(^)(NSError *error))errorBlock;
+
+// no block is called
+- (void)cancel;
+
+@end
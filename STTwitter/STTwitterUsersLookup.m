@@ -0,0 +1,279 @@
+//
+//  STTwitterUsersLookup.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STTwitterUsersLookup.h"
+#import "STTwitterAPI.h"
+#import "STTwitterRequestRegistry.h"
+#import "STTwitterRateLimiter.h"
+#import "STHTTPRequest+STTwitter.h"
+#import "STHTTPRequest.h"
+
+#if DEBUG
+#   define STLog(...) NSLog(__VA_ARGS__)
+#else
+#   define STLog(...)
+#endif
+
+@interface STTwitterUsersLookup ()
+@property (nonatomic, retain) STTwitterAPI *twitter;
+@property (nonatomic, retain) NSString *tag; // shared by the chunks, to cancel the ones in flight
+@property (nonatomic, retain) NSArray *userIDs;
+@property (nonatomic, retain) NSArray *screenNames;
+@property (nonatomic, retain) NSMutableArray *pendingChunks; // request parameters
+@property (nonatomic, retain) NSMutableDictionary *retryCounts; // chunk parameters -> NSNumber
+@property (nonatomic) NSUInteger runningCount;
+@property (nonatomic, retain) NSMutableDictionary *usersByID;
+@property (nonatomic, retain) NSMutableSet *foundScreenNames; // lowercase
+@property (nonatomic, copy) void(^successBlock)(NSDictionary *usersByID, NSArray *missingUserIDs, NSArray *missingScreenNames);
+@property (nonatomic, copy) void(^errorBlock)(NSError *error);
+@property (nonatomic, readwrite) NSUInteger requestCount;
+@property (nonatomic, readwrite) BOOL isFinished;
+@end
+
+@implementation STTwitterUsersLookup
+
+- (id)init {
+    self = [super init];
+    self.chunkSize = 100;
+    self.maxConcurrentRequests = 4;
+    self.maxRetriesPerChunk = 3;
+    self.retryDelay = 1.0;
+    self.priority = STTwitterRequestPriorityBulk;
+    self.tag = [[NSUUID UUID] UUIDString];
+    self.pendingChunks = [NSMutableArray array];
+    self.retryCounts = [NSMutableDictionary dictionary];
+    self.usersByID = [NSMutableDictionary dictionary];
+    self.foundScreenNames = [NSMutableSet set];
+    return self;
+}
+
++ (instancetype)usersLookupWithTwitter:(STTwitterAPI *)twitter {
+
+    NSParameterAssert(twitter);
+
+    STTwitterUsersLookup *lookup = [[self alloc] init];
+    lookup.twitter = twitter;
+    return lookup;
+}
+
++ (NSArray *)uniqueValues:(NSArray *)values caseInsensitive:(BOOL)caseInsensitive {
+
+    NSMutableArray *uniqueValues = [NSMutableArray array];
+    NSMutableSet *seenValues = [NSMutableSet set];
+
+    for(id value in values) {
+        NSString *s = [[value description] stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+        if([s length] == 0) continue;
+
+        NSString *key = caseInsensitive ? [s lowercaseString] : s;
+        if([seenValues containsObject:key]) continue;
+
+        [seenValues addObject:key];
+        [uniqueValues addObject:s];
+    }
+
+    return uniqueValues;
+}
+
++ (NSArray *)chunksOfValues:(NSArray *)values chunkSize:(NSUInteger)chunkSize {
+
+    NSParameterAssert(chunkSize > 0);
+
+    NSMutableArray *chunks = [NSMutableArray array];
+
+    for(NSUInteger location = 0; location < [values count]; location += chunkSize) {
+        NSRange range = NSMakeRange(location, MIN(chunkSize, [values count] - location));
+        [chunks addObject:[values subarrayWithRange:range]];
+    }
+
+    return chunks;
+}
+
+#pragma mark Lookup
+
+- (void)lookupUserIDs:(NSArray *)userIDs
+          screenNames:(NSArray *)screenNames
+         successBlock:(void(^)(NSDictionary *usersByID, NSArray *missingUserIDs, NSArray *missingScreenNames))successBlock
+           errorBlock:(void(^)(NSError *error))errorBlock {
+
+    NSParameterAssert(successBlock);
+    NSAssert(_successBlock == nil && _isFinished == NO, @"a lookup can only be started once");
+
+    self.userIDs = [[self class] uniqueValues:userIDs caseInsensitive:NO];
+    self.screenNames = [[self class] uniqueValues:screenNames caseInsensitive:YES];
+    self.successBlock = successBlock;
+    self.errorBlock = errorBlock;
+
+    NSUInteger chunkSize = MIN(MAX(_chunkSize, 1), 100);
+
+    for(NSArray *chunk in [[self class] chunksOfValues:_userIDs chunkSize:chunkSize]) {
+        [_pendingChunks addObject:@{@"user_id" : [chunk componentsJoinedByString:@","]}];
+    }
+
+    for(NSArray *chunk in [[self class] chunksOfValues:_screenNames chunkSize:chunkSize]) {
+        [_pendingChunks addObject:@{@"screen_name" : [chunk componentsJoinedByString:@","]}];
+    }
+
+    [self startPendingChunks];
+    [self finishIfDone];
+}
+
+- (void)startPendingChunks {
+
+    while(_isFinished == NO && [_pendingChunks count] > 0 && _runningCount < MAX(_maxConcurrentRequests, 1)) {
+
+        NSDictionary *chunk = _pendingChunks[0];
+        [_pendingChunks removeObjectAtIndex:0];
+        
+        NSMutableDictionary *md = [chunk mutableCopy];
+
+        if(_includeEntities) md[@"include_entities"] = [_includeEntities boolValue] ? @"1" : @"0";
+        md[kSTRequestTagKey] = _tag;
+        md[kSTRequestPriorityKey] = @(_priority);
+
+        self.runningCount += 1;
+        self.requestCount += 1;
+
+        // the blocks retain the lookup until the last chunk is answered
+
+        [_twitter getAPIResource:@"users/lookup.json" parameters:md successBlock:^(NSDictionary *rateLimits, id response) {
+            if(_isFinished) return;
+
+            if([response isKindOfClass:[NSArray class]]) {
+                [self addUsers:response];
+            }
+
+            [self chunkDidFinish];
+        } errorBlock:^(NSError *error) {
+            if(_isFinished) return;
+
+            NSInteger status = [[[error userInfo] objectForKey:kSTHTTPStatusCodeKey] integerValue];
+
+            if(status == 404) { // no user of the chunk was found
+                [self chunkDidFinish];
+                return;
+            }
+            
+            NSUInteger retryCount = [_retryCounts[chunk] unsignedIntegerValue];
+            
+            if(retryCount >= _maxRetriesPerChunk || [self shouldRetryAfterError:error] == NO) {
+                [self finishWithError:error];
+                return;
+            }
+            
+            _retryCounts[chunk] = @(retryCount + 1);
+            
+            NSTimeInterval delay = [self retryDelayAfterError:error retryCount:retryCount];
+            
+            STLog(@"-- users/lookup chunk failed, retry in %.1f seconds: %@", delay, [error localizedDescription]);
+            
+            // the chunk keeps its slot during the backoff, the other chunks go on
+            dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+                if(_isFinished) return;
+                [_pendingChunks insertObject:chunk atIndex:0];
+                self.runningCount -= 1;
+                [self startPendingChunks];
+            });
+        }];
+    }
+}
+
+- (BOOL)shouldRetryAfterError:(NSError *)error {
+    
+    if([error st_isCancellationError]) return NO;
+    
+    NSInteger status = [[[error userInfo] objectForKey:kSTHTTPStatusCodeKey] integerValue];
+    
+    return (status == 0 || status == 429 || status >= 500); // network errors and server errors
+}
+
+// a 429 is retried once its rate limit window is over
+- (NSTimeInterval)retryDelayAfterError:(NSError *)error retryCount:(NSUInteger)retryCount {
+    
+    NSTimeInterval delay = _retryDelay * pow(2, retryCount);
+    
+    NSInteger status = [[[error userInfo] objectForKey:kSTHTTPStatusCodeKey] integerValue];
+    if(status != 429) return delay;
+    
+    NSDate *resetDate = [[error userInfo] objectForKey:kSTRateLimitResetDateKey];
+    if(resetDate == nil) resetDate = [[_twitter rateLimiter] rateLimitForResource:@"users/lookup.json"][@"reset"];
+    
+    // the reset has a one second resolution
+    if(resetDate) delay = MAX(delay, [resetDate timeIntervalSinceNow] + 1.0);
+    
+    return delay;
+}
+
+- (void)addUsers:(NSArray *)users {
+    for(NSDictionary *user in users) {
+        if([user isKindOfClass:[NSDictionary class]] == NO) continue;
+
+        NSString *userID = [user valueForKey:@"id_str"];
+        if(userID) _usersByID[userID] = user;
+
+        NSString *screenName = [user valueForKey:@"screen_name"];
+        if(screenName) [_foundScreenNames addObject:[screenName lowercaseString]];
+    }
+}
+
+- (void)chunkDidFinish {
+    self.runningCount -= 1;
+
+    [self startPendingChunks];
+    [self finishIfDone];
+}
+
+- (void)finishIfDone {
+
+    if(_isFinished || _runningCount > 0 || [_pendingChunks count] > 0) return;
+
+    NSMutableArray *missingUserIDs = [NSMutableArray array];
+    for(NSString *userID in _userIDs) {
+        if(_usersByID[userID] == nil) [missingUserIDs addObject:userID];
+    }
+
+    NSMutableArray *missingScreenNames = [NSMutableArray array];
+    for(NSString *screenName in _screenNames) {
+        if([_foundScreenNames containsObject:[screenName lowercaseString]] == NO) [missingScreenNames addObject:screenName];
+    }
+
+    void(^successBlock)(NSDictionary *, NSArray *, NSArray *) = _successBlock;
+    NSDictionary *usersByID = [_usersByID copy];
+
+    [self finishWithError:nil];
+
+    successBlock(usersByID, missingUserIDs, missingScreenNames);
+}
+
+- (void)finishWithError:(NSError *)error {
+
+    if(_isFinished) return;
+
+    self.isFinished = YES;
+    [_pendingChunks removeAllObjects];
+
+    if(_runningCount > 0) {
+        [[_twitter requestRegistry] cancelRequestsWithTag:_tag];
+        self.runningCount = 0;
+    }
+
+    void(^errorBlock)(NSError *) = _errorBlock;
+
+    // the blocks may retain the caller, which retains the lookup
+    self.successBlock = nil;
+    self.errorBlock = nil;
+
+    if(error && errorBlock) errorBlock(error);
+}
+
+- (void)cancel {
+    self.errorBlock = nil;
+    [self finishWithError:nil];
+}
+
+@end
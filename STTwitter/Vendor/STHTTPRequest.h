@@ -14,7 +14,10 @@
 #import <Foundation/Foundation.h>
 
 extern NSUInteger const kSTHTTPRequestCancellationError;
+extern NSUInteger const kSTHTTPRequestStallError;
+extern NSUInteger const kSTHTTPRequestDecodingError;
 extern NSUInteger const kSTHTTPRequestDefaultTimeout;
+extern NSUInteger const kSTHTTPRequestStreamingModeTailLength;
 
 @class STHTTPRequest;
 
@@ -23,6 +26,18 @@ typedef void (^downloadProgressBlock_t)(NSData *data, NSInteger totalBytesReceiv
 typedef void (^completionBlock_t)(NSDictionary *headers, NSString *body);
 typedef void (^errorBlock_t)(NSError *error);
 
+/*
+ Response cache for GET requests, eg. STTwitterResponseCache
+ 
+ Fresh responses are delivered without a network round-trip.
+ Stale responses with an ETag or a Last-Modified header are revalidated, a 304 response is then completed with the cached body.
+ */
+@protocol STHTTPRequestCache <NSObject>
+// cachedResponse is nil on miss, completionBlock is called before returning unless the cache reads the disk, then on the main queue
+- (void)lookUpCachedResponseForRequest:(NSURLRequest *)request completionBlock:(void(^)(NSCachedURLResponse *cachedResponse, BOOL isFresh))completionBlock;
+- (void)storeCachedResponse:(NSCachedURLResponse *)cachedResponse forRequest:(NSURLRequest *)request; // also called after a revalidation, with the updated headers
+@end
+
 @interface STHTTPRequest : NSObject <NSURLConnectionDelegate>
 
 @property (copy) uploadProgressBlock_t uploadProgressBlock;
@@ -41,6 +56,10 @@ typedef void (^errorBlock_t)(NSError *error);
 @property (nonatomic) BOOL encodePOSTDictionary; // default YES
 @property (nonatomic, retain, readonly) NSURL *url;
 @property (nonatomic) BOOL ignoreCookieStorage;
+@property (nonatomic, retain) NSOperationQueue *delegateQueue; // default nil, connection runs on the main run loop, otherwise blocks are called on this queue
+@property (nonatomic) BOOL usesSessionTransport; // default from +setSessionTransportEnabled:, set before starting
+@property (nonatomic) BOOL acceptsCompressedResponse; // default YES, sends Accept-Encoding: gzip, deflate
+@property (nonatomic, retain) id <STHTTPRequestCache> responseCache; // default nil, used by GET requests that are not in streaming mode
 
 // response
 @property (nonatomic) NSStringEncoding forcedResponseEncoding;
@@ -48,15 +67,43 @@ typedef void (^errorBlock_t)(NSError *error);
 @property (nonatomic, retain, readonly) NSString *responseStringEncodingName;
 @property (nonatomic, retain, readonly) NSDictionary *responseHeaders;
 @property (nonatomic, retain, readonly) NSString *responseString;
-@property (nonatomic, retain, readonly) NSMutableData *responseData;
+@property (nonatomic, retain, readonly) NSMutableData *responseData; // presized from Content-Length
+@property (nonatomic) BOOL reusesResponseBuffer; // default NO, responseData is drawn from a shared pool and returned to it when the request is deallocated, don't keep it longer than the request
 @property (nonatomic, retain, readonly) NSError *error;
+@property (nonatomic, readonly) BOOL isResponseFromCache; // fresh cached response, or revalidated with a 304
+
+// streaming
+@property (nonatomic) BOOL streamingMode; // default NO, received data is handed to downloadProgressBlock and released, responseData only keeps the last kSTHTTPRequestStreamingModeTailLength bytes
+@property (nonatomic, readonly) NSUInteger totalBytesReceived; // decoded body bytes
+@property (nonatomic, readonly) NSUInteger totalEncodedBytesReceived; // body bytes before Content-Encoding decoding, same as totalBytesReceived when isEncodedByteCountAvailable is NO
+@property (nonatomic, readonly) BOOL isEncodedByteCountAvailable; // NO when NSURLConnection decoded the body itself, eg. streams, it doesn't report the bytes received
+@property (nonatomic) NSTimeInterval stallTimeoutSeconds; // default 0, disabled, otherwise the request fails with kSTHTTPRequestStallError when no data is received for this duration
 
 + (STHTTPRequest *)requestWithURL:(NSURL *)url;
 + (STHTTPRequest *)requestWithURLString:(NSString *)urlString;
 
+/*
+ Session transport, iOS 7 and OS X 10.9
+ Asynchronous requests share an NSURLSession, which keeps connections alive and reuses them for the same host.
+ Delegate callbacks run on a private serial queue, blocks are still called on the main queue, or on delegateQueue, cancellations included.
+ The response body is accumulated on the private queue, responseString is decoded on first access, on the thread reading it.
+ The body passed to completionBlock and responseString are nil when the bytes are not valid in the response encoding.
+ */
++ (void)setSessionTransportEnabled:(BOOL)enabled; // default YES when NSURLSession is available, otherwise one NSURLConnection per request
++ (void)setMaximumConnectionsPerHost:(NSUInteger)maximumConnectionsPerHost; // default 4, applies to requests started afterwards
+
+/*
+ Compressed responses
+ The URL loading system usually decodes gzip and deflate bodies itself, bodies that still arrive encoded are inflated as they arrive,
+ so that downloadProgressBlock and responseData always see decoded bytes. Only bodies declared by Content-Encoding are inflated.
+ encodedBytes only counts the bodies whose isEncodedByteCountAvailable is YES, decodedBytes counts all of them.
+ */
++ (void)getEncodedBytesReceived:(unsigned long long *)encodedBytes decodedBytesReceived:(unsigned long long *)decodedBytes; // all requests since launch
+
 - (NSString *)startSynchronousWithError:(NSError **)error;
 - (void)startAsynchronous;
-- (void)cancel;
+- (void)lookUpCachedResponseWithCompletionBlock:(void(^)(BOOL hasFreshCachedResponse))completionBlock; // YES if a GET started now would be answered by responseCache, without a request, -startAsynchronous does the lookup itself otherwise
+- (void)cancel; // no effect once the response is complete, exactly one of completionBlock and errorBlock is called
 
 // Cookies
 + (void)addCookieWithName:(NSString *)name value:(NSString *)value url:(NSURL *)url;
@@ -79,6 +126,7 @@ typedef void (^errorBlock_t)(NSError *error);
 
 // Upload
 - (void)addFileToUpload:(NSString *)path parameterName:(NSString *)param;
+- (void)addFileToUpload:(NSString *)path range:(NSRange)range parameterName:(NSString *)param mimeType:(NSString *)mimeType fileName:(NSString *)fileName; // range location NSNotFound for the whole file, fileName nil for the last path component
 - (void)addDataToUpload:(NSData *)data parameterName:(NSString *)param;
 - (void)addDataToUpload:(NSData *)data parameterName:(NSString *)param mimeType:(NSString *)mimeType fileName:(NSString *)fileName;
 
@@ -90,6 +138,7 @@ typedef void (^errorBlock_t)(NSError *error);
 @interface NSError (STHTTPRequest)
 - (BOOL)st_isAuthenticationError;
 - (BOOL)st_isCancellationError;
+- (BOOL)st_isStallError;
 @end
 
 @interface NSString (RFC3986)
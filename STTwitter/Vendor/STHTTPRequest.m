@@ -13,13 +13,23 @@
 #endif
 
 #import "STHTTPRequest.h"
+#import <zlib.h>
+#import <stdatomic.h>
 
 //#define DEBUG 1
 
 NSUInteger const kSTHTTPRequestCancellationError = 1;
+NSUInteger const kSTHTTPRequestStallError = 2;
+NSUInteger const kSTHTTPRequestDecodingError = 3;
 NSUInteger const kSTHTTPRequestDefaultTimeout = 30;
+NSUInteger const kSTHTTPRequestStreamingModeTailLength = 4096;
 
 static NSMutableDictionary *sharedCredentialsStorage = nil;
+static BOOL sessionTransportEnabled = YES;
+static NSUInteger maximumConnectionsPerHost = 4;
+static _Atomic uint64_t encodedBytesReceived = 0;
+static _Atomic uint64_t decodedBytesReceived = 0;
+static NSUInteger const kSTHTTPRequestMaxReservedCapacity = 16 * 1024 * 1024; // don't trust larger Content-Length values
 
 /**/
 
@@ -27,6 +37,8 @@ static NSMutableDictionary *sharedCredentialsStorage = nil;
 @property (nonatomic, retain) NSString *path;
 @property (nonatomic, retain) NSString *parameterName;
 @property (nonatomic, retain) NSString *mimeType;
+@property (nonatomic, retain) NSString *fileName; // default, last path component
+@property (nonatomic) NSRange range; // default, location NSNotFound for the whole file
 
 + (instancetype)fileUploadWithPath:(NSString *)path parameterName:(NSString *)parameterName mimeType:(NSString *)mimeType;
 + (instancetype)fileUploadWithPath:(NSString *)path parameterName:(NSString *)parameterName;
@@ -40,6 +52,41 @@ static NSMutableDictionary *sharedCredentialsStorage = nil;
 + (instancetype)dataUploadWithData:(NSData *)data parameterName:(NSString *)parameterName mimeType:(NSString *)mimeType fileName:(NSString *)fileName;
 @end
 
+// shared NSURLSession, forwards the delegate callbacks of its tasks to their requests
+@interface STHTTPRequestSessionTransport : NSObject <NSURLSessionDataDelegate>
+@property (nonatomic, retain) NSURLSession *session;
+@property (nonatomic, retain) NSOperationQueue *delegateQueue;
+@property (nonatomic, retain) NSMutableDictionary *requestsByTaskIdentifier; // requests are retained until their task completes
++ (instancetype)sharedTransport;
++ (void)resetSharedTransport;
+- (NSURLSessionDataTask *)dataTaskWithRequest:(NSURLRequest *)request forHTTPRequest:(STHTTPRequest *)r;
+@end
+
+// multipart body read lazily by the transport, parts are NSData or STHTTPRequestFileUpload instances, files are mapped one at a time
+@interface STHTTPRequestMultipartBodyStream : NSInputStream
+@property (nonatomic, readonly) unsigned long long contentLength;
+- (instancetype)initWithParts:(NSArray *)parts;
+@end
+
+// completionBlock body, decoded on first use since most clients only read responseData
+@interface STHTTPRequestLazyResponseString : NSString
+- (instancetype)initWithStringBlock:(NSString *(^)(void))stringBlock;
+@end
+
+// response buffers by size class, for requests with reusesResponseBuffer
+@interface STHTTPRequestBufferPool : NSObject
++ (instancetype)sharedPool;
+- (NSMutableData *)bufferWithCapacity:(NSUInteger)capacity;
+- (void)recycleBuffer:(NSMutableData *)buffer;
+@end
+
+// incremental gzip and zlib decoding, for bodies that the URL loading system did not decode
+@interface STHTTPRequestInflater : NSObject
++ (BOOL)isCompressedData:(NSData *)data contentEncoding:(NSString *)contentEncoding; // looks for the header of the declared encoding only
+- (id)initWithContentEncoding:(NSString *)contentEncoding; // gzip or deflate
+- (NSData *)inflateData:(NSData *)data; // nil on error
+@end
+
 /**/
 
 @interface STHTTPRequest ()
@@ -54,7 +101,33 @@ static NSMutableDictionary *sharedCredentialsStorage = nil;
 @property (nonatomic, retain) NSMutableArray *filesToUpload; // STHTTPRequestFileUpload instances
 @property (nonatomic, retain) NSMutableArray *dataToUpload; // STHTTPRequestDataUpload instances
 @property (nonatomic, retain) NSURLRequest *request;
+@property (nonatomic, retain) NSArray *multipartBodyParts; // kept to provide a new body stream, eg. after a redirection
 @property (nonatomic, retain) NSString *responseString;
+@property (nonatomic) NSUInteger totalBytesReceived;
+@property (nonatomic) NSUInteger totalEncodedBytesReceived;
+@property (nonatomic) NSUInteger reportedEncodedBytesReceived; // part of totalEncodedBytesReceived added to the count of all requests
+@property (nonatomic) BOOL isEncodedByteCountAvailable;
+@property (nonatomic, retain) NSString *responseContentEncoding; // gzip or deflate, nil when the response declares no encoding we decode
+@property (nonatomic, retain) NSMutableData *undecidedEncodedData; // first bytes of a body with a Content-Encoding, until we know if the transport decoded it
+@property (nonatomic, retain) STHTTPRequestInflater *inflater; // set when the body still arrives encoded
+@property (nonatomic, retain) NSCachedURLResponse *cachedResponse; // stale response being revalidated
+@property (nonatomic, retain) NSCachedURLResponse *lookedUpCachedResponse; // found by -lookUpCachedResponseWithCompletionBlock:, used by the next start
+@property (nonatomic) BOOL isLookedUpCachedResponseFresh;
+@property (nonatomic) BOOL hasLookedUpCache;
+@property (nonatomic) BOOL isResponseFromCache;
+@property (nonatomic, retain) NSMutableData *pooledResponseData; // responseData drawn from STHTTPRequestBufferPool, returned in dealloc
+@property (nonatomic) CFAbsoluteTime lastDataTime; // accessed from the connection delegate thread only
+@property (nonatomic) BOOL isFinished;
+@property (nonatomic, retain) NSURLSessionDataTask *task; // session transport, instead of connection
+@property (nonatomic, retain) NSOperationQueue *transportQueue; // where the transport calls back
+- (void)didSendBodyData:(NSInteger)bytesWritten totalBytesWritten:(NSInteger)totalBytesWritten totalBytesExpectedToWrite:(NSInteger)totalBytesExpectedToWrite;
+- (void)didReceiveResponse:(NSURLResponse *)response;
+- (void)didReceiveData:(NSData *)data;
+- (void)didFinishLoading;
+- (void)didFailWithError:(NSError *)error;
+- (NSInputStream *)newBodyStream;
+- (void)didReceiveChallenge:(NSURLAuthenticationChallenge *)challenge
+          completionHandler:(void (^)(NSURLSessionAuthChallengeDisposition disposition, NSURLCredential *credential))completionHandler;
 @end
 
 @interface NSData (Base64)
@@ -87,12 +160,32 @@ static NSMutableDictionary *sharedCredentialsStorage = nil;
         self.timeoutSeconds = kSTHTTPRequestDefaultTimeout;
         self.filesToUpload = [NSMutableArray array];
         self.dataToUpload = [NSMutableArray array];
+        self.usesSessionTransport = sessionTransportEnabled && NSClassFromString(@"NSURLSession") != nil;
+        self.acceptsCompressedResponse = YES;
         // self.HTTPMethod = @"GET"; // default
     }
     
     return self;
 }
 
+- (void)dealloc {
+    if(_pooledResponseData) [[STHTTPRequestBufferPool sharedPool] recycleBuffer:_pooledResponseData];
+}
+
++ (void)setSessionTransportEnabled:(BOOL)enabled {
+    sessionTransportEnabled = enabled;
+}
+
++ (void)setMaximumConnectionsPerHost:(NSUInteger)count {
+    maximumConnectionsPerHost = count;
+    [STHTTPRequestSessionTransport resetSharedTransport];
+}
+
++ (void)getEncodedBytesReceived:(unsigned long long *)encodedBytes decodedBytesReceived:(unsigned long long *)decodedBytes {
+    if(encodedBytes) *encodedBytes = atomic_load(&encodedBytesReceived);
+    if(decodedBytes) *decodedBytes = atomic_load(&decodedBytesReceived);
+}
+
 + (void)clearSession {
     [self deleteAllCookies];
     [self deleteAllCredentials];
@@ -266,7 +359,7 @@ static NSMutableDictionary *sharedCredentialsStorage = nil;
     return sortedDictionaries;
 }
 
-+ (NSData *)multipartContentWithBoundary:(NSString *)boundary data:(NSData *)someData fileName:(NSString *)fileName parameterName:(NSString *)parameterName mimeType:(NSString *)aMimeType {
++ (NSData *)multipartHeaderWithBoundary:(NSString *)boundary fileName:(NSString *)fileName parameterName:(NSString *)parameterName mimeType:(NSString *)aMimeType {
     
     NSString *mimeType = aMimeType ? aMimeType : @"application/octet-stream";
     
@@ -279,12 +372,24 @@ static NSMutableDictionary *sharedCredentialsStorage = nil;
     
     [data appendData:[contentDisposition dataUsingEncoding:NSUTF8StringEncoding]];
     [data appendData:[[NSString stringWithFormat:@"Content-Type: %@\r\n\r\n", mimeType] dataUsingEncoding:NSUTF8StringEncoding]];
-    [data appendData:someData];
-    [data appendData:[@"\r\n" dataUsingEncoding:NSUTF8StringEncoding]];
     
     return data;
 }
 
+// escapes POST dictionary keys and values if needed
+- (NSDictionary *)escapedPOSTDictionary {
+    
+    if(_encodePOSTDictionary == NO || _POSTDictionary == nil) return _POSTDictionary;
+    
+    NSMutableDictionary *escapedPOSTDictionary = [NSMutableDictionary dictionary];
+    [_POSTDictionary enumerateKeysAndObjectsUsingBlock:^(id key, id obj, BOOL *stop) {
+        NSString *k = [key st_stringByAddingRFC3986PercentEscapesUsingEncoding:_POSTDataEncoding];
+        NSString *v = [[obj description] st_stringByAddingRFC3986PercentEscapesUsingEncoding:_POSTDataEncoding];
+        [escapedPOSTDictionary setValue:v forKey:k];
+    }];
+    return escapedPOSTDictionary;
+}
+
 - (NSMutableURLRequest *)requestByAddingCredentialsToURL:(BOOL)useCredentialsInURL {
     
     NSURL *theURL = nil;
@@ -303,19 +408,11 @@ static NSMutableDictionary *sharedCredentialsStorage = nil;
     
     request.timeoutInterval = self.timeoutSeconds;
     
-    // escape POST dictionary keys and values if needed
-    if(_encodePOSTDictionary) {
-        NSMutableDictionary *escapedPOSTDictionary = _POSTDictionary ? [NSMutableDictionary dictionary] : nil;
-        [_POSTDictionary enumerateKeysAndObjectsUsingBlock:^(id key, id obj, BOOL *stop) {
-            NSString *k = [key st_stringByAddingRFC3986PercentEscapesUsingEncoding:_POSTDataEncoding];
-            NSString *v = [[obj description] st_stringByAddingRFC3986PercentEscapesUsingEncoding:_POSTDataEncoding];
-            [escapedPOSTDictionary setValue:v forKey:k];
-        }];
-        self.POSTDictionary = escapedPOSTDictionary;
-    }
+    // escape a copy, the request may be built several times and POSTDictionary is signed as is
+    NSDictionary *POSTDictionary = [self escapedPOSTDictionary];
     
     // sort POST parameters in order to get deterministic, unit testable requests
-    NSArray *sortedPOSTDictionaries = [[self class] dictionariesSortedByKey:_POSTDictionary];
+    NSArray *sortedPOSTDictionaries = [[self class] dictionariesSortedByKey:POSTDictionary];
     
     if([self.filesToUpload count] > 0 || [self.dataToUpload count] > 0) {
         
@@ -324,55 +421,64 @@ static NSMutableDictionary *sharedCredentialsStorage = nil;
         NSString *contentType = [NSString stringWithFormat:@"multipart/form-data; boundary=%@", boundary];
         [request addValue:contentType forHTTPHeaderField:@"Content-Type"];
         
-        NSMutableData *body = [NSMutableData data];
+        // contents are not copied, the body is read from the parts as it is sent
+        
+        NSMutableArray *parts = [NSMutableArray array];
+        NSData *partSeparator = [@"\r\n" dataUsingEncoding:NSUTF8StringEncoding];
         
         /**/
         
         for(STHTTPRequestFileUpload *fileToUpload in self.filesToUpload) {
             
-            NSData *data = [NSData dataWithContentsOfFile:fileToUpload.path];
-            if(data == nil) continue;
-            NSString *fileName = [fileToUpload.path lastPathComponent];
+            if([[NSFileManager defaultManager] isReadableFileAtPath:fileToUpload.path] == NO) continue;
             
-            NSData *multipartData = [[self class] multipartContentWithBoundary:boundary
-                                                                          data:data
-                                                                      fileName:fileName
-                                                                 parameterName:fileToUpload.parameterName
-                                                                      mimeType:fileToUpload.mimeType];
-            [body appendData:multipartData];
+            NSString *fileName = fileToUpload.fileName ? fileToUpload.fileName : [fileToUpload.path lastPathComponent];
+            
+            [parts addObject:[[self class] multipartHeaderWithBoundary:boundary
+                                                              fileName:fileName
+                                                         parameterName:fileToUpload.parameterName
+                                                              mimeType:fileToUpload.mimeType]];
+            [parts addObject:fileToUpload];
+            [parts addObject:partSeparator];
         }
         
         /**/
         
         for(STHTTPRequestDataUpload *dataToUpload in self.dataToUpload) {
-            NSData *multipartData = [[self class] multipartContentWithBoundary:boundary
-                                                                          data:dataToUpload.data
-                                                                      fileName:dataToUpload.fileName
-                                                                 parameterName:dataToUpload.parameterName
-                                                                      mimeType:dataToUpload.mimeType];
-            
-            [body appendData:multipartData];
+            [parts addObject:[[self class] multipartHeaderWithBoundary:boundary
+                                                              fileName:dataToUpload.fileName
+                                                         parameterName:dataToUpload.parameterName
+                                                              mimeType:dataToUpload.mimeType]];
+            [parts addObject:dataToUpload.data];
+            [parts addObject:partSeparator];
         }
         
         /**/
         
+        NSMutableData *parameters = [NSMutableData data];
+        
         [sortedPOSTDictionaries enumerateObjectsUsingBlock:^(id obj, NSUInteger idx, BOOL *stop) {
             NSDictionary *d = (NSDictionary *)obj;
             NSString *key = [[d allKeys] lastObject];
             NSObject *value = [[d allValues] lastObject];
             
-            [body appendData:[[NSString stringWithFormat:@"\r\n--%@\r\n", boundary] dataUsingEncoding:NSUTF8StringEncoding]];
-            [body appendData:[[NSString stringWithFormat:@"Content-Disposition: form-data; name=\"%@\"\r\n\r\n", key] dataUsingEncoding:NSUTF8StringEncoding]];
-            [body appendData:[[value description] dataUsingEncoding:NSUTF8StringEncoding]];
+            [parameters appendData:[[NSString stringWithFormat:@"\r\n--%@\r\n", boundary] dataUsingEncoding:NSUTF8StringEncoding]];
+            [parameters appendData:[[NSString stringWithFormat:@"Content-Disposition: form-data; name=\"%@\"\r\n\r\n", key] dataUsingEncoding:NSUTF8StringEncoding]];
+            [parameters appendData:[[value description] dataUsingEncoding:NSUTF8StringEncoding]];
         }];
         
         /**/
         
-        [body appendData:[[NSString stringWithFormat:@"\r\n--%@--\r\n", boundary] dataUsingEncoding:NSUTF8StringEncoding]];
+        [parameters appendData:[[NSString stringWithFormat:@"\r\n--%@--\r\n", boundary] dataUsingEncoding:NSUTF8StringEncoding]];
+        [parts addObject:parameters];
+        
+        self.multipartBodyParts = parts;
+        
+        STHTTPRequestMultipartBodyStream *bodyStream = [[STHTTPRequestMultipartBodyStream alloc] initWithParts:parts];
         
         if([request HTTPMethod] == nil) [request setHTTPMethod:@"POST"];
-        [request setValue:[NSString stringWithFormat:@"%u", (unsigned int)[body length]] forHTTPHeaderField:@"Content-Length"];
-        [request setHTTPBody:body];
+        [request setValue:[NSString stringWithFormat:@"%llu", bodyStream.contentLength] forHTTPHeaderField:@"Content-Length"];
+        [request setHTTPBodyStream:bodyStream];
         
     } else if (_rawPOSTData) {
         
@@ -394,7 +500,7 @@ static NSMutableDictionary *sharedCredentialsStorage = nil;
             }
         }
         
-        NSMutableArray *ma = [NSMutableArray arrayWithCapacity:[_POSTDictionary count]];
+        NSMutableArray *ma = [NSMutableArray arrayWithCapacity:[POSTDictionary count]];
         
         [sortedPOSTDictionaries enumerateObjectsUsingBlock:^(id obj, NSUInteger idx, BOOL *stop) {
             NSDictionary *d = (NSDictionary *)obj;
@@ -421,6 +527,10 @@ static NSMutableDictionary *sharedCredentialsStorage = nil;
         [request addValue:obj forHTTPHeaderField:key];
     }];
     
+    if(_acceptsCompressedResponse && [request valueForHTTPHeaderField:@"Accept-Encoding"] == nil) {
+        [request setValue:@"gzip, deflate" forHTTPHeaderField:@"Accept-Encoding"];
+    }
+    
     NSURLCredential *credentialForHost = [self credentialForCurrentHost];
     
     if(credentialForHost) {
@@ -449,6 +559,14 @@ static NSMutableDictionary *sharedCredentialsStorage = nil;
     [self.filesToUpload addObject:fu];
 }
 
+- (void)addFileToUpload:(NSString *)path range:(NSRange)range parameterName:(NSString *)parameterName mimeType:(NSString *)mimeType fileName:(NSString *)fileName {
+    
+    STHTTPRequestFileUpload *fu = [STHTTPRequestFileUpload fileUploadWithPath:path parameterName:parameterName mimeType:mimeType];
+    fu.range = range;
+    fu.fileName = fileName;
+    [self.filesToUpload addObject:fu];
+}
+
 - (void)addDataToUpload:(NSData *)data parameterName:(NSString *)param {
     STHTTPRequestDataUpload *du = [STHTTPRequestDataUpload dataUploadWithData:data parameterName:param mimeType:nil fileName:nil];
     [self.dataToUpload addObject:du];
@@ -461,13 +579,56 @@ static NSMutableDictionary *sharedCredentialsStorage = nil;
 
 #pragma mark Response
 
-- (NSString *)stringWithData:(NSData *)data encodingName:(NSString *)encodingName {
-    if(data == nil) return nil;
+// strict, as -[NSString initWithData:encoding:], no overlong forms, surrogates or code points above U+10FFFF
+static BOOL STIsValidUTF8(const unsigned char *bytes, NSUInteger length) {
+    
+    NSUInteger i = 0;
     
-    if(_forcedResponseEncoding > 0) {
-        return [[NSString alloc] initWithData:data encoding:_forcedResponseEncoding];
+    while(i < length) {
+        
+        unsigned char c = bytes[i];
+        
+        if(c < 0x80) {
+            i++;
+            continue;
+        }
+        
+        NSUInteger count = 0;
+        unsigned char min = 0x80;
+        unsigned char max = 0xBF;
+        
+        if(c >= 0xC2 && c <= 0xDF) {
+            count = 1;
+        } else if(c >= 0xE0 && c <= 0xEF) {
+            count = 2;
+            if(c == 0xE0) min = 0xA0;
+            if(c == 0xED) max = 0x9F;
+        } else if(c >= 0xF0 && c <= 0xF4) {
+            count = 3;
+            if(c == 0xF0) min = 0x90;
+            if(c == 0xF4) max = 0x8F;
+        } else {
+            return NO;
+        }
+        
+        if(i + count >= length) return NO;
+        
+        // only the first continuation byte has a narrower range
+        if(bytes[i + 1] < min || bytes[i + 1] > max) return NO;
+        for(NSUInteger j = 2; j <= count; j++) {
+            if(bytes[i + j] < 0x80 || bytes[i + j] > 0xBF) return NO;
+        }
+        
+        i += count + 1;
     }
     
+    return YES;
+}
+
+- (NSStringEncoding)responseStringEncodingForEncodingName:(NSString *)encodingName {
+    
+    if(_forcedResponseEncoding > 0) return _forcedResponseEncoding;
+    
     NSStringEncoding encoding = NSUTF8StringEncoding;
     
     /* try to use encoding declared in HTTP response headers */
@@ -481,7 +642,42 @@ static NSMutableDictionary *sharedCredentialsStorage = nil;
         }
     }
     
-    return [[NSString alloc] initWithData:data encoding:encoding];
+    return encoding;
+}
+
+- (NSString *)stringWithData:(NSData *)data encodingName:(NSString *)encodingName {
+    if(data == nil) return nil;
+    
+    return [[NSString alloc] initWithData:data encoding:[self responseStringEncodingForEncodingName:encodingName]];
+}
+
+// completionBlock body, nil when the bytes are not valid in the response encoding
+// UTF-8 bodies are only validated here and decoded on first use, as Latin-1 ones, other encodings are decoded right away
+- (NSString *)completionBody {
+    
+    if(_responseData == nil) return nil;
+    
+    NSStringEncoding encoding = [self responseStringEncodingForEncodingName:_responseStringEncodingName];
+    
+    if(encoding == NSUTF8StringEncoding) {
+        if(STIsValidUTF8([_responseData bytes], [_responseData length]) == NO) return nil;
+    } else if(encoding != NSISOLatin1StringEncoding) { // every byte is a Latin-1 character
+        return [self responseString];
+    }
+    
+    return [[STHTTPRequestLazyResponseString alloc] initWithStringBlock:^NSString *{
+        return [self responseString];
+    }];
+}
+
+// decoded on first access, the body is kept once as responseData
+- (NSString *)responseString {
+    @synchronized(self) {
+        if(_responseString == nil && _isFinished && _responseData) {
+            _responseString = [self stringWithData:_responseData encodingName:_responseStringEncodingName];
+        }
+        return _responseString;
+    }
 }
 
 #if DEBUG
@@ -502,7 +698,7 @@ static NSMutableDictionary *sharedCredentialsStorage = nil;
     
     if(_POSTDictionary) {
         NSMutableArray *postParameters = [NSMutableArray array];
-        [_POSTDictionary enumerateKeysAndObjectsUsingBlock:^(id key, id obj, BOOL *stop) {
+        [[self escapedPOSTDictionary] enumerateKeysAndObjectsUsingBlock:^(id key, id obj, BOOL *stop) {
             NSString *s = [NSString stringWithFormat:@"%@=%@", key, obj];
             [postParameters addObject:s];
         }];
@@ -616,13 +812,45 @@ static NSMutableDictionary *sharedCredentialsStorage = nil;
 
 - (void)startAsynchronous {
     
+    // the cache may read the disk, the request starts once it answers
+    if([self mayUseResponseCache] && _hasLookedUpCache == NO) {
+        [self lookUpCachedResponseWithCompletionBlock:^(BOOL hasFreshCachedResponse) {
+            if(_error) return; // cancelled while looking up
+            [self startAsynchronous];
+        }];
+        return;
+    }
+    
     NSMutableURLRequest *request = [self requestByAddingCredentialsToURL:_addCredentialsToURL];
     
-    self.connection = [[NSURLConnection alloc] initWithRequest:request delegate:self startImmediately:NO];
-    [_connection scheduleInRunLoop:[NSRunLoop mainRunLoop] forMode:NSRunLoopCommonModes];
-    [_connection start];
+    if([self startWithCachedResponseForRequest:request]) return;
+    
+    if(_usesSessionTransport) {
+        STHTTPRequestSessionTransport *transport = [STHTTPRequestSessionTransport sharedTransport];
+        self.transportQueue = transport.delegateQueue;
+        self.task = [transport dataTaskWithRequest:request forHTTPRequest:self];
+    } else {
+        self.connection = [[NSURLConnection alloc] initWithRequest:request delegate:self startImmediately:NO];
+        if(_delegateQueue) {
+            [_connection setDelegateQueue:_delegateQueue];
+        } else {
+            [_connection scheduleInRunLoop:[NSRunLoop mainRunLoop] forMode:NSRunLoopCommonModes];
+        }
+        self.transportQueue = _delegateQueue ? _delegateQueue : [NSOperationQueue mainQueue];
+    }
+    
+    if(_stallTimeoutSeconds > 0) {
+        self.lastDataTime = CFAbsoluteTimeGetCurrent();
+        [self scheduleStallCheckAfterDelay:_stallTimeoutSeconds];
+    }
     
-    self.request = [_connection currentRequest];
+    if(_task) {
+        self.request = [_task currentRequest];
+        [_task resume];
+    } else {
+        self.request = [_connection currentRequest];
+        [_connection start];
+    }
     
     self.requestHeaders = [[_request allHTTPHeaderFields] mutableCopy];
     
@@ -630,7 +858,7 @@ static NSMutableDictionary *sharedCredentialsStorage = nil;
     NSLog(@"%@", [self debugDescription]);
 #endif
     
-    if(_connection == nil) {
+    if(_connection == nil && _task == nil) {
         NSString *s = @"can't create connection";
         NSDictionary *userInfo = [NSDictionary dictionaryWithObject:s forKey:NSLocalizedDescriptionKey];
         self.error = [NSError errorWithDomain:NSStringFromClass([self class])
@@ -676,19 +904,257 @@ static NSMutableDictionary *sharedCredentialsStorage = nil;
 }
 
 - (void)cancel {
-    [_connection cancel];
+    [self cancelWithErrorCode:kSTHTTPRequestCancellationError description:@"Connection was cancelled."];
+}
+
+- (void)cancelWithErrorCode:(NSUInteger)code description:(NSString *)s {
     
-    NSString *s = @"Connection was cancelled.";
     NSDictionary *userInfo = [NSDictionary dictionaryWithObject:s forKey:NSLocalizedDescriptionKey];
-    self.error = [NSError errorWithDomain:NSStringFromClass([self class])
-                                     code:kSTHTTPRequestCancellationError
+    NSError *e = [NSError errorWithDomain:NSStringFromClass([self class])
+                                     code:code
                                  userInfo:userInfo];
     
-    dispatch_async(dispatch_get_main_queue(), ^{
+    if([self markFinishedWithError:e] == NO) return; // the response won, its block is called
+    
+    [_connection cancel];
+    [_task cancel]; // the transport ignores the cancellation error of finished requests
+    
+    // asynchronous, cancel may be called from a block of the request
+    [self performBlockAsynchronously:^{
         _errorBlock(_error);
+    }];
+}
+
+#pragma mark Response cache
+
+static NSString *STHTTPHeaderValue(NSDictionary *headers, NSString *key) {
+    for(NSString *k in headers) {
+        if([k caseInsensitiveCompare:key] == NSOrderedSame) return headers[k];
+    }
+    return nil;
+}
+
+- (BOOL)usesResponseCacheForRequest:(NSURLRequest *)request {
+    return _responseCache && _streamingMode == NO && [[request HTTPMethod] isEqualToString:@"GET"];
+}
+
+// tells without building the request, which must not happen before the prepare block signs it
+- (BOOL)mayUseResponseCache {
+    
+    if(_responseCache == nil || _streamingMode) return NO;
+    
+    if(_HTTPMethod) return [_HTTPMethod isEqualToString:@"GET"];
+    
+    return _POSTDictionary == nil && _rawPOSTData == nil && [_filesToUpload count] == 0 && [_dataToUpload count] == 0;
+}
+
+- (void)lookUpCachedResponseWithCompletionBlock:(void(^)(BOOL hasFreshCachedResponse))completionBlock {
+    
+    NSURLRequest *request = [self mayUseResponseCache] ? [self requestByAddingCredentialsToURL:_addCredentialsToURL] : nil;
+    
+    if(request == nil || [self usesResponseCacheForRequest:request] == NO) {
+        self.lookedUpCachedResponse = nil;
+        self.hasLookedUpCache = YES;
+        completionBlock(NO);
+        return;
+    }
+    
+    // the next start uses this lookup, so that the cache counts it once
+    
+    [_responseCache lookUpCachedResponseForRequest:request completionBlock:^(NSCachedURLResponse *cachedResponse, BOOL isFresh) {
+        self.lookedUpCachedResponse = cachedResponse;
+        self.isLookedUpCachedResponseFresh = isFresh;
+        self.hasLookedUpCache = YES;
+        completionBlock(cachedResponse && isFresh);
+    }];
+}
+
+// delivers a fresh cached response and returns YES, or adds the validators of a stale one to the request
+- (BOOL)startWithCachedResponseForRequest:(NSMutableURLRequest *)request {
+    
+    self.cachedResponse = nil;
+    self.isResponseFromCache = NO;
+    
+    // a stale response stays stale, a fresh one was started right away
+    
+    NSCachedURLResponse *cachedResponse = _lookedUpCachedResponse;
+    BOOL isFresh = _isLookedUpCachedResponseFresh;
+    BOOL hasLookedUpCache = _hasLookedUpCache;
+    
+    self.lookedUpCachedResponse = nil;
+    self.hasLookedUpCache = NO;
+    
+    if(hasLookedUpCache == NO || [self usesResponseCacheForRequest:request] == NO) return NO;
+    
+    if(cachedResponse == nil) return NO;
+    
+    if(isFresh) {
+        
+        self.request = request;
+        self.requestHeaders = [[request allHTTPHeaderFields] mutableCopy];
+        
+        [self useCachedResponse:cachedResponse];
+        
+        // asynchronous, as with a network response, it can still be cancelled until then
+        [self performBlockAsynchronously:^{
+            if([self markFinishedWithError:nil] == NO) return; // cancelled
+            _completionBlock(_responseHeaders, [self completionBody]);
+        }];
+        
+        return YES;
+    }
+    
+    NSDictionary *headers = [(NSHTTPURLResponse *)[cachedResponse response] allHeaderFields];
+    NSString *etag = STHTTPHeaderValue(headers, @"ETag");
+    NSString *lastModified = STHTTPHeaderValue(headers, @"Last-Modified");
+    
+    if(etag == nil && lastModified == nil) return NO; // cannot be revalidated
+    
+    if(etag) [request setValue:etag forHTTPHeaderField:@"If-None-Match"];
+    if(lastModified) [request setValue:lastModified forHTTPHeaderField:@"If-Modified-Since"];
+    [request setCachePolicy:NSURLRequestReloadIgnoringLocalCacheData]; // the 304 must reach us
+    
+    self.cachedResponse = cachedResponse;
+    
+    return NO;
+}
+
+- (void)useCachedResponse:(NSCachedURLResponse *)cachedResponse {
+    
+    NSHTTPURLResponse *response = (NSHTTPURLResponse *)[cachedResponse response];
+    
+    self.responseHeaders = [response allHeaderFields];
+    self.responseStatus = [response statusCode];
+    self.responseStringEncodingName = [response textEncodingName];
+    self.responseData = [[cachedResponse data] mutableCopy];
+    self.responseString = nil;
+    self.totalBytesReceived = [_responseData length];
+    self.isResponseFromCache = YES;
+}
+
+// called once the body is complete
+- (void)updateResponseCache {
+    
+    if([self usesResponseCacheForRequest:_request] == NO) return;
+    
+    NSMutableDictionary *headers = nil;
+    NSData *data = nil;
+    NSInteger status = _responseStatus;
+    
+    if(_responseStatus == 304 && _cachedResponse) {
+        // the stored headers are updated with the ones of the 304, the body is the cached one
+        NSHTTPURLResponse *cachedHTTPResponse = (NSHTTPURLResponse *)[_cachedResponse response];
+        headers = [[cachedHTTPResponse allHeaderFields] mutableCopy];
+        [_responseHeaders enumerateKeysAndObjectsUsingBlock:^(NSString *key, id obj, BOOL *stop) {
+            if([key caseInsensitiveCompare:@"Content-Length"] == NSOrderedSame) return;
+            for(NSString *k in [headers allKeys]) {
+                if([k caseInsensitiveCompare:key] == NSOrderedSame) [headers removeObjectForKey:k];
+            }
+            headers[key] = obj;
+        }];
+        data = [_cachedResponse data];
+        status = [cachedHTTPResponse statusCode];
+    } else if(_responseStatus == 200) {
+        headers = [_responseHeaders mutableCopy];
+        data = [NSData dataWithData:_responseData];
+    } else {
+        return;
+    }
+    
+    // the body is stored decoded
+    for(NSString *k in [headers allKeys]) {
+        if([k caseInsensitiveCompare:@"Content-Encoding"] == NSOrderedSame || [k caseInsensitiveCompare:@"Content-Length"] == NSOrderedSame) {
+            [headers removeObjectForKey:k];
+        }
+    }
+    
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:[_request URL] statusCode:status HTTPVersion:@"HTTP/1.1" headerFields:headers];
+    NSCachedURLResponse *cachedResponse = [[NSCachedURLResponse alloc] initWithResponse:response data:data userInfo:nil storagePolicy:NSURLCacheStorageAllowed];
+    
+    [_responseCache storeCachedResponse:cachedResponse forRequest:_request];
+    
+    if(_responseStatus == 304) [self useCachedResponse:cachedResponse];
+    
+    self.cachedResponse = nil;
+}
+
+#pragma mark Stall detection
+
+// checks run where the delegate methods run, so that lastDataTime is not shared between threads
+- (void)scheduleStallCheckAfterDelay:(NSTimeInterval)delay {
+    
+    __weak STHTTPRequest *weakSelf = self;
+    
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        [weakSelf.transportQueue addOperationWithBlock:^{
+            [weakSelf checkForStall];
+        }];
     });
 }
 
+- (void)checkForStall {
+    
+    if(_isFinished) return;
+    
+    NSTimeInterval silence = CFAbsoluteTimeGetCurrent() - _lastDataTime;
+    
+    if(silence < _stallTimeoutSeconds) {
+        [self scheduleStallCheckAfterDelay:(_stallTimeoutSeconds - silence)];
+        return;
+    }
+    
+    NSString *s = [NSString stringWithFormat:@"Connection stalled, no data received for %d seconds.", (int)silence];
+    [self cancelWithErrorCode:kSTHTTPRequestStallError description:s];
+}
+
+// the body is appended without reallocations when the server announces its length
+// an encoded body grows beyond Content-Length once inflated, the capacity is then only a lower bound
+- (void)prepareResponseBufferForContentLength:(long long)contentLength {
+    
+    NSUInteger capacity = contentLength > 0 ? (NSUInteger)MIN(contentLength, (long long)kSTHTTPRequestMaxReservedCapacity) : 0;
+    
+    if(_streamingMode) { // only the tail is kept
+        [_responseData setLength:0];
+        return;
+    }
+    
+    if(_reusesResponseBuffer) {
+        STHTTPRequestBufferPool *pool = [STHTTPRequestBufferPool sharedPool];
+        if(_pooledResponseData) [pool recycleBuffer:_pooledResponseData]; // eg. a response after a redirection
+        self.pooledResponseData = [pool bufferWithCapacity:capacity];
+        self.responseData = _pooledResponseData;
+        return;
+    }
+    
+    if(capacity > 0) {
+        self.responseData = [NSMutableData dataWithCapacity:capacity];
+    } else {
+        [_responseData setLength:0];
+    }
+}
+
+// in streaming mode, only the last bytes are kept, so that an error body can still be reported
+- (void)appendDataToResponseTail:(NSData *)data {
+    
+    NSUInteger dataLength = [data length];
+    
+    if(dataLength >= kSTHTTPRequestStreamingModeTailLength) {
+        const char *tailBytes = (const char *)[data bytes] + (dataLength - kSTHTTPRequestStreamingModeTailLength);
+        [_responseData setLength:0];
+        [_responseData appendBytes:tailBytes length:kSTHTTPRequestStreamingModeTailLength];
+        return;
+    }
+    
+    [_responseData appendData:data];
+    
+    NSUInteger responseDataLength = [_responseData length];
+    
+    if(responseDataLength > kSTHTTPRequestStreamingModeTailLength) {
+        NSRange headRange = NSMakeRange(0, responseDataLength - kSTHTTPRequestStreamingModeTailLength);
+        [_responseData replaceBytesInRange:headRange withBytes:NULL length:0];
+    }
+}
+
 #pragma mark NSURLConnectionDelegate
 
 -(BOOL)connection:(NSURLConnection *)connection canAuthenticateAgainstProtectionSpace:(NSURLProtectionSpace *)protectionSpace
@@ -733,12 +1199,67 @@ static NSMutableDictionary *sharedCredentialsStorage = nil;
 }
 
 - (void)connection:(NSURLConnection *)connection didSendBodyData:(NSInteger)bytesWritten totalBytesWritten:(NSInteger)totalBytesWritten totalBytesExpectedToWrite:(NSInteger)totalBytesExpectedToWrite {
+    [self didSendBodyData:bytesWritten totalBytesWritten:totalBytesWritten totalBytesExpectedToWrite:totalBytesExpectedToWrite];
+}
+
+- (void)connection:(NSURLConnection *)connection didReceiveResponse:(NSURLResponse *)response {
+    [self didReceiveResponse:response];
+}
+
+- (void)connection:(NSURLConnection *)connection didReceiveData:(NSData *)theData {
+    [self didReceiveData:theData];
+}
+
+- (NSInputStream *)connection:(NSURLConnection *)connection needNewBodyStream:(NSURLRequest *)request {
+    return [self newBodyStream];
+}
+
+- (void)connectionDidFinishLoading:(NSURLConnection *)connection {
+    [self didFinishLoading];
+}
+
+- (void)connection:(NSURLConnection *)connection didFailWithError:(NSError *)e {
+    [self didFailWithError:e];
+}
+
+#pragma mark Transport events
+
+// YES for the first caller only, cancellations run on the caller's thread and race with the transport callbacks
+- (BOOL)markFinishedWithError:(NSError *)e {
+    @synchronized(self) {
+        if(_isFinished) return NO;
+        self.isFinished = YES;
+        if(e) self.error = e;
+        return YES;
+    }
+}
+
+// connections call back where the blocks must run, the session transport calls back on its own queue
+- (void)performBlock:(dispatch_block_t)block {
+    
+    if(_task == nil) {
+        block();
+        return;
+    }
+    
+    [self performBlockAsynchronously:block];
+}
+
+// on delegateQueue, or on the main queue
+- (void)performBlockAsynchronously:(dispatch_block_t)block {
+    NSOperationQueue *queue = _delegateQueue ? _delegateQueue : [NSOperationQueue mainQueue];
+    [queue addOperationWithBlock:block];
+}
+
+- (void)didSendBodyData:(NSInteger)bytesWritten totalBytesWritten:(NSInteger)totalBytesWritten totalBytesExpectedToWrite:(NSInteger)totalBytesExpectedToWrite {
     if (_uploadProgressBlock) {
-        _uploadProgressBlock(bytesWritten, totalBytesWritten, totalBytesExpectedToWrite);
+        [self performBlock:^{
+            _uploadProgressBlock(bytesWritten, totalBytesWritten, totalBytesExpectedToWrite);
+        }];
     }
 }
 
-- (void)connection:(NSURLConnection *)connection didReceiveResponse:(NSURLResponse *)response {
+- (void)didReceiveResponse:(NSURLResponse *)response {
     
     if([response isKindOfClass:[NSHTTPURLResponse class]]) {
         NSHTTPURLResponse *r = (NSHTTPURLResponse *)response;
@@ -748,34 +1269,279 @@ static NSMutableDictionary *sharedCredentialsStorage = nil;
         self.responseExpectedContentLength = [r expectedContentLength];
     }
     
-    [_responseData setLength:0];
+    [self prepareResponseBufferForContentLength:_responseExpectedContentLength];
+    self.totalBytesReceived = 0;
+    self.totalEncodedBytesReceived = 0;
+    self.reportedEncodedBytesReceived = 0;
+    
+    // the headers are kept when the transport decodes the body, so the first bytes tell
+    NSString *contentEncoding = [[self responseHeaderValueForKey:@"Content-Encoding"] lowercaseString];
+    BOOL isEncoded = [contentEncoding isEqualToString:@"gzip"] || [contentEncoding isEqualToString:@"deflate"];
+    self.responseContentEncoding = isEncoded ? contentEncoding : nil;
+    self.undecidedEncodedData = isEncoded ? [NSMutableData data] : nil;
+    self.inflater = nil;
+    
+    // the session reports the bytes received before it decodes the body, the connection doesn't
+    self.isEncodedByteCountAvailable = (isEncoded == NO || _task != nil);
 }
 
-- (void)connection:(NSURLConnection *)connection didReceiveData:(NSData *)theData {
+- (NSString *)responseHeaderValueForKey:(NSString *)key {
+    return STHTTPHeaderValue(_responseHeaders, key);
+}
+
+// empty while the encoding is undecided, nil after a decoding error
+- (NSData *)dataByDecodingReceivedData:(NSData *)data {
+    
+    if(_undecidedEncodedData) {
+        [_undecidedEncodedData appendData:data];
+        if([_undecidedEncodedData length] < 2) return [NSData data];
+        
+        data = _undecidedEncodedData;
+        self.undecidedEncodedData = nil;
+        
+        if([STHTTPRequestInflater isCompressedData:data contentEncoding:_responseContentEncoding]) {
+            self.inflater = [[STHTTPRequestInflater alloc] initWithContentEncoding:_responseContentEncoding];
+            self.isEncodedByteCountAvailable = YES; // the bytes we inflate are the bytes received
+        }
+    }
+    
+    if(_inflater == nil) return data;
+    
+    NSData *inflatedData = [_inflater inflateData:data];
+    
+    if(inflatedData == nil) {
+        [self cancelWithErrorCode:kSTHTTPRequestDecodingError description:@"Cannot decode the response body."];
+    }
+    
+    return inflatedData;
+}
+
+- (void)didReceiveData:(NSData *)theData {
+    
+    if(_isFinished) return; // cancelled task
+    
+    _lastDataTime = CFAbsoluteTimeGetCurrent();
     
-    [_responseData appendData:theData];
+    NSUInteger encodedLength = [theData length];
+    
+    theData = [self dataByDecodingReceivedData:theData];
+    if(theData == nil) return;
+    
+    if(_task && _inflater == nil && _undecidedEncodedData == nil) {
+        _totalEncodedBytesReceived = MAX((NSUInteger)[_task countOfBytesReceived], _totalEncodedBytesReceived); // counted before the transport decodes the body
+    } else {
+        _totalEncodedBytesReceived += encodedLength; // decoded bytes when the connection transport decoded the body
+    }
+    
+    if(_isEncodedByteCountAvailable) {
+        atomic_fetch_add_explicit(&encodedBytesReceived, _totalEncodedBytesReceived - _reportedEncodedBytesReceived, memory_order_relaxed);
+        _reportedEncodedBytesReceived = _totalEncodedBytesReceived;
+    }
+    
+    atomic_fetch_add_explicit(&decodedBytesReceived, [theData length], memory_order_relaxed);
+    
+    if([theData length] == 0) return;
+    
+    [self didReceiveDecodedData:theData];
+}
+
+- (void)didReceiveDecodedData:(NSData *)theData {
+    
+    _totalBytesReceived += [theData length];
+    
+    if(_streamingMode) {
+        [self appendDataToResponseTail:theData];
+    } else {
+        [_responseData appendData:theData];
+    }
     
     if (_downloadProgressBlock) {
-        _downloadProgressBlock(theData, [_responseData length], self.responseExpectedContentLength);
+        NSInteger totalBytesReceived = _totalBytesReceived;
+        NSInteger totalBytesExpectedToReceive = _responseExpectedContentLength;
+        [self performBlock:^{
+            _downloadProgressBlock(theData, totalBytesReceived, totalBytesExpectedToReceive);
+        }];
     }
 }
 
-- (void)connectionDidFinishLoading:(NSURLConnection *)connection {
+- (void)didFinishLoading {
     
-    self.responseString = [self stringWithData:_responseData encodingName:_responseStringEncodingName];
+    if(_isFinished) return; // cancelled
+    
+    if(_undecidedEncodedData) { // body shorter than a compression header
+        NSData *data = _undecidedEncodedData;
+        self.undecidedEncodedData = nil;
+        atomic_fetch_add_explicit(&decodedBytesReceived, [data length], memory_order_relaxed);
+        if([data length]) [self didReceiveDecodedData:data];
+    }
+    
+    if([self markFinishedWithError:nil] == NO) return; // cancelled meanwhile
+    
+    [self updateResponseCache];
     
     if(_responseStatus >= 400) {
         self.error = [NSError errorWithDomain:NSStringFromClass([self class]) code:_responseStatus userInfo:nil];
+        [self performBlock:^{
+            _errorBlock(_error);
+        }];
+        return;
+    }
+    
+    NSString *body = [self completionBody];
+    
+    [self performBlock:^{
+        _completionBlock(_responseHeaders, body);
+    }];
+}
+
+- (NSInputStream *)newBodyStream {
+    if(_multipartBodyParts == nil) return nil;
+    return [[STHTTPRequestMultipartBodyStream alloc] initWithParts:_multipartBodyParts];
+}
+
+- (void)didFailWithError:(NSError *)e {
+    
+    if([self markFinishedWithError:e] == NO) return; // cancelled
+    
+    [self performBlock:^{
         _errorBlock(_error);
+    }];
+}
+
+- (void)didReceiveChallenge:(NSURLAuthenticationChallenge *)challenge
+          completionHandler:(void (^)(NSURLSessionAuthChallengeDisposition disposition, NSURLCredential *credential))completionHandler {
+    
+    NSString *authenticationMethod = [[challenge protectionSpace] authenticationMethod];
+    
+    // same policy as connections
+    
+    if ([authenticationMethod isEqualToString:NSURLAuthenticationMethodServerTrust]) {
+        completionHandler(NSURLSessionAuthChallengeUseCredential, [NSURLCredential credentialForTrust:challenge.protectionSpace.serverTrust]);
+        return;
+    }
+    
+    if ([authenticationMethod isEqualToString:NSURLAuthenticationMethodHTTPDigest] ||
+        [authenticationMethod isEqualToString:NSURLAuthenticationMethodHTTPBasic]) {
+        
+        if([challenge previousFailureCount] == 0) {
+            completionHandler(NSURLSessionAuthChallengeUseCredential, [self credentialForCurrentHost]);
+        } else {
+            [[[self class] sharedCredentialsStorage] removeObjectForKey:[_url host]];
+            completionHandler(NSURLSessionAuthChallengeCancelAuthenticationChallenge, nil);
+        }
         return;
     }
     
-    _completionBlock(_responseHeaders, [self responseString]);
+    NSLog(@"Unhandled authentication challenge type - %@", authenticationMethod);
+    completionHandler(NSURLSessionAuthChallengeCancelAuthenticationChallenge, nil);
 }
 
-- (void)connection:(NSURLConnection *)connection didFailWithError:(NSError *)e {
-    self.error = e;
-    _errorBlock(_error);
+@end
+
+/**/
+
+static STHTTPRequestSessionTransport *sharedTransport = nil;
+
+@implementation STHTTPRequestSessionTransport
+
++ (instancetype)sharedTransport {
+    @synchronized(self) {
+        if(sharedTransport == nil) {
+            sharedTransport = [[self alloc] init];
+        }
+        return sharedTransport;
+    }
+}
+
+// running tasks keep the previous session, which is invalidated once they are done
++ (void)resetSharedTransport {
+    @synchronized(self) {
+        [sharedTransport.session finishTasksAndInvalidate];
+        sharedTransport = nil;
+    }
+}
+
+- (id)init {
+    self = [super init];
+    
+    self.requestsByTaskIdentifier = [NSMutableDictionary dictionary];
+    
+    self.delegateQueue = [[NSOperationQueue alloc] init];
+    [_delegateQueue setName:@"STHTTPRequest session transport queue"];
+    [_delegateQueue setMaxConcurrentOperationCount:1];
+    
+    // requests set their own timeout, cookies and credentials
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration defaultSessionConfiguration];
+    configuration.HTTPMaximumConnectionsPerHost = maximumConnectionsPerHost;
+    configuration.URLCredentialStorage = nil;
+    configuration.URLCache = nil;
+    
+    self.session = [NSURLSession sessionWithConfiguration:configuration delegate:self delegateQueue:_delegateQueue];
+    
+    return self;
+}
+
+- (NSURLSessionDataTask *)dataTaskWithRequest:(NSURLRequest *)request forHTTPRequest:(STHTTPRequest *)r {
+    
+    NSURLSessionDataTask *task = [_session dataTaskWithRequest:request];
+    
+    @synchronized(_requestsByTaskIdentifier) {
+        _requestsByTaskIdentifier[@([task taskIdentifier])] = r;
+    }
+    
+    return task;
+}
+
+- (STHTTPRequest *)requestForTask:(NSURLSessionTask *)task {
+    @synchronized(_requestsByTaskIdentifier) {
+        return _requestsByTaskIdentifier[@([task taskIdentifier])];
+    }
+}
+
+#pragma mark NSURLSessionDataDelegate
+
+- (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task didReceiveChallenge:(NSURLAuthenticationChallenge *)challenge completionHandler:(void (^)(NSURLSessionAuthChallengeDisposition disposition, NSURLCredential *credential))completionHandler {
+    
+    STHTTPRequest *r = [self requestForTask:task];
+    
+    if(r == nil) {
+        completionHandler(NSURLSessionAuthChallengePerformDefaultHandling, nil);
+        return;
+    }
+    
+    [r didReceiveChallenge:challenge completionHandler:completionHandler];
+}
+
+- (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task didSendBodyData:(int64_t)bytesSent totalBytesSent:(int64_t)totalBytesSent totalBytesExpectedToSend:(int64_t)totalBytesExpectedToSend {
+    [[self requestForTask:task] didSendBodyData:(NSInteger)bytesSent totalBytesWritten:(NSInteger)totalBytesSent totalBytesExpectedToWrite:(NSInteger)totalBytesExpectedToSend];
+}
+
+- (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask didReceiveResponse:(NSURLResponse *)response completionHandler:(void (^)(NSURLSessionResponseDisposition disposition))completionHandler {
+    [[self requestForTask:dataTask] didReceiveResponse:response];
+    completionHandler(NSURLSessionResponseAllow);
+}
+
+- (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask didReceiveData:(NSData *)data {
+    [[self requestForTask:dataTask] didReceiveData:data];
+}
+
+- (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task needNewBodyStream:(void (^)(NSInputStream *bodyStream))completionHandler {
+    completionHandler([[self requestForTask:task] newBodyStream]);
+}
+
+- (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task didCompleteWithError:(NSError *)error {
+    
+    STHTTPRequest *r = [self requestForTask:task];
+    
+    @synchronized(_requestsByTaskIdentifier) {
+        [_requestsByTaskIdentifier removeObjectForKey:@([task taskIdentifier])];
+    }
+    
+    if(error) {
+        [r didFailWithError:error];
+    } else {
+        [r didFinishLoading];
+    }
 }
 
 @end
@@ -796,6 +1562,12 @@ static NSMutableDictionary *sharedCredentialsStorage = nil;
     return ([self code] == kSTHTTPRequestCancellationError);
 }
 
+- (BOOL)st_isStallError {
+    if([[self domain] isEqualToString:@"STHTTPRequest"] == NO) return NO;
+    
+    return ([self code] == kSTHTTPRequestStallError);
+}
+
 @end
 
 @implementation NSString (RFC3986)
@@ -828,6 +1600,7 @@ static NSMutableDictionary *sharedCredentialsStorage = nil;
 
 + (instancetype)fileUploadWithPath:(NSString *)path parameterName:(NSString *)parameterName mimeType:(NSString *)mimeType {
     STHTTPRequestFileUpload *fu = [[self alloc] init];
+    fu.range = NSMakeRange(NSNotFound, 0);
     fu.path = path;
     fu.parameterName = parameterName;
     fu.mimeType = mimeType;
@@ -852,3 +1625,353 @@ static NSMutableDictionary *sharedCredentialsStorage = nil;
 }
 
 @end
+
+/**/
+
+@implementation STHTTPRequestMultipartBodyStream {
+    NSArray *_parts;
+    NSUInteger _nextPartIndex;
+    NSData *_partData; // file contents are mapped, not read
+    NSUInteger _partOffset;
+    NSUInteger _partEnd;
+    NSStreamStatus _streamStatus;
+    NSError *_streamError;
+    __weak id <NSStreamDelegate> _delegate;
+}
+
++ (NSRange)rangeOfFileUpload:(STHTTPRequestFileUpload *)fileUpload fileLength:(unsigned long long)fileLength {
+    if(fileUpload.range.location == NSNotFound) return NSMakeRange(0, (NSUInteger)fileLength);
+    NSUInteger location = (NSUInteger)MIN(fileUpload.range.location, fileLength);
+    return NSMakeRange(location, (NSUInteger)MIN(fileUpload.range.length, fileLength - location));
+}
+
+- (instancetype)initWithParts:(NSArray *)parts {
+    self = [super init];
+    
+    _parts = parts;
+    _streamStatus = NSStreamStatusNotOpen;
+    
+    for(id part in parts) {
+        if([part isKindOfClass:[NSData class]]) {
+            _contentLength += [(NSData *)part length];
+        } else {
+            STHTTPRequestFileUpload *fileUpload = part;
+            unsigned long long fileLength = [[[NSFileManager defaultManager] attributesOfItemAtPath:fileUpload.path error:nil] fileSize];
+            _contentLength += [[self class] rangeOfFileUpload:fileUpload fileLength:fileLength].length;
+        }
+    }
+    
+    return self;
+}
+
+- (BOOL)openNextPart {
+    
+    _partData = nil;
+    
+    if(_nextPartIndex == [_parts count]) return NO;
+    
+    id part = _parts[_nextPartIndex++];
+    
+    if([part isKindOfClass:[NSData class]]) {
+        _partData = part;
+        _partOffset = 0;
+        _partEnd = [_partData length];
+        return YES;
+    }
+    
+    STHTTPRequestFileUpload *fileUpload = part;
+    NSError *error = nil;
+    _partData = [NSData dataWithContentsOfFile:fileUpload.path options:NSDataReadingMappedIfSafe error:&error];
+    
+    if(_partData == nil) {
+        _streamError = error;
+        _streamStatus = NSStreamStatusError;
+        return NO;
+    }
+    
+    NSRange range = [[self class] rangeOfFileUpload:fileUpload fileLength:[_partData length]];
+    _partOffset = range.location;
+    _partEnd = NSMaxRange(range);
+    
+    return YES;
+}
+
+#pragma mark NSInputStream
+
+- (NSInteger)read:(uint8_t *)buffer maxLength:(NSUInteger)maxLength {
+    
+    if(_streamStatus == NSStreamStatusClosed || _streamStatus == NSStreamStatusError) return -1;
+    if(_streamStatus == NSStreamStatusAtEnd) return 0;
+    
+    NSUInteger readLength = 0;
+    
+    while(readLength < maxLength) {
+        
+        if(_partData == nil || _partOffset == _partEnd) {
+            if([self openNextPart]) continue;
+            if(_streamStatus == NSStreamStatusError) return -1;
+            _streamStatus = NSStreamStatusAtEnd;
+            break;
+        }
+        
+        NSUInteger length = MIN(maxLength - readLength, _partEnd - _partOffset);
+        memcpy(buffer + readLength, (const uint8_t *)[_partData bytes] + _partOffset, length);
+        _partOffset += length;
+        readLength += length;
+    }
+    
+    return readLength;
+}
+
+- (BOOL)getBuffer:(uint8_t **)buffer length:(NSUInteger *)len {
+    return NO;
+}
+
+- (BOOL)hasBytesAvailable {
+    return _streamStatus == NSStreamStatusOpen;
+}
+
+#pragma mark NSStream
+
+- (void)open {
+    _streamStatus = NSStreamStatusOpen;
+}
+
+- (void)close {
+    _streamStatus = NSStreamStatusClosed;
+    _partData = nil;
+}
+
+- (NSStreamStatus)streamStatus {
+    return _streamStatus;
+}
+
+- (NSError *)streamError {
+    return _streamError;
+}
+
+- (id <NSStreamDelegate>)delegate {
+    return _delegate;
+}
+
+- (void)setDelegate:(id <NSStreamDelegate>)delegate {
+    _delegate = delegate;
+}
+
+- (id)propertyForKey:(NSString *)key {
+    return nil;
+}
+
+- (BOOL)setProperty:(id)property forKey:(NSString *)key {
+    return NO;
+}
+
+// the stream is read synchronously, it never sends events
+- (void)scheduleInRunLoop:(NSRunLoop *)aRunLoop forMode:(NSString *)mode {}
+- (void)removeFromRunLoop:(NSRunLoop *)aRunLoop forMode:(NSString *)mode {}
+
+// toll-free bridging, called by CFNetwork on NSInputStream subclasses
+- (void)_scheduleInCFRunLoop:(CFRunLoopRef)aRunLoop forMode:(CFStringRef)aMode {}
+- (void)_unscheduleFromCFRunLoop:(CFRunLoopRef)aRunLoop forMode:(CFStringRef)aMode {}
+- (BOOL)_setCFClientFlags:(CFOptionFlags)inFlags callback:(CFReadStreamClientCallBack)inCallback context:(CFStreamClientContext *)inContext {
+    return NO;
+}
+
+@end
+
+/**/
+
+@implementation STHTTPRequestInflater {
+    z_stream _stream;
+}
+
++ (BOOL)isCompressedData:(NSData *)data contentEncoding:(NSString *)contentEncoding {
+    
+    if([data length] < 2) return NO;
+    
+    const uint8_t *bytes = [data bytes];
+    
+    if([contentEncoding isEqualToString:@"gzip"]) {
+        return (bytes[0] == 0x1f && bytes[1] == 0x8b); // not the start of a text body
+    }
+    
+    if([contentEncoding isEqualToString:@"deflate"]) {
+        return ((bytes[0] & 0x0f) == Z_DEFLATED && (bytes[0] >> 4) <= 7 && ((bytes[0] << 8) | bytes[1]) % 31 == 0); // zlib
+    }
+    
+    return NO;
+}
+
+- (id)initWithContentEncoding:(NSString *)contentEncoding {
+    self = [super init];
+    
+    memset(&_stream, 0, sizeof(_stream));
+    
+    int windowBits = [contentEncoding isEqualToString:@"gzip"] ? 15 + 16 : 15; // + 16, gzip header only
+    
+    if(inflateInit2(&_stream, windowBits) != Z_OK) return nil;
+    
+    return self;
+}
+
+- (void)dealloc {
+    inflateEnd(&_stream);
+}
+
+- (NSData *)inflateData:(NSData *)data {
+    
+    NSMutableData *inflatedData = [NSMutableData dataWithLength:MAX([data length] * 4, 4096)];
+    NSUInteger inflatedLength = 0;
+    
+    _stream.next_in = (Bytef *)[data bytes];
+    _stream.avail_in = (uInt)[data length];
+    
+    do {
+        if(inflatedLength == [inflatedData length]) {
+            [inflatedData setLength:inflatedLength * 2];
+        }
+        
+        _stream.next_out = (Bytef *)[inflatedData mutableBytes] + inflatedLength;
+        _stream.avail_out = (uInt)([inflatedData length] - inflatedLength);
+        
+        int status = inflate(&_stream, Z_NO_FLUSH);
+        
+        inflatedLength = [inflatedData length] - _stream.avail_out;
+        
+        if(status == Z_STREAM_END) {
+            if(_stream.avail_in == 0) break;
+            if(inflateReset(&_stream) != Z_OK) return nil; // concatenated gzip members
+        } else if(status == Z_BUF_ERROR) {
+            break; // needs more input
+        } else if(status != Z_OK) {
+            return nil;
+        }
+        
+    } while (_stream.avail_in > 0 || _stream.avail_out == 0);
+    
+    [inflatedData setLength:inflatedLength];
+    
+    return inflatedData;
+}
+
+@end
+
+/**/
+
+static NSUInteger const kSTHTTPRequestBufferPoolCapacity = 8; // buffers kept per size class
+
+@implementation STHTTPRequestBufferPool {
+    NSArray *_sizeClasses;
+    NSMutableDictionary *_buffersBySizeClass; // NSNumber -> NSMutableArray
+    NSMapTable *_sizeClassesByBuffer; // buffers in use, weak keys compared by pointer, their content changes
+}
+
++ (instancetype)sharedPool {
+    static STHTTPRequestBufferPool *sharedPool = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedPool = [[self alloc] init];
+    });
+    return sharedPool;
+}
+
+- (id)init {
+    self = [super init];
+    _sizeClasses = @[@(16 * 1024), @(64 * 1024), @(256 * 1024), @(1024 * 1024), @(4 * 1024 * 1024)];
+    _buffersBySizeClass = [NSMutableDictionary dictionary];
+    _sizeClassesByBuffer = [NSMapTable mapTableWithKeyOptions:NSPointerFunctionsWeakMemory|NSPointerFunctionsObjectPointerPersonality
+                                                 valueOptions:NSPointerFunctionsStrongMemory];
+    return self;
+}
+
+- (NSNumber *)sizeClassForCapacity:(NSUInteger)capacity {
+    for(NSNumber *sizeClass in _sizeClasses) {
+        if(capacity <= [sizeClass unsignedIntegerValue]) return sizeClass;
+    }
+    return nil; // too large to be kept around
+}
+
+- (NSMutableData *)bufferWithCapacity:(NSUInteger)capacity {
+    
+    NSNumber *sizeClass = [self sizeClassForCapacity:capacity];
+    if(sizeClass == nil) return [NSMutableData dataWithCapacity:capacity];
+    
+    NSMutableData *buffer = nil;
+    
+    @synchronized(self) {
+        NSMutableArray *buffers = _buffersBySizeClass[sizeClass];
+        buffer = [buffers lastObject];
+        if(buffer) [buffers removeLastObject];
+    }
+    
+    if(buffer == nil) buffer = [NSMutableData dataWithCapacity:[sizeClass unsignedIntegerValue]];
+    
+    @synchronized(self) {
+        [_sizeClassesByBuffer setObject:sizeClass forKey:buffer];
+    }
+    
+    return buffer;
+}
+
+- (void)recycleBuffer:(NSMutableData *)buffer {
+    
+    @synchronized(self) {
+        
+        NSNumber *sizeClass = [_sizeClassesByBuffer objectForKey:buffer];
+        if(sizeClass == nil) return;
+        [_sizeClassesByBuffer removeObjectForKey:buffer];
+        
+        if([buffer length] > 2 * [sizeClass unsignedIntegerValue]) return; // grew much larger, eg. an inflated body
+        
+        NSMutableArray *buffers = _buffersBySizeClass[sizeClass];
+        if(buffers == nil) {
+            buffers = [NSMutableArray array];
+            _buffersBySizeClass[sizeClass] = buffers;
+        }
+        
+        if([buffers count] >= kSTHTTPRequestBufferPoolCapacity) return;
+        
+        [buffer setLength:0];
+        [buffers addObject:buffer];
+    }
+}
+
+@end
+
+/**/
+
+@implementation STHTTPRequestLazyResponseString {
+    NSString *(^_stringBlock)(void);
+    NSString *_string;
+}
+
+- (instancetype)initWithStringBlock:(NSString *(^)(void))stringBlock {
+    self = [super init];
+    _stringBlock = [stringBlock copy];
+    return self;
+}
+
+- (NSString *)string {
+    @synchronized(self) {
+        if(_stringBlock) {
+            _string = _stringBlock();
+            if(_string == nil) _string = @""; // not expected, the bytes were validated before the proxy was made
+            _stringBlock = nil; // releases the request
+        }
+        return _string;
+    }
+}
+
+- (NSUInteger)length {
+    return [[self string] length];
+}
+
+- (unichar)characterAtIndex:(NSUInteger)index {
+    return [[self string] characterAtIndex:index];
+}
+
+- (void)getCharacters:(unichar *)buffer range:(NSRange)range {
+    [[self string] getCharacters:buffer range:range];
+}
+
+@end
@@ -0,0 +1,24 @@
+//
+//  STAllocationCounter.h
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/*
+ Counts the allocations of the default malloc zone, on all threads, by wrapping its functions
+ Objective-C objects and CoreFoundation buffers are allocated there, the count is an approximation for the others.
+ */
+
+@interface STAllocationCounter : NSObject
+
++ (void)start;
++ (void)stop;
+
++ (uint64_t)allocationsCount; // since start
++ (uint64_t)allocatedBytesCount;
+
+@end
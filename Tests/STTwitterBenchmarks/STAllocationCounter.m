@@ -0,0 +1,96 @@
+//
+//  STAllocationCounter.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STAllocationCounter.h"
+#include <malloc/malloc.h>
+#include <mach/mach.h>
+#include <libkern/OSAtomic.h>
+
+static volatile int64_t allocationsCount = 0;
+static volatile int64_t allocatedBytesCount = 0;
+
+static void *(*originalMalloc)(malloc_zone_t *zone, size_t size) = NULL;
+static void *(*originalCalloc)(malloc_zone_t *zone, size_t count, size_t size) = NULL;
+static void *(*originalRealloc)(malloc_zone_t *zone, void *ptr, size_t size) = NULL;
+static BOOL isCounting = NO;
+
+static void STCountAllocation(size_t size) {
+    OSAtomicIncrement64(&allocationsCount);
+    OSAtomicAdd64((int64_t)size, &allocatedBytesCount);
+}
+
+static void *STCountingMalloc(malloc_zone_t *zone, size_t size) {
+    STCountAllocation(size);
+    return originalMalloc(zone, size);
+}
+
+static void *STCountingCalloc(malloc_zone_t *zone, size_t count, size_t size) {
+    STCountAllocation(count * size);
+    return originalCalloc(zone, count, size);
+}
+
+static void *STCountingRealloc(malloc_zone_t *zone, void *ptr, size_t size) {
+    STCountAllocation(size);
+    return originalRealloc(zone, ptr, size);
+}
+
+// the zone structure is read-only, it must be made writable to swap its functions
+static void STSetZoneFunctions(void *(*mallocFunction)(malloc_zone_t *, size_t),
+                               void *(*callocFunction)(malloc_zone_t *, size_t, size_t),
+                               void *(*reallocFunction)(malloc_zone_t *, void *, size_t)) {
+    
+    malloc_zone_t *zone = malloc_default_zone();
+    
+    vm_protect(mach_task_self(), (vm_address_t)zone, sizeof(malloc_zone_t), 0, VM_PROT_READ | VM_PROT_WRITE);
+    
+    zone->malloc = mallocFunction;
+    zone->calloc = callocFunction;
+    zone->realloc = reallocFunction;
+    
+    vm_protect(mach_task_self(), (vm_address_t)zone, sizeof(malloc_zone_t), 0, VM_PROT_READ);
+}
+
+@implementation STAllocationCounter
+
++ (void)start {
+    
+    if(isCounting) return;
+    
+    // the original functions are kept after stop, counting functions may still be running on other threads
+    
+    if(originalMalloc == NULL) {
+        malloc_zone_t *zone = malloc_default_zone();
+        originalMalloc = zone->malloc;
+        originalCalloc = zone->calloc;
+        originalRealloc = zone->realloc;
+    }
+    
+    allocationsCount = 0;
+    allocatedBytesCount = 0;
+    
+    STSetZoneFunctions(STCountingMalloc, STCountingCalloc, STCountingRealloc);
+    isCounting = YES;
+}
+
++ (void)stop {
+    
+    if(isCounting == NO) return;
+    
+    STSetZoneFunctions(originalMalloc, originalCalloc, originalRealloc);
+    isCounting = NO;
+}
+
++ (uint64_t)allocationsCount {
+    return allocationsCount;
+}
+
++ (uint64_t)allocatedBytesCount {
+    return allocatedBytesCount;
+}
+
+@end
@@ -0,0 +1,37 @@
+//
+//  STLoopbackStreamServer.h
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/*
+ Minimal HTTP server on 127.0.0.1, answers every request with a synthetic stream of tweets and closes the connection
+ 
+ Each message carries its send time in "st_sent_ns", see +currentTimeNanoseconds, to measure end-to-end latency.
+ Messages are written in chunks of chunkSize bytes, so that chunk boundaries don't match message boundaries.
+ */
+
+@interface STLoopbackStreamServer : NSObject
+
+@property (nonatomic) NSUInteger messageCount; // per connection, default 10000
+@property (nonatomic) NSUInteger messageSize; // approximate size in bytes, default 2500
+@property (nonatomic) NSUInteger messagesPerSecond; // default 0, as fast as possible
+@property (nonatomic) NSUInteger chunkSize; // bytes per write, default 1448
+@property (nonatomic) NSUInteger keepAliveInterval; // a keep-alive newline every n messages, default 0, none
+@property (nonatomic) BOOL delimitedByLength; // default NO
+@property (nonatomic) BOOL gzipEncoded; // default NO, Content-Encoding: gzip, flushed after each message like Twitter streams
+
+@property (nonatomic, readonly) unsigned short port;
+@property (nonatomic, readonly) NSString *baseURLString;
+@property (nonatomic, readonly) unsigned long long sentBytesCount;
+
++ (uint64_t)currentTimeNanoseconds;
+
+- (BOOL)startWithError:(NSError **)error;
+- (void)stop;
+
+@end
@@ -0,0 +1,284 @@
+//
+//  STLoopbackStreamServer.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STLoopbackStreamServer.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <mach/mach_time.h>
+#include <zlib.h>
+
+@interface STLoopbackStreamServer ()
+@property (nonatomic) unsigned short port;
+@property (atomic) unsigned long long sentBytesCount;
+@property (atomic) BOOL isStopped;
+@end
+
+@implementation STLoopbackStreamServer {
+    int _listeningSocket;
+    dispatch_source_t _acceptSource;
+}
+
++ (uint64_t)currentTimeNanoseconds {
+    static mach_timebase_info_data_t timebase;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        mach_timebase_info(&timebase);
+    });
+    return mach_absolute_time() * timebase.numer / timebase.denom;
+}
+
+- (id)init {
+    self = [super init];
+    
+    _listeningSocket = -1;
+    
+    self.messageCount = 10000;
+    self.messageSize = 2500;
+    self.chunkSize = 1448;
+    
+    return self;
+}
+
+- (void)dealloc {
+    [self stop];
+}
+
+- (NSString *)baseURLString {
+    return [NSString stringWithFormat:@"http://127.0.0.1:%d", _port];
+}
+
+- (NSError *)errorWithDescription:(NSString *)description {
+    NSString *s = [NSString stringWithFormat:@"%@: %s", description, strerror(errno)];
+    return [NSError errorWithDomain:NSStringFromClass([self class]) code:errno userInfo:@{NSLocalizedDescriptionKey : s}];
+}
+
+- (BOOL)startWithError:(NSError **)error {
+    
+    _listeningSocket = socket(AF_INET, SOCK_STREAM, 0);
+    
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_len = sizeof(address);
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0; // any free port
+    
+    socklen_t addressLength = sizeof(address);
+    
+    if(_listeningSocket < 0 ||
+       bind(_listeningSocket, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+       listen(_listeningSocket, 16) != 0 ||
+       getsockname(_listeningSocket, (struct sockaddr *)&address, &addressLength) != 0) {
+        if(error) *error = [self errorWithDescription:@"Cannot start loopback server"];
+        [self stop];
+        return NO;
+    }
+    
+    self.port = ntohs(address.sin_port);
+    
+    int listeningSocket = _listeningSocket;
+    
+    _acceptSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, listeningSocket, 0, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0));
+    
+    __weak STLoopbackStreamServer *weakSelf = self;
+    
+    dispatch_source_set_event_handler(_acceptSource, ^{
+        int connectionSocket = accept(listeningSocket, NULL, NULL);
+        if(connectionSocket < 0) return;
+        
+        int noSigPipe = 1;
+        setsockopt(connectionSocket, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof(noSigPipe));
+        
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0), ^{
+            [weakSelf serveConnection:connectionSocket];
+            close(connectionSocket);
+        });
+    });
+    
+    dispatch_source_set_cancel_handler(_acceptSource, ^{
+        close(listeningSocket);
+    });
+    
+    dispatch_resume(_acceptSource);
+    
+    return YES;
+}
+
+- (void)stop {
+    
+    self.isStopped = YES;
+    
+    if(_acceptSource) {
+        dispatch_source_cancel(_acceptSource);
+#if !OS_OBJECT_USE_OBJC
+        dispatch_release(_acceptSource);
+#endif
+        _acceptSource = NULL;
+    } else if(_listeningSocket >= 0) {
+        close(_listeningSocket);
+    }
+    
+    _listeningSocket = -1;
+}
+
+#pragma mark Connection
+
+- (BOOL)readRequestHeadersFromSocket:(int)s {
+    
+    NSMutableData *request = [NSMutableData data];
+    char buffer[4096];
+    
+    while([request length] < 65536) {
+        ssize_t length = recv(s, buffer, sizeof(buffer), 0);
+        if(length <= 0) return NO;
+        
+        [request appendBytes:buffer length:length];
+        
+        NSRange range = [request rangeOfData:[NSData dataWithBytes:"\r\n\r\n" length:4] options:0 range:NSMakeRange(0, [request length])];
+        if(range.location != NSNotFound) return YES;
+    }
+    
+    return NO;
+}
+
+- (BOOL)writeData:(NSData *)data toSocket:(int)s {
+    
+    const char *bytes = [data bytes];
+    NSUInteger length = [data length];
+    NSUInteger offset = 0;
+    
+    while(offset < length) {
+        ssize_t written = send(s, bytes + offset, length - offset, 0);
+        if(written <= 0) return NO;
+        offset += written;
+    }
+    
+    self.sentBytesCount += length;
+    
+    return YES;
+}
+
+// writes full chunks, or everything when flushing
+- (BOOL)writeChunksFromBuffer:(NSMutableData *)buffer toSocket:(int)s flush:(BOOL)flush {
+    
+    NSUInteger chunkSize = MAX(_chunkSize, 1);
+    NSUInteger offset = 0;
+    
+    while([buffer length] - offset >= chunkSize || (flush && offset < [buffer length])) {
+        NSUInteger length = MIN(chunkSize, [buffer length] - offset);
+        NSData *chunk = [NSData dataWithBytesNoCopy:((char *)[buffer mutableBytes] + offset) length:length freeWhenDone:NO];
+        if([self writeData:chunk toSocket:s] == NO) return NO;
+        offset += length;
+    }
+    
+    [buffer replaceBytesInRange:NSMakeRange(0, offset) withBytes:NULL length:0];
+    
+    return YES;
+}
+
+- (NSData *)messageDataWithIndex:(NSUInteger)i padding:(NSString *)padding {
+    
+    NSString *s = [NSString stringWithFormat:@"{\"created_at\":\"Thu Oct 17 12:00:00 +0000 2013\",\"id\":%lu,\"id_str\":\"%lu\",\"text\":\"%@\",\"lang\":\"en\",\"user\":{\"id\":42,\"id_str\":\"42\",\"screen_name\":\"loopback\"},\"st_sent_ns\":%llu}",
+                   (unsigned long)i, (unsigned long)i, padding, [[self class] currentTimeNanoseconds]];
+    
+    NSMutableData *data = [NSMutableData data];
+    
+    if(_delimitedByLength) {
+        [data appendData:[[NSString stringWithFormat:@"%lu\r\n", (unsigned long)([s lengthOfBytesUsingEncoding:NSUTF8StringEncoding] + 2)] dataUsingEncoding:NSUTF8StringEncoding]];
+    }
+    
+    [data appendData:[s dataUsingEncoding:NSUTF8StringEncoding]];
+    [data appendBytes:"\r\n" length:2];
+    
+    return data;
+}
+
+- (void)serveConnection:(int)s {
+    
+    if([self readRequestHeadersFromSocket:s] == NO) return;
+    
+    NSString *contentEncodingHeader = _gzipEncoded ? @"Content-Encoding: gzip\r\n" : @"";
+    NSString *headersString = [NSString stringWithFormat:@"HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n%@Connection: close\r\n\r\n", contentEncodingHeader];
+    if([self writeData:[headersString dataUsingEncoding:NSUTF8StringEncoding] toSocket:s] == NO) return;
+    
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    z_stream *compressor = NULL;
+    
+    if(_gzipEncoded) {
+        if(deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) return; // + 16, gzip header
+        compressor = &zs;
+    }
+    
+    [self serveMessagesToSocket:s compressor:compressor];
+    
+    if(compressor) deflateEnd(compressor);
+}
+
+// compresses when needed, Z_SYNC_FLUSH makes each message decodable as soon as it is received
+- (void)appendData:(NSData *)data toBuffer:(NSMutableData *)buffer compressor:(z_stream *)compressor flush:(int)flush {
+    
+    if(compressor == NULL) {
+        [buffer appendData:data];
+        return;
+    }
+    
+    compressor->next_in = (Bytef *)[data bytes];
+    compressor->avail_in = (uInt)[data length];
+    
+    uint8_t output[16384];
+    
+    do {
+        compressor->next_out = output;
+        compressor->avail_out = sizeof(output);
+        deflate(compressor, flush);
+        [buffer appendBytes:output length:sizeof(output) - compressor->avail_out];
+    } while (compressor->avail_out == 0);
+}
+
+- (void)serveMessagesToSocket:(int)s compressor:(z_stream *)compressor {
+    
+    NSUInteger paddingLength = _messageSize > 200 ? _messageSize - 200 : 0; // without the other fields
+    NSString *padding = [@"" stringByPaddingToLength:paddingLength withString:@"lorem ipsum " startingAtIndex:0];
+    
+    NSMutableData *buffer = [NSMutableData data];
+    uint64_t startTime = [[self class] currentTimeNanoseconds];
+    
+    for(NSUInteger i = 0; i < _messageCount && self.isStopped == NO; i++) {
+        
+        if(_messagesPerSecond > 0) {
+            
+            // send pending bytes before waiting, so that they don't count as latency
+            
+            uint64_t dueTime = startTime + (uint64_t)i * NSEC_PER_SEC / _messagesPerSecond;
+            uint64_t now = [[self class] currentTimeNanoseconds];
+            
+            if(dueTime > now) {
+                if([self writeChunksFromBuffer:buffer toSocket:s flush:YES] == NO) return;
+                usleep((useconds_t)((dueTime - now) / NSEC_PER_USEC));
+            }
+        }
+        
+        @autoreleasepool {
+            [self appendData:[self messageDataWithIndex:i padding:padding] toBuffer:buffer compressor:compressor flush:Z_SYNC_FLUSH];
+        }
+        
+        if(_keepAliveInterval > 0 && (i + 1) % _keepAliveInterval == 0) {
+            [self appendData:[NSData dataWithBytes:"\r\n" length:2] toBuffer:buffer compressor:compressor flush:Z_SYNC_FLUSH];
+        }
+        
+        if([self writeChunksFromBuffer:buffer toSocket:s flush:NO] == NO) return;
+    }
+    
+    [self appendData:[NSData data] toBuffer:buffer compressor:compressor flush:Z_FINISH];
+    
+    [self writeChunksFromBuffer:buffer toSocket:s flush:YES];
+}
+
+@end
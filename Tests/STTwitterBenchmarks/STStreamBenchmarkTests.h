@@ -0,0 +1,18 @@
+//
+//  STStreamBenchmarkTests.h
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+/*
+ Throughput and latency of the whole streaming path, from the socket to the blocks on the main queue
+ Run the STTwitterBenchmarks target with the Release configuration, results are logged.
+ */
+
+@interface STStreamBenchmarkTests : XCTestCase
+
+@end
@@ -0,0 +1,164 @@
+//
+//  STStreamBenchmarkTests.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STStreamBenchmarkTests.h"
+#import "STLoopbackStreamServer.h"
+#import "STAllocationCounter.h"
+#import "STTwitterAPI.h"
+#import "STTwitterStreamSession.h"
+#import "STHTTPRequest.h"
+
+static NSTimeInterval const kSTStreamBenchmarkTimeout = 120.0;
+
+@implementation STStreamBenchmarkTests
+
+static int STCompareUInt64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+- (void)runBenchmarkNamed:(NSString *)name
+                   server:(STLoopbackStreamServer *)server
+                  batched:(BOOL)batched {
+    
+    NSError *error = nil;
+    BOOL started = [server startWithError:&error];
+    XCTAssertTrue(started, @"%@", error);
+    if(started == NO) return;
+    
+    STTwitterAPI *twitter = [STTwitterAPI twitterAPIWithOAuthConsumerKey:@"key"
+                                                          consumerSecret:@"secret"
+                                                              oauthToken:@"token"
+                                                        oauthTokenSecret:@"secret"];
+    
+    NSUInteger expectedCount = server.messageCount;
+    uint64_t *latencies = calloc(expectedCount, sizeof(uint64_t));
+    __block NSUInteger receivedCount = 0;
+    __block NSError *streamError = nil;
+    
+    void(^receiveBlock)(id json) = ^(id json) {
+        if(receivedCount >= expectedCount) return;
+        uint64_t sentTime = [[json valueForKey:@"st_sent_ns"] unsignedLongLongValue];
+        latencies[receivedCount++] = [STLoopbackStreamServer currentTimeNanoseconds] - sentTime;
+    };
+    
+    NSDictionary *parameters = server.delimitedByLength ? @{@"delimited" : @"length"} : @{};
+    
+    unsigned long long decodedBytesAtStart = 0;
+    [STHTTPRequest getEncodedBytesReceived:NULL decodedBytesReceived:&decodedBytesAtStart];
+    
+    [STAllocationCounter start];
+    uint64_t startTime = [STLoopbackStreamServer currentTimeNanoseconds];
+    
+    STTwitterStreamSession *session = [twitter streamResource:@"statuses/sample.json"
+                                                   HTTPMethod:@"GET"
+                                                baseURLString:server.baseURLString
+                                                   parameters:parameters
+                                                progressBlock:receiveBlock
+                                            stallWarningBlock:nil
+                                                   errorBlock:^(NSError *error) {
+                                                       streamError = error;
+                                                   }];
+    
+    if(batched) {
+        session.batchBlock = ^(NSArray *messages) {
+            for(id json in messages) receiveBlock(json);
+        };
+    }
+    
+    NSDate *timeout = [NSDate dateWithTimeIntervalSinceNow:kSTStreamBenchmarkTimeout];
+    while(receivedCount < expectedCount && streamError == nil && [timeout timeIntervalSinceNow] > 0) {
+        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+    }
+    
+    uint64_t elapsed = [STLoopbackStreamServer currentTimeNanoseconds] - startTime;
+    
+    [STAllocationCounter stop];
+    [session stop];
+    [server stop];
+    
+    // streams use NSURLConnection, which doesn't report the encoded bytes, the server counts them
+    unsigned long long decodedBytes = 0;
+    [STHTTPRequest getEncodedBytesReceived:NULL decodedBytesReceived:&decodedBytes];
+    decodedBytes -= decodedBytesAtStart;
+    
+    XCTAssertNil(streamError, @"%@", streamError);
+    XCTAssertEqual((int)receivedCount, (int)expectedCount, @"");
+    
+    if(receivedCount > 0) {
+        
+        qsort(latencies, receivedCount, sizeof(uint64_t), STCompareUInt64);
+        
+        double seconds = (double)elapsed / NSEC_PER_SEC;
+        double p50 = (double)latencies[receivedCount * 50 / 100] / NSEC_PER_MSEC;
+        double p99 = (double)latencies[MIN(receivedCount * 99 / 100, receivedCount - 1)] / NSEC_PER_MSEC;
+        
+        NSLog(@"-- %@: %.0f msg/s, %.2f MB/s, latency p50 %.2f ms p99 %.2f ms, %.1f allocs/msg, %.2f MB received, %.2f MB decoded",
+              name,
+              receivedCount / seconds,
+              server.sentBytesCount / seconds / (1024 * 1024),
+              p50,
+              p99,
+              (double)[STAllocationCounter allocationsCount] / receivedCount,
+              server.sentBytesCount / (1024.0 * 1024),
+              decodedBytes / (1024.0 * 1024));
+    }
+    
+    free(latencies);
+}
+
+- (void)testThroughputDelimited {
+    
+    STLoopbackStreamServer *server = [[STLoopbackStreamServer alloc] init];
+    
+    [self runBenchmarkNamed:@"delimited" server:server batched:NO];
+}
+
+- (void)testThroughputLengthDelimited {
+    
+    STLoopbackStreamServer *server = [[STLoopbackStreamServer alloc] init];
+    server.delimitedByLength = YES;
+    
+    [self runBenchmarkNamed:@"delimited=length" server:server batched:NO];
+}
+
+- (void)testThroughputBatched {
+    
+    STLoopbackStreamServer *server = [[STLoopbackStreamServer alloc] init];
+    
+    [self runBenchmarkNamed:@"batched" server:server batched:YES];
+}
+
+- (void)testThroughputGzip {
+    
+    STLoopbackStreamServer *server = [[STLoopbackStreamServer alloc] init];
+    server.gzipEncoded = YES;
+    
+    [self runBenchmarkNamed:@"gzip" server:server batched:NO];
+}
+
+- (void)testSmallChunksAndKeepAlives {
+    
+    STLoopbackStreamServer *server = [[STLoopbackStreamServer alloc] init];
+    server.chunkSize = 100;
+    server.keepAliveInterval = 10;
+    
+    [self runBenchmarkNamed:@"small chunks" server:server batched:NO];
+}
+
+- (void)testLatencyAtSteadyRate {
+    
+    STLoopbackStreamServer *server = [[STLoopbackStreamServer alloc] init];
+    server.messageCount = 4000;
+    server.messagesPerSecond = 2000;
+    
+    [self runBenchmarkNamed:@"2000 msg/s" server:server batched:NO];
+}
+
+@end
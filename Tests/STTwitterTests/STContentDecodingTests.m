@@ -0,0 +1,188 @@
+//
+//  STContentDecodingTests.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STContentDecodingTests.h"
+#import "STHTTPRequest.h"
+#include <zlib.h>
+
+// transport events, as called by the connection or the session
+@interface STHTTPRequest (STContentDecodingTests)
+- (void)didReceiveResponse:(NSURLResponse *)response;
+- (void)didReceiveData:(NSData *)data;
+- (void)didFinishLoading;
+@end
+
+@implementation STContentDecodingTests
+
+- (NSData *)gzipData:(NSData *)data {
+    
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+    
+    NSMutableData *gzipData = [NSMutableData dataWithLength:deflateBound(&zs, [data length]) + 32];
+    
+    zs.next_in = (Bytef *)[data bytes];
+    zs.avail_in = (uInt)[data length];
+    zs.next_out = [gzipData mutableBytes];
+    zs.avail_out = (uInt)[gzipData length];
+    
+    deflate(&zs, Z_FINISH);
+    [gzipData setLength:zs.total_out];
+    deflateEnd(&zs);
+    
+    return gzipData;
+}
+
+- (STHTTPRequest *)requestReceivingData:(NSData *)data contentEncoding:(NSString *)contentEncoding chunkSize:(NSUInteger)chunkSize {
+    
+    STHTTPRequest *r = [STHTTPRequest requestWithURLString:@"https://stream.twitter.com/1.1/statuses/sample.json"];
+    
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:r.url
+                                                              statusCode:200
+                                                             HTTPVersion:@"HTTP/1.1"
+                                                            headerFields:@{@"Content-Encoding" : contentEncoding}];
+    [r didReceiveResponse:response];
+    
+    for(NSUInteger offset = 0; offset < [data length]; offset += chunkSize) {
+        NSRange range = NSMakeRange(offset, MIN(chunkSize, [data length] - offset));
+        [r didReceiveData:[data subdataWithRange:range]];
+    }
+    
+    return r;
+}
+
+- (void)testGzipBodyIsInflatedIncrementally {
+    
+    NSMutableString *ms = [NSMutableString string];
+    for(NSUInteger i = 0; i < 500; i++) {
+        [ms appendFormat:@"{\"id\":%lu,\"text\":\"lorem ipsum dolor sit amet\"}\r\n", (unsigned long)i];
+    }
+    NSData *data = [ms dataUsingEncoding:NSUTF8StringEncoding];
+    NSData *gzipData = [self gzipData:data];
+    
+    STHTTPRequest *r = [self requestReceivingData:gzipData contentEncoding:@"gzip" chunkSize:7];
+    
+    XCTAssertEqualObjects(r.responseData, data, @"");
+    XCTAssertEqual(r.totalBytesReceived, [data length], @"");
+    XCTAssertEqual(r.totalEncodedBytesReceived, [gzipData length], @"");
+    XCTAssertTrue(r.isEncodedByteCountAvailable, @"");
+}
+
+- (void)testBodyDecodedByTheTransportIsKept {
+    
+    NSData *data = [@"{\"id\":1}\r\n" dataUsingEncoding:NSUTF8StringEncoding];
+    
+    STHTTPRequest *r = [self requestReceivingData:data contentEncoding:@"gzip" chunkSize:1];
+    
+    XCTAssertEqualObjects(r.responseData, data, @"");
+    XCTAssertFalse(r.isEncodedByteCountAvailable, @"the connection doesn't report the bytes it decoded");
+}
+
+- (void)testDecodedBodyLookingLikeAnotherEncodingIsKept {
+    
+    NSData *data = [@"x^2 + y^2" dataUsingEncoding:NSUTF8StringEncoding]; // starts with a valid zlib header
+    
+    STHTTPRequest *r = [self requestReceivingData:data contentEncoding:@"gzip" chunkSize:4];
+    
+    XCTAssertEqualObjects(r.responseData, data, @"only a gzip header is looked for");
+}
+
+- (void)testResponseStringIsDecodedOnFirstAccess {
+    
+    NSData *data = [@"caf\u00e9" dataUsingEncoding:NSISOLatin1StringEncoding];
+    
+    STHTTPRequest *r = [STHTTPRequest requestWithURLString:@"https://api.twitter.com/1.1/help/tos.json"];
+    
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:r.url
+                                                              statusCode:200
+                                                             HTTPVersion:@"HTTP/1.1"
+                                                            headerFields:@{@"Content-Type" : @"text/plain; charset=iso-8859-1"}];
+    
+    __block NSString *body = nil;
+    r.completionBlock = ^(NSDictionary *headers, NSString *b) {
+        body = b;
+    };
+    
+    [r didReceiveResponse:response];
+    [r didReceiveData:data];
+    [r didFinishLoading];
+    
+    XCTAssertNotNil(body, @"");
+    XCTAssertNil([r valueForKey:@"_responseString"], @"body must not be decoded before it is used");
+    
+    XCTAssertEqualObjects(body, @"caf\u00e9", @"");
+    XCTAssertEqualObjects(r.responseString, @"caf\u00e9", @"");
+    XCTAssertEqualObjects(r.responseData, data, @"");
+}
+
+- (void)testCancelledRequestCallsOnlyItsErrorBlock {
+    
+    STHTTPRequest *r = [STHTTPRequest requestWithURLString:@"https://api.twitter.com/1.1/help/tos.json"];
+    
+    __block NSUInteger completionCount = 0;
+    __block NSUInteger errorCount = 0;
+    r.completionBlock = ^(NSDictionary *headers, NSString *body) { completionCount++; };
+    r.errorBlock = ^(NSError *error) { errorCount++; };
+    
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:r.url statusCode:200 HTTPVersion:@"HTTP/1.1" headerFields:@{}];
+    
+    [r didReceiveResponse:response];
+    [r cancel];
+    [r didFinishLoading]; // the transport was already completing the request
+    [r cancel];
+    
+    [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+    
+    XCTAssertEqual(completionCount, (NSUInteger)0, @"");
+    XCTAssertEqual(errorCount, (NSUInteger)1, @"");
+    
+    // once complete, a request cannot be cancelled
+    
+    r = [STHTTPRequest requestWithURLString:@"https://api.twitter.com/1.1/help/tos.json"];
+    r.completionBlock = ^(NSDictionary *headers, NSString *body) { completionCount++; };
+    r.errorBlock = ^(NSError *error) { errorCount++; };
+    
+    [r didReceiveResponse:response];
+    [r didFinishLoading];
+    [r cancel];
+    
+    [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+    
+    XCTAssertEqual(completionCount, (NSUInteger)1, @"");
+    XCTAssertEqual(errorCount, (NSUInteger)1, @"");
+    XCTAssertNil(r.error, @"");
+}
+
+- (void)testUndecodableBodyIsNil {
+    
+    const unsigned char bytes[] = {'{', '"', 'a', '"', ':', '"', 0xC3, '"', '}'}; // truncated UTF-8 sequence
+    NSData *data = [NSData dataWithBytes:bytes length:sizeof(bytes)];
+    
+    STHTTPRequest *r = [STHTTPRequest requestWithURLString:@"https://api.twitter.com/1.1/help/tos.json"];
+    
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:r.url statusCode:200 HTTPVersion:@"HTTP/1.1" headerFields:@{}];
+    
+    __block BOOL didComplete = NO;
+    __block NSString *body = @"";
+    r.completionBlock = ^(NSDictionary *headers, NSString *b) {
+        didComplete = YES;
+        body = b;
+    };
+    
+    [r didReceiveResponse:response];
+    [r didReceiveData:data];
+    [r didFinishLoading];
+    
+    XCTAssertTrue(didComplete, @"");
+    XCTAssertNil(body, @"");
+    XCTAssertNil(r.responseString, @"");
+    XCTAssertEqualObjects(r.responseData, data, @"");
+}
+
+@end
@@ -0,0 +1,218 @@
+//
+//  STCredentialPoolTests.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STCredentialPoolTests.h"
+#import "STTwitterCredentialPool.h"
+#import "STTwitterAppOnly.h"
+#import "STHTTPRequest+UnitTests.h"
+#import "STHTTPRequestTestResponse.h"
+#import "STHTTPRequestTestResponseQueue.h"
+#import "STHTTPRequest+STTwitter.h"
+#import "STTwitterAPI.h"
+#import "STTwitterRequestRegistry.h"
+#import "STTwitterOAuth.h"
+#import "STTwitterResponseCache.h"
+
+// keeps its requests in flight until they are cancelled
+@interface STPendingCredential : NSObject <STTwitterProtocol>
+@property (nonatomic, retain) NSMutableDictionary *errorBlocksByRequestID;
+@property (nonatomic, retain) NSMutableArray *cancelledRequestIDs;
+@end
+
+@implementation STPendingCredential
+
+- (id)init {
+    self = [super init];
+    self.errorBlocksByRequestID = [NSMutableDictionary dictionary];
+    self.cancelledRequestIDs = [NSMutableArray array];
+    return self;
+}
+
+- (BOOL)canVerifyCredentials { return NO; }
+- (void)verifyCredentialsWithSuccessBlock:(void(^)(NSString *username))successBlock errorBlock:(void(^)(NSError *error))errorBlock {}
+- (NSString *)consumerName { return @"pending"; }
+- (NSString *)loginTypeDescription { return @"Pending"; }
+
+- (NSString *)fetchResource:(NSString *)resource
+                 HTTPMethod:(NSString *)HTTPMethod
+              baseURLString:(NSString *)baseURLString
+                 parameters:(NSDictionary *)params
+              progressBlock:(void(^)(NSString *requestID, id response))progressBlock
+               successBlock:(void(^)(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, id response))successBlock
+                 errorBlock:(void(^)(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, NSError *error))errorBlock {
+    NSString *requestID = [NSString stringWithFormat:@"%lu", (unsigned long)[_errorBlocksByRequestID count] + 1];
+    _errorBlocksByRequestID[requestID] = [errorBlock copy];
+    return requestID;
+}
+
+- (void)cancelRequestWithID:(NSString *)requestID {
+    [_cancelledRequestIDs addObject:requestID];
+    void(^errorBlock)(NSString *, NSDictionary *, NSDictionary *, NSError *) = _errorBlocksByRequestID[requestID];
+    NSError *error = [NSError errorWithDomain:@"STHTTPRequest" code:kSTHTTPRequestCancellationError userInfo:nil];
+    errorBlock(requestID, nil, nil, error);
+}
+
+@end
+
+@implementation STCredentialPoolTests
+
+- (STTwitterAppOnly *)credentialWithBearerToken:(NSString *)bearerToken {
+    STTwitterAppOnly *appOnly = [STTwitterAppOnly twitterAppOnlyWithConsumerName:bearerToken consumerKey:@"key" consumerSecret:@"secret"];
+    appOnly.bearerToken = bearerToken;
+    return appOnly;
+}
+
+// responseBlock returns the HTTP status and the remaining budget for the bearer token of the request
+- (void)enqueueResponses:(NSUInteger)count
+           bearerTokens:(NSMutableArray *)bearerTokens
+          responseBlock:(NSUInteger(^)(NSString *bearerToken, NSInteger *remaining))responseBlock {
+    
+    for(NSUInteger i = 0; i < count; i++) {
+        
+        STHTTPRequestTestResponse *tr = [STHTTPRequestTestResponse testResponseWithBlock:^(STHTTPRequest *r) {
+            
+            NSString *bearerToken = [[r.requestHeaders valueForKey:@"Authorization"] stringByReplacingOccurrencesOfString:@"Bearer " withString:@""];
+            [bearerTokens addObject:bearerToken];
+            
+            NSInteger remaining = 0;
+            NSUInteger status = responseBlock(bearerToken, &remaining);
+            
+            NSDictionary *json = @{};
+            if(status >= 400) {
+                json = @{@"errors" : @[@{@"message" : @"Invalid or expired token", @"code" : @(89)}]};
+                r.error = [NSError errorWithDomain:@"STHTTPRequest" code:status userInfo:nil];
+            }
+            
+            NSString *reset = [@(floor([[NSDate date] timeIntervalSince1970] + 900)) description];
+            
+            r.responseStatus = status;
+            r.responseHeaders = @{@"x-rate-limit-limit" : @"180", @"x-rate-limit-remaining" : [@(remaining) description], @"x-rate-limit-reset" : reset};
+            NSData *data = [NSJSONSerialization dataWithJSONObject:json options:0 error:nil];
+            r.responseData = [data mutableCopy];
+            r.responseString = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
+        }];
+        
+        [[STHTTPRequestTestResponseQueue sharedInstance] enqueue:tr];
+    }
+}
+
+- (void)getUserWithPool:(STTwitterCredentialPool *)pool successCount:(NSUInteger *)successCount {
+    [pool fetchResource:@"users/show.json"
+             HTTPMethod:@"GET"
+          baseURLString:@"https://api.twitter.com/1.1"
+             parameters:@{@"screen_name" : @"nst021"}
+          progressBlock:nil
+           successBlock:^(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, id response) {
+               (*successCount)++;
+           } errorBlock:^(NSString *requestID, NSDictionary *requestHeaders, NSDictionary *responseHeaders, NSError *error) {
+               XCTFail(@"%@", error);
+           }];
+}
+
+- (void)testRequestsGoToTheLargestBudget {
+    
+    STTwitterCredentialPool *pool = [STTwitterCredentialPool credentialPoolWithCredentials:@[[self credentialWithBearerToken:@"A"], [self credentialWithBearerToken:@"B"]]];
+    
+    NSMutableArray *bearerTokens = [NSMutableArray array];
+    
+    [self enqueueResponses:3 bearerTokens:bearerTokens responseBlock:^NSUInteger(NSString *bearerToken, NSInteger *remaining) {
+        *remaining = [bearerToken isEqualToString:@"A"] ? 10 : 50;
+        return 200;
+    }];
+    
+    NSUInteger successCount = 0;
+    for(NSUInteger i = 0; i < 3; i++) {
+        [self getUserWithPool:pool successCount:&successCount];
+    }
+    
+    XCTAssertEqual(successCount, (NSUInteger)3, @"");
+    XCTAssertEqualObjects(bearerTokens, (@[@"A", @"B", @"B"]), @"unknown budgets first, then the largest budget");
+}
+
+- (void)testAuthenticationErrorSidelinesCredentialAndRetries {
+    
+    STTwitterAppOnly *credentialA = [self credentialWithBearerToken:@"A"];
+    STTwitterAppOnly *credentialB = [self credentialWithBearerToken:@"B"];
+    
+    STTwitterCredentialPool *pool = [STTwitterCredentialPool credentialPoolWithCredentials:@[credentialA, credentialB]];
+    
+    NSMutableArray *bearerTokens = [NSMutableArray array];
+    
+    [self enqueueResponses:3 bearerTokens:bearerTokens responseBlock:^NSUInteger(NSString *bearerToken, NSInteger *remaining) {
+        *remaining = 100;
+        return [bearerToken isEqualToString:@"A"] ? 401 : 200;
+    }];
+    
+    NSUInteger successCount = 0;
+    [self getUserWithPool:pool successCount:&successCount];
+    [self getUserWithPool:pool successCount:&successCount];
+    
+    XCTAssertEqual(successCount, (NSUInteger)2, @"");
+    XCTAssertEqualObjects(bearerTokens, (@[@"A", @"B", @"B"]), @"retried once with B, then A is no longer used");
+    XCTAssertEqualObjects(pool.availableCredentials, @[credentialB], @"");
+    
+    [pool reinstateCredential:credentialA];
+    
+    XCTAssertEqual([pool.availableCredentials count], (NSUInteger)2, @"");
+}
+
+- (void)testPooledRequestsAreCancelledByTag {
+    
+    STPendingCredential *credential = [[STPendingCredential alloc] init];
+    STTwitterAPI *twitter = [STTwitterAPI twitterAPIWithCredentialPool:[STTwitterCredentialPool credentialPoolWithCredentials:@[credential]]];
+    
+    __block NSError *requestError = nil;
+    
+    [twitter getAPIResource:@"users/show.json" parameters:@{@"screen_name" : @"nst021", kSTRequestTagKey : @"job"} successBlock:^(NSDictionary *rateLimits, id response) {
+        XCTFail(@"");
+    } errorBlock:^(NSError *error) {
+        requestError = error;
+    }];
+    
+    XCTAssertNotNil([twitter requestRegistry], @"");
+    XCTAssertEqual([[twitter requestRegistry] count], (NSUInteger)1, @"");
+    
+    [[twitter requestRegistry] cancelRequestsWithTag:@"job"];
+    
+    XCTAssertEqualObjects(credential.cancelledRequestIDs, @[@"1"], @"the credential cancels the attempt in flight");
+    XCTAssertEqual([requestError code], (NSInteger)kSTHTTPRequestCancellationError, @"");
+    XCTAssertEqual([[twitter requestRegistry] count], (NSUInteger)0, @"");
+}
+
+- (void)testUserCredentialsDontShareCachedResponses {
+    
+    STTwitterOAuth *userA = [STTwitterOAuth twitterOAuthWithConsumerName:@"A" consumerKey:@"key" consumerSecret:@"secret" oauthToken:@"1-tokenA" oauthTokenSecret:@"secretA"];
+    STTwitterOAuth *userB = [STTwitterOAuth twitterOAuthWithConsumerName:@"B" consumerKey:@"key" consumerSecret:@"secret" oauthToken:@"2-tokenB" oauthTokenSecret:@"secretB"];
+    STTwitterAppOnly *appOnly = [self credentialWithBearerToken:@"C"];
+    
+    STTwitterCredentialPool *pool = [STTwitterCredentialPool credentialPoolWithCredentials:@[userA, userB, appOnly]];
+    STTwitterResponseCache *cache = [[STTwitterResponseCache alloc] initWithDirectoryPath:nil];
+    pool.responseCache = cache;
+    
+    NSURL *url = [NSURL URLWithString:@"https://api.twitter.com/1.1/users/show.json?screen_name=nst021"];
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:url statusCode:200 HTTPVersion:@"HTTP/1.1" headerFields:@{@"cache-control" : @"no-cache"}];
+    NSCachedURLResponse *cachedResponse = [[NSCachedURLResponse alloc] initWithResponse:response data:[@"{\"following\":true}" dataUsingEncoding:NSUTF8StringEncoding] userInfo:nil storagePolicy:NSURLCacheStorageAllowed];
+    
+    [[pool responseCacheForCredential:userA] storeCachedResponse:cachedResponse forRequest:[NSURLRequest requestWithURL:url]];
+    
+    __block NSCachedURLResponse *responseA = nil;
+    __block NSCachedURLResponse *responseB = cachedResponse;
+    
+    [[pool responseCacheForCredential:userA] lookUpCachedResponseForRequest:[NSURLRequest requestWithURL:url] completionBlock:^(NSCachedURLResponse *r, BOOL isFresh) {
+        responseA = r;
+    }];
+    [[pool responseCacheForCredential:userB] lookUpCachedResponseForRequest:[NSURLRequest requestWithURL:url] completionBlock:^(NSCachedURLResponse *r, BOOL isFresh) {
+        responseB = r;
+    }];
+    
+    XCTAssertNotNil(responseA, @"");
+    XCTAssertNil(responseB, @"");
+    XCTAssertEqualObjects([pool responseCacheForCredential:appOnly], cache, @"app-only credentials share the cache");
+}
+
+@end
@@ -0,0 +1,132 @@
+//
+//  STCursorIteratorTests.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STCursorIteratorTests.h"
+#import "STTwitterCursorIterator.h"
+#import "STTwitterAPI.h"
+#import "NSString+STTwitter.h"
+#import "STHTTPRequest+UnitTests.h"
+#import "STHTTPRequestTestResponse.h"
+#import "STHTTPRequestTestResponseQueue.h"
+
+@implementation STCursorIteratorTests
+
+- (void)testNextPageIsFetchedWhilePageIsConsumed {
+    
+    NSMutableArray *fetchedCursors = [NSMutableArray array];
+    NSMutableDictionary *pendingSuccessBlocks = [NSMutableDictionary dictionary];
+    
+    STTwitterCursorIterator *iterator = [STTwitterCursorIterator cursorIteratorWithCursor:nil fetchBlock:^(NSString *cursor, void (^successBlock)(NSArray *, NSString *), void (^errorBlock)(NSError *)) {
+        [fetchedCursors addObject:cursor];
+        pendingSuccessBlocks[cursor] = successBlock;
+    }];
+    
+    NSMutableArray *pages = [NSMutableArray array];
+    __block void(^pendingDoneBlock)(BOOL) = nil;
+    __block BOOL isCompleted = NO;
+    
+    [iterator startWithAsynchronousPageBlock:^(NSArray *items, void (^doneBlock)(BOOL)) {
+        [pages addObject:items];
+        pendingDoneBlock = doneBlock;
+    } completionBlock:^(NSError *error) {
+        XCTAssertNil(error, @"");
+        isCompleted = YES;
+    }];
+    
+    XCTAssertEqualObjects(fetchedCursors, @[@"-1"], @"");
+    
+    ((void(^)(NSArray *, NSString *))pendingSuccessBlocks[@"-1"])(@[@"a", @"b"], @"2");
+    
+    XCTAssertEqualObjects(pages, @[@[@"a", @"b"]], @"");
+    XCTAssertEqualObjects(fetchedCursors, (@[@"-1", @"2"]), @"page 2 is requested while page 1 is consumed");
+    
+    ((void(^)(NSArray *, NSString *))pendingSuccessBlocks[@"2"])(@[@"c"], @"3");
+    
+    XCTAssertEqual([fetchedCursors count], (NSUInteger)2, @"no more than one page ahead");
+    
+    pendingDoneBlock(NO);
+    
+    XCTAssertEqualObjects([pages lastObject], @[@"c"], @"");
+    XCTAssertEqualObjects([fetchedCursors lastObject], @"3", @"");
+    
+    ((void(^)(NSArray *, NSString *))pendingSuccessBlocks[@"3"])(@[@"d"], @"0");
+    pendingDoneBlock(NO);
+    
+    XCTAssertFalse(isCompleted, @"the last page is still consumed");
+    
+    pendingDoneBlock(NO);
+    
+    XCTAssertTrue(isCompleted, @"");
+    XCTAssertEqual(iterator.pageCount, (NSUInteger)3, @"");
+    XCTAssertEqual(iterator.itemCount, (NSUInteger)4, @"");
+    XCTAssertEqualObjects(iterator.cursor, @"0", @"");
+}
+
+- (void)testStopEndsTheIteration {
+    
+    __block NSUInteger fetchCount = 0;
+    
+    STTwitterCursorIterator *iterator = [STTwitterCursorIterator cursorIteratorWithCursor:nil fetchBlock:^(NSString *cursor, void (^successBlock)(NSArray *, NSString *), void (^errorBlock)(NSError *)) {
+        fetchCount++;
+        successBlock(@[cursor], [NSString stringWithFormat:@"%lu", (unsigned long)fetchCount + 1]); // endless
+    }];
+    
+    __block NSUInteger completionCount = 0;
+    
+    [iterator startWithPageBlock:^(NSArray *items, BOOL *stop) {
+        *stop = (iterator.pageCount == 2);
+    } completionBlock:^(NSError *error) {
+        completionCount++;
+    }];
+    
+    XCTAssertEqual(completionCount, (NSUInteger)1, @"");
+    XCTAssertTrue(iterator.isFinished, @"");
+    XCTAssertEqual(iterator.pageCount, (NSUInteger)2, @"");
+    XCTAssertEqualObjects(iterator.cursor, @"3", @"resumes after the last page handed out");
+}
+
+- (void)testFollowersIDsIterator {
+    
+    NSArray *pages = @[@{@"ids" : @[@"1", @"2"], @"next_cursor_str" : @"1374004777531007833", @"previous_cursor_str" : @"0"},
+                       @{@"ids" : @[@"3"], @"next_cursor_str" : @"0", @"previous_cursor_str" : @"-1374004777531007833"}];
+    
+    NSMutableArray *cursors = [NSMutableArray array];
+    
+    for(NSDictionary *json in pages) {
+        STHTTPRequestTestResponse *tr = [STHTTPRequestTestResponse testResponseWithBlock:^(STHTTPRequest *r) {
+            NSString *query = [[r url] query];
+            [cursors addObject:[query firstMatchWithRegex:@"cursor=([^&]*)" error:nil] ?: @""];
+            
+            NSData *data = [NSJSONSerialization dataWithJSONObject:json options:0 error:nil];
+            r.responseStatus = 200;
+            r.responseData = [data mutableCopy];
+            r.responseString = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
+        }];
+        [[STHTTPRequestTestResponseQueue sharedInstance] enqueue:tr];
+    }
+    
+    STTwitterAPI *twitter = [STTwitterAPI twitterAPIWithOAuthConsumerKey:@"key" consumerSecret:@"secret" oauthToken:@"token" oauthTokenSecret:@"tokenSecret"];
+    
+    STTwitterCursorIterator *iterator = [twitter followersIDsIteratorForUserID:nil orScreenName:@"nst021" count:nil];
+    
+    NSMutableArray *ids = [NSMutableArray array];
+    __block BOOL isCompleted = NO;
+    
+    [iterator startWithPageBlock:^(NSArray *items, BOOL *stop) {
+        [ids addObjectsFromArray:items];
+    } completionBlock:^(NSError *error) {
+        XCTAssertNil(error, @"");
+        isCompleted = YES;
+    }];
+    
+    XCTAssertTrue(isCompleted, @"");
+    XCTAssertEqualObjects(ids, (@[@"1", @"2", @"3"]), @"");
+    XCTAssertEqualObjects(cursors, (@[@"-1", @"1374004777531007833"]), @"");
+}
+
+@end
@@ -0,0 +1,13 @@
+//
+//  STMediaUploadTests.h
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+@interface STMediaUploadTests : XCTestCase
+
+@end
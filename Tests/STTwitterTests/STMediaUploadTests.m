@@ -0,0 +1,221 @@
+//
+//  STMediaUploadTests.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STMediaUploadTests.h"
+#import "STTwitterAPI.h"
+#import "STTwitterMediaUpload.h"
+#import "STHTTPRequest+UnitTests.h"
+#import "STHTTPRequestTestResponse.h"
+#import "STHTTPRequestTestResponseQueue.h"
+
+@implementation STMediaUploadTests
+
+- (STTwitterAPI *)twitter {
+    return [STTwitterAPI twitterAPIWithOAuthConsumerKey:@"key" consumerSecret:@"secret" oauthToken:@"token" oauthTokenSecret:@"tokenSecret"];
+}
+
+- (NSString *)temporaryFileWithLength:(NSUInteger)length {
+    
+    NSMutableData *data = [NSMutableData dataWithLength:length];
+    uint8_t *bytes = [data mutableBytes];
+    for(NSUInteger i = 0; i < length; i++) bytes[i] = (uint8_t)i;
+    
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    [data writeToFile:path atomically:YES];
+    return path;
+}
+
+// answers media/upload commands, failedStatus is returned once for each segment index in failingSegments
+- (void)enqueueResponses:(NSUInteger)count
+         failingSegments:(NSMutableIndexSet *)failingSegments
+            failedStatus:(NSUInteger)failedStatus
+        appendedSegments:(NSMutableArray *)appendedSegments {
+    [self enqueueResponses:count failingSegments:failingSegments failedStatus:failedStatus appendedSegments:appendedSegments initResponse:@{@"media_id_string" : @"710511363345354753", @"expires_after_secs" : @(86400)}];
+}
+
+- (void)enqueueResponses:(NSUInteger)count
+         failingSegments:(NSMutableIndexSet *)failingSegments
+            failedStatus:(NSUInteger)failedStatus
+        appendedSegments:(NSMutableArray *)appendedSegments
+            initResponse:(NSDictionary *)initResponse {
+    
+    for(NSUInteger i = 0; i < count; i++) {
+        
+        STHTTPRequestTestResponse *tr = [STHTTPRequestTestResponse testResponseWithBlock:^(STHTTPRequest *r) {
+            
+            NSString *command = r.POSTDictionary[@"command"];
+            NSDictionary *json = nil;
+            
+            if([command isEqualToString:@"INIT"]) {
+                json = initResponse;
+            } else if([command isEqualToString:@"APPEND"]) {
+                XCTAssertEqualObjects(r.POSTDictionary[@"media_id"], @"710511363345354753", @"");
+                NSUInteger segmentIndex = [r.POSTDictionary[@"segment_index"] integerValue];
+                [appendedSegments addObject:@(segmentIndex)];
+                if([failingSegments containsIndex:segmentIndex]) {
+                    [failingSegments removeIndex:segmentIndex];
+                    json = @{@"errors" : @[@{@"message" : @"Segment failed", @"code" : @(131)}]};
+                    r.responseStatus = failedStatus;
+                    r.error = [NSError errorWithDomain:@"STHTTPRequest" code:failedStatus userInfo:nil];
+                }
+            } else if([command isEqualToString:@"FINALIZE"]) {
+                json = @{@"media_id_string" : @"710511363345354753", @"size" : @(2600)};
+            }
+            
+            if(r.responseStatus == 0) r.responseStatus = (json || [command isEqualToString:@"APPEND"]) ? 200 : 400;
+            
+            NSData *data = json ? [NSJSONSerialization dataWithJSONObject:json options:0 error:nil] : [NSData data];
+            r.responseData = [data mutableCopy];
+            r.responseString = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
+        }];
+        
+        [[STHTTPRequestTestResponseQueue sharedInstance] enqueue:tr];
+    }
+}
+
+- (void)waitWhile:(BOOL(^)(void))conditionBlock {
+    NSDate *timeout = [NSDate dateWithTimeIntervalSinceNow:3.0];
+    while(conditionBlock() && [timeout timeIntervalSinceNow] > 0) {
+        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    }
+}
+
+- (void)testSegmentIsRetried {
+    
+    NSString *path = [self temporaryFileWithLength:2600];
+    
+    NSMutableArray *appendedSegments = [NSMutableArray array];
+    
+    // INIT, 3 APPEND, 1 retry, FINALIZE
+    [self enqueueResponses:6 failingSegments:[NSMutableIndexSet indexSetWithIndex:1] failedStatus:503 appendedSegments:appendedSegments];
+    
+    STTwitterMediaUpload *upload = [STTwitterMediaUpload mediaUploadWithTwitter:[self twitter] fileURL:[NSURL fileURLWithPath:path] mediaType:nil];
+    upload.segmentSize = 1024;
+    upload.retryDelay = 0.05;
+    
+    __block NSString *uploadedMediaID = nil;
+    __block NSError *uploadError = nil;
+    __block unsigned long long progress = 0;
+    
+    [upload startWithProgressBlock:^(unsigned long long uploadedBytes, unsigned long long totalBytes) {
+        XCTAssertTrue(uploadedBytes > progress, @"");
+        XCTAssertEqual(totalBytes, 2600ULL, @"");
+        progress = uploadedBytes;
+    } successBlock:^(NSString *mediaID, NSDictionary *response) {
+        uploadedMediaID = mediaID;
+    } errorBlock:^(NSError *error) {
+        uploadError = error;
+    }];
+    
+    [self waitWhile:^BOOL{ return uploadedMediaID == nil && uploadError == nil; }];
+    
+    XCTAssertNil(uploadError, @"%@", uploadError);
+    XCTAssertEqualObjects(uploadedMediaID, @"710511363345354753", @"");
+    XCTAssertEqual(progress, 2600ULL, @"");
+    XCTAssertEqualObjects(appendedSegments, (@[@0, @1, @2, @1]), @"only the failed segment is sent again");
+    XCTAssertTrue(upload.isFinished, @"");
+    
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testUploadResumesFromCheckpoint {
+    
+    NSString *path = [self temporaryFileWithLength:2600];
+    NSString *checkpointPath = [path stringByAppendingPathExtension:@"plist"];
+    
+    NSMutableArray *appendedSegments = [NSMutableArray array];
+    
+    // INIT, 3 APPEND, the last one fails with a client error that is not retried
+    [self enqueueResponses:4 failingSegments:[NSMutableIndexSet indexSetWithIndex:2] failedStatus:400 appendedSegments:appendedSegments];
+    
+    STTwitterMediaUpload *upload = [STTwitterMediaUpload mediaUploadWithTwitter:[self twitter] fileURL:[NSURL fileURLWithPath:path] mediaType:@"video/mp4"];
+    upload.segmentSize = 1024;
+    upload.checkpointPath = checkpointPath;
+    
+    __block NSError *uploadError = nil;
+    
+    [upload startWithProgressBlock:nil successBlock:^(NSString *mediaID, NSDictionary *response) {
+        XCTFail(@"upload should fail");
+    } errorBlock:^(NSError *error) {
+        uploadError = error;
+    }];
+    
+    [self waitWhile:^BOOL{ return uploadError == nil; }];
+    
+    XCTAssertNotNil(uploadError, @"");
+    XCTAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:checkpointPath], @"");
+    
+    // resume, only the missing segment is sent
+    
+    [appendedSegments removeAllObjects];
+    
+    [self enqueueResponses:2 failingSegments:nil failedStatus:0 appendedSegments:appendedSegments];
+    
+    STTwitterMediaUpload *resumedUpload = [STTwitterMediaUpload mediaUploadWithTwitter:[self twitter] checkpointPath:checkpointPath];
+    
+    XCTAssertNotNil(resumedUpload, @"");
+    XCTAssertEqualObjects(resumedUpload.mediaID, @"710511363345354753", @"");
+    XCTAssertEqualObjects(resumedUpload.mediaType, @"video/mp4", @"");
+    
+    __block NSString *uploadedMediaID = nil;
+    
+    [resumedUpload startWithProgressBlock:nil successBlock:^(NSString *mediaID, NSDictionary *response) {
+        uploadedMediaID = mediaID;
+    } errorBlock:^(NSError *error) {
+        XCTFail(@"-- error: %@", [error localizedDescription]);
+    }];
+    
+    [self waitWhile:^BOOL{ return uploadedMediaID == nil; }];
+    
+    XCTAssertEqualObjects(uploadedMediaID, @"710511363345354753", @"");
+    XCTAssertEqualObjects(appendedSegments, (@[@2]), @"");
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:checkpointPath], @"");
+    
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testMediaCategoryIsGuessedFromMediaType {
+    
+    XCTAssertEqualObjects([STTwitterMediaUpload mediaCategoryForMediaType:@"video/mp4"], @"tweet_video", @"");
+    XCTAssertEqualObjects([STTwitterMediaUpload mediaCategoryForMediaType:@"video/quicktime"], @"tweet_video", @"");
+    XCTAssertEqualObjects([STTwitterMediaUpload mediaCategoryForMediaType:@"image/gif"], @"tweet_gif", @"");
+    XCTAssertNil([STTwitterMediaUpload mediaCategoryForMediaType:@"image/jpeg"], @"");
+}
+
+- (void)testCheckpointWithoutExpirationIsResumed {
+    
+    NSString *path = [self temporaryFileWithLength:2600];
+    NSString *checkpointPath = [path stringByAppendingPathExtension:@"plist"];
+    
+    // INIT without expires_after_secs, 3 APPEND, the last one fails with a client error that is not retried
+    [self enqueueResponses:4 failingSegments:[NSMutableIndexSet indexSetWithIndex:2] failedStatus:400 appendedSegments:[NSMutableArray array] initResponse:@{@"media_id_string" : @"710511363345354753"}];
+    
+    STTwitterMediaUpload *upload = [STTwitterMediaUpload mediaUploadWithTwitter:[self twitter] fileURL:[NSURL fileURLWithPath:path] mediaType:@"video/mp4"];
+    upload.segmentSize = 1024;
+    upload.checkpointPath = checkpointPath;
+    
+    __block NSError *uploadError = nil;
+    
+    [upload startWithProgressBlock:nil successBlock:^(NSString *mediaID, NSDictionary *response) {
+        XCTFail(@"upload should fail");
+    } errorBlock:^(NSError *error) {
+        uploadError = error;
+    }];
+    
+    [self waitWhile:^BOOL{ return uploadError == nil; }];
+    
+    STTwitterMediaUpload *resumedUpload = [STTwitterMediaUpload mediaUploadWithTwitter:[self twitter] checkpointPath:checkpointPath];
+    
+    XCTAssertNotNil(resumedUpload, @"media IDs last 24 hours by default");
+    XCTAssertEqualObjects(resumedUpload.mediaID, @"710511363345354753", @"");
+    
+    [[NSFileManager defaultManager] removeItemAtPath:checkpointPath error:nil];
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+@end
@@ -0,0 +1,73 @@
+//
+//  STMultipartBodyTests.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STMultipartBodyTests.h"
+#import "STHTTPRequest.h"
+
+@interface STHTTPRequest (STMultipartBodyTests)
+- (NSURLRequest *)request;
+@end
+
+@implementation STMultipartBodyTests
+
+- (NSData *)dataFromStream:(NSInputStream *)stream readLength:(NSUInteger)readLength {
+    
+    NSMutableData *data = [NSMutableData data];
+    uint8_t buffer[1024];
+    
+    [stream open];
+    
+    NSInteger length = 0;
+    while((length = [stream read:buffer maxLength:MIN(readLength, sizeof(buffer))]) > 0) {
+        [data appendBytes:buffer length:length];
+    }
+    
+    XCTAssertEqual(length, (NSInteger)0, @"%@", [stream streamError]);
+    
+    [stream close];
+    
+    return data;
+}
+
+- (void)testBodyIsStreamedFromParts {
+    
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    [[@"0123456789" dataUsingEncoding:NSUTF8StringEncoding] writeToFile:path atomically:YES];
+    
+    STHTTPRequest *r = [STHTTPRequest requestWithURLString:@"https://upload.twitter.com/1.1/media/upload.json"];
+    r.POSTDictionary = @{@"command" : @"APPEND"};
+    [r addFileToUpload:path range:NSMakeRange(2, 5) parameterName:@"media" mimeType:nil fileName:@"chunk"];
+    [r addDataToUpload:[@"abc" dataUsingEncoding:NSUTF8StringEncoding] parameterName:@"data"];
+    
+    NSURLRequest *request = [r request];
+    
+    XCTAssertNil([request HTTPBody], @"");
+    
+    NSString *expectedBody = @"------------kStHtTpReQuEsTbOuNdArY\r\n"
+    "Content-Disposition: form-data; name=\"media\"; filename=\"chunk\"\r\n"
+    "Content-Type: application/octet-stream\r\n\r\n"
+    "23456\r\n"
+    "------------kStHtTpReQuEsTbOuNdArY\r\n"
+    "Content-Disposition: form-data; name=\"data\"; \r\n"
+    "Content-Type: application/octet-stream\r\n\r\n"
+    "abc\r\n"
+    "\r\n------------kStHtTpReQuEsTbOuNdArY\r\n"
+    "Content-Disposition: form-data; name=\"command\"\r\n\r\n"
+    "APPEND"
+    "\r\n------------kStHtTpReQuEsTbOuNdArY--\r\n";
+    
+    // small reads cross the part boundaries
+    NSData *body = [self dataFromStream:[request HTTPBodyStream] readLength:7];
+    
+    XCTAssertEqualObjects([[NSString alloc] initWithData:body encoding:NSUTF8StringEncoding], expectedBody, @"");
+    XCTAssertEqualObjects([request valueForHTTPHeaderField:@"Content-Length"], ([NSString stringWithFormat:@"%lu", (unsigned long)[body length]]), @"");
+    
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+@end
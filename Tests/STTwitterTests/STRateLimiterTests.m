@@ -0,0 +1,98 @@
+//
+//  STRateLimiterTests.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STRateLimiterTests.h"
+#import "STTwitterRateLimiter.h"
+
+@implementation STRateLimiterTests
+
+- (NSDictionary *)headersWithLimit:(NSInteger)limit remaining:(NSInteger)remaining resetIn:(NSTimeInterval)seconds {
+    NSTimeInterval reset = floor([[NSDate date] timeIntervalSince1970] + seconds);
+    return @{@"x-rate-limit-limit" : [@(limit) description],
+             @"x-rate-limit-remaining" : [@(remaining) description],
+             @"x-rate-limit-reset" : [@(reset) description]};
+}
+
+- (void)testResourceForURL {
+    
+    NSURL *url = [NSURL URLWithString:@"https://api.twitter.com/1.1/statuses/retweets/123456.json?count=5"];
+    
+    XCTAssertEqualObjects([STTwitterRateLimiter resourceForURL:url], @"statuses/retweets", @"");
+    XCTAssertEqualObjects([STTwitterRateLimiter resourceForURL:[NSURL URLWithString:@"https://api.twitter.com/1.1/users/show.json"]], @"users/show", @"");
+}
+
+- (void)testRequestsWaitOnceTheBudgetIsSpent {
+    
+    STTwitterRateLimiter *rateLimiter = [[STTwitterRateLimiter alloc] init];
+    
+    NSURL *url = [NSURL URLWithString:@"https://api.twitter.com/1.1/friends/ids.json"];
+    
+    __block NSUInteger startCount = 0;
+    
+    [rateLimiter scheduleRequestForURL:url priority:STTwitterRequestPriorityBulk startBlock:^{ startCount++; }];
+    
+    XCTAssertEqual(startCount, (NSUInteger)1, @"unknown budget, not limited");
+    
+    [rateLimiter requestDidFinishForURL:url statusCode:200 responseHeaders:[self headersWithLimit:15 remaining:2 resetIn:600]];
+    
+    for(NSUInteger i = 0; i < 3; i++) {
+        [rateLimiter scheduleRequestForURL:url priority:STTwitterRequestPriorityBulk startBlock:^{ startCount++; }];
+    }
+    
+    XCTAssertEqual(startCount, (NSUInteger)3, @"");
+    XCTAssertEqual(rateLimiter.waitingCount, (NSUInteger)1, @"");
+    XCTAssertEqual(rateLimiter.delayedCount, (NSUInteger)1, @"");
+}
+
+- (void)testRequestsAreSpreadBeyondTheBurst {
+    
+    STTwitterRateLimiter *rateLimiter = [[STTwitterRateLimiter alloc] init];
+    rateLimiter.burstSize = 5;
+    
+    NSURL *url = [NSURL URLWithString:@"https://api.twitter.com/1.1/users/lookup.json"];
+    
+    [rateLimiter scheduleRequestForURL:url priority:STTwitterRequestPriorityBulk startBlock:^{}];
+    [rateLimiter requestDidFinishForURL:url statusCode:200 responseHeaders:[self headersWithLimit:180 remaining:100 resetIn:100]];
+    
+    __block NSUInteger startCount = 0;
+    
+    for(NSUInteger i = 0; i < 10; i++) {
+        [rateLimiter scheduleRequestForURL:url priority:STTwitterRequestPriorityBulk startBlock:^{ startCount++; }];
+    }
+    
+    XCTAssertEqual(startCount, (NSUInteger)5, @"about one request per second after the burst");
+    XCTAssertEqual(rateLimiter.waitingCount, (NSUInteger)5, @"");
+}
+
+- (void)testSeedFromRateLimitStatus {
+    
+    STTwitterRateLimiter *rateLimiter = [[STTwitterRateLimiter alloc] init];
+    
+    NSTimeInterval reset = floor([[NSDate date] timeIntervalSince1970] + 300);
+    
+    NSDictionary *status = @{@"resources" : @{@"statuses" : @{@"/statuses/show/:id" : @{@"limit" : @180, @"remaining" : @42, @"reset" : @(reset)}}}};
+    
+    [rateLimiter updateWithRateLimitStatus:status];
+    
+    NSDictionary *d = [rateLimiter rateLimitForResource:@"statuses/show.json"];
+    
+    XCTAssertEqualObjects(d[@"limit"], @180, @"");
+    XCTAssertEqualObjects(d[@"remaining"], @42, @"");
+    XCTAssertEqualObjects(d[@"reset"], [NSDate dateWithTimeIntervalSince1970:reset], @"");
+    
+    // a late response from the same window cannot raise the remaining count
+    
+    NSURL *url = [NSURL URLWithString:@"https://api.twitter.com/1.1/statuses/show/123.json"];
+    [rateLimiter requestDidFinishForURL:url statusCode:200 responseHeaders:@{@"x-rate-limit-limit" : @"180", @"x-rate-limit-remaining" : @"50", @"x-rate-limit-reset" : [@(reset) description]}];
+    
+    XCTAssertEqualObjects([rateLimiter rateLimitForResource:@"statuses/show.json"][@"remaining"], @42, @"");
+    
+    XCTAssertNil([rateLimiter rateLimitForResource:@"users/show.json"], @"");
+}
+
+@end
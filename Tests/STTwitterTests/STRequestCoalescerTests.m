@@ -0,0 +1,86 @@
+//
+//  STRequestCoalescerTests.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STRequestCoalescerTests.h"
+#import "STTwitterRequestCoalescer.h"
+
+@implementation STRequestCoalescerTests
+
+- (void)testKeyIgnoresParametersOrderButNotCredentials {
+    
+    NSString *key1 = [STTwitterRequestCoalescer keyForResource:@"users/show.json" baseURLString:@"https://api.twitter.com/1.1" parameters:@{@"screen_name":@"nst021", @"include_entities":@"0"} credentials:@"a"];
+    NSString *key2 = [STTwitterRequestCoalescer keyForResource:@"users/show.json" baseURLString:@"https://api.twitter.com/1.1" parameters:@{@"include_entities":@"0", @"screen_name":@"nst021"} credentials:@"a"];
+    NSString *key3 = [STTwitterRequestCoalescer keyForResource:@"users/show.json" baseURLString:@"https://api.twitter.com/1.1" parameters:@{@"screen_name":@"nst021", @"include_entities":@"0"} credentials:@"b"];
+    
+    XCTAssertEqualObjects(key1, key2, @"");
+    XCTAssertFalse([key1 isEqualToString:key3], @"");
+}
+
+- (void)testIdenticalRequestsInFlightShareOneFetch {
+    
+    STTwitterRequestCoalescer *coalescer = [[STTwitterRequestCoalescer alloc] init];
+    
+    __block NSUInteger fetchCount = 0;
+    __block void(^pendingSuccessBlock)(NSDictionary *, id) = nil;
+    
+    void(^fetchBlock)(void(^)(NSDictionary *, id), void(^)(NSError *)) = ^(void(^successBlock)(NSDictionary *, id), void(^errorBlock)(NSError *)) {
+        fetchCount++;
+        pendingSuccessBlock = successBlock;
+    };
+    
+    NSMutableArray *responses = [NSMutableArray array];
+    
+    for(NSUInteger i = 0; i < 3; i++) {
+        [coalescer performRequestWithKey:@"k" successBlock:^(NSDictionary *responseHeaders, id response) {
+            [responses addObject:response];
+        } errorBlock:^(NSError *error) {
+            XCTFail(@"");
+        } fetchBlock:fetchBlock];
+    }
+    
+    XCTAssertEqual(fetchCount, (NSUInteger)1, @"");
+    XCTAssertEqual(coalescer.inFlightCount, (NSUInteger)1, @"");
+    
+    pendingSuccessBlock(@{}, @"user");
+    pendingSuccessBlock(@{}, @"user"); // called twice by mistake, ignored
+    
+    XCTAssertEqualObjects(responses, (@[@"user", @"user", @"user"]), @"");
+    XCTAssertEqual(coalescer.requestCount, (NSUInteger)1, @"");
+    XCTAssertEqual(coalescer.mergeCount, (NSUInteger)2, @"");
+    XCTAssertEqual(coalescer.inFlightCount, (NSUInteger)0, @"");
+    
+    // once the request ended, the same GET goes to the network again
+    
+    [coalescer performRequestWithKey:@"k" successBlock:nil errorBlock:nil fetchBlock:fetchBlock];
+    
+    XCTAssertEqual(fetchCount, (NSUInteger)2, @"");
+}
+
+- (void)testErrorIsDeliveredToAllCallers {
+    
+    STTwitterRequestCoalescer *coalescer = [[STTwitterRequestCoalescer alloc] init];
+    
+    __block void(^pendingErrorBlock)(NSError *) = nil;
+    __block NSUInteger errorCount = 0;
+    
+    for(NSUInteger i = 0; i < 2; i++) {
+        [coalescer performRequestWithKey:@"k" successBlock:^(NSDictionary *responseHeaders, id response) {
+            XCTFail(@"");
+        } errorBlock:^(NSError *error) {
+            errorCount++;
+        } fetchBlock:^(void (^successBlock)(NSDictionary *, id), void (^errorBlock)(NSError *)) {
+            pendingErrorBlock = errorBlock;
+        }];
+    }
+    
+    pendingErrorBlock([NSError errorWithDomain:@"test" code:0 userInfo:nil]);
+    
+    XCTAssertEqual(errorCount, (NSUInteger)2, @"");
+}
+
+@end
@@ -0,0 +1,129 @@
+//
+//  STRequestRegistryTests.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STRequestRegistryTests.h"
+#import "STTwitterRequestRegistry.h"
+#import "STTwitterRateLimiter.h"
+#import "STHTTPRequest+UnitTests.h"
+#import "STHTTPRequestTestResponse.h"
+#import "STHTTPRequestTestResponseQueue.h"
+
+// the request built by -startAsynchronous, which is replaced in unit tests
+@interface STHTTPRequest (STRequestRegistryTests)
+- (NSURLRequest *)request;
+@end
+
+@implementation STRequestRegistryTests
+
+- (void)testCancelByTag {
+    
+    STTwitterRequestRegistry *registry = [[STTwitterRequestRegistry alloc] init];
+    
+    NSMutableArray *cancelledIDs = [NSMutableArray array];
+    
+    for(NSString *requestID in @[@"1", @"2", @"3"]) {
+        NSString *tag = [requestID isEqualToString:@"3"] ? @"other" : @"timeline";
+        [registry registerRequestWithID:requestID tag:tag cancelBlock:^{
+            [cancelledIDs addObject:requestID];
+        }];
+    }
+    
+    [registry requestDidStartWithID:@"2"];
+    
+    XCTAssertEqual([registry stateOfRequestWithID:@"1"], STTwitterRequestStatePending, @"");
+    XCTAssertEqual([registry stateOfRequestWithID:@"2"], STTwitterRequestStateRunning, @"");
+    XCTAssertEqual([registry stateOfRequestWithID:@"4"], STTwitterRequestStateUnknown, @"");
+    
+    [registry cancelRequestsWithTag:@"timeline"];
+    [registry cancelRequestsWithTag:@"timeline"]; // requests are cancelled only once
+    
+    XCTAssertEqualObjects([cancelledIDs sortedArrayUsingSelector:@selector(compare:)], (@[@"1", @"2"]), @"");
+    
+    [registry cancelAllRequests];
+    
+    XCTAssertEqualObjects([cancelledIDs lastObject], @"3", @"");
+    XCTAssertEqual([cancelledIDs count], (NSUInteger)3, @"");
+}
+
+- (void)testWaitForRequests {
+    
+    STTwitterRequestRegistry *registry = [[STTwitterRequestRegistry alloc] init];
+    
+    [registry registerRequestWithID:@"1" tag:@"job" cancelBlock:nil];
+    [registry registerRequestWithID:@"2" tag:@"job" cancelBlock:nil];
+    
+    __block BOOL firstRequestDidFinish = NO;
+    __block BOOL jobDidFinish = NO;
+    
+    [registry waitForRequestWithID:@"1" completionBlock:^{
+        firstRequestDidFinish = YES;
+    }];
+    
+    [registry waitForRequestsWithTag:@"job" completionBlock:^{
+        jobDidFinish = YES;
+    }];
+    
+    [registry requestDidFinishWithID:@"1"];
+    
+    [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+    
+    XCTAssertTrue(firstRequestDidFinish, @"");
+    XCTAssertFalse(jobDidFinish, @"");
+    XCTAssertEqual(registry.count, (NSUInteger)1, @"");
+    
+    [registry requestDidFinishWithID:@"2"];
+    
+    NSDate *timeout = [NSDate dateWithTimeIntervalSinceNow:2.0];
+    while(jobDidFinish == NO && [timeout timeIntervalSinceNow] > 0) {
+        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    }
+    
+    XCTAssertTrue(jobDidFinish, @"");
+    XCTAssertEqual([registry stateOfRequestWithID:@"2"], STTwitterRequestStateUnknown, @"");
+}
+
+- (void)testPOSTThroughRateLimiterIsEscapedOnce {
+    
+    STTwitterRequestRegistry *registry = [[STTwitterRequestRegistry alloc] init];
+    registry.rateLimiter = [[STTwitterRateLimiter alloc] init];
+    
+    __block NSString *body = nil;
+    
+    STHTTPRequestTestResponse *tr = [STHTTPRequestTestResponse testResponseWithBlock:^(STHTTPRequest *r) {
+        body = [[NSString alloc] initWithData:[[r request] HTTPBody] encoding:NSUTF8StringEncoding];
+        r.responseStatus = 200;
+        r.responseString = @"{}";
+    }];
+    
+    [[STHTTPRequestTestResponseQueue sharedInstance] enqueue:tr];
+    
+    STHTTPRequest *r = [STHTTPRequest requestWithURLString:@"https://api.twitter.com/1.1/statuses/update.json"];
+    r.POSTDictionary = @{@"status" : @"a b&c"};
+    
+    __block BOOL didFinish = NO;
+    r.completionBlock = ^(NSDictionary *headers, NSString *body) { didFinish = YES; };
+    r.errorBlock = ^(NSError *error) { didFinish = YES; };
+    
+    __block NSString *signedStatus = nil;
+    
+    [registry startRequest:r withID:@"1" requestOptions:nil prepareBlock:^{
+        signedStatus = r.POSTDictionary[@"status"]; // as read by the OAuth signature
+    }];
+    
+    NSDate *timeout = [NSDate dateWithTimeIntervalSinceNow:2.0];
+    while(didFinish == NO && [timeout timeIntervalSinceNow] > 0) {
+        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    }
+    
+    XCTAssertTrue(didFinish, @"");
+    XCTAssertEqualObjects(signedStatus, @"a b&c", @"");
+    XCTAssertEqualObjects(body, @"status=a%20b%26c", @"");
+    XCTAssertEqualObjects(r.POSTDictionary[@"status"], @"a b&c", @"");
+}
+
+@end
@@ -0,0 +1,143 @@
+//
+//  STRequestSchedulerTests.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STRequestSchedulerTests.h"
+#import "STTwitterRequestScheduler.h"
+
+@implementation STRequestSchedulerTests
+
+- (STTwitterRequestScheduler *)scheduler {
+    STTwitterRequestScheduler *scheduler = [[STTwitterRequestScheduler alloc] init];
+    scheduler.maxConcurrentRequests = 3;
+    scheduler.maxConcurrentRequestsPerHost = 2;
+    scheduler.interactiveReservedSlots = 1;
+    return scheduler;
+}
+
+- (void)testPriorityAndFIFOOrder {
+    
+    STTwitterRequestScheduler *scheduler = [self scheduler];
+    scheduler.maxConcurrentRequests = 4;
+    scheduler.maxConcurrentRequestsPerHost = 3;
+    
+    NSMutableArray *startedNames = [NSMutableArray array];
+    NSMutableDictionary *finishBlocks = [NSMutableDictionary dictionary];
+    
+    void(^schedule)(NSString *, STTwitterRequestPriority) = ^(NSString *name, STTwitterRequestPriority priority) {
+        [scheduler scheduleRequestForHost:@"api.twitter.com" priority:priority startBlock:^(dispatch_block_t finishBlock) {
+            [startedNames addObject:name];
+            finishBlocks[name] = finishBlock;
+        }];
+    };
+    
+    schedule(@"bulk1", STTwitterRequestPriorityBulk);
+    schedule(@"bulk2", STTwitterRequestPriorityBulk);
+    schedule(@"bulk3", STTwitterRequestPriorityBulk); // last slot of the host is reserved to interactive requests
+    schedule(@"background1", STTwitterRequestPriorityBackground);
+    schedule(@"interactive1", STTwitterRequestPriorityInteractive);
+    
+    XCTAssertEqualObjects(startedNames, (@[@"bulk1", @"bulk2", @"interactive1"]), @"");
+    XCTAssertEqual(scheduler.runningCount, (NSUInteger)3, @"");
+    XCTAssertEqual(scheduler.pendingCount, (NSUInteger)2, @"");
+    
+    ((dispatch_block_t)finishBlocks[@"interactive1"])();
+    
+    XCTAssertEqual([startedNames count], (NSUInteger)3, @"background and bulk requests don't use the reserved slot");
+    
+    ((dispatch_block_t)finishBlocks[@"bulk1"])();
+    
+    XCTAssertEqualObjects([startedNames lastObject], @"background1", @"background before bulk");
+    
+    ((dispatch_block_t)finishBlocks[@"background1"])();
+    
+    XCTAssertEqualObjects([startedNames lastObject], @"bulk3", @"");
+    XCTAssertEqual(scheduler.pendingCount, (NSUInteger)0, @"");
+}
+
+- (void)testBulkRequestsDontStarveInteractiveRequestsOnTheSameHost {
+    
+    STTwitterRequestScheduler *scheduler = [self scheduler];
+    
+    NSMutableArray *startedNames = [NSMutableArray array];
+    
+    for(NSString *name in @[@"bulk1", @"bulk2", @"bulk3", @"bulk4", @"interactive1"]) {
+        STTwitterRequestPriority priority = [name hasPrefix:@"bulk"] ? STTwitterRequestPriorityBulk : STTwitterRequestPriorityInteractive;
+        [scheduler scheduleRequestForHost:@"api.twitter.com" priority:priority startBlock:^(dispatch_block_t finishBlock) {
+            [startedNames addObject:name];
+        }];
+    }
+    
+    XCTAssertEqualObjects(startedNames, (@[@"bulk1", @"interactive1"]), @"bulk requests get maxConcurrentRequestsPerHost - interactiveReservedSlots slots");
+    XCTAssertEqual(scheduler.pendingCount, (NSUInteger)3, @"");
+}
+
+- (void)testReservedSlotsAreScaledOnEachHost {
+    
+    STTwitterRequestScheduler *scheduler = [[STTwitterRequestScheduler alloc] init]; // 8 slots, 4 per host, 2 reserved
+    
+    __block NSUInteger startCount = 0;
+    
+    for(NSUInteger i = 0; i < 4; i++) {
+        [scheduler scheduleRequestForHost:@"api.twitter.com" priority:STTwitterRequestPriorityBulk startBlock:^(dispatch_block_t finishBlock) {
+            startCount++;
+        }];
+    }
+    
+    XCTAssertEqual(startCount, (NSUInteger)3, @"one slot of four is reserved on the host");
+    
+    [scheduler scheduleRequestForHost:@"api.twitter.com" priority:STTwitterRequestPriorityInteractive startBlock:^(dispatch_block_t finishBlock) {
+        startCount++;
+    }];
+    
+    XCTAssertEqual(startCount, (NSUInteger)4, @"");
+    XCTAssertEqual(scheduler.pendingCount, (NSUInteger)1, @"");
+}
+
+- (void)testPerHostLimit {
+    
+    STTwitterRequestScheduler *scheduler = [self scheduler];
+    
+    NSMutableArray *startedNames = [NSMutableArray array];
+    
+    for(NSString *name in @[@"a1", @"a2", @"a3"]) {
+        [scheduler scheduleRequestForHost:@"api.twitter.com" priority:STTwitterRequestPriorityInteractive startBlock:^(dispatch_block_t finishBlock) {
+            [startedNames addObject:name];
+        }];
+    }
+    
+    XCTAssertEqualObjects(startedNames, (@[@"a1", @"a2"]), @"a3 waits for a slot on its host");
+}
+
+- (void)testGiveUpBeforeStart {
+    
+    STTwitterRequestScheduler *scheduler = [self scheduler];
+    scheduler.maxConcurrentRequests = 1;
+    
+    __block dispatch_block_t runningFinishBlock = nil;
+    __block BOOL pendingRequestDidStart = NO;
+    
+    [scheduler scheduleRequestForHost:@"a" priority:STTwitterRequestPriorityInteractive startBlock:^(dispatch_block_t finishBlock) {
+        runningFinishBlock = finishBlock;
+    }];
+    
+    dispatch_block_t pendingFinishBlock = [scheduler scheduleRequestForHost:@"a" priority:STTwitterRequestPriorityInteractive startBlock:^(dispatch_block_t finishBlock) {
+        pendingRequestDidStart = YES;
+    }];
+    
+    XCTAssertEqual(scheduler.pendingCount, (NSUInteger)1, @"");
+    
+    pendingFinishBlock();
+    pendingFinishBlock(); // harmless
+    runningFinishBlock();
+    
+    XCTAssertFalse(pendingRequestDidStart, @"");
+    XCTAssertEqual(scheduler.runningCount, (NSUInteger)0, @"");
+    XCTAssertEqual(scheduler.pendingCount, (NSUInteger)0, @"");
+}
+
+@end
@@ -0,0 +1,99 @@
+//
+//  STResponseBufferTests.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STResponseBufferTests.h"
+#import "STHTTPRequest.h"
+
+// transport events, as called by the connection or the session
+@interface STHTTPRequest (STResponseBufferTests)
+- (void)didReceiveResponse:(NSURLResponse *)response;
+- (void)didReceiveData:(NSData *)data;
+@end
+
+@interface STHTTPRequestBufferPool : NSObject
+- (NSMutableData *)bufferWithCapacity:(NSUInteger)capacity;
+- (void)recycleBuffer:(NSMutableData *)buffer;
+@end
+
+@implementation STResponseBufferTests
+
+- (STHTTPRequest *)requestReceivingLength:(NSUInteger)length reusesResponseBuffer:(BOOL)reusesResponseBuffer {
+    
+    STHTTPRequest *r = [STHTTPRequest requestWithURLString:@"https://api.twitter.com/1.1/statuses/home_timeline.json"];
+    r.reusesResponseBuffer = reusesResponseBuffer;
+    
+    NSString *contentLength = [NSString stringWithFormat:@"%lu", (unsigned long)length];
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:r.url
+                                                              statusCode:200
+                                                             HTTPVersion:@"HTTP/1.1"
+                                                            headerFields:@{@"Content-Length" : contentLength}];
+    [r didReceiveResponse:response];
+    
+    NSMutableData *data = [NSMutableData dataWithLength:length];
+    memset([data mutableBytes], 'a', length);
+    [r didReceiveData:data];
+    
+    return r;
+}
+
+- (void)testBufferIsReusedAfterTheRequest {
+    
+    NSMutableData *firstBuffer = nil;
+    
+    @autoreleasepool {
+        STHTTPRequest *r = [self requestReceivingLength:100000 reusesResponseBuffer:YES];
+        XCTAssertEqual([r.responseData length], (NSUInteger)100000, @"");
+        firstBuffer = r.responseData;
+    }
+    
+    __unsafe_unretained NSMutableData *unretainedFirstBuffer = firstBuffer;
+    firstBuffer = nil; // the pool holds it now
+    
+    @autoreleasepool {
+        STHTTPRequest *r = [self requestReceivingLength:200000 reusesResponseBuffer:YES]; // same size class
+        XCTAssertTrue(r.responseData == unretainedFirstBuffer, @"");
+        XCTAssertEqual([r.responseData length], (NSUInteger)200000, @"");
+        
+        STHTTPRequest *r2 = [self requestReceivingLength:1000 reusesResponseBuffer:YES];
+        XCTAssertTrue(r2.responseData != r.responseData, @"a buffer is never shared by two live requests");
+    }
+}
+
+- (void)testBufferIsNotReusedByDefault {
+    
+    NSMutableData *firstBuffer = nil;
+    
+    @autoreleasepool {
+        STHTTPRequest *r = [self requestReceivingLength:100000 reusesResponseBuffer:NO];
+        firstBuffer = r.responseData;
+    }
+    
+    STHTTPRequest *r = [self requestReceivingLength:100000 reusesResponseBuffer:YES];
+    
+    XCTAssertTrue(r.responseData != firstBuffer, @"");
+    XCTAssertEqual([firstBuffer length], (NSUInteger)100000, @"the response is kept by its owner");
+}
+
+- (void)testFilledBufferIsRecycled {
+    
+    STHTTPRequestBufferPool *pool = [[STHTTPRequestBufferPool alloc] init];
+    
+    NSMutableData *buffer = [pool bufferWithCapacity:1000];
+    NSMutableData *otherBuffer = [pool bufferWithCapacity:1000];
+    XCTAssertTrue(buffer != otherBuffer, @"two empty buffers in use are tracked apart");
+    
+    [buffer appendBytes:"hello" length:5]; // changes the hash of the buffer
+    [pool recycleBuffer:buffer];
+    
+    NSMutableData *reusedBuffer = [pool bufferWithCapacity:1000];
+    XCTAssertTrue(reusedBuffer == buffer, @"");
+    XCTAssertEqual([reusedBuffer length], (NSUInteger)0, @"");
+    XCTAssertTrue(otherBuffer != nil, @"");
+}
+
+@end
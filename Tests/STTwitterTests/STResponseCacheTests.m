@@ -0,0 +1,178 @@
+//
+//  STResponseCacheTests.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STResponseCacheTests.h"
+#import "STTwitterResponseCache.h"
+#import "STHTTPRequest.h"
+
+// steps of -startAsynchronous, which is replaced in unit tests
+@interface STHTTPRequest (STResponseCacheTests)
+- (NSURLRequest *)request;
+- (void)setRequest:(NSURLRequest *)request;
+- (BOOL)startWithCachedResponseForRequest:(NSMutableURLRequest *)request;
+- (void)didReceiveResponse:(NSURLResponse *)response;
+- (void)didFinishLoading;
+@end
+
+@implementation STResponseCacheTests
+
+- (void)storeResponseForURLString:(NSString *)urlString headers:(NSDictionary *)headers body:(NSString *)body inCache:(STTwitterResponseCache *)cache {
+    
+    NSURL *url = [NSURL URLWithString:urlString];
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:url statusCode:200 HTTPVersion:@"HTTP/1.1" headerFields:headers];
+    NSData *data = [body dataUsingEncoding:NSUTF8StringEncoding];
+    NSCachedURLResponse *cachedResponse = [[NSCachedURLResponse alloc] initWithResponse:response data:data userInfo:nil storagePolicy:NSURLCacheStorageAllowed];
+    
+    [cache storeCachedResponse:cachedResponse forRequest:[NSURLRequest requestWithURL:url]];
+}
+
+// memory only caches answer right away
+- (NSCachedURLResponse *)cachedResponseForRequest:(NSURLRequest *)request inCache:(STTwitterResponseCache *)cache isFresh:(BOOL *)isFresh {
+    
+    __block NSCachedURLResponse *cachedResponse = nil;
+    __block BOOL didAnswer = NO;
+    
+    [cache lookUpCachedResponseForRequest:request completionBlock:^(NSCachedURLResponse *r, BOOL fresh) {
+        cachedResponse = r;
+        *isFresh = fresh;
+        didAnswer = YES;
+    }];
+    
+    XCTAssertTrue(didAnswer, @"");
+    
+    return cachedResponse;
+}
+
+- (void)testResourceMaxAgeWinsOverNoCache {
+    
+    STTwitterResponseCache *cache = [[STTwitterResponseCache alloc] initWithDirectoryPath:nil];
+    
+    NSDictionary *twitterHeaders = @{@"cache-control" : @"no-cache, no-store, must-revalidate, pre-check=0, post-check=0"};
+    
+    [self storeResponseForURLString:@"https://api.twitter.com/1.1/users/show.json?screen_name=nst021&include_entities=1" headers:twitterHeaders body:@"{\"id\":1}" inCache:cache];
+    [self storeResponseForURLString:@"https://api.twitter.com/1.1/statuses/home_timeline.json" headers:twitterHeaders body:@"[]" inCache:cache];
+    
+    // same parameters, in another order
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"https://api.twitter.com/1.1/users/show.json?include_entities=1&screen_name=nst021"]];
+    
+    BOOL isFresh = NO;
+    NSCachedURLResponse *cachedResponse = [self cachedResponseForRequest:request inCache:cache isFresh:&isFresh];
+    
+    XCTAssertTrue(isFresh, @"");
+    XCTAssertEqualObjects([[NSString alloc] initWithData:[cachedResponse data] encoding:NSUTF8StringEncoding], @"{\"id\":1}", @"");
+    
+    request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"https://api.twitter.com/1.1/statuses/home_timeline.json"]];
+    
+    XCTAssertNil([self cachedResponseForRequest:request inCache:cache isFresh:&isFresh], @"no max age for the resource, no-store is honored");
+    
+    XCTAssertEqual(cache.freshHitCount, (NSUInteger)1, @"");
+    XCTAssertEqual(cache.missCount, (NSUInteger)1, @"");
+}
+
+- (void)testNotModifiedResponseIsCompletedWithCachedBody {
+    
+    STTwitterResponseCache *cache = [[STTwitterResponseCache alloc] initWithDirectoryPath:nil];
+    
+    NSString *urlString = @"https://api.twitter.com/1.1/statuses/show.json?id=1";
+    
+    [self storeResponseForURLString:urlString headers:@{@"ETag" : @"\"v1\"", @"Cache-Control" : @"no-cache"} body:@"{\"id\":1}" inCache:cache];
+    
+    STHTTPRequest *r = [STHTTPRequest requestWithURLString:urlString];
+    r.responseCache = cache;
+    
+    __block NSString *body = nil;
+    r.completionBlock = ^(NSDictionary *headers, NSString *b) {
+        body = b;
+    };
+    
+    [r lookUpCachedResponseWithCompletionBlock:^(BOOL hasFreshCachedResponse) {}];
+    
+    NSMutableURLRequest *request = (NSMutableURLRequest *)[r request];
+    
+    XCTAssertFalse([r startWithCachedResponseForRequest:request], @"a stale response is revalidated");
+    XCTAssertEqualObjects([request valueForHTTPHeaderField:@"If-None-Match"], @"\"v1\"", @"");
+    XCTAssertEqual(cache.revalidationCount, (NSUInteger)1, @"");
+    
+    [r setRequest:request];
+    
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:[request URL]
+                                                              statusCode:304
+                                                             HTTPVersion:@"HTTP/1.1"
+                                                            headerFields:@{@"ETag" : @"\"v1\"", @"X-Rate-Limit-Remaining" : @"179"}];
+    [r didReceiveResponse:response];
+    [r didFinishLoading];
+    
+    XCTAssertEqualObjects(body, @"{\"id\":1}", @"");
+    XCTAssertEqual(r.responseStatus, (NSInteger)200, @"");
+    XCTAssertTrue(r.isResponseFromCache, @"");
+    XCTAssertEqualObjects(r.responseHeaders[@"X-Rate-Limit-Remaining"], @"179", @"headers of the 304 are kept");
+}
+
+- (void)testFreshResponseIsLookedUpOnce {
+    
+    STTwitterResponseCache *cache = [[STTwitterResponseCache alloc] initWithDirectoryPath:nil];
+    
+    NSString *urlString = @"https://api.twitter.com/1.1/users/show.json?screen_name=nst021";
+    
+    [self storeResponseForURLString:urlString headers:@{@"cache-control" : @"no-cache"} body:@"{\"id\":1}" inCache:cache];
+    
+    STHTTPRequest *r = [STHTTPRequest requestWithURLString:urlString];
+    r.responseCache = cache;
+    r.completionBlock = ^(NSDictionary *headers, NSString *body) {};
+    
+    __block BOOL hasFreshCachedResponse = NO;
+    [r lookUpCachedResponseWithCompletionBlock:^(BOOL isFresh) {
+        hasFreshCachedResponse = isFresh;
+    }];
+    
+    XCTAssertTrue(hasFreshCachedResponse, @"the request can skip the rate limiter");
+    XCTAssertTrue([r startWithCachedResponseForRequest:(NSMutableURLRequest *)[r request]], @"");
+    XCTAssertEqual(cache.freshHitCount, (NSUInteger)1, @"");
+}
+
+- (void)testDiskLookupDoesNotBlock {
+    
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    NSString *urlString = @"https://api.twitter.com/1.1/users/show.json?screen_name=nst021";
+    
+    STTwitterResponseCache *cache = [[STTwitterResponseCache alloc] initWithDirectoryPath:path];
+    [self storeResponseForURLString:urlString headers:@{@"cache-control" : @"no-cache"} body:@"{\"id\":1}" inCache:cache];
+    
+    NSDate *timeout = [NSDate dateWithTimeIntervalSinceNow:2.0];
+    while([[[NSFileManager defaultManager] contentsOfDirectoryAtPath:path error:nil] count] == 0 && [timeout timeIntervalSinceNow] > 0) {
+        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    }
+    
+    // empty memory tier
+    cache = [[STTwitterResponseCache alloc] initWithDirectoryPath:path];
+    
+    __block NSCachedURLResponse *cachedResponse = nil;
+    __block BOOL isFresh = NO;
+    __block BOOL didAnswer = NO;
+    
+    [cache lookUpCachedResponseForRequest:[NSURLRequest requestWithURL:[NSURL URLWithString:urlString]] completionBlock:^(NSCachedURLResponse *r, BOOL fresh) {
+        cachedResponse = r;
+        isFresh = fresh;
+        didAnswer = YES;
+    }];
+    
+    XCTAssertFalse(didAnswer, @"the disk is read on the disk queue");
+    
+    timeout = [NSDate dateWithTimeIntervalSinceNow:2.0];
+    while(didAnswer == NO && [timeout timeIntervalSinceNow] > 0) {
+        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    }
+    
+    XCTAssertTrue(didAnswer, @"");
+    XCTAssertTrue(isFresh, @"");
+    XCTAssertEqualObjects([[NSString alloc] initWithData:[cachedResponse data] encoding:NSUTF8StringEncoding], @"{\"id\":1}", @"");
+    
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+@end
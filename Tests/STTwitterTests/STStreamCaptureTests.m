@@ -0,0 +1,146 @@
+//
+//  STStreamCaptureTests.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STStreamCaptureTests.h"
+#import "STTwitterStreamRecorder.h"
+#import "STTwitterStreamReplay.h"
+#import "STTwitterStreamSession.h"
+#import "STTwitterAPI.h"
+
+@implementation STStreamCaptureTests
+
+- (NSArray *)replayCaptureCompressed:(BOOL)compressed {
+    
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    
+    NSError *error = nil;
+    STTwitterStreamRecorder *recorder = [STTwitterStreamRecorder streamRecorderWithPath:path compressed:compressed error:&error];
+    XCTAssertNotNil(recorder, @"%@", error);
+    
+    // chunks don't match message boundaries
+    [recorder appendData:[@"{\"text\":\"a\"}\r\n{\"te" dataUsingEncoding:NSUTF8StringEncoding]];
+    [recorder appendData:[@"xt\":\"b\"}\r\n\r\n" dataUsingEncoding:NSUTF8StringEncoding]];
+    [recorder close];
+    
+    NSMutableArray *messages = [NSMutableArray array];
+    __block BOOL isDone = NO;
+    
+    STTwitterStreamReplay *replay = [STTwitterStreamReplay streamReplayWithPath:path];
+    
+    [replay replayWithProgressBlock:^(id json) {
+        [messages addObject:json];
+    } completionBlock:^(NSError *error) {
+        XCTAssertNil(error, @"");
+        isDone = YES;
+    }];
+    
+    NSDate *timeout = [NSDate dateWithTimeIntervalSinceNow:2.0];
+    while(isDone == NO && [timeout timeIntervalSinceNow] > 0) {
+        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    }
+    
+    XCTAssertEqual((int)replay.replayedChunksCount, 2, @"");
+    
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+    
+    return messages;
+}
+
+- (void)testUncompressedCaptureIsReplayed {
+    
+    NSArray *messages = [self replayCaptureCompressed:NO];
+    
+    XCTAssertEqual((int)[messages count], 2, @"");
+    XCTAssertEqualObjects(messages[1][@"text"], @"b", @"");
+}
+
+- (void)testCompressedCaptureIsReplayed {
+    
+    NSArray *messages = [self replayCaptureCompressed:YES];
+    
+    XCTAssertEqual((int)[messages count], 2, @"");
+    XCTAssertEqualObjects(messages[0][@"text"], @"a", @"");
+}
+
+- (void)waitUntilDone:(BOOL *)isDone {
+    NSDate *timeout = [NSDate dateWithTimeIntervalSinceNow:2.0];
+    while(*isDone == NO && [timeout timeIntervalSinceNow] > 0) {
+        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    }
+}
+
+- (void)testPartialMessageIsDroppedAtConnectionStart {
+    
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    
+    STTwitterStreamRecorder *recorder = [STTwitterStreamRecorder streamRecorderWithPath:path compressed:NO error:nil];
+    
+    // the first connection drops in the middle of a message
+    [recorder appendConnectionStart];
+    [recorder appendData:[@"{\"text\":\"a\"}\r\n{\"te" dataUsingEncoding:NSUTF8StringEncoding]];
+    [recorder appendConnectionStart];
+    [recorder appendData:[@"{\"text\":\"b\"}\r\n" dataUsingEncoding:NSUTF8StringEncoding]];
+    [recorder close];
+    
+    NSMutableArray *messages = [NSMutableArray array];
+    __block BOOL isDone = NO;
+    
+    STTwitterStreamReplay *replay = [STTwitterStreamReplay streamReplayWithPath:path];
+    
+    [replay replayWithProgressBlock:^(id json) {
+        [messages addObject:json];
+    } completionBlock:^(NSError *error) {
+        XCTAssertNil(error, @"");
+        isDone = YES;
+    }];
+    
+    [self waitUntilDone:&isDone];
+    
+    XCTAssertEqual((int)replay.replayedChunksCount, 2, @"connection starts are not chunks");
+    XCTAssertEqualObjects([messages valueForKey:@"text"], (@[@"a", @"b"]), @"");
+    
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testReplayIsRoutedThroughSession {
+    
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    
+    STTwitterStreamRecorder *recorder = [STTwitterStreamRecorder streamRecorderWithPath:path compressed:NO error:nil];
+    [recorder appendConnectionStart];
+    [recorder appendData:[@"{\"text\":\"a\"}\r\n{\"limit\":{\"track\":12}}\r\n{\"delete\":{}}\r\n{\"text\":\"b\"}\r\n" dataUsingEncoding:NSUTF8StringEncoding]];
+    [recorder close];
+    
+    STTwitterAPI *twitter = [STTwitterAPI twitterAPIAppOnlyWithConsumerKey:@"key" consumerSecret:@"secret"];
+    
+    NSMutableArray *messages = [NSMutableArray array];
+    __block NSUInteger undeliveredCount = 0;
+    __block BOOL isDone = NO;
+    
+    STTwitterStreamSession *session = [twitter streamSessionWithReplay:[STTwitterStreamReplay streamReplayWithPath:path] progressBlock:^(id response) {
+        [messages addObject:response];
+    } stallWarningBlock:nil completionBlock:^(NSError *error) {
+        XCTAssertNil(error, @"");
+        isDone = YES;
+    }];
+    
+    session.messageTypes = STTwitterStreamMessageTypeTweet;
+    session.limitBlock = ^(NSUInteger count) {
+        undeliveredCount = count;
+    };
+    
+    [self waitUntilDone:&isDone];
+    
+    XCTAssertEqualObjects([messages valueForKey:@"text"], (@[@"a", @"b"]), @"deletions are not subscribed to");
+    XCTAssertEqual(undeliveredCount, (NSUInteger)12, @"");
+    XCTAssertTrue(session.isStopped, @"");
+    
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+@end
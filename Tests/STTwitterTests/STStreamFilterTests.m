@@ -0,0 +1,48 @@
+//
+//  STStreamFilterTests.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STStreamFilterTests.h"
+#import "STTwitterStreamFilter.h"
+
+@implementation STStreamFilterTests
+
+- (NSData *)dataWithString:(NSString *)s {
+    return [s dataUsingEncoding:NSUTF8StringEncoding];
+}
+
+- (void)testFilterDropsTweetsThatCannotMatch {
+    
+    STTwitterStreamFilter *filter = [STTwitterStreamFilter streamFilterWithKeywords:@[@"apple"] userIDs:@[@(42)] languages:@[@"en"]];
+    
+    XCTAssertTrue([filter mayMatchMessageData:[self dataWithString:@"{\"text\":\"I like Apples\",\"user\":{\"id\":42,\"id_str\":\"42\"},\"lang\":\"en\"}"]], @"");
+    XCTAssertFalse([filter mayMatchMessageData:[self dataWithString:@"{\"text\":\"I like pears\",\"user\":{\"id\":42,\"id_str\":\"42\"},\"lang\":\"en\"}"]], @"");
+    XCTAssertFalse([filter mayMatchMessageData:[self dataWithString:@"{\"text\":\"I like apples\",\"user\":{\"id\":4242,\"id_str\":\"4242\"},\"lang\":\"en\"}"]], @"");
+    XCTAssertFalse([filter mayMatchMessageData:[self dataWithString:@"{\"text\":\"I like apples\",\"user\":{\"id\":42,\"id_str\":\"42\"},\"lang\":\"fr\"}"]], @"");
+    
+    // other messages are kept
+    XCTAssertTrue([filter mayMatchMessageData:[self dataWithString:@"{\"delete\":{\"status\":{\"id\":1}}}"]], @"");
+}
+
+- (void)testLanguageIsReadFromTheTweet {
+    
+    STTwitterStreamFilter *filter = [STTwitterStreamFilter streamFilterWithKeywords:nil userIDs:nil languages:@[@"en"]];
+    
+    XCTAssertFalse([filter mayMatchMessageData:[self dataWithString:@"{\"text\":\"bonjour\",\"user\":{\"id_str\":\"1\",\"lang\":\"en\"},\"lang\":\"fr\"}"]], @"lang of the user");
+    XCTAssertTrue([filter mayMatchMessageData:[self dataWithString:@"{\"text\":\"hello\",\"user\":{\"id_str\":\"1\",\"lang\":\"fr\"},\"lang\":\"en\"}"]], @"");
+}
+
+- (void)testUserIDIsReadFromTheAuthor {
+    
+    STTwitterStreamFilter *filter = [STTwitterStreamFilter streamFilterWithKeywords:nil userIDs:@[@"42"] languages:nil];
+    
+    XCTAssertFalse([filter mayMatchMessageData:[self dataWithString:@"{\"text\":\"@bob hi\",\"in_reply_to_user_id_str\":\"42\",\"user\":{\"id_str\":\"7\"}}"]], @"reply to the user");
+    XCTAssertFalse([filter mayMatchMessageData:[self dataWithString:@"{\"text\":\"see 42\",\"user\":{\"id_str\":\"7\",\"description\":\"\\\"id_str\\\":\\\"42\\\"\"}}"]], @"");
+    XCTAssertTrue([filter mayMatchMessageData:[self dataWithString:@"{\"text\":\"hi\",\"entities\":{\"user_mentions\":[{\"id_str\":\"7\"}]},\"user\":{\"id\":42,\"id_str\":\"42\"}}"]], @"");
+}
+
+@end
@@ -0,0 +1,198 @@
+//
+//  STStreamParserTests.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STStreamParserTests.h"
+#import "STTwitterStreamParser.h"
+
+@implementation STStreamParserTests
+
+- (void)setUp
+{
+    [super setUp];
+    
+    // Set-up code here.
+}
+
+- (void)tearDown
+{
+    // Tear-down code here.
+    
+    [super tearDown];
+}
+
+- (NSArray *)parsedJSONObjectsWithChunks:(NSArray *)chunks {
+    
+    STTwitterStreamParser *parser = [[STTwitterStreamParser alloc] init];
+    
+    NSMutableArray *ma = [NSMutableArray array];
+    
+    for(NSString *chunk in chunks) {
+        NSData *data = [chunk dataUsingEncoding:NSUTF8StringEncoding];
+        [parser parseWithStreamData:data parsedJSONBlock:^(id json) {
+            [ma addObject:json];
+        }];
+    }
+    
+    return ma;
+}
+
+- (void)testSeveralMessagesInOneChunk {
+    
+    NSArray *a = [self parsedJSONObjectsWithChunks:@[@"{\"a\":1}\r\n{\"b\":2}\r\n{\"c\":3}\r\n"]];
+    
+    XCTAssertEqual((int)[a count], 3, @"");
+    XCTAssertEqualObjects(a[2], @{@"c":@(3)}, @"");
+}
+
+- (void)testMessageSplitAcrossChunks {
+    
+    NSArray *a = [self parsedJSONObjectsWithChunks:@[@"{\"text\":\"hel", @"lo\"}\r", @"\n{\"text\":", @"\"world\"}\r\n"]];
+    
+    XCTAssertEqual((int)[a count], 2, @"");
+    XCTAssertEqualObjects(a[0], @{@"text":@"hello"}, @"");
+    XCTAssertEqualObjects(a[1], @{@"text":@"world"}, @"");
+}
+
+- (void)testPartialMessageIsNotEmitted {
+    
+    NSArray *a = [self parsedJSONObjectsWithChunks:@[@"{\"a\":1}\r\n{\"b\":"]];
+    
+    XCTAssertEqual((int)[a count], 1, @"");
+}
+
+- (void)testKeepAliveLinesAreIgnored {
+    
+    NSArray *a = [self parsedJSONObjectsWithChunks:@[@"\r\n", @"\r\n\r\n{\"a\":1}\r\n", @"\r\n"]];
+    
+    XCTAssertEqual((int)[a count], 1, @"");
+}
+
+- (void)testMultiByteCharacterSplitAcrossChunks {
+    
+    STTwitterStreamParser *parser = [[STTwitterStreamParser alloc] init];
+    
+    NSData *data = [@"{\"text\":\"café\"}\r\n" dataUsingEncoding:NSUTF8StringEncoding];
+    NSUInteger splitIndex = [data length] - 5; // between the two bytes of 'é'
+    
+    NSMutableArray *ma = [NSMutableArray array];
+    
+    [parser parseWithStreamData:[data subdataWithRange:NSMakeRange(0, splitIndex)] parsedJSONBlock:^(id json) {
+        [ma addObject:json];
+    }];
+    
+    [parser parseWithStreamData:[data subdataWithRange:NSMakeRange(splitIndex, [data length] - splitIndex)] parsedJSONBlock:^(id json) {
+        [ma addObject:json];
+    }];
+    
+    XCTAssertEqual((int)[ma count], 1, @"");
+    XCTAssertEqualObjects(ma[0][@"text"], @"café", @"");
+}
+
+- (NSArray *)parsedJSONObjectsWithLengthDelimitedChunks:(NSArray *)chunks {
+    
+    STTwitterStreamParser *parser = [STTwitterStreamParser streamParserWithFraming:STTwitterStreamFramingLength];
+    
+    NSMutableArray *ma = [NSMutableArray array];
+    
+    for(NSString *chunk in chunks) {
+        NSData *data = [chunk dataUsingEncoding:NSUTF8StringEncoding];
+        [parser parseWithStreamData:data parsedJSONBlock:^(id json) {
+            [ma addObject:json];
+        }];
+    }
+    
+    return ma;
+}
+
+- (void)testLengthDelimitedMessages {
+    
+    // lengths include the trailing \r\n
+    NSArray *a = [self parsedJSONObjectsWithLengthDelimitedChunks:@[@"9\r\n{\"a\":1}\r\n12\r\n{\"b\":\"\\n\"}\r\n"]];
+    
+    XCTAssertEqual((int)[a count], 2, @"");
+    XCTAssertEqualObjects(a[0], @{@"a":@(1)}, @"");
+    XCTAssertEqualObjects(a[1], @{@"b":@"\n"}, @"");
+}
+
+- (void)testLengthDelimitedMessageSplitAcrossChunks {
+    
+    NSArray *a = [self parsedJSONObjectsWithLengthDelimitedChunks:@[@"\r\n1", @"8\r", @"\n{\"text\":\"hel", @"lo\"}\r\n\r\n"]];
+    
+    XCTAssertEqual((int)[a count], 1, @"");
+    XCTAssertEqualObjects(a[0], @{@"text":@"hello"}, @"");
+}
+
+- (void)testLengthFramingFallsBackOnDelimiters {
+    
+    NSArray *a = [self parsedJSONObjectsWithLengthDelimitedChunks:@[@"{\"a\":1}\r\n{\"b\":2}\r\n"]];
+    
+    XCTAssertEqual((int)[a count], 2, @"");
+}
+
+- (void)testOversizedLengthPrefixFallsBackOnDelimiters {
+    
+    NSArray *a = [self parsedJSONObjectsWithLengthDelimitedChunks:@[@"99999999999999999999999\r\n{\"a\":1}\r\n", @"{\"b\":2}\r\n"]];
+    
+    XCTAssertEqual((int)[a count], 2, @"");
+    XCTAssertEqualObjects(a[0], @{@"a":@(1)}, @"");
+}
+
+- (STTwitterStreamMessageType)messageTypeOfString:(NSString *)s {
+    return [STTwitterStreamParser messageTypeOfMessageData:[s dataUsingEncoding:NSUTF8StringEncoding]];
+}
+
+- (void)testMessageClassification {
+    
+    XCTAssertEqual([self messageTypeOfString:@"{\"created_at\":\"Thu Oct 17 12:00:00 +0000 2013\",\"id\":1,\"id_str\":\"1\",\"text\":\"hello\"}"], STTwitterStreamMessageTypeTweet, @"");
+    XCTAssertEqual([self messageTypeOfString:@"{\"delete\":{\"status\":{\"id\":1234,\"id_str\":\"1234\",\"user_id\":3,\"user_id_str\":\"3\"}}}"], STTwitterStreamMessageTypeDelete, @"");
+    XCTAssertEqual([self messageTypeOfString:@"{\"limit\":{\"track\":1234}}"], STTwitterStreamMessageTypeLimit, @"");
+    XCTAssertEqual([self messageTypeOfString:@"{\"warning\":{\"code\":\"FALLING_BEHIND\",\"message\":\"Your connection is falling behind\",\"percent_full\":60}}"], STTwitterStreamMessageTypeWarning, @"");
+    XCTAssertEqual([self messageTypeOfString:@"{\"friends\":[1,2,3]}"], STTwitterStreamMessageTypeFriendsList, @"");
+    XCTAssertEqual([self messageTypeOfString:@"[1,2,3]"], STTwitterStreamMessageTypeUnknown, @"");
+}
+
+- (void)testClassificationsAgreeOnMessagesWithSeveralKeys {
+    
+    for(NSString *s in @[@"{\"limit\":{\"track\":1},\"delete\":{\"status\":{\"id\":1}}}",
+                         @"{\"direct_message\":{\"id\":1},\"event\":\"favorite\"}",
+                         @"{\"for_user\":1,\"text\":\"hello\"}"]) {
+        
+        id json = [NSJSONSerialization JSONObjectWithData:[s dataUsingEncoding:NSUTF8StringEncoding] options:0 error:nil];
+        
+        XCTAssertEqual([self messageTypeOfString:s], [STTwitterStreamParser messageTypeOfJSONObject:json], @"%@", s);
+    }
+    
+    XCTAssertEqual([self messageTypeOfString:@"{\"limit\":{\"track\":1},\"delete\":{\"status\":{\"id\":1}}}"], STTwitterStreamMessageTypeDelete, @"");
+}
+
+- (void)testNestedKeysAreIgnoredByClassification {
+    
+    // "text" only appears in nested objects and strings
+    NSString *s = @"{\"target\":{\"text\":\"x\"},\"source\":{\"name\":\"\\\"text\\\"\"},\"event\":\"favorite\"}";
+    
+    XCTAssertEqual([self messageTypeOfString:s], STTwitterStreamMessageTypeEvent, @"");
+}
+
+- (void)testUndecodedMessageTypesAreSkipped {
+    
+    STTwitterStreamParser *parser = [[STTwitterStreamParser alloc] init];
+    parser.decodedMessageTypes = STTwitterStreamMessageTypeTweet;
+    
+    NSData *data = [@"{\"delete\":{\"status\":{\"id\":1}}}\r\n{\"text\":\"hello\"}\r\n" dataUsingEncoding:NSUTF8StringEncoding];
+    
+    NSMutableArray *ma = [NSMutableArray array];
+    
+    [parser parseWithStreamData:data parsedJSONBlock:^(id json) {
+        [ma addObject:json];
+    }];
+    
+    XCTAssertEqual((int)[ma count], 1, @"");
+    XCTAssertEqualObjects(ma[0][@"text"], @"hello", @"");
+}
+
+@end
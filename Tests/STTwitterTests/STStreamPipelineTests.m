@@ -0,0 +1,37 @@
+//
+//  STStreamPipelineTests.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STStreamPipelineTests.h"
+#import "STTwitterStreamPipeline.h"
+#import "STTwitterStreamParser.h"
+
+@implementation STStreamPipelineTests
+
+- (void)testPipelineFlushesBatchesOnCountAndLatency {
+    
+    NSMutableArray *batches = [NSMutableArray array];
+    
+    STTwitterStreamPipeline *pipeline = [STTwitterStreamPipeline streamPipelineWithParser:[[STTwitterStreamParser alloc] init] jsonBlock:^(id json) {
+        [batches addObject:json];
+    }];
+    pipeline.batchSize = 2;
+    pipeline.batchLatency = 0.1;
+    
+    [pipeline appendData:[@"{\"a\":1}\r\n{\"a\":2}\r\n{\"a\":3}\r\n" dataUsingEncoding:NSUTF8StringEncoding]];
+    
+    NSDate *timeout = [NSDate dateWithTimeIntervalSinceNow:2.0];
+    while([batches count] < 2 && [timeout timeIntervalSinceNow] > 0) {
+        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    }
+    
+    XCTAssertEqual((int)[batches count], 2, @"");
+    XCTAssertEqual((int)[batches[0] count], 2, @"");
+    XCTAssertEqualObjects(batches[1][0][@"a"], @(3), @"");
+}
+
+@end
@@ -0,0 +1,13 @@
+//
+//  STStreamSessionTests.h
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+@interface STStreamSessionTests : XCTestCase
+
+@end
@@ -0,0 +1,122 @@
+//
+//  STStreamSessionTests.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STStreamSessionTests.h"
+#import "STTwitterStreamSession.h"
+#import "STHTTPRequest.h"
+#import "STHTTPRequest+STTwitter.h"
+
+@implementation STStreamSessionTests
+
+- (NSError *)errorWithHTTPStatus:(NSInteger)status {
+    NSDictionary *userInfo = status ? @{kSTHTTPStatusCodeKey : @(status)} : nil;
+    return [NSError errorWithDomain:@"STHTTPRequest" code:0 userInfo:userInfo];
+}
+
+- (void)testNetworkErrorBackoffIsLinear {
+    
+    NSError *error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorNetworkConnectionLost userInfo:nil];
+    
+    NSTimeInterval delay = [STTwitterStreamSession reconnectDelayAfterError:error previousDelay:0];
+    XCTAssertEqualWithAccuracy(delay, 0.25, 0.001, @"");
+    
+    delay = [STTwitterStreamSession reconnectDelayAfterError:error previousDelay:delay];
+    XCTAssertEqualWithAccuracy(delay, 0.5, 0.001, @"");
+    
+    delay = [STTwitterStreamSession reconnectDelayAfterError:error previousDelay:16.0];
+    XCTAssertEqualWithAccuracy(delay, 16.0, 0.001, @"");
+}
+
+- (void)testStallErrorBackoffIsLinear {
+    
+    NSError *error = [NSError errorWithDomain:@"STHTTPRequest" code:kSTHTTPRequestStallError userInfo:nil];
+    
+    NSTimeInterval delay = [STTwitterStreamSession reconnectDelayAfterError:error previousDelay:0];
+    XCTAssertEqualWithAccuracy(delay, 0.25, 0.001, @"");
+}
+
+- (void)testHTTPErrorBackoffIsExponential {
+    
+    NSError *error = [self errorWithHTTPStatus:503];
+    
+    NSTimeInterval delay = [STTwitterStreamSession reconnectDelayAfterError:error previousDelay:0];
+    XCTAssertEqualWithAccuracy(delay, 5.0, 0.001, @"");
+    
+    delay = [STTwitterStreamSession reconnectDelayAfterError:error previousDelay:delay];
+    XCTAssertEqualWithAccuracy(delay, 10.0, 0.001, @"");
+    
+    delay = [STTwitterStreamSession reconnectDelayAfterError:error previousDelay:320.0];
+    XCTAssertEqualWithAccuracy(delay, 320.0, 0.001, @"");
+}
+
+- (void)testRateLimitBackoffStartsWithOneMinute {
+    
+    NSError *error = [self errorWithHTTPStatus:420];
+    
+    NSTimeInterval delay = [STTwitterStreamSession reconnectDelayAfterError:error previousDelay:0];
+    XCTAssertEqualWithAccuracy(delay, 60.0, 0.001, @"");
+    
+    delay = [STTwitterStreamSession reconnectDelayAfterError:error previousDelay:delay];
+    XCTAssertEqualWithAccuracy(delay, 120.0, 0.001, @"");
+}
+
+- (void)testSessionReconnectsAfterNetworkErrorAndStopsOnAuthenticationError {
+    
+    __block NSUInteger connectionCount = 0;
+    __block NSError *finalError = nil;
+    
+    STTwitterStreamSession *session = [STTwitterStreamSession streamSessionWithConnectBlock:^NSString *(void (^connectedBlock)(void), void (^errorBlock)(NSError *)) {
+        
+        connectionCount += 1;
+        
+        if(connectionCount == 1) {
+            connectedBlock();
+            errorBlock([NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorNetworkConnectionLost userInfo:nil]);
+        } else {
+            errorBlock([self errorWithHTTPStatus:401]);
+        }
+        
+        return [NSString stringWithFormat:@"%lu", (unsigned long)connectionCount];
+        
+    } cancelBlock:nil errorBlock:^(NSError *error) {
+        finalError = error;
+    }];
+    
+    [session start];
+    
+    NSDate *timeout = [NSDate dateWithTimeIntervalSinceNow:2.0];
+    while(finalError == nil && [timeout timeIntervalSinceNow] > 0) {
+        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    }
+    
+    XCTAssertEqual((int)connectionCount, 2, @"");
+    XCTAssertEqual((int)session.reconnectCount, 1, @"");
+    XCTAssertTrue(session.isStopped, @"");
+    XCTAssertNotNil(finalError, @"");
+}
+
+- (void)testConnectionFailingSynchronouslyIsNotCancelled {
+    
+    NSMutableArray *cancelledRequestIDs = [NSMutableArray array];
+    
+    STTwitterStreamSession *session = [STTwitterStreamSession streamSessionWithConnectBlock:^NSString *(void (^connectedBlock)(void), void (^errorBlock)(NSError *)) {
+        errorBlock([NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorNotConnectedToInternet userInfo:nil]);
+        return @"1";
+    } cancelBlock:^(NSString *requestID) {
+        [cancelledRequestIDs addObject:requestID];
+    } errorBlock:nil];
+    
+    [session start];
+    
+    // stopped during the backoff, no request is running
+    [session stop];
+    
+    XCTAssertEqual([cancelledRequestIDs count], (NSUInteger)0, @"");
+}
+
+@end
@@ -0,0 +1,139 @@
+//
+//  STTimelineBackfillTests.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STTimelineBackfillTests.h"
+#import "STTwitterTimelineBackfill.h"
+#import "STTwitterTimelineBackfillQueue.h"
+#import "STTwitterAPI.h"
+#import "NSString+STTwitter.h"
+#import "STHTTPRequest+UnitTests.h"
+#import "STHTTPRequestTestResponse.h"
+#import "STHTTPRequestTestResponseQueue.h"
+
+@implementation STTimelineBackfillTests
+
+- (void)enqueueTimelinePages:(NSArray *)pages maxIDs:(NSMutableArray *)maxIDs {
+    
+    for(NSArray *ids in pages) {
+        
+        NSMutableArray *statuses = [NSMutableArray array];
+        for(NSString *statusID in ids) {
+            [statuses addObject:@{@"id_str" : statusID, @"text" : @"hello"}];
+        }
+        
+        STHTTPRequestTestResponse *tr = [STHTTPRequestTestResponse testResponseWithBlock:^(STHTTPRequest *r) {
+            NSString *query = [[r url] query];
+            [maxIDs addObject:[query firstMatchWithRegex:@"max_id=([^&]*)" error:nil] ?: @""];
+            
+            NSData *data = [NSJSONSerialization dataWithJSONObject:statuses options:0 error:nil];
+            r.responseStatus = 200;
+            r.responseData = [data mutableCopy];
+            r.responseString = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
+        }];
+        [[STHTTPRequestTestResponseQueue sharedInstance] enqueue:tr];
+    }
+}
+
+- (STTwitterAPI *)twitter {
+    return [STTwitterAPI twitterAPIWithOAuthConsumerKey:@"key" consumerSecret:@"secret" oauthToken:@"token" oauthTokenSecret:@"tokenSecret"];
+}
+
+- (void)testMaxIDIsLowestIDMinusOne {
+    
+    NSMutableArray *maxIDs = [NSMutableArray array];
+    
+    [self enqueueTimelinePages:@[@[@"1374004777531007835", @"1374004777531007834", @"1374004777531007833"],
+                                 @[@"1374004777531007833", @"1374004777531007832", @"1374004777531007831"], // overlaps
+                                 @[]]
+                        maxIDs:maxIDs];
+    
+    STTwitterTimelineBackfill *backfill = [STTwitterTimelineBackfill userTimelineBackfillWithTwitter:[self twitter] userID:nil orScreenName:@"nst021" includeRetweets:nil];
+    
+    NSMutableArray *statusIDs = [NSMutableArray array];
+    __block BOOL isCompleted = NO;
+    
+    [backfill startWithPageBlock:^(NSArray *statuses, BOOL *stop) {
+        [statusIDs addObjectsFromArray:[statuses valueForKey:@"id_str"]];
+    } completionBlock:^(NSError *error) {
+        XCTAssertNil(error, @"");
+        isCompleted = YES;
+    }];
+    
+    XCTAssertTrue(isCompleted, @"");
+    XCTAssertEqualObjects(maxIDs, (@[@"", @"1374004777531007832", @"1374004777531007830"]), @"");
+    XCTAssertEqualObjects(statusIDs, (@[@"1374004777531007835", @"1374004777531007834", @"1374004777531007833", @"1374004777531007832", @"1374004777531007831"]), @"no status is received twice");
+    XCTAssertEqual(backfill.pageCount, (NSUInteger)2, @"the empty page is not handed out");
+    XCTAssertEqualObjects(backfill.oldestID, @"1374004777531007831", @"");
+    XCTAssertNil(backfill.resumeMaxID, @"");
+}
+
+- (void)testBackfillStopsAtSinceID {
+    
+    NSMutableArray *maxIDs = [NSMutableArray array];
+    
+    [self enqueueTimelinePages:@[@[@"30", @"29"],
+                                 @[@"28", @"27", @"26"]]
+                        maxIDs:maxIDs];
+    
+    STTwitterTimelineBackfill *backfill = [STTwitterTimelineBackfill homeTimelineBackfillWithTwitter:[self twitter]];
+    backfill.sinceID = @"27";
+    
+    NSMutableArray *statusIDs = [NSMutableArray array];
+    __block BOOL isCompleted = NO;
+    
+    [backfill startWithPageBlock:^(NSArray *statuses, BOOL *stop) {
+        [statusIDs addObjectsFromArray:[statuses valueForKey:@"id_str"]];
+    } completionBlock:^(NSError *error) {
+        XCTAssertNil(error, @"");
+        isCompleted = YES;
+    }];
+    
+    XCTAssertTrue(isCompleted, @"");
+    XCTAssertEqual([maxIDs count], (NSUInteger)2, @"no page is requested past sinceID");
+    XCTAssertEqualObjects(statusIDs, (@[@"30", @"29", @"28"]), @"");
+    XCTAssertEqual(backfill.statusCount, (NSUInteger)3, @"");
+}
+
+- (void)testQueueRunsBackfillsUpToTheLimit {
+    
+    NSMutableArray *maxIDs = [NSMutableArray array];
+    
+    [self enqueueTimelinePages:@[@[@"20", @"19"], @[@"10"], @[@"5"]] maxIDs:maxIDs];
+    
+    STTwitterAPI *twitter = [self twitter];
+    
+    STTwitterTimelineBackfillQueue *queue = [[STTwitterTimelineBackfillQueue alloc] init];
+    queue.maxConcurrentBackfills = 2;
+    
+    __block NSUInteger queueCompletionCount = 0;
+    queue.completionBlock = ^{
+        queueCompletionCount++;
+    };
+    
+    NSMutableArray *finishedUsers = [NSMutableArray array];
+    
+    for(NSString *screenName in @[@"a", @"b", @"c"]) {
+        STTwitterTimelineBackfill *backfill = [STTwitterTimelineBackfill userTimelineBackfillWithTwitter:twitter userID:nil orScreenName:screenName includeRetweets:nil];
+        backfill.maxPages = 1;
+        
+        [queue addBackfill:backfill pageBlock:^(STTwitterTimelineBackfill *backfill, NSArray *statuses, BOOL *stop) {
+            XCTAssertTrue(queue.runningCount <= 2, @"");
+        } completionBlock:^(STTwitterTimelineBackfill *backfill, NSError *error) {
+            XCTAssertNil(error, @"");
+            XCTAssertNotNil(backfill.resumeMaxID, @"maxPages stops before the end of the timeline");
+            [finishedUsers addObject:screenName];
+        }];
+    }
+    
+    XCTAssertEqualObjects(finishedUsers, (@[@"a", @"b", @"c"]), @"");
+    XCTAssertEqual(queue.runningCount, (NSUInteger)0, @"");
+    XCTAssertEqual(queue.pendingCount, (NSUInteger)0, @"");
+    XCTAssertEqual(queueCompletionCount, (NSUInteger)3, @"called each time the queue drains");
+}
+
+@end
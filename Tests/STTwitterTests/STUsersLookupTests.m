@@ -0,0 +1,203 @@
+//
+//  STUsersLookupTests.m
+//  STTwitter
+//
+//  Created by Nicolas Seriot on 10/17/13.
+//  Copyright (c) 2013 Nicolas Seriot. All rights reserved.
+//
+
+#import "STUsersLookupTests.h"
+#import "STTwitterUsersLookup.h"
+#import "STTwitterAPI.h"
+#import "NSString+STTwitter.h"
+#import "STHTTPRequest+UnitTests.h"
+#import "STHTTPRequestTestResponse.h"
+#import "STHTTPRequestTestResponseQueue.h"
+
+@implementation STUsersLookupTests
+
+- (STTwitterAPI *)twitter {
+    return [STTwitterAPI twitterAPIWithOAuthConsumerKey:@"key" consumerSecret:@"secret" oauthToken:@"token" oauthTokenSecret:@"tokenSecret"];
+}
+
+// users are returned for the requested IDs which are not multiples of 50, a 404 if none is found
+- (void)enqueueLookupResponses:(NSUInteger)count requestedUserIDs:(NSMutableArray *)requestedUserIDs {
+    
+    for(NSUInteger i = 0; i < count; i++) {
+        
+        STHTTPRequestTestResponse *tr = [STHTTPRequestTestResponse testResponseWithBlock:^(STHTTPRequest *r) {
+            
+            NSString *query = [[r url] query];
+            NSString *userIDs = [[query firstMatchWithRegex:@"user_id=([^&]*)" error:nil] stringByReplacingOccurrencesOfString:@"%2C" withString:@","];
+            NSArray *ids = userIDs ? [userIDs componentsSeparatedByString:@","] : @[];
+            [requestedUserIDs addObject:ids];
+            
+            NSMutableArray *users = [NSMutableArray array];
+            for(NSString *userID in ids) {
+                if([userID integerValue] % 50 == 0) continue;
+                [users addObject:@{@"id_str" : userID, @"screen_name" : [@"user" stringByAppendingString:userID]}];
+            }
+            
+            id json = users;
+            r.responseStatus = 200;
+            
+            if([users count] == 0) {
+                json = @{@"errors" : @[@{@"message" : @"No user matches for specified terms.", @"code" : @(17)}]};
+                r.responseStatus = 404;
+                r.error = [NSError errorWithDomain:@"STHTTPRequest" code:404 userInfo:nil];
+            }
+            
+            NSData *data = [NSJSONSerialization dataWithJSONObject:json options:0 error:nil];
+            r.responseData = [data mutableCopy];
+            r.responseString = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
+        }];
+        
+        [[STHTTPRequestTestResponseQueue sharedInstance] enqueue:tr];
+    }
+}
+
+- (void)testUniqueValues {
+    
+    NSArray *values = @[@"1", @(1), @"2", @" 3", @"", @"3"];
+    XCTAssertEqualObjects([STTwitterUsersLookup uniqueValues:values caseInsensitive:NO], (@[@"1", @"2", @"3"]), @"");
+    
+    NSArray *screenNames = @[@"nst021", @"NST021", @"jack"];
+    XCTAssertEqualObjects([STTwitterUsersLookup uniqueValues:screenNames caseInsensitive:YES], (@[@"nst021", @"jack"]), @"");
+    
+    NSArray *chunks = [STTwitterUsersLookup chunksOfValues:@[@"a", @"b", @"c"] chunkSize:2];
+    XCTAssertEqualObjects(chunks, (@[@[@"a", @"b"], @[@"c"]]), @"");
+}
+
+- (void)testLookupIsChunkedAndDeduplicated {
+    
+    NSMutableArray *userIDs = [NSMutableArray array];
+    for(NSUInteger i = 1; i <= 250; i++) {
+        [userIDs addObject:@(i)]; // followers/ids without stringify_ids
+    }
+    [userIDs addObjectsFromArray:@[@"1", @"2", @"250"]];
+    
+    NSMutableArray *requestedUserIDs = [NSMutableArray array];
+    [self enqueueLookupResponses:3 requestedUserIDs:requestedUserIDs];
+    
+    __block NSDictionary *users = nil;
+    __block NSArray *misses = nil;
+    
+    STTwitterUsersLookup *lookup = [[self twitter] getUsersLookupForUserIDs:userIDs orScreenNames:nil includeEntities:nil successBlock:^(NSDictionary *usersByID, NSArray *missingUserIDs, NSArray *missingScreenNames) {
+        users = usersByID;
+        misses = missingUserIDs;
+        XCTAssertEqual([missingScreenNames count], (NSUInteger)0, @"");
+    } errorBlock:^(NSError *error) {
+        XCTFail(@"%@", error);
+    }];
+    
+    XCTAssertTrue(lookup.isFinished, @"");
+    XCTAssertEqual(lookup.requestCount, (NSUInteger)3, @"");
+    XCTAssertEqualObjects([requestedUserIDs valueForKey:@"count"], (@[@100, @100, @50]), @"");
+    XCTAssertEqual([users count], (NSUInteger)245, @"");
+    XCTAssertEqualObjects(users[@"42"][@"screen_name"], @"user42", @"");
+    XCTAssertEqualObjects(misses, (@[@"50", @"100", @"150", @"200", @"250"]), @"");
+}
+
+- (void)testNotFoundChunkOnlyAddsMisses {
+    
+    NSMutableArray *requestedUserIDs = [NSMutableArray array];
+    [self enqueueLookupResponses:2 requestedUserIDs:requestedUserIDs];
+    
+    STTwitterUsersLookup *lookup = [STTwitterUsersLookup usersLookupWithTwitter:[self twitter]];
+    lookup.chunkSize = 2;
+    
+    __block BOOL isCompleted = NO;
+    
+    [lookup lookupUserIDs:@[@"50", @"100", @"7"] screenNames:nil successBlock:^(NSDictionary *usersByID, NSArray *missingUserIDs, NSArray *missingScreenNames) {
+        XCTAssertEqualObjects([usersByID allKeys], @[@"7"], @"");
+        XCTAssertEqualObjects(missingUserIDs, (@[@"50", @"100"]), @"");
+        isCompleted = YES;
+    } errorBlock:^(NSError *error) {
+        XCTFail(@"%@", error);
+    }];
+    
+    XCTAssertTrue(isCompleted, @"");
+    XCTAssertEqual([requestedUserIDs count], (NSUInteger)2, @"");
+}
+
+- (void)testFailedChunkIsRetried {
+    
+    // the first request fails with a server error
+    STHTTPRequestTestResponse *tr = [STHTTPRequestTestResponse testResponseWithBlock:^(STHTTPRequest *r) {
+        NSData *data = [NSJSONSerialization dataWithJSONObject:@{@"errors" : @[@{@"message" : @"Over capacity", @"code" : @(130)}]} options:0 error:nil];
+        r.responseStatus = 503;
+        r.error = [NSError errorWithDomain:@"STHTTPRequest" code:503 userInfo:nil];
+        r.responseData = [data mutableCopy];
+        r.responseString = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
+    }];
+    [[STHTTPRequestTestResponseQueue sharedInstance] enqueue:tr];
+    
+    NSMutableArray *requestedUserIDs = [NSMutableArray array];
+    [self enqueueLookupResponses:2 requestedUserIDs:requestedUserIDs];
+    
+    STTwitterUsersLookup *lookup = [STTwitterUsersLookup usersLookupWithTwitter:[self twitter]];
+    lookup.chunkSize = 2;
+    lookup.maxConcurrentRequests = 1;
+    lookup.retryDelay = 0.05;
+    
+    __block NSDictionary *foundUsersByID = nil;
+    
+    [lookup lookupUserIDs:@[@"1", @"2", @"3"] screenNames:nil successBlock:^(NSDictionary *usersByID, NSArray *missingUserIDs, NSArray *missingScreenNames) {
+        XCTAssertEqual([missingUserIDs count], (NSUInteger)0, @"");
+        foundUsersByID = usersByID;
+    } errorBlock:^(NSError *error) {
+        XCTFail(@"%@", error);
+    }];
+    
+    NSDate *timeout = [NSDate dateWithTimeIntervalSinceNow:2.0];
+    while(foundUsersByID == nil && [timeout timeIntervalSinceNow] > 0) {
+        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    }
+    
+    XCTAssertEqual([foundUsersByID count], (NSUInteger)3, @"the users of the failed chunk are not lost");
+    XCTAssertEqualObjects(requestedUserIDs, (@[@[@"1", @"2"], @[@"3"]]), @"");
+    XCTAssertEqual(lookup.requestCount, (NSUInteger)3, @"");
+}
+
+- (void)testRateLimitedChunkIsRetriedAfterTheReset {
+    
+    NSTimeInterval reset = ceil([[NSDate date] timeIntervalSince1970]) + 1;
+    
+    STHTTPRequestTestResponse *tr = [STHTTPRequestTestResponse testResponseWithBlock:^(STHTTPRequest *r) {
+        NSData *data = [NSJSONSerialization dataWithJSONObject:@{@"errors" : @[@{@"message" : @"Rate limit exceeded", @"code" : @(88)}]} options:0 error:nil];
+        r.responseStatus = 429;
+        r.responseHeaders = @{@"x-rate-limit-limit" : @"180", @"x-rate-limit-remaining" : @"0", @"x-rate-limit-reset" : [@(reset) description]};
+        r.error = [NSError errorWithDomain:@"STHTTPRequest" code:429 userInfo:nil];
+        r.responseData = [data mutableCopy];
+        r.responseString = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
+    }];
+    [[STHTTPRequestTestResponseQueue sharedInstance] enqueue:tr];
+    
+    NSMutableArray *requestedUserIDs = [NSMutableArray array];
+    [self enqueueLookupResponses:1 requestedUserIDs:requestedUserIDs];
+    
+    STTwitterUsersLookup *lookup = [STTwitterUsersLookup usersLookupWithTwitter:[self twitter]];
+    lookup.retryDelay = 0.01;
+    
+    __block NSDictionary *foundUsersByID = nil;
+    
+    [lookup lookupUserIDs:@[@"1", @"2"] screenNames:nil successBlock:^(NSDictionary *usersByID, NSArray *missingUserIDs, NSArray *missingScreenNames) {
+        foundUsersByID = usersByID;
+    } errorBlock:^(NSError *error) {
+        XCTFail(@"%@", error);
+    }];
+    
+    [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.2]];
+    
+    XCTAssertEqual([requestedUserIDs count], (NSUInteger)0, @"the backoff waits for the reset of the window");
+    
+    NSDate *timeout = [NSDate dateWithTimeIntervalSinceNow:4.0];
+    while(foundUsersByID == nil && [timeout timeIntervalSinceNow] > 0) {
+        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    }
+    
+    XCTAssertEqual([foundUsersByID count], (NSUInteger)2, @"");
+    XCTAssertGreaterThanOrEqual([[NSDate date] timeIntervalSince1970], reset, @"");
+}
+
+@end